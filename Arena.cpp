@@ -0,0 +1,53 @@
+#include "Arena.h"
+
+using namespace std;
+
+Arena::~Arena() {
+    release();
+}
+
+// Blocks double in size up to MaxBlockSize, so a large index needs only a few
+// hundred of them. An allocation bigger than the next block gets a block of
+// its own size.
+void Arena::addBlock(size_t minimumSize) {
+    size_t size = nextBlockSize;
+    if (size < minimumSize) {
+        size = minimumSize;
+    }
+    if (nextBlockSize < MaxBlockSize) {
+        nextBlockSize *= 2;
+    }
+
+    char* block = static_cast<char*>(::operator new(size));
+    blocks.push_back(block);
+    cursor = block;
+    limit = block + size;
+    bytesReserved += size;
+}
+
+// Objects are destroyed newest first, the reverse of their construction.
+void Arena::release() {
+    for (size_t i = destructors.size(); i-- > 0;) {
+        destructors[i].destroy(destructors[i].object);
+    }
+    destructors.clear();
+
+    for (char* block : blocks) {
+        ::operator delete(block);
+    }
+    blocks.clear();
+
+    cursor = nullptr;
+    limit = nullptr;
+    nextBlockSize = InitialBlockSize;
+    bytesReserved = 0;
+    bytesUsed = 0;
+}
+
+size_t Arena::getBytesUsed() const {
+    return bytesUsed;
+}
+
+size_t Arena::getBytesReserved() const {
+    return bytesReserved;
+}
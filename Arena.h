@@ -0,0 +1,80 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Bump-pointer allocator owned by an index. Memory is carved out of large
+// blocks, so an allocation is a pointer increment and objects created one
+// after another sit next to each other. Nothing is freed individually; the
+// whole arena is given back at once by release().
+//
+// Objects with a trivial destructor cost nothing to tear down. Others are
+// recorded when they are created and destroyed by release() in one flat pass,
+// without the owner having to walk its own structure.
+class Arena {
+private:
+    struct Destructor {
+        void* object;
+        void (*destroy)(void*);
+    };
+
+    std::vector<char*> blocks;
+    std::vector<Destructor> destructors;
+    char* cursor = nullptr;
+    char* limit = nullptr;
+    size_t nextBlockSize;
+    size_t bytesReserved = 0;
+    size_t bytesUsed = 0;
+
+    void addBlock(size_t minimumSize);
+
+    template <typename T>
+    static void destroyObject(void* object) {
+        static_cast<T*>(object)->~T();
+    }
+
+public:
+    static constexpr size_t InitialBlockSize = 64 * 1024;
+    static constexpr size_t MaxBlockSize = 4 * 1024 * 1024;
+
+    Arena() : nextBlockSize(InitialBlockSize) {}
+    ~Arena();
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    // alignment must be a power of two no larger than alignof(std::max_align_t).
+    void* allocate(size_t bytes, size_t alignment = alignof(std::max_align_t)) {
+        uintptr_t address = reinterpret_cast<uintptr_t>(cursor);
+        size_t padding = (alignment - (address & (alignment - 1))) & (alignment - 1);
+        if (cursor == nullptr || static_cast<size_t>(limit - cursor) < padding + bytes) {
+            addBlock(bytes);
+            padding = 0;
+        }
+        char* result = cursor + padding;
+        cursor = result + bytes;
+        bytesUsed += padding + bytes;
+        return result;
+    }
+
+    template <typename T, typename... Args>
+    T* create(Args&&... args) {
+        T* object = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+        if (!std::is_trivially_destructible<T>::value) {
+            destructors.push_back({ object, &destroyObject<T> });
+        }
+        return object;
+    }
+
+    template <typename T>
+    T* allocateArray(size_t count) {
+        static_assert(std::is_trivially_destructible<T>::value, "arena arrays are never destroyed");
+        return static_cast<T*>(allocate(sizeof(T) * count, alignof(T)));
+    }
+
+    void release();
+    size_t getBytesUsed() const;
+    size_t getBytesReserved() const;
+};
@@ -0,0 +1,482 @@
+#include "Benchmark.h"
+#include "SearchEngine.h"
+#include "TermDictionary.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <sstream>
+#include <unordered_map>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+ZipfVocabulary::ZipfVocabulary(size_t size, double exponent, uint64_t seed) : random(seed) {
+    cumulative.reserve(size);
+    double total = 0.0;
+    for (size_t rank = 0; rank < size; ++rank) {
+        total += 1.0 / pow(static_cast<double>(rank + 1), exponent);
+        cumulative.push_back(total);
+    }
+    for (double& weight : cumulative) {
+        weight /= total;
+    }
+}
+
+// Bijective base 26, so the most frequent words are also the shortest:
+// 0 -> "a", 25 -> "z", 26 -> "aa".
+string ZipfVocabulary::word(size_t rank) {
+    string result;
+    for (size_t n = rank + 1; n > 0; n = (n - 1) / 26) {
+        result += static_cast<char>('a' + (n - 1) % 26);
+    }
+    reverse(result.begin(), result.end());
+    return result;
+}
+
+size_t ZipfVocabulary::sampleRank() {
+    double u = (random() >> 11) * (1.0 / 9007199254740992.0);  // 53 random bits in [0, 1)
+    size_t rank = upper_bound(cumulative.begin(), cumulative.end(), u) - cumulative.begin();
+    return min(rank, cumulative.size() - 1);
+}
+
+size_t ZipfVocabulary::uniform(size_t bound) {
+    return static_cast<size_t>(random() % bound);
+}
+
+// Nearest-rank percentiles.
+LatencySummary LatencySummary::fromSamples(vector<double>& samples) {
+    LatencySummary summary;
+    summary.count = samples.size();
+    if (samples.empty()) {
+        return summary;
+    }
+    sort(samples.begin(), samples.end());
+    auto percentile = [&](double fraction) {
+        size_t rank = static_cast<size_t>(ceil(fraction * samples.size()));
+        return samples[rank > 0 ? rank - 1 : 0];
+    };
+
+    double total = 0.0;
+    for (double sample : samples) {
+        total += sample;
+    }
+    summary.mean = total / samples.size();
+    summary.p50 = percentile(0.50);
+    summary.p99 = percentile(0.99);
+    summary.p999 = percentile(0.999);
+    summary.max = samples.back();
+    return summary;
+}
+
+static size_t residentBytes() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return counters.WorkingSetSize;
+    }
+    return 0;
+#else
+    ifstream statm("/proc/self/statm");
+    size_t pages = 0;
+    size_t residentPages = 0;
+    statm >> pages >> residentPages;
+    return residentPages * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+}
+
+static double secondsSince(chrono::steady_clock::time_point start) {
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// The engine reports every indexed file and every dump on cout; that output
+// is discarded while the benchmark runs so it neither floods the console nor
+// ends up in the timings as terminal I/O.
+class NullBuffer : public streambuf {
+protected:
+    int overflow(int c) override {
+        return c;
+    }
+};
+
+class QuietOutput {
+private:
+    NullBuffer buffer;
+    streambuf* previous;
+
+public:
+    QuietOutput() : previous(cout.rdbuf(&buffer)) {
+    }
+    ~QuietOutput() {
+        cout.rdbuf(previous);
+    }
+};
+
+// Adds the bytes it hands out to a counter, to weigh a node-based container.
+template <typename T>
+struct CountingAllocator {
+    using value_type = T;
+    size_t* bytes;
+
+    explicit CountingAllocator(size_t* bytes) : bytes(bytes) {
+    }
+    template <typename U>
+    CountingAllocator(const CountingAllocator<U>& other) : bytes(other.bytes) {
+    }
+
+    T* allocate(size_t count) {
+        *bytes += count * sizeof(T);
+        return allocator<T>().allocate(count);
+    }
+    void deallocate(T* pointer, size_t count) {
+        *bytes -= count * sizeof(T);
+        allocator<T>().deallocate(pointer, count);
+    }
+    template <typename U>
+    bool operator==(const CountingAllocator<U>& other) const {
+        return bytes == other.bytes;
+    }
+    template <typename U>
+    bool operator!=(const CountingAllocator<U>& other) const {
+        return bytes != other.bytes;
+    }
+};
+
+static string escapeJson(const string& text) {
+    string result;
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            result += '\\';
+        }
+        result += c;
+    }
+    return result;
+}
+
+Benchmark::Benchmark(const BenchmarkOptions& options) : options(options) {
+}
+
+bool Benchmark::generateCorpus() {
+    error_code error;
+    fs::create_directories(options.corpusFolder, error);
+    if (error) {
+        cerr << "Error creating benchmark corpus folder: " << options.corpusFolder << "\n";
+        return false;
+    }
+
+    ZipfVocabulary vocabulary(options.vocabularySize, options.zipfExponent, options.seed);
+    size_t lengthRange = options.maxDocumentLength - options.minDocumentLength + 1;
+    documents.assign(options.documentCount, {});
+    tokenCount = 0;
+    corpusBytes = 0;
+
+    for (size_t i = 0; i < options.documentCount; ++i) {
+        vector<uint32_t>& document = documents[i];
+        size_t length = options.minDocumentLength + vocabulary.uniform(lengthRange);
+        ostringstream text;
+        for (size_t position = 0; position < length; ++position) {
+            document.push_back(static_cast<uint32_t>(vocabulary.sampleRank()));
+            text << ZipfVocabulary::word(document.back()) << ((position + 1) % 12 == 0 ? '\n' : ' ');
+        }
+
+        ostringstream fileName;
+        fileName << options.corpusFolder << "/review_" << i + 1 << ".txt";
+        ofstream file(fileName.str(), ios::binary);
+        if (!file.is_open()) {
+            cerr << "Error writing benchmark document: " << fileName.str() << "\n";
+            return false;
+        }
+        string contents = text.str();
+        file.write(contents.data(), contents.size());
+        tokenCount += length;
+        corpusBytes += contents.size();
+    }
+    return true;
+}
+
+// Every backend runs the same queries. Words are drawn with their corpus
+// frequencies, so common words dominate as they do in real query logs, and
+// phrases are cut from the generated documents so that they do occur.
+void Benchmark::generateQueries() {
+    ZipfVocabulary vocabulary(options.vocabularySize, options.zipfExponent, options.seed + 1);
+    auto word = [&]() {
+        return ZipfVocabulary::word(vocabulary.sampleRank());
+    };
+
+    vector<string> single, conjunction, disjunction, phrase, exclusion;
+    for (size_t i = 0; i < options.queriesPerKind; ++i) {
+        single.push_back(word());
+        conjunction.push_back(word() + " " + word());
+        disjunction.push_back(word() + " OR " + word());
+        exclusion.push_back(word() + " -" + word());
+
+        const vector<uint32_t>& document = documents[vocabulary.uniform(documents.size())];
+        size_t start = vocabulary.uniform(document.size() - 1);
+        phrase.push_back("\"" + ZipfVocabulary::word(document[start]) + " " + ZipfVocabulary::word(document[start + 1]) + "\"");
+    }
+
+    querySets = {
+        { "single", single },
+        { "and", conjunction },
+        { "or", disjunction },
+        { "phrase", phrase },
+        { "exclusion", exclusion },
+    };
+}
+
+bool Benchmark::measureBackend(bool useHashMap, BackendMeasurements& measurements) {
+    measurements.name = useHashMap ? "hashmap" : "trie";
+    bool previousBackend = SearchEngine::useHashMap;
+    SearchEngine::useHashMap = useHashMap;
+
+    size_t residentBefore = residentBytes();
+    SearchEngine engine;
+    engine.setQueryCacheCapacity(0);  // every timed query is evaluated
+
+    auto start = chrono::steady_clock::now();
+    engine.indexDocuments(options.corpusFolder, useHashMap, static_cast<int>(options.documentCount), options.indexingWorkers);
+    measurements.indexingSeconds = secondsSince(start);
+    measurements.residentBytesDelta = static_cast<int64_t>(residentBytes()) - static_cast<int64_t>(residentBefore);
+
+    for (const auto& querySet : querySets) {
+        const vector<string>& queries = querySet.second;
+        for (size_t i = 0; i < min<size_t>(queries.size(), 100); ++i) {
+            measurements.checksum += engine.search(queries[i], useHashMap)->size();
+        }
+
+        vector<double> latencies;
+        latencies.reserve(queries.size());
+        for (const string& query : queries) {
+            auto queryStart = chrono::steady_clock::now();
+            QueryCache::Results results = engine.search(query, useHashMap);
+            latencies.push_back(secondsSince(queryStart) * 1e6);
+            measurements.checksum = measurements.checksum * 31 + results->size() + (results->empty() ? 0 : results->front().docId);
+        }
+        measurements.sequentialSeconds += accumulate(latencies.begin(), latencies.end(), 0.0) / 1e6;
+        measurements.queries.push_back({ querySet.first, LatencySummary::fromSamples(latencies) });
+    }
+
+    // Every query once more, as one batch. Its results have to match the
+    // ones the queries got one at a time.
+    vector<string> batch;
+    for (const auto& querySet : querySets) {
+        batch.insert(batch.end(), querySet.second.begin(), querySet.second.end());
+    }
+    measurements.batchQueries = batch.size();
+    start = chrono::steady_clock::now();
+    vector<BatchResult> batchResults = engine.searchBatch(batch, useHashMap);
+    measurements.batchSeconds = secondsSince(start);
+    measurements.batchVerified = true;
+    for (size_t i = 0; i < batch.size() && measurements.batchVerified; i += 10) {
+        QueryCache::Results expected = engine.search(batch[i], useHashMap);
+        measurements.batchVerified = expected->size() == batchResults[i].documents.size();
+        for (size_t j = 0; j < expected->size() && measurements.batchVerified; ++j) {
+            measurements.batchVerified = (*expected)[j].docId == batchResults[i].documents[j].docId;
+        }
+    }
+
+    start = chrono::steady_clock::now();
+    bool dumped = engine.dumpSearchEngine(options.dumpFilePath);
+    measurements.dumpSeconds = secondsSince(start);
+    if (!dumped) {
+        SearchEngine::useHashMap = previousBackend;
+        return false;
+    }
+    measurements.dumpBytes = fs::file_size(options.dumpFilePath);
+
+    SearchEngine loaded;
+    loaded.setQueryCacheCapacity(0);
+    start = chrono::steady_clock::now();
+    bool loadSucceeded = loaded.loadSearchEngine(options.dumpFilePath);
+    measurements.loadSeconds = secondsSince(start);
+
+    // The reloaded index has to answer a sample of the queries the same way.
+    measurements.loadVerified = loadSucceeded;
+    for (const auto& querySet : querySets) {
+        for (size_t i = 0; i < min<size_t>(querySet.second.size(), 20) && measurements.loadVerified; ++i) {
+            QueryCache::Results expected = engine.search(querySet.second[i], useHashMap);
+            QueryCache::Results actual = loaded.search(querySet.second[i], useHashMap);
+            measurements.loadVerified = expected->size() == actual->size();
+            for (size_t j = 0; j < expected->size() && measurements.loadVerified; ++j) {
+                measurements.loadVerified = (*expected)[j].docId == (*actual)[j].docId;
+            }
+        }
+    }
+
+    start = chrono::steady_clock::now();
+    engine.dumpMappedIndex(options.mappedIndexPath);
+    measurements.mappedWriteSeconds = secondsSince(start);
+    SearchEngine mapped;
+    start = chrono::steady_clock::now();
+    mapped.openMappedIndex(options.mappedIndexPath);
+    measurements.mappedOpenSeconds = secondsSince(start);
+
+    SearchEngine::useHashMap = previousBackend;
+    return true;
+}
+
+void Benchmark::measureDictionary() {
+    typedef CountingAllocator<pair<const string, PostingList>> NodeAllocator;
+    size_t mapBytes = 0;
+    unordered_map<string, PostingList, hash<string>, equal_to<string>, NodeAllocator> map(0, hash<string>(),
+        equal_to<string>(), NodeAllocator(&mapBytes));
+    TermDictionary flat;
+    for (size_t rank = 0; rank < options.vocabularySize; ++rank) {
+        string term = ZipfVocabulary::word(rank);
+        map[term];
+        flat.insert(term);
+        // Keys too long for the string's own buffer live on the heap as well.
+        if (term.size() > string().capacity()) {
+            mapBytes += term.size() + 1;
+        }
+    }
+    dictionary.terms = options.vocabularySize;
+    dictionary.mapBytesPerTerm = static_cast<double>(mapBytes) / options.vocabularySize;
+    dictionary.flatBytesPerTerm = static_cast<double>(flat.memoryBytes()) / options.vocabularySize;
+
+    ZipfVocabulary vocabulary(options.vocabularySize, options.zipfExponent, options.seed + 2);
+    size_t lookups = max<size_t>(options.queriesPerKind * 100, 100000);
+    vector<string> hits, misses;
+    for (size_t i = 0; i < lookups; ++i) {
+        hits.push_back(ZipfVocabulary::word(vocabulary.sampleRank()));
+        misses.push_back(ZipfVocabulary::word(options.vocabularySize + vocabulary.uniform(options.vocabularySize)));
+    }
+    dictionary.lookups = lookups;
+
+    // Nanoseconds per lookup; every lookup feeds the checksum.
+    auto timeLookups = [&](const vector<string>& words, auto find) {
+        auto start = chrono::steady_clock::now();
+        for (const string& word : words) {
+            dictionary.checksum = dictionary.checksum * 31 + (find(word) != nullptr ? 1 : 0);
+        }
+        return secondsSince(start) * 1e9 / words.size();
+    };
+    auto findFlat = [&](const string& word) {
+        return flat.find(word);
+    };
+    auto findMap = [&](const string& word) {
+        auto it = map.find(word);
+        return (it != map.end()) ? &it->second : nullptr;
+    };
+    dictionary.flatHitNanos = timeLookups(hits, findFlat);
+    dictionary.flatMissNanos = timeLookups(misses, findFlat);
+    dictionary.mapHitNanos = timeLookups(hits, findMap);
+    dictionary.mapMissNanos = timeLookups(misses, findMap);
+}
+
+void Benchmark::writeJson(ostream& out) const {
+    out << setprecision(6) << fixed;
+    out << "{\n";
+    out << "  \"corpus\": {\"documents\": " << options.documentCount
+        << ", \"vocabulary\": " << options.vocabularySize
+        << ", \"zipfExponent\": " << options.zipfExponent
+        << ", \"seed\": " << options.seed
+        << ", \"tokens\": " << tokenCount
+        << ", \"bytes\": " << corpusBytes
+        << ", \"folder\": \"" << escapeJson(options.corpusFolder) << "\"},\n";
+    out << "  \"queriesPerKind\": " << options.queriesPerKind << ",\n";
+    out << "  \"backends\": [\n";
+    for (size_t b = 0; b < backends.size(); ++b) {
+        const BackendMeasurements& backend = backends[b];
+        double seconds = max(backend.indexingSeconds, 1e-9);
+        out << "    {\n";
+        out << "      \"name\": \"" << backend.name << "\",\n";
+        out << "      \"indexing\": {\"seconds\": " << backend.indexingSeconds
+            << ", \"documentsPerSecond\": " << options.documentCount / seconds
+            << ", \"tokensPerSecond\": " << tokenCount / seconds
+            << ", \"megabytesPerSecond\": " << corpusBytes / seconds / (1024.0 * 1024.0) << "},\n";
+        out << "      \"memory\": {\"residentBytesDelta\": " << backend.residentBytesDelta << "},\n";
+        out << "      \"queries\": {\n";
+        for (size_t q = 0; q < backend.queries.size(); ++q) {
+            const LatencySummary& latency = backend.queries[q].second;
+            out << "        \"" << backend.queries[q].first << "\": {\"count\": " << latency.count
+                << ", \"meanMicros\": " << latency.mean
+                << ", \"p50Micros\": " << latency.p50
+                << ", \"p99Micros\": " << latency.p99
+                << ", \"p999Micros\": " << latency.p999
+                << ", \"maxMicros\": " << latency.max << "}"
+                << (q + 1 < backend.queries.size() ? ",\n" : "\n");
+        }
+        out << "      },\n";
+        out << "      \"batch\": {\"queries\": " << backend.batchQueries
+            << ", \"sequentialSeconds\": " << backend.sequentialSeconds
+            << ", \"batchSeconds\": " << backend.batchSeconds
+            << ", \"queriesPerSecond\": " << backend.batchQueries / max(backend.batchSeconds, 1e-9)
+            << ", \"verified\": " << (backend.batchVerified ? "true" : "false") << "},\n";
+        out << "      \"persistence\": {\"dumpSeconds\": " << backend.dumpSeconds
+            << ", \"loadSeconds\": " << backend.loadSeconds
+            << ", \"dumpBytes\": " << backend.dumpBytes
+            << ", \"loadVerified\": " << (backend.loadVerified ? "true" : "false")
+            << ", \"mappedWriteSeconds\": " << backend.mappedWriteSeconds
+            << ", \"mappedOpenSeconds\": " << backend.mappedOpenSeconds << "},\n";
+        out << "      \"checksum\": " << backend.checksum << "\n";
+        out << "    }" << (b + 1 < backends.size() ? ",\n" : "\n");
+    }
+    out << "  ],\n";
+    out << "  \"dictionary\": {\"terms\": " << dictionary.terms
+        << ", \"lookups\": " << dictionary.lookups
+        << ", \"flat\": {\"hitNanos\": " << dictionary.flatHitNanos
+        << ", \"missNanos\": " << dictionary.flatMissNanos
+        << ", \"bytesPerTerm\": " << dictionary.flatBytesPerTerm << "}"
+        << ", \"unorderedMap\": {\"hitNanos\": " << dictionary.mapHitNanos
+        << ", \"missNanos\": " << dictionary.mapMissNanos
+        << ", \"bytesPerTerm\": " << dictionary.mapBytesPerTerm << "}"
+        << ", \"checksum\": " << dictionary.checksum << "}\n";
+    out << "}\n";
+}
+
+void Benchmark::displaySummary() const {
+    cout << "Benchmark corpus: " << options.documentCount << " documents, " << tokenCount << " tokens, "
+        << options.vocabularySize << " word vocabulary (Zipf s = " << options.zipfExponent << ")\n";
+    for (const BackendMeasurements& backend : backends) {
+        cout << backend.name << ": indexed in " << backend.indexingSeconds * 1000.0 << " ms ("
+            << tokenCount / max(backend.indexingSeconds, 1e-9) << " tokens/s), dump "
+            << backend.dumpSeconds * 1000.0 << " ms, load " << backend.loadSeconds * 1000.0 << " ms"
+            << (backend.loadVerified ? "" : " (reloaded results differ!)") << "\n";
+        for (const auto& query : backend.queries) {
+            cout << "  " << query.first << ": p50 " << query.second.p50 << " us, p99 " << query.second.p99
+                << " us, p999 " << query.second.p999 << " us\n";
+        }
+        cout << "  batch of " << backend.batchQueries << " queries: " << backend.batchSeconds * 1000.0 << " ms ("
+            << backend.sequentialSeconds * 1000.0 << " ms one at a time)"
+            << (backend.batchVerified ? "" : " (batch results differ!)") << "\n";
+    }
+    cout << "term dictionary, " << dictionary.terms << " terms: flat table " << dictionary.flatHitNanos << " ns per hit, "
+        << dictionary.flatMissNanos << " ns per miss, " << dictionary.flatBytesPerTerm << " bytes/term; unordered_map "
+        << dictionary.mapHitNanos << " ns per hit, " << dictionary.mapMissNanos << " ns per miss, "
+        << dictionary.mapBytesPerTerm << " bytes/term\n";
+}
+
+bool Benchmark::run(ostream& json) {
+    if (options.documentCount == 0 || options.vocabularySize == 0 || options.minDocumentLength < 2
+        || options.maxDocumentLength < options.minDocumentLength) {
+        cerr << "Invalid benchmark options.\n";
+        return false;
+    }
+
+    backends.assign(2, BackendMeasurements());
+    {
+        QuietOutput quiet;
+        if (!generateCorpus()) {
+            return false;
+        }
+        generateQueries();
+        if (!measureBackend(true, backends[0]) || !measureBackend(false, backends[1])) {
+            return false;
+        }
+        measureDictionary();
+    }
+
+    writeJson(json);
+    return true;
+}
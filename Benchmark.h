@@ -0,0 +1,115 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <ostream>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+struct BenchmarkOptions {
+    std::string corpusFolder = "benchmark_corpus";
+    std::string dumpFilePath = "benchmark_dump.dat";
+    std::string mappedIndexPath = "benchmark_index.idx";
+    size_t documentCount = 2000;
+    size_t vocabularySize = 20000;
+    double zipfExponent = 1.0;
+    size_t minDocumentLength = 50;
+    size_t maxDocumentLength = 400;
+    size_t queriesPerKind = 1000;
+    int indexingWorkers = 0;
+    uint64_t seed = 42;
+};
+
+// Words drawn from a synthetic vocabulary whose rank frequencies follow Zipf's
+// law, like natural text. The sequence depends only on the seed: mt19937_64
+// is fully specified by the standard, and it is turned into numbers here
+// rather than through the library's distributions, whose output is not.
+class ZipfVocabulary {
+private:
+    std::vector<double> cumulative;
+    std::mt19937_64 random;
+
+public:
+    ZipfVocabulary(size_t size, double exponent, uint64_t seed);
+
+    static std::string word(size_t rank);
+    size_t sampleRank();
+    size_t uniform(size_t bound);
+};
+
+// Latency distribution of one kind of query, in microseconds.
+struct LatencySummary {
+    size_t count = 0;
+    double mean = 0.0;
+    double p50 = 0.0;
+    double p99 = 0.0;
+    double p999 = 0.0;
+    double max = 0.0;
+
+    static LatencySummary fromSamples(std::vector<double>& samples);
+};
+
+struct BackendMeasurements {
+    std::string name;
+    double indexingSeconds = 0.0;
+    int64_t residentBytesDelta = 0;
+    std::vector<std::pair<std::string, LatencySummary>> queries;
+    double dumpSeconds = 0.0;
+    double loadSeconds = 0.0;
+    uintmax_t dumpBytes = 0;
+    bool loadVerified = false;
+    double mappedWriteSeconds = 0.0;
+    double mappedOpenSeconds = 0.0;
+    size_t batchQueries = 0;
+    double sequentialSeconds = 0.0;
+    double batchSeconds = 0.0;
+    bool batchVerified = false;
+    uint64_t checksum = 0;
+};
+
+// Term lookups on their own: the hash backend's TermDictionary against the
+// std::unordered_map it replaced, both holding every word of the vocabulary.
+// Hits are drawn with the corpus word frequencies, misses are words outside
+// the vocabulary.
+struct DictionaryMeasurements {
+    size_t terms = 0;
+    size_t lookups = 0;
+    double flatHitNanos = 0.0;
+    double flatMissNanos = 0.0;
+    double mapHitNanos = 0.0;
+    double mapMissNanos = 0.0;
+    double flatBytesPerTerm = 0.0;
+    double mapBytesPerTerm = 0.0;
+    uint64_t checksum = 0;
+};
+
+// Benchmark suite for both backends over a generated corpus: indexing
+// throughput, latency percentiles per query kind, batch query throughput,
+// dump/load and mapped index times, resident memory growth, and term
+// dictionary lookups. Results are written as JSON so runs can
+// be compared between releases. The result count and top document of every
+// query are folded into a checksum that is part of the output, so none of the
+// timed work can be optimized away.
+class Benchmark {
+private:
+    BenchmarkOptions options;
+    std::vector<std::vector<uint32_t>> documents;
+    size_t tokenCount = 0;
+    uintmax_t corpusBytes = 0;
+    std::vector<std::pair<std::string, std::vector<std::string>>> querySets;
+    std::vector<BackendMeasurements> backends;
+    DictionaryMeasurements dictionary;
+
+    bool generateCorpus();
+    void generateQueries();
+    bool measureBackend(bool useHashMap, BackendMeasurements& measurements);
+    void measureDictionary();
+    void writeJson(std::ostream& out) const;
+
+public:
+    explicit Benchmark(const BenchmarkOptions& options);
+
+    bool run(std::ostream& json);
+    void displaySummary() const;
+};
@@ -0,0 +1,230 @@
+#include "Bm25Ranker.h"
+#include "PostingIntersection.h"
+#include "Metrics.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+using namespace std;
+
+// Min-heap of the k best documents. Among equal scores the lower document id
+// ranks higher, so results do not depend on evaluation order.
+class TopKHeap {
+private:
+    size_t k;
+    vector<ScoredDocument> heap;
+
+    static bool better(const ScoredDocument& a, const ScoredDocument& b) {
+        if (a.score != b.score) {
+            return a.score > b.score;
+        }
+        return a.docId < b.docId;
+    }
+
+public:
+    explicit TopKHeap(size_t k) : k(k) {
+    }
+
+    // Scores strictly below the threshold can never enter the heap.
+    double threshold() const {
+        if (k == 0 || heap.size() < k) {
+            return -numeric_limits<double>::infinity();
+        }
+        return heap.front().score;
+    }
+
+    void offer(uint32_t docId, double score) {
+        ScoredDocument document = { docId, score };
+        if (k == 0 || heap.size() < k) {
+            heap.push_back(document);
+            push_heap(heap.begin(), heap.end(), better);
+        }
+        else if (better(document, heap.front())) {
+            pop_heap(heap.begin(), heap.end(), better);
+            heap.back() = document;
+            push_heap(heap.begin(), heap.end(), better);
+        }
+    }
+
+    vector<ScoredDocument> take() {
+        ScopedTimer timer(Phase::Sort);
+        sort(heap.begin(), heap.end(), better);
+        return move(heap);
+    }
+};
+
+Bm25Ranker::Bm25Ranker(const CorpusStatistics& statistics, double k1, double b)
+    : statistics(statistics), k1(k1), b(b) {
+    if (this->statistics.averageLength <= 0.0) {
+        this->statistics.averageLength = 1.0;
+    }
+}
+
+// Deleted documents keep their postings until they are purged, so every
+// ranking checks the documents it is about to score.
+bool Bm25Ranker::isDeleted(uint32_t docId) const {
+    return statistics.deleted != nullptr && statistics.deleted->contains(statistics.docBase + docId);
+}
+
+double Bm25Ranker::inverseDocumentFrequency(size_t documentFrequency) const {
+    double n = static_cast<double>(statistics.documentCount);
+    double df = static_cast<double>(documentFrequency);
+    return log(1.0 + (n - df + 0.5) / (df + 0.5));
+}
+
+double Bm25Ranker::termScore(uint32_t frequency, uint32_t documentLength, double idf) const {
+    double tf = static_cast<double>(frequency);
+    double norm = k1 * (1.0 - b + b * documentLength / statistics.averageLength);
+    return idf * tf * (k1 + 1.0) / (tf + norm);
+}
+
+// The score grows with the frequency and shrinks with the document length, so
+// the largest frequency in the list in the shortest document is an upper
+// bound. Without a known frequency the limit of the saturation curve is used.
+double Bm25Ranker::maxTermScore(uint32_t maxFrequency, double idf) const {
+    if (maxFrequency == 0) {
+        return idf * (k1 + 1.0);
+    }
+    return termScore(maxFrequency, statistics.minLength, idf);
+}
+
+// documentFrequency is the number of documents in the whole collection that
+// contain the term; it is larger than postings.size when the postings are
+// those of one segment only.
+RankedTerm Bm25Ranker::prepare(const PostingView& postings, size_t documentFrequency) const {
+    double idf = inverseDocumentFrequency(documentFrequency);
+    return { postings, idf, maxTermScore(postings.maxFrequency, idf) };
+}
+
+// MaxScore over a disjunction. Terms are ordered by upper bound; the longest
+// prefix of low-bound terms whose bounds add up to less than the threshold is
+// "non-essential": a document found only in those lists cannot make the top k.
+// Candidates are therefore drawn from the essential lists only, and the
+// non-essential lists are probed by galloping, highest bound first, until the
+// remaining bounds cannot lift the document over the threshold.
+vector<ScoredDocument> Bm25Ranker::topKDisjunctive(vector<RankedTerm> terms, size_t k) const {
+    TopKHeap heap(k);
+    sort(terms.begin(), terms.end(), [](const RankedTerm& a, const RankedTerm& c) {
+        return a.upperBound < c.upperBound;
+        });
+
+    size_t termCount = terms.size();
+    vector<double> boundPrefix(termCount + 1, 0.0);
+    for (size_t i = 0; i < termCount; ++i) {
+        boundPrefix[i + 1] = boundPrefix[i] + terms[i].upperBound;
+    }
+
+    vector<size_t> cursors(termCount, 0);
+    size_t firstEssential = 0;
+
+    while (true) {
+        uint32_t docId = UINT32_MAX;
+        for (size_t i = firstEssential; i < termCount; ++i) {
+            if (cursors[i] < terms[i].postings.size) {
+                docId = min(docId, terms[i].postings.docIds[cursors[i]]);
+            }
+        }
+        if (docId == UINT32_MAX) {
+            break;
+        }
+        if (isDeleted(docId)) {
+            for (size_t i = firstEssential; i < termCount; ++i) {
+                if (cursors[i] < terms[i].postings.size && terms[i].postings.docIds[cursors[i]] == docId) {
+                    cursors[i]++;
+                }
+            }
+            continue;
+        }
+
+        uint32_t documentLength = statistics.lengths[docId];
+        double score = 0.0;
+        for (size_t i = firstEssential; i < termCount; ++i) {
+            const PostingView& postings = terms[i].postings;
+            if (cursors[i] < postings.size && postings.docIds[cursors[i]] == docId) {
+                score += termScore(postings.frequency(cursors[i]), documentLength, terms[i].idf);
+                cursors[i]++;
+            }
+        }
+
+        double threshold = heap.threshold();
+        for (size_t i = firstEssential; i-- > 0;) {
+            if (score + boundPrefix[i + 1] < threshold) {
+                break;
+            }
+            const PostingView& postings = terms[i].postings;
+            cursors[i] = PostingIntersection::gallop(postings.docIds, cursors[i], postings.size, docId);
+            if (cursors[i] < postings.size && postings.docIds[cursors[i]] == docId) {
+                score += termScore(postings.frequency(cursors[i]), documentLength, terms[i].idf);
+            }
+        }
+
+        heap.offer(docId, score);
+
+        threshold = heap.threshold();
+        while (firstEssential < termCount && boundPrefix[firstEssential + 1] < threshold) {
+            firstEssential++;
+        }
+    }
+    return heap.take();
+}
+
+// Scores a fixed candidate set, such as the result of an intersection. Terms
+// are applied highest bound first, and a candidate is dropped as soon as its
+// partial score plus the bounds of the terms still to come cannot reach the
+// threshold.
+vector<ScoredDocument> Bm25Ranker::topKCandidates(const vector<uint32_t>& candidates, vector<RankedTerm> terms, size_t k) const {
+    TopKHeap heap(k);
+    sort(terms.begin(), terms.end(), [](const RankedTerm& a, const RankedTerm& c) {
+        return a.upperBound > c.upperBound;
+        });
+
+    size_t termCount = terms.size();
+    vector<double> boundSuffix(termCount + 1, 0.0);
+    for (size_t i = termCount; i-- > 0;) {
+        boundSuffix[i] = boundSuffix[i + 1] + terms[i].upperBound;
+    }
+
+    vector<size_t> cursors(termCount, 0);
+    for (uint32_t docId : candidates) {
+        if (isDeleted(docId)) {
+            continue;
+        }
+        uint32_t documentLength = statistics.lengths[docId];
+        double threshold = heap.threshold();
+        double score = 0.0;
+        bool pruned = false;
+
+        for (size_t i = 0; i < termCount; ++i) {
+            if (score + boundSuffix[i] < threshold) {
+                pruned = true;
+                break;
+            }
+            const PostingView& postings = terms[i].postings;
+            cursors[i] = PostingIntersection::gallop(postings.docIds, cursors[i], postings.size, docId);
+            if (cursors[i] < postings.size && postings.docIds[cursors[i]] == docId) {
+                score += termScore(postings.frequency(cursors[i]), documentLength, terms[i].idf);
+            }
+        }
+
+        if (!pruned) {
+            heap.offer(docId, score);
+        }
+    }
+    return heap.take();
+}
+
+// Ranks documents by a single pseudo-term given as per-document frequencies,
+// such as the number of times a phrase occurs. Its document frequency is
+// passed in, since the documents listed may be one segment's share of them.
+vector<ScoredDocument> Bm25Ranker::topKFrequencies(const vector<uint32_t>& docIds, const vector<uint32_t>& frequencies,
+    size_t documentFrequency, size_t k) const {
+    TopKHeap heap(k);
+    double idf = inverseDocumentFrequency(documentFrequency);
+    for (size_t i = 0; i < docIds.size(); ++i) {
+        if (termScore(frequencies[i], statistics.minLength, idf) < heap.threshold() || isDeleted(docIds[i])) {
+            continue;
+        }
+        heap.offer(docIds[i], termScore(frequencies[i], statistics.lengths[docIds[i]], idf));
+    }
+    return heap.take();
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include "PostingView.h"
+#include "DocIdBitmap.h"
+
+// Collection-wide numbers BM25 needs, taken from the document table or from a
+// mapped index. lengths is indexed by document id, relative to the postings
+// being ranked.
+struct CorpusStatistics {
+    size_t documentCount = 0;
+    double averageLength = 0.0;
+    uint32_t minLength = 0;
+    const uint32_t* lengths = nullptr;
+    // Documents no ranking returns, by the ids of the document table; null
+    // when there are none. docBase turns the ids of the postings into those.
+    const DocIdBitmap* deleted = nullptr;
+    uint32_t docBase = 0;
+};
+
+struct ScoredDocument {
+    uint32_t docId;
+    double score;
+};
+
+// A term taking part in ranking: its postings, its idf, and the highest score
+// any single document can get from it.
+struct RankedTerm {
+    PostingView postings;
+    double idf;
+    double upperBound;
+};
+
+// BM25 scoring with bounded top-k retrieval. Every method keeps a heap of the
+// k best documents seen so far; the k-th best score is the threshold a
+// document has to beat, and per-term upper bounds let documents and whole
+// lists that cannot beat it be skipped without scoring. k == 0 returns every
+// match.
+class Bm25Ranker {
+private:
+    CorpusStatistics statistics;
+    double k1;
+    double b;
+
+    bool isDeleted(uint32_t docId) const;
+
+public:
+    static constexpr double DefaultK1 = 1.2;
+    static constexpr double DefaultB = 0.75;
+
+    explicit Bm25Ranker(const CorpusStatistics& statistics, double k1 = DefaultK1, double b = DefaultB);
+
+    double inverseDocumentFrequency(size_t documentFrequency) const;
+    double termScore(uint32_t frequency, uint32_t documentLength, double idf) const;
+    double maxTermScore(uint32_t maxFrequency, double idf) const;
+    RankedTerm prepare(const PostingView& postings, size_t documentFrequency) const;
+
+    std::vector<ScoredDocument> topKDisjunctive(std::vector<RankedTerm> terms, size_t k) const;
+    std::vector<ScoredDocument> topKCandidates(const std::vector<uint32_t>& candidates, std::vector<RankedTerm> terms, size_t k) const;
+    std::vector<ScoredDocument> topKFrequencies(const std::vector<uint32_t>& docIds, const std::vector<uint32_t>& frequencies,
+        size_t documentFrequency, size_t k) const;
+};
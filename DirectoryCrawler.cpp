@@ -0,0 +1,175 @@
+#include "DirectoryCrawler.h"
+#include <algorithm>
+#include <cctype>
+#include <iostream>
+#include <system_error>
+#include <experimental/filesystem>
+
+namespace fs = std::experimental::filesystem;
+using namespace std;
+
+struct DirectoryEntry {
+    string name;
+    bool isDirectory;
+};
+
+static string joinPath(const string& directory, const string& name) {
+    if (directory.empty() || directory.back() == '/' || directory.back() == '\\') {
+        return directory + name;
+    }
+    return directory + "/" + name;
+}
+
+// Greedy matching with backtracking to the last *: when the rest of the text
+// does not match, that * takes one more character and matching resumes.
+bool DirectoryCrawler::matchGlob(string_view pattern, string_view text) {
+    size_t p = 0;
+    size_t t = 0;
+    size_t starPattern = string_view::npos;
+    size_t starText = 0;
+    while (t < text.size()) {
+        if (p < pattern.size() && pattern[p] == '*') {
+            starPattern = p++;
+            starText = t;
+        }
+        else if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == text[t])) {
+            p++;
+            t++;
+        }
+        else if (starPattern != string_view::npos) {
+            p = starPattern + 1;
+            t = ++starText;
+        }
+        else {
+            return false;
+        }
+    }
+    while (p < pattern.size() && pattern[p] == '*') {
+        p++;
+    }
+    return p == pattern.size();
+}
+
+// Runs of digits compare by value, then by length so that "07" and "7" are
+// still ordered; everything else compares byte by byte.
+bool DirectoryCrawler::naturalLess(const string& a, const string& b) {
+    size_t i = 0;
+    size_t j = 0;
+    while (i < a.size() && j < b.size()) {
+        bool digitA = isdigit(static_cast<unsigned char>(a[i])) != 0;
+        bool digitB = isdigit(static_cast<unsigned char>(b[j])) != 0;
+        if (!digitA || !digitB) {
+            if (a[i] != b[j]) {
+                return static_cast<unsigned char>(a[i]) < static_cast<unsigned char>(b[j]);
+            }
+            i++;
+            j++;
+            continue;
+        }
+
+        size_t runA = i;
+        size_t runB = j;
+        while (runA < a.size() && a[runA] == '0') {
+            runA++;
+        }
+        while (runB < b.size() && b[runB] == '0') {
+            runB++;
+        }
+        size_t endA = runA;
+        size_t endB = runB;
+        while (endA < a.size() && isdigit(static_cast<unsigned char>(a[endA]))) {
+            endA++;
+        }
+        while (endB < b.size() && isdigit(static_cast<unsigned char>(b[endB]))) {
+            endB++;
+        }
+        if (endA - runA != endB - runB) {
+            return endA - runA < endB - runB;
+        }
+        int order = a.compare(runA, endA - runA, b, runB, endB - runB);
+        if (order != 0) {
+            return order < 0;
+        }
+        if (endA - i != endB - j) {
+            return endA - i < endB - j;
+        }
+        i = endA;
+        j = endB;
+    }
+    return a.size() - i < b.size() - j;
+}
+
+static bool matchesAny(const vector<string>& patterns, const string& relativePath, const string& name) {
+    for (const string& pattern : patterns) {
+        bool onPath = pattern.find('/') != string::npos;
+        if (DirectoryCrawler::matchGlob(pattern, onPath ? relativePath : name)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool DirectoryCrawler::isExcluded(const string& relativePath, const string& name) const {
+    return matchesAny(excludePatterns, relativePath, name);
+}
+
+bool DirectoryCrawler::isIncluded(const string& relativePath, const string& name) const {
+    return includePatterns.empty() || matchesAny(includePatterns, relativePath, name);
+}
+
+void DirectoryCrawler::crawlDirectory(const string& path, const string& relativePath, vector<CrawledFile>& files) const {
+    error_code error;
+    vector<DirectoryEntry> entries;
+    fs::directory_iterator it(path, error);
+    for (; !error && it != fs::directory_iterator(); it.increment(error)) {
+        fs::file_status status = fs::symlink_status(it->path(), error);
+        if (!error && fs::is_symlink(status)) {
+            status = fs::status(it->path(), error);
+            if (fs::is_directory(status)) {
+                continue;
+            }
+        }
+        if (error) {
+            error.clear();  // a dangling link or an entry removed meanwhile
+            continue;
+        }
+        if (fs::is_directory(status) || fs::is_regular_file(status)) {
+            entries.push_back({ it->path().filename().string(), fs::is_directory(status) });
+        }
+    }
+    if (error) {
+        cerr << "Error reading directory: " << path << " (" << error.message() << ")\n";
+        return;
+    }
+
+    sort(entries.begin(), entries.end(), [](const DirectoryEntry& a, const DirectoryEntry& b) {
+        return naturalLess(a.name, b.name);
+    });
+
+    for (const DirectoryEntry& entry : entries) {
+        if (maxFiles != 0 && files.size() >= maxFiles) {
+            return;
+        }
+        string entryPath = joinPath(path, entry.name);
+        string entryRelativePath = relativePath.empty() ? entry.name : relativePath + "/" + entry.name;
+        if (isExcluded(entryRelativePath, entry.name)) {
+            continue;
+        }
+        if (entry.isDirectory) {
+            if (recursive) {
+                crawlDirectory(entryPath, entryRelativePath, files);
+            }
+        }
+        else if (isIncluded(entryRelativePath, entry.name)) {
+            uintmax_t size = fs::file_size(entryPath, error);
+            files.push_back({ entryPath, error ? 0 : static_cast<uint64_t>(size) });
+            error.clear();
+        }
+    }
+}
+
+vector<CrawledFile> DirectoryCrawler::crawl(const string& root) const {
+    vector<CrawledFile> files;
+    crawlDirectory(root, "", files);
+    return files;
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct CrawledFile {
+    std::string path;
+    uint64_t size;
+};
+
+// Lists the files under a directory for indexing. Each directory's entries
+// are visited in natural order (runs of digits compare as numbers, so
+// review_2.txt comes before review_10.txt) and subdirectories are descended
+// into where they fall in that order, so a crawl always returns the same
+// files in the same order. Symbolic links to directories are not followed.
+//
+// Patterns are globs where * matches any run of characters and ? any one
+// character. A pattern with a / is matched against the path relative to the
+// root, with / separators, and any other pattern against the entry's name
+// alone. A file is listed if it matches an include pattern (or there are
+// none) and no exclude pattern; a directory matching an exclude pattern is
+// skipped with everything under it.
+class DirectoryCrawler {
+private:
+    bool isExcluded(const std::string& relativePath, const std::string& name) const;
+    bool isIncluded(const std::string& relativePath, const std::string& name) const;
+    void crawlDirectory(const std::string& path, const std::string& relativePath, std::vector<CrawledFile>& files) const;
+
+public:
+    std::vector<std::string> includePatterns;
+    std::vector<std::string> excludePatterns;
+    bool recursive = true;
+    // Stops after this many files; 0 lists them all.
+    size_t maxFiles = 0;
+
+    static bool matchGlob(std::string_view pattern, std::string_view text);
+    static bool naturalLess(const std::string& a, const std::string& b);
+
+    // Directories that cannot be read are reported on cerr and skipped.
+    std::vector<CrawledFile> crawl(const std::string& root) const;
+};
@@ -0,0 +1,435 @@
+#include "DocIdBitmap.h"
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SEARCH_ENGINE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+using namespace std;
+
+static int countBits(uint64_t word) {
+#ifdef _MSC_VER
+    return static_cast<int>(__popcnt64(word));
+#else
+    return __builtin_popcountll(word);
+#endif
+}
+
+static int lowestSetBit(uint64_t word) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, word);
+    return static_cast<int>(index);
+#else
+    return __builtin_ctzll(word);
+#endif
+}
+
+enum class WordOp { And, Or, AndNot };
+
+// out = a op b over the words of one bitmap container. Returns the number of
+// bits set in out.
+static uint32_t combineWords(WordOp op, const uint64_t* a, const uint64_t* b, uint64_t* out) {
+    const size_t count = DocIdBitmap::WordsPerBitmap;
+    size_t i = 0;
+#ifdef SEARCH_ENGINE_SSE2
+    for (; i + 2 <= count; i += 2) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        __m128i z;
+        if (op == WordOp::And) {
+            z = _mm_and_si128(x, y);
+        }
+        else if (op == WordOp::Or) {
+            z = _mm_or_si128(x, y);
+        }
+        else {
+            z = _mm_andnot_si128(y, x);
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), z);
+    }
+#endif
+    for (; i < count; ++i) {
+        if (op == WordOp::And) {
+            out[i] = a[i] & b[i];
+        }
+        else if (op == WordOp::Or) {
+            out[i] = a[i] | b[i];
+        }
+        else {
+            out[i] = a[i] & ~b[i];
+        }
+    }
+
+    uint32_t cardinality = 0;
+    for (i = 0; i < count; ++i) {
+        cardinality += countBits(out[i]);
+    }
+    return cardinality;
+}
+
+bool DocIdBitmap::Container::isBitmap() const {
+    return !words.empty();
+}
+
+bool DocIdBitmap::Container::contains(uint16_t low) const {
+    if (isBitmap()) {
+        return (words[low >> 6] >> (low & 63)) & 1;
+    }
+    return binary_search(values.begin(), values.end(), low);
+}
+
+void DocIdBitmap::Container::toBitmap() {
+    words.assign(WordsPerBitmap, 0);
+    for (uint16_t low : values) {
+        words[low >> 6] |= uint64_t(1) << (low & 63);
+    }
+    values.clear();
+    values.shrink_to_fit();
+}
+
+// Turns a bitmap container that has become sparse back into an array.
+void DocIdBitmap::Container::shrink() {
+    if (!isBitmap() || cardinality > ArrayLimit) {
+        return;
+    }
+    values.reserve(cardinality);
+    for (size_t w = 0; w < WordsPerBitmap; ++w) {
+        for (uint64_t word = words[w]; word != 0; word &= word - 1) {
+            values.push_back(static_cast<uint16_t>((w << 6) + lowestSetBit(word)));
+        }
+    }
+    words.clear();
+    words.shrink_to_fit();
+}
+
+DocIdBitmap DocIdBitmap::fromSorted(DocIdSpan docIds) {
+    DocIdBitmap bitmap;
+    size_t i = 0;
+    while (i < docIds.size) {
+        uint32_t key = docIds.data[i] >> 16;
+        size_t end = i;
+        while (end < docIds.size && (docIds.data[end] >> 16) == key) {
+            ++end;
+        }
+
+        Container container;
+        container.key = static_cast<uint16_t>(key);
+        container.cardinality = static_cast<uint32_t>(end - i);
+        if (container.cardinality > ArrayLimit) {
+            container.words.assign(WordsPerBitmap, 0);
+            for (; i < end; ++i) {
+                uint16_t low = static_cast<uint16_t>(docIds.data[i]);
+                container.words[low >> 6] |= uint64_t(1) << (low & 63);
+            }
+        }
+        else {
+            container.values.reserve(container.cardinality);
+            for (; i < end; ++i) {
+                container.values.push_back(static_cast<uint16_t>(docIds.data[i]));
+            }
+        }
+        bitmap.containers.push_back(move(container));
+    }
+    return bitmap;
+}
+
+DocIdBitmap DocIdBitmap::range(uint32_t count) {
+    DocIdBitmap bitmap;
+    for (uint32_t first = 0; first < count; first += 65536) {
+        uint32_t size = min<uint32_t>(65536, count - first);
+        Container container;
+        container.key = static_cast<uint16_t>(first >> 16);
+        container.cardinality = size;
+        container.words.assign(WordsPerBitmap, 0);
+        for (uint32_t w = 0; w < size / 64; ++w) {
+            container.words[w] = ~uint64_t(0);
+        }
+        if (size % 64 != 0) {
+            container.words[size / 64] = (uint64_t(1) << (size % 64)) - 1;
+        }
+        container.shrink();
+        bitmap.containers.push_back(move(container));
+    }
+    return bitmap;
+}
+
+DocIdBitmap::Container DocIdBitmap::intersect(const Container& a, const Container& b) {
+    Container result;
+    result.key = a.key;
+    if (a.isBitmap() && b.isBitmap()) {
+        result.words.resize(WordsPerBitmap);
+        result.cardinality = combineWords(WordOp::And, a.words.data(), b.words.data(), result.words.data());
+        result.shrink();
+    }
+    else if (a.isBitmap() || b.isBitmap()) {
+        const Container& array = a.isBitmap() ? b : a;
+        const Container& bitmap = a.isBitmap() ? a : b;
+        for (uint16_t low : array.values) {
+            if (bitmap.contains(low)) {
+                result.values.push_back(low);
+            }
+        }
+        result.cardinality = static_cast<uint32_t>(result.values.size());
+    }
+    else {
+        set_intersection(a.values.begin(), a.values.end(), b.values.begin(), b.values.end(), back_inserter(result.values));
+        result.cardinality = static_cast<uint32_t>(result.values.size());
+    }
+    return result;
+}
+
+DocIdBitmap::Container DocIdBitmap::unite(const Container& a, const Container& b) {
+    Container result;
+    result.key = a.key;
+    if (a.isBitmap() && b.isBitmap()) {
+        result.words.resize(WordsPerBitmap);
+        result.cardinality = combineWords(WordOp::Or, a.words.data(), b.words.data(), result.words.data());
+    }
+    else if (a.isBitmap() || b.isBitmap()) {
+        const Container& array = a.isBitmap() ? b : a;
+        result.words = a.isBitmap() ? a.words : b.words;
+        result.cardinality = a.isBitmap() ? a.cardinality : b.cardinality;
+        for (uint16_t low : array.values) {
+            uint64_t bit = uint64_t(1) << (low & 63);
+            if ((result.words[low >> 6] & bit) == 0) {
+                result.words[low >> 6] |= bit;
+                ++result.cardinality;
+            }
+        }
+    }
+    else {
+        set_union(a.values.begin(), a.values.end(), b.values.begin(), b.values.end(), back_inserter(result.values));
+        result.cardinality = static_cast<uint32_t>(result.values.size());
+        if (result.cardinality > ArrayLimit) {
+            result.toBitmap();
+        }
+    }
+    return result;
+}
+
+DocIdBitmap::Container DocIdBitmap::difference(const Container& a, const Container& b) {
+    Container result;
+    result.key = a.key;
+    if (!a.isBitmap()) {
+        for (uint16_t low : a.values) {
+            if (!b.contains(low)) {
+                result.values.push_back(low);
+            }
+        }
+        result.cardinality = static_cast<uint32_t>(result.values.size());
+    }
+    else if (b.isBitmap()) {
+        result.words.resize(WordsPerBitmap);
+        result.cardinality = combineWords(WordOp::AndNot, a.words.data(), b.words.data(), result.words.data());
+        result.shrink();
+    }
+    else {
+        result.words = a.words;
+        result.cardinality = a.cardinality;
+        for (uint16_t low : b.values) {
+            uint64_t bit = uint64_t(1) << (low & 63);
+            if ((result.words[low >> 6] & bit) != 0) {
+                result.words[low >> 6] &= ~bit;
+                --result.cardinality;
+            }
+        }
+        result.shrink();
+    }
+    return result;
+}
+
+// Containers are matched by key like the ids of two sorted lists; chunks that
+// only one side has need no work at all.
+DocIdBitmap DocIdBitmap::intersect(const DocIdBitmap& a, const DocIdBitmap& b) {
+    DocIdBitmap result;
+    size_t i = 0;
+    size_t j = 0;
+    while (i < a.containers.size() && j < b.containers.size()) {
+        if (a.containers[i].key < b.containers[j].key) {
+            ++i;
+        }
+        else if (b.containers[j].key < a.containers[i].key) {
+            ++j;
+        }
+        else {
+            Container container = intersect(a.containers[i], b.containers[j]);
+            if (container.cardinality > 0) {
+                result.containers.push_back(move(container));
+            }
+            ++i;
+            ++j;
+        }
+    }
+    return result;
+}
+
+DocIdBitmap DocIdBitmap::unite(const DocIdBitmap& a, const DocIdBitmap& b) {
+    DocIdBitmap result;
+    size_t i = 0;
+    size_t j = 0;
+    while (i < a.containers.size() || j < b.containers.size()) {
+        if (j == b.containers.size() || (i < a.containers.size() && a.containers[i].key < b.containers[j].key)) {
+            result.containers.push_back(a.containers[i++]);
+        }
+        else if (i == a.containers.size() || b.containers[j].key < a.containers[i].key) {
+            result.containers.push_back(b.containers[j++]);
+        }
+        else {
+            result.containers.push_back(unite(a.containers[i], b.containers[j]));
+            ++i;
+            ++j;
+        }
+    }
+    return result;
+}
+
+DocIdBitmap DocIdBitmap::difference(const DocIdBitmap& a, const DocIdBitmap& b) {
+    DocIdBitmap result;
+    size_t j = 0;
+    for (const Container& container : a.containers) {
+        while (j < b.containers.size() && b.containers[j].key < container.key) {
+            ++j;
+        }
+        if (j == b.containers.size() || b.containers[j].key != container.key) {
+            result.containers.push_back(container);
+            continue;
+        }
+        Container remaining = difference(container, b.containers[j]);
+        if (remaining.cardinality > 0) {
+            result.containers.push_back(move(remaining));
+        }
+    }
+    return result;
+}
+
+void DocIdBitmap::add(uint32_t docId) {
+    uint16_t key = static_cast<uint16_t>(docId >> 16);
+    uint16_t low = static_cast<uint16_t>(docId);
+    auto found = lower_bound(containers.begin(), containers.end(), key, [](const Container& container, uint16_t key) {
+        return container.key < key;
+        });
+    if (found == containers.end() || found->key != key) {
+        found = containers.insert(found, Container());
+        found->key = key;
+    }
+
+    Container& container = *found;
+    if (container.isBitmap()) {
+        uint64_t bit = uint64_t(1) << (low & 63);
+        if ((container.words[low >> 6] & bit) == 0) {
+            container.words[low >> 6] |= bit;
+            ++container.cardinality;
+        }
+        return;
+    }
+    auto position = lower_bound(container.values.begin(), container.values.end(), low);
+    if (position != container.values.end() && *position == low) {
+        return;
+    }
+    container.values.insert(position, low);
+    if (++container.cardinality > ArrayLimit) {
+        container.toBitmap();
+    }
+}
+
+DocIdBitmap DocIdBitmap::slice(uint32_t first, uint32_t count) const {
+    vector<uint32_t> docIds;
+    for (uint32_t docId : toVector()) {
+        if (docId >= first && docId - first < count) {
+            docIds.push_back(docId - first);
+        }
+    }
+    return fromSorted({ docIds.data(), docIds.size() });
+}
+
+bool DocIdBitmap::prefersBitmap(size_t count, size_t universe) {
+    return count >= ArrayLimit && count * (65536 / ArrayLimit) >= universe;
+}
+
+bool DocIdBitmap::empty() const {
+    return containers.empty();
+}
+
+size_t DocIdBitmap::cardinality() const {
+    size_t total = 0;
+    for (const Container& container : containers) {
+        total += container.cardinality;
+    }
+    return total;
+}
+
+bool DocIdBitmap::contains(uint32_t docId) const {
+    uint16_t key = static_cast<uint16_t>(docId >> 16);
+    auto found = lower_bound(containers.begin(), containers.end(), key, [](const Container& container, uint16_t key) {
+        return container.key < key;
+        });
+    return found != containers.end() && found->key == key && found->contains(static_cast<uint16_t>(docId));
+}
+
+vector<uint32_t> DocIdBitmap::toVector() const {
+    vector<uint32_t> docIds;
+    docIds.reserve(cardinality());
+    for (const Container& container : containers) {
+        uint32_t high = uint32_t(container.key) << 16;
+        if (container.isBitmap()) {
+            for (size_t w = 0; w < WordsPerBitmap; ++w) {
+                for (uint64_t word = container.words[w]; word != 0; word &= word - 1) {
+                    docIds.push_back(high | static_cast<uint32_t>((w << 6) + lowestSetBit(word)));
+                }
+            }
+        }
+        else {
+            for (uint16_t low : container.values) {
+                docIds.push_back(high | low);
+            }
+        }
+    }
+    return docIds;
+}
+
+size_t DocIdBitmap::memoryBytes() const {
+    size_t bytes = containers.capacity() * sizeof(Container);
+    for (const Container& container : containers) {
+        bytes += container.values.capacity() * sizeof(uint16_t) + container.words.capacity() * sizeof(uint64_t);
+    }
+    return bytes;
+}
+
+TermBitmapCache& TermBitmapCache::operator=(const TermBitmapCache&) {
+    clear();
+    return *this;
+}
+
+TermBitmapCache::Shard& TermBitmapCache::shardOf(const string& term) {
+    return shards[hash<string>()(term) % ShardCount];
+}
+
+// The bitmap is built outside the lock, so that building a large one does not
+// hold up lookups of other terms in the same shard.
+shared_ptr<const DocIdBitmap> TermBitmapCache::get(const string& term, DocIdSpan docIds) {
+    Shard& shard = shardOf(term);
+    {
+        lock_guard<mutex> lock(shard.mutex);
+        auto found = shard.bitmaps.find(term);
+        if (found != shard.bitmaps.end()) {
+            return found->second;
+        }
+    }
+
+    auto bitmap = make_shared<const DocIdBitmap>(DocIdBitmap::fromSorted(docIds));
+    lock_guard<mutex> lock(shard.mutex);
+    return shard.bitmaps.emplace(term, bitmap).first->second;
+}
+
+void TermBitmapCache::clear() {
+    for (Shard& shard : shards) {
+        lock_guard<mutex> lock(shard.mutex);
+        shard.bitmaps.clear();
+    }
+}
@@ -0,0 +1,95 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "PostingIntersection.h"
+
+// Compressed set of document ids in the style of Roaring bitmaps. Ids are
+// split by their high 16 bits into chunks of 65536, and every non-empty chunk
+// is one container: a sorted array of the low 16 bits while it holds at most
+// ArrayLimit ids, and a plain 65536-bit bitmap beyond that, where the array
+// would be the larger of the two. AND, OR and ANDNOT of two bitmap
+// containers run over whole 64-bit words (two at a time with SSE2), so dense
+// sets are combined without looking at single ids.
+class DocIdBitmap {
+public:
+    static constexpr size_t ArrayLimit = 4096;
+    static constexpr size_t WordsPerBitmap = 65536 / 64;
+
+    static DocIdBitmap fromSorted(DocIdSpan docIds);
+    // Every id in [0, count).
+    static DocIdBitmap range(uint32_t count);
+
+    static DocIdBitmap intersect(const DocIdBitmap& a, const DocIdBitmap& b);
+    static DocIdBitmap unite(const DocIdBitmap& a, const DocIdBitmap& b);
+    static DocIdBitmap difference(const DocIdBitmap& a, const DocIdBitmap& b);
+
+    // Whether a set of count ids out of universe is better kept as a bitmap
+    // than as a sorted list: large enough to fill array containers, and dense
+    // enough that most of its chunks would be bitmap containers.
+    static bool prefersBitmap(size_t count, size_t universe);
+
+    void add(uint32_t docId);
+    // The ids in [first, first + count), less first.
+    DocIdBitmap slice(uint32_t first, uint32_t count) const;
+
+    bool empty() const;
+    size_t cardinality() const;
+    bool contains(uint32_t docId) const;
+    std::vector<uint32_t> toVector() const;
+    size_t memoryBytes() const;
+
+private:
+    struct Container {
+        uint16_t key = 0;
+        uint32_t cardinality = 0;
+        // Exactly one of these is used: values for an array container,
+        // words (WordsPerBitmap of them) for a bitmap container.
+        std::vector<uint16_t> values;
+        std::vector<uint64_t> words;
+
+        bool isBitmap() const;
+        bool contains(uint16_t low) const;
+        void toBitmap();
+        void shrink();
+    };
+
+    std::vector<Container> containers;
+
+    static Container intersect(const Container& a, const Container& b);
+    static Container unite(const Container& a, const Container& b);
+    static Container difference(const Container& a, const Container& b);
+};
+
+// Bitmaps of the frequent terms of one index, built the first time a query
+// needs them and kept for as long as the index. The index must not change
+// once a term's bitmap is cached; a copy of the cache starts out empty, so a
+// copy of an index can be extended as before. Entries are spread over shards
+// like those of TermLookupCache. Two threads may build the same bitmap at
+// once; the first one stored is kept.
+class TermBitmapCache {
+private:
+    static constexpr size_t ShardCount = 16;
+
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<std::string, std::shared_ptr<const DocIdBitmap>> bitmaps;
+    };
+
+    Shard shards[ShardCount];
+
+    Shard& shardOf(const std::string& term);
+
+public:
+    TermBitmapCache() = default;
+    TermBitmapCache(const TermBitmapCache&) {}
+    TermBitmapCache& operator=(const TermBitmapCache&);
+
+    // The bitmap of term, whose sorted document ids are docIds.
+    std::shared_ptr<const DocIdBitmap> get(const std::string& term, DocIdSpan docIds);
+    void clear();
+};
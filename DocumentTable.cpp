@@ -0,0 +1,214 @@
+#include "DocumentTable.h"
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+
+using namespace std;
+
+// A copy that is not the last one made from its table cannot add to the
+// shared path -> id map, whose ids past its own would then be wrong for it,
+// so it first builds a map of its own.
+uint32_t DocumentTable::addDocument(const string& path) {
+    uint32_t existing = path.empty() ? InvalidId : findDocument(path);
+    if (existing != InvalidId) {
+        return existing;
+    }
+
+    uint32_t docId = static_cast<uint32_t>(size());
+    if (ids->previous.size() != docId) {
+        shared_ptr<PathIds> own = make_shared<PathIds>();
+        for (uint32_t id = 0; id < docId; ++id) {
+            string_view stored = storedPath(id);
+            uint32_t previous = InvalidId;
+            if (!stored.empty()) {
+                auto inserted = own->latest.emplace(string(stored), id);
+                if (!inserted.second) {
+                    previous = inserted.first->second;
+                    inserted.first->second = id;
+                }
+            }
+            own->previous.push_back(previous);
+        }
+        ids = move(own);
+    }
+
+    pathBytes.append(path.data(), path.size());
+    pathEnds.push_back(pathBytes.size());
+    lengths.push_back(0);
+    lock_guard<mutex> lock(ids->mutex);
+    if (path.empty()) {
+        markDeleted(docId);
+        ids->previous.push_back(InvalidId);
+    }
+    else {
+        auto inserted = ids->latest.emplace(path, docId);
+        ids->previous.push_back(inserted.second ? InvalidId : inserted.first->second);
+        inserted.first->second = docId;
+    }
+    return docId;
+}
+
+// The path stays in pathBytes, where findDocument still follows it to older
+// ids of the same path.
+bool DocumentTable::removeDocument(uint32_t docId) {
+    if (docId >= size() || isDeleted(docId)) {
+        return false;
+    }
+    markDeleted(docId);
+    return true;
+}
+
+// Copies of the table share the deleted set, so it is copied when another
+// table still holds it: once after every published copy rather than once per
+// removed document. Only copies of this table can share it, and they are
+// made on the writer's thread, so a count of one cannot go up while the set
+// is changed; the fence orders the change after the last reads of copies
+// that have since let go of it.
+void DocumentTable::markDeleted(uint32_t docId) {
+    if (deleted.use_count() != 1) {
+        deleted = make_shared<DocIdBitmap>(*deleted);
+    }
+    else {
+        atomic_thread_fence(memory_order_acquire);
+    }
+    deleted->add(docId);
+    deletedCount++;
+}
+
+bool DocumentTable::isDeleted(uint32_t docId) const {
+    return deleted->contains(docId);
+}
+
+const DocIdBitmap& DocumentTable::deletedDocuments() const {
+    return *deleted;
+}
+
+size_t DocumentTable::deletedDocumentCount() const {
+    return deletedCount;
+}
+
+// Follows the ids the path has had, newest first, to the last one this copy
+// holds.
+uint32_t DocumentTable::findDocument(const string& path) const {
+    uint32_t docId;
+    {
+        lock_guard<mutex> lock(ids->mutex);
+        auto it = ids->latest.find(path);
+        if (it == ids->latest.end()) {
+            return InvalidId;
+        }
+        docId = it->second;
+        while (docId != InvalidId && docId >= size()) {
+            docId = ids->previous[docId];
+        }
+    }
+    return (docId != InvalidId && !isDeleted(docId)) ? docId : InvalidId;
+}
+
+bool DocumentTable::contains(const string& path) const {
+    return findDocument(path) != InvalidId;
+}
+
+string_view DocumentTable::storedPath(uint32_t docId) const {
+    uint64_t start = docId == 0 ? 0 : pathEnds[docId - 1];
+    return string_view(pathBytes.data() + start, pathEnds[docId] - start);
+}
+
+string DocumentTable::getPath(uint32_t docId) const {
+    return isDeleted(docId) ? string() : string(storedPath(docId));
+}
+
+void DocumentTable::setLength(uint32_t docId, uint32_t length) {
+    lengthSum += static_cast<uint64_t>(length) - lengths[docId];
+    lengths.set(docId, length);
+    shortestLength = min(shortestLength, length);
+}
+
+uint32_t DocumentTable::getLength(uint32_t docId) const {
+    return lengths[docId];
+}
+
+const uint32_t* DocumentTable::lengthData() const {
+    return lengths.data();
+}
+
+uint64_t DocumentTable::totalLength() const {
+    return lengthSum;
+}
+
+// Shortest length ever set. It only serves as a bound for ranking, so it is
+// not raised again when a length is replaced.
+uint32_t DocumentTable::minLength() const {
+    return lengths.empty() ? 0 : shortestLength;
+}
+
+size_t DocumentTable::size() const {
+    return pathEnds.size();
+}
+
+// Copies keep the map they share; this table starts a new one.
+void DocumentTable::clear() {
+    pathBytes.clear();
+    pathEnds.clear();
+    lengths.clear();
+    ids = make_shared<PathIds>();
+    lengthSum = 0;
+    shortestLength = UINT32_MAX;
+    deleted = make_shared<DocIdBitmap>();
+    deletedCount = 0;
+}
+
+bool DocumentTable::save(ofstream& outFile) const {
+    size_t count = size();
+    outFile.write(reinterpret_cast<const char*>(&count), sizeof(count));
+
+    for (uint32_t docId = 0; docId < count; ++docId) {
+        string_view path = isDeleted(docId) ? string_view() : storedPath(docId);
+        size_t pathLength = path.size();
+        outFile.write(reinterpret_cast<const char*>(&pathLength), sizeof(pathLength));
+        outFile.write(path.data(), pathLength);
+    }
+    outFile.write(reinterpret_cast<const char*>(lengths.data()), lengths.size() * sizeof(uint32_t));
+
+    if (!outFile) {
+        cerr << "Error: Failed to write document table." << endl;
+        return false;
+    }
+    return true;
+}
+
+bool DocumentTable::load(ifstream& inFile) {
+    clear();
+
+    size_t count;
+    inFile.read(reinterpret_cast<char*>(&count), sizeof(count));
+    if (!inFile) {
+        cerr << "Error: Failed to read document count." << endl;
+        return false;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        size_t pathLength;
+        inFile.read(reinterpret_cast<char*>(&pathLength), sizeof(pathLength));
+        string path(pathLength, '\0');
+        inFile.read(&path[0], pathLength);
+        if (!inFile) {
+            cerr << "Error: Failed to read document path." << endl;
+            clear();
+            return false;
+        }
+        addDocument(path);
+    }
+
+    vector<uint32_t> loadedLengths(count);
+    inFile.read(reinterpret_cast<char*>(loadedLengths.data()), loadedLengths.size() * sizeof(uint32_t));
+    if (!inFile) {
+        cerr << "Error: Failed to read document lengths." << endl;
+        clear();
+        return false;
+    }
+    for (uint32_t docId = 0; docId < size(); ++docId) {
+        setLength(docId, loadedLengths[docId]);
+    }
+    return true;
+}
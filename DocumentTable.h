@@ -0,0 +1,73 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include "DocIdBitmap.h"
+#include "SharedVector.h"
+
+// Assigns every indexed file a dense document id. Postings store only the
+// id; the path is looked up here when results are displayed. The table also
+// keeps each document's length in tokens for ranking.
+//
+// A removed document keeps its id, so postings that still mention it stay
+// valid, but loses its path: it is marked in deleted, and the file can be
+// indexed again under a new id. Ids are never reused. Dumps and mapped
+// indexes store a removed document as an empty path, and adding an empty
+// path adds a removed document. Lengths of removed documents still count
+// towards the totals used for ranking, as their postings do until they are
+// purged.
+//
+// The engine publishes a copy of the table with every change, so copies
+// share everything: paths and lengths are SharedVectors, the deleted set is
+// copied before the first change after the table was copied, and the path ->
+// id map is shared by every copy and keeps the ids a path has had, from
+// which each copy picks the last one it holds.
+class DocumentTable {
+private:
+    struct PathIds {
+        std::mutex mutex;
+        std::unordered_map<std::string, uint32_t> latest;
+        // For each document, the document the same path had before, or
+        // InvalidId.
+        std::vector<uint32_t> previous;
+    };
+
+    SharedVector<char> pathBytes;
+    SharedVector<uint64_t> pathEnds;
+    SharedVector<uint32_t> lengths;
+    std::shared_ptr<PathIds> ids = std::make_shared<PathIds>();
+    uint64_t lengthSum = 0;
+    uint32_t shortestLength = UINT32_MAX;
+    std::shared_ptr<DocIdBitmap> deleted = std::make_shared<DocIdBitmap>();
+    size_t deletedCount = 0;
+
+    std::string_view storedPath(uint32_t docId) const;
+    void markDeleted(uint32_t docId);
+
+public:
+    static constexpr uint32_t InvalidId = UINT32_MAX;
+
+    uint32_t addDocument(const std::string& path);
+    bool removeDocument(uint32_t docId);
+    bool isDeleted(uint32_t docId) const;
+    const DocIdBitmap& deletedDocuments() const;
+    size_t deletedDocumentCount() const;
+    uint32_t findDocument(const std::string& path) const;
+    bool contains(const std::string& path) const;
+    // Empty for a removed document.
+    std::string getPath(uint32_t docId) const;
+    void setLength(uint32_t docId, uint32_t length);
+    uint32_t getLength(uint32_t docId) const;
+    const uint32_t* lengthData() const;
+    uint64_t totalLength() const;
+    uint32_t minLength() const;
+    size_t size() const;
+    void clear();
+    bool save(std::ofstream& outFile) const;
+    bool load(std::ifstream& inFile);
+};
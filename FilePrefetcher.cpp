@@ -0,0 +1,94 @@
+#include "FilePrefetcher.h"
+#include "Metrics.h"
+#include <algorithm>
+#include <fstream>
+
+using namespace std;
+
+// Reads the whole file in one go; the size comes from the open file rather
+// than the crawl, in case the file changed in between.
+static bool readFile(const string& path, vector<char>& contents) {
+    ifstream file(path, ios::binary | ios::ate);
+    if (!file.is_open()) {
+        return false;
+    }
+    streamoff size = file.tellg();
+    if (size < 0) {
+        return false;
+    }
+    contents.resize(static_cast<size_t>(size));
+    file.seekg(0);
+    file.read(contents.data(), size);
+    contents.resize(static_cast<size_t>(file.gcount()));
+    return !file.bad();
+}
+
+FilePrefetcher::FilePrefetcher(const vector<CrawledFile>& files, size_t readerCount, size_t byteBudget)
+    : files(files), sizeBefore(files.size() + 1, 0), byteBudget(byteBudget), slots(files.size()) {
+    for (size_t i = 0; i < files.size(); ++i) {
+        sizeBefore[i + 1] = sizeBefore[i] + files[i].size;
+    }
+    readerCount = max<size_t>(1, min(readerCount, files.size()));
+    for (size_t i = 0; i < readerCount && !files.empty(); ++i) {
+        readers.emplace_back(&FilePrefetcher::readLoop, this);
+    }
+}
+
+FilePrefetcher::~FilePrefetcher() {
+    {
+        lock_guard<mutex> lock(stateMutex);
+        stopping = true;
+    }
+    windowMoved.notify_all();
+    for (thread& reader : readers) {
+        reader.join();
+    }
+}
+
+bool FilePrefetcher::inWindow(size_t index) const {
+    return index == firstUntaken || sizeBefore[index + 1] - sizeBefore[firstUntaken] <= byteBudget;
+}
+
+void FilePrefetcher::readLoop() {
+    unique_lock<mutex> lock(stateMutex);
+    while (true) {
+        windowMoved.wait(lock, [this] { return stopping || nextToRead == files.size() || inWindow(nextToRead); });
+        if (stopping || nextToRead == files.size()) {
+            return;
+        }
+        size_t index = nextToRead++;
+        lock.unlock();
+
+        vector<char> contents;
+        bool ok;
+        {
+            ScopedTimer timer(Phase::Read);
+            ok = readFile(files[index].path, contents);
+        }
+
+        lock.lock();
+        slots[index].contents = move(contents);
+        slots[index].state = ok ? SlotState::Ready : SlotState::Failed;
+        readDone.notify_all();
+    }
+}
+
+bool FilePrefetcher::take(size_t index, vector<char>& contents) {
+    unique_lock<mutex> lock(stateMutex);
+    readDone.wait(lock, [&] { return slots[index].state != SlotState::Pending; });
+    bool ok = slots[index].state == SlotState::Ready;
+    contents = move(slots[index].contents);
+    slots[index].contents = vector<char>();
+    slots[index].state = SlotState::Taken;
+
+    bool windowChanged = false;
+    while (firstUntaken < slots.size() && slots[firstUntaken].state == SlotState::Taken) {
+        firstUntaken++;
+        windowChanged = true;
+    }
+    lock.unlock();
+    if (windowChanged) {
+        windowMoved.notify_all();
+    }
+    return ok;
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "DirectoryCrawler.h"
+
+// Reads a list of files ahead of the threads that index them. Reader threads
+// take the files in list order and read each one whole into memory, so the
+// open and read latency of one file overlaps with the reads of the next ones
+// and with tokenizing those already read; on storage where every open is a
+// round trip, far more reads are in flight than there are indexing threads.
+//
+// Reading ahead is bounded by bytes: a file is only read while the files from
+// the first one not yet taken up to it total at most the budget, going by the
+// sizes the crawl found. The first file not yet taken can always be read, so
+// consumers that take files in list order (each thread its own run of files,
+// runs handed out in order) never wait on a read that cannot start.
+class FilePrefetcher {
+private:
+    enum class SlotState { Pending, Ready, Failed, Taken };
+
+    struct Slot {
+        std::vector<char> contents;
+        SlotState state = SlotState::Pending;
+    };
+
+    const std::vector<CrawledFile>& files;
+    std::vector<uint64_t> sizeBefore;  // sizes of files [0, i)
+    size_t byteBudget;
+    std::vector<Slot> slots;
+    size_t nextToRead = 0;
+    size_t firstUntaken = 0;
+    bool stopping = false;
+
+    std::mutex stateMutex;
+    std::condition_variable readDone;
+    std::condition_variable windowMoved;
+    std::vector<std::thread> readers;
+
+    bool inWindow(size_t index) const;
+    void readLoop();
+
+public:
+    static constexpr size_t DefaultReaderCount = 8;
+    static constexpr size_t DefaultByteBudget = 64 * 1024 * 1024;
+
+    // files must outlive the prefetcher. Reading starts right away.
+    explicit FilePrefetcher(const std::vector<CrawledFile>& files, size_t readerCount = DefaultReaderCount,
+        size_t byteBudget = DefaultByteBudget);
+    ~FilePrefetcher();
+    FilePrefetcher(const FilePrefetcher&) = delete;
+    FilePrefetcher& operator=(const FilePrefetcher&) = delete;
+
+    // Waits until file index has been read and moves its contents out. Each
+    // file is taken once. Returns false if the file could not be read.
+    bool take(size_t index, std::vector<char>& contents);
+};
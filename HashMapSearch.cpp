@@ -1,114 +1,104 @@
 #include "HashMapSearch.h"
+#include "Metrics.h"
 #include <iostream>
 #include <fstream>
-#include <unordered_set>
-#include <unordered_map>
 #include <algorithm>
 
-void HashMapSearch::insertWord(const std::string& word, const std::string& docName, int position) {
-    auto& wordList = hashMap[word];  
-
-    for (WordInDocument* wid : wordList) {
-        if (wid->getDocName() == docName) {
-            wid->addPosition(position); 
-            return;
-        }
-    }
-
-    wordList.push_back(new WordInDocument(docName, std::vector<int>{ position }));
+// Appends the postings of a document that is not yet in the index, as produced
+// by a PartialIndex. No scan for an existing entry is needed.
+void HashMapSearch::addPostings(const std::string& word, uint32_t docId, const std::vector<int>& positions) {
+    dictionary.insert(word).add(postingArena->create<WordInDocument>(docId, positions, *postingArena));
+    Metrics::add(Counter::PostingsCreated);
 }
 
-
-
-std::vector<WordInDocument*> HashMapSearch::searchWord(const std::string& word) const {
-    auto it = hashMap.find(word);
-    return (it != hashMap.end()) ? it->second : std::vector<WordInDocument*>{};
+const PostingList* HashMapSearch::findPostings(std::string_view word) const {
+    const PostingList* postings = dictionary.find(word);
+    Metrics::add(postings != nullptr ? Counter::LookupHits : Counter::LookupMisses);
+    return postings;
 }
 
-std::vector<WordInDocument*> HashMapSearch::searchTwoWords(const std::string& word1, const std::string& word2) const {
-    auto resultsWord1 = searchWord(word1);
-    auto resultsWord2 = searchWord(word2);
-    std::vector<WordInDocument*> result;
-    std::unordered_map<std::string, WordInDocument*> docsMap;
-
-    for (const auto& wid : resultsWord1) {
-        docsMap[wid->getDocName()] = wid;
+// The hash map has no order to prune with, so every term is tested against the
+// pattern. Only the maxTerms most frequent matches (0 means all) are kept.
+std::vector<std::pair<std::string, const PostingList*>> HashMapSearch::matchTerms(const WildcardPattern& pattern, size_t maxTerms) const {
+    std::vector<std::pair<std::string, const PostingList*>> terms;
+    if (!pattern.valid()) {
+        return terms;
     }
 
-    for (const auto& wid : resultsWord2) {
-        if (docsMap.find(wid->getDocName()) != docsMap.end()) {
-            result.push_back(docsMap[wid->getDocName()]);
+    std::string prefix = pattern.literalPrefix();
+    for (size_t i = 0; i < dictionary.size(); ++i) {
+        std::string_view term = dictionary.termAt(i);
+        const PostingList& postings = dictionary.postingsAt(i);
+        if (term.compare(0, prefix.size(), prefix) == 0 && !postings.empty() && pattern.matches(term)) {
+            terms.emplace_back(std::string(term), &postings);
         }
     }
 
-    return result;
-}
-
-std::vector<WordInDocument*> HashMapSearch::searchMultipleWords(const std::vector<std::string>& words) const {
-    if (words.empty()) {
-        return {};
-    }
-
-    std::unordered_map<std::string, int> docCount;
-
-    for (const auto& word : words) {
-        auto results = searchWord(word);
-
-        for (const auto& wid : results) {
-            docCount[wid->getDocName()]++;
+    auto moreFrequent = [](const std::pair<std::string, const PostingList*>& a, const std::pair<std::string, const PostingList*>& b) {
+        if (a.second->size() != b.second->size()) {
+            return a.second->size() > b.second->size();
         }
+        return a.first < b.first;
+    };
+    if (maxTerms != 0 && terms.size() > maxTerms) {
+        std::partial_sort(terms.begin(), terms.begin() + maxTerms, terms.end(), moreFrequent);
+        terms.resize(maxTerms);
     }
-
-    std::vector<WordInDocument*> result;
-    for (const auto& entry : docCount) {
-        if (entry.second == words.size()) {
-            for (const auto& word : words) {
-                auto results = searchWord(word);
-                for (const auto& wid : results) {
-                    if (wid->getDocName() == entry.first) {
-                        result.push_back(wid);
-                        break;
-                    }
-                }
-            }
-        }
+    else {
+        std::sort(terms.begin(), terms.end(), moreFrequent);
     }
-
-    return result;
+    return terms;
 }
 
-std::vector<WordInDocument*> HashMapSearch::searchExclusion(const std::string& word1, const std::string& word2) const {
-    auto docsWithWord1 = searchWord(word1);
-    auto docsWithWord2 = searchWord(word2);
-
-    std::unordered_set<std::string> excludeDocs;
-    for (const auto& doc : docsWithWord2) {
-        excludeDocs.insert(doc->getDocName());
+// As with wildcards, every term is tested. Terms whose length differs from the
+// word's by more than the distance are skipped without running the automaton,
+// and the automaton stops at the first character that puts a term out of
+// reach. The trie backend only visits terms close to the word.
+std::vector<std::pair<std::string, const PostingList*>> HashMapSearch::matchFuzzy(const LevenshteinAutomaton& automaton) const {
+    std::vector<std::pair<std::string, const PostingList*>> terms;
+    if (!automaton.valid()) {
+        return terms;
+    }
+
+    size_t length = automaton.text().size();
+    size_t limit = automaton.distanceLimit();
+    for (size_t i = 0; i < dictionary.size(); ++i) {
+        std::string_view term = dictionary.termAt(i);
+        const PostingList& postings = dictionary.postingsAt(i);
+        if (term.size() + limit < length || term.size() > length + limit || postings.empty()) {
+            continue;
+        }
+        if (automaton.distanceTo(term) <= limit) {
+            terms.emplace_back(std::string(term), &postings);
+        }
     }
+    return terms;
+}
 
-    std::vector<WordInDocument*> result;
-    for (const auto& doc : docsWithWord1) {
-        if (excludeDocs.find(doc->getDocName()) == excludeDocs.end()) {
-            result.push_back(doc);
-        }
+void HashMapSearch::collectTerms(std::vector<std::pair<std::string, const PostingList*>>& terms) const {
+    terms.reserve(terms.size() + dictionary.size());
+    for (size_t i = 0; i < dictionary.size(); ++i) {
+        terms.emplace_back(std::string(dictionary.termAt(i)), &dictionary.postingsAt(i));
     }
-    return result;
 }
 
+// The postings are not visited one by one; the arena frees them all once no
+// copy of the index uses it any more.
 void HashMapSearch::clear() {
-    for (auto& pair : hashMap) {
-        for (WordInDocument* wid : pair.second) {
-            delete wid;
-        }
-    }
-    hashMap.clear();
+    dictionary.clear();
+    bitmaps.clear();
+    postingArena = std::make_shared<Arena>();
 }
 
-void HashMapSearch::display() const {
-    for (const auto& pair : hashMap) {
-        std::cout << "Word: " << pair.first << std::endl;
-        for (const WordInDocument* wid : pair.second) {
-            std::cout << "  Document: " << wid->getDocName() << ", Positions: ";
+TermBitmapCache& HashMapSearch::bitmapCache() const {
+    return bitmaps;
+}
+
+void HashMapSearch::display(const DocumentTable& documents) const {
+    for (size_t i = 0; i < dictionary.size(); ++i) {
+        std::cout << "Word: " << dictionary.termAt(i) << std::endl;
+        for (const WordInDocument* wid : dictionary.postingsAt(i)) {
+            std::cout << "  Document: " << documents.getPath(wid->getDocId()) << ", Positions: ";
             for (int pos : wid->getPositions()) {
                 std::cout << pos << " ";
             }
@@ -123,7 +113,7 @@ void HashMapSearch::save(std::ofstream& outFile) const {
         return;
     }
 
-    size_t mapSize = hashMap.size();
+    size_t mapSize = dictionary.size();
     outFile.write(reinterpret_cast<const char*>(&mapSize), sizeof(mapSize));
 
     if (!outFile) {
@@ -131,8 +121,10 @@ void HashMapSearch::save(std::ofstream& outFile) const {
         return;
     }
 
-    for (const auto& pair : hashMap) {
-        size_t wordLength = pair.first.size();
+    for (size_t i = 0; i < dictionary.size(); ++i) {
+        std::string_view word = dictionary.termAt(i);
+        const PostingList& postings = dictionary.postingsAt(i);
+        size_t wordLength = word.size();
         outFile.write(reinterpret_cast<const char*>(&wordLength), sizeof(wordLength));
 
         if (!outFile) {
@@ -140,14 +132,14 @@ void HashMapSearch::save(std::ofstream& outFile) const {
             return;
         }
 
-        outFile.write(pair.first.c_str(), wordLength);
+        outFile.write(word.data(), wordLength);
 
         if (!outFile) {
             std::cerr << "Error: Failed to write word." << std::endl;
             return;
         }
 
-        size_t listSize = pair.second.size();
+        size_t listSize = postings.size();
         outFile.write(reinterpret_cast<const char*>(&listSize), sizeof(listSize));
 
         if (!outFile) {
@@ -155,7 +147,7 @@ void HashMapSearch::save(std::ofstream& outFile) const {
             return;
         }
 
-        for (const WordInDocument* wid : pair.second) {
+        for (const WordInDocument* wid : postings) {
             wid->serialize(outFile);
 
             if (!outFile) {
@@ -169,61 +161,74 @@ void HashMapSearch::save(std::ofstream& outFile) const {
 }
 
 
-void HashMapSearch::load(std::ifstream& inFile) {
+bool HashMapSearch::load(std::ifstream& inFile, size_t documentCount) {
     if (!inFile.is_open()) {
         std::cerr << "Error: Input file stream is not open." << std::endl;
-        return;
+        return false;
     }
 
     clear();
 
+    // Lengths read from the file are checked against the bytes left in it, so
+    // a corrupt length fails the load instead of allocating that much.
+    std::streampos start = inFile.tellg();
+    inFile.seekg(0, std::ios::end);
+    uint64_t remaining = static_cast<uint64_t>(inFile.tellg() - start);
+    inFile.seekg(start);
+
     size_t mapSize;
     inFile.read(reinterpret_cast<char*>(&mapSize), sizeof(mapSize));
     if (!inFile) {
         std::cerr << "Error: Failed to read map size." << std::endl;
-        return;
+        return false;
     }
+    remaining -= sizeof(mapSize);
 
     for (size_t i = 0; i < mapSize; ++i) {
         size_t wordLength;
         inFile.read(reinterpret_cast<char*>(&wordLength), sizeof(wordLength));
-        if (!inFile) {
+        if (!inFile || wordLength > remaining - sizeof(wordLength)) {
             std::cerr << "Error: Failed to read word length." << std::endl;
-            return;
+            clear();
+            return false;
         }
+        remaining -= sizeof(wordLength) + wordLength;
 
         std::string word(wordLength, '\0');
         inFile.read(&word[0], wordLength);
         if (!inFile) {
             std::cerr << "Error: Failed to read word data." << std::endl;
-            return;
+            clear();
+            return false;
         }
 
         size_t listSize;
         inFile.read(reinterpret_cast<char*>(&listSize), sizeof(listSize));
         if (!inFile) {
             std::cerr << "Error: Failed to read list size." << std::endl;
-            return;
+            clear();
+            return false;
         }
+        remaining -= sizeof(listSize);
 
-        std::vector<WordInDocument*> wordList;
+        PostingList& wordList = dictionary.insert(word);
         for (size_t j = 0; j < listSize; ++j) {
-            WordInDocument* wid = WordInDocument::deserialize(inFile);
-            if (wid) {
-                wordList.push_back(wid);
-            }
-            else {
+            WordInDocument* wid = WordInDocument::deserialize(inFile, remaining, *postingArena);
+            if (wid == nullptr) {
                 std::cerr << "Error: Failed to deserialize WordInDocument." << std::endl;
+                clear();
+                return false;
             }
+            if (wid->getDocId() >= documentCount) {
+                std::cerr << "Error: A posting of \"" << word << "\" refers to a document that is not in the dump." << std::endl;
+                clear();
+                return false;
+            }
+            wordList.add(wid);
         }
 
-        hashMap[word] = wordList;
     }
 
     std::cout << "HashMap successfully loaded." << std::endl;
-}
-
-
-HashMapSearch::~HashMapSearch() {
-    clear();
+    return true;
 }
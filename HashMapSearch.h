@@ -1,23 +1,40 @@
 #pragma once
-#include <unordered_map>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <fstream>
+#include <memory>
 #include "WordInDocument.h"
+#include "PostingList.h"
+#include "WildcardPattern.h"
+#include "LevenshteinAutomaton.h"
+#include "Arena.h"
+#include "TermDictionary.h"
+#include "DocIdBitmap.h"
 
 class HashMapSearch {
 private:
-    std::unordered_map<std::string, std::vector<WordInDocument*>> hashMap;
+    // Shares its blocks with copies of the index; see TermDictionary.
+    TermDictionary dictionary;
+    // Owns every WordInDocument in dictionary. A copy of the index shares the
+    // arena with the original and adds its own postings to it, so copying
+    // does not copy position data. Postings shared that way must not change
+    // any more; a copy is only extended with addPostings.
+    std::shared_ptr<Arena> postingArena = std::make_shared<Arena>();
+    mutable TermBitmapCache bitmaps;
 
 public:
-    void insertWord(const std::string& word, const std::string& docName, int position);
-    std::vector<WordInDocument*> searchWord(const std::string& word) const;
-    std::vector<WordInDocument*> searchTwoWords(const std::string& word1, const std::string& word2) const;
-    std::vector<WordInDocument*> searchMultipleWords(const std::vector<std::string>& words) const;
-    std::vector<WordInDocument*> searchExclusion(const std::string& word1, const std::string& word2) const;
+    void addPostings(const std::string& word, uint32_t docId, const std::vector<int>& positions);
+    const PostingList* findPostings(std::string_view word) const;
+    std::vector<std::pair<std::string, const PostingList*>> matchTerms(const WildcardPattern& pattern, size_t maxTerms) const;
+    std::vector<std::pair<std::string, const PostingList*>> matchFuzzy(const LevenshteinAutomaton& automaton) const;
+    TermBitmapCache& bitmapCache() const;
+    void collectTerms(std::vector<std::pair<std::string, const PostingList*>>& terms) const;
     void clear();
-    void display() const;
+    void display(const DocumentTable& documents) const;
     void save(std::ofstream& outFile) const;
-    void load(std::ifstream& inFile);
-    ~HashMapSearch();
+    // Returns false, leaving the index empty, if the dump cannot be read or
+    // a posting refers to a document at or past documentCount, the size of
+    // the document table loaded with it.
+    bool load(std::ifstream& inFile, size_t documentCount);
 };
@@ -0,0 +1,125 @@
+#include "LevenshteinAutomaton.h"
+#include <algorithm>
+#include <cctype>
+
+using namespace std;
+
+// The word is normalized the same way SearchEngine::normalize does.
+LevenshteinAutomaton::LevenshteinAutomaton(const string& word, unsigned maxDistance)
+    : maxDistance(min(maxDistance, MaxDistance)) {
+    for (char c : word) {
+        if (isalnum(static_cast<unsigned char>(c))) {
+            this->word += static_cast<char>(tolower(static_cast<unsigned char>(c)));
+        }
+    }
+    for (char c : this->word) {
+        inWord[static_cast<unsigned char>(c)] = true;
+    }
+}
+
+bool LevenshteinAutomaton::parse(const string& queryWord, string& word, unsigned& distance) {
+    size_t tilde = queryWord.rfind('~');
+    if (tilde == string::npos || tilde == 0) {
+        return false;
+    }
+    string suffix = queryWord.substr(tilde + 1);
+    if (suffix.empty()) {
+        distance = MaxDistance;
+    }
+    else if (suffix.size() == 1 && suffix[0] >= '0' && suffix[0] <= '9') {
+        distance = static_cast<unsigned>(suffix[0] - '0');
+    }
+    else {
+        return false;
+    }
+    word = queryWord.substr(0, tilde);
+    return true;
+}
+
+bool LevenshteinAutomaton::valid() const {
+    return !word.empty() && word.size() <= MaxLength;
+}
+
+const string& LevenshteinAutomaton::text() const {
+    return word;
+}
+
+unsigned LevenshteinAutomaton::distanceLimit() const {
+    return maxDistance;
+}
+
+// Cell j of the state, or the cap when j lies outside its band.
+uint8_t LevenshteinAutomaton::cell(const State& state, size_t j) const {
+    if (j + maxDistance < state.depth || j > state.depth + maxDistance) {
+        return static_cast<uint8_t>(maxDistance + 1);
+    }
+    return state.cells[j];
+}
+
+LevenshteinAutomaton::State LevenshteinAutomaton::start() const {
+    State state;
+    state.depth = 0;
+    for (size_t j = 0; j <= min<size_t>(word.size(), maxDistance); ++j) {
+        state.cells[j] = static_cast<uint8_t>(j);
+    }
+    state.minimum = 0;
+    return state;
+}
+
+LevenshteinAutomaton::State LevenshteinAutomaton::step(const State& state, char c) const {
+    const int cap = static_cast<int>(maxDistance + 1);
+    State next;
+    next.depth = static_cast<uint16_t>(min<size_t>(state.depth + 1, MaxLength + MaxDistance + 1));
+    next.minimum = static_cast<uint8_t>(cap);
+
+    size_t low = next.depth > maxDistance ? next.depth - maxDistance : 0;
+    size_t high = min<size_t>(word.size(), next.depth + maxDistance);
+    int left = cap;
+    for (size_t j = low; j <= high; ++j) {
+        int value;
+        if (j == 0) {
+            value = min<int>(next.depth, cap);
+        }
+        else {
+            int substitution = cell(state, j - 1) + (word[j - 1] == c ? 0 : 1);
+            int deletion = cell(state, j) + 1;
+            value = min(min(substitution, deletion), min(left + 1, cap));
+        }
+        next.cells[j] = static_cast<uint8_t>(value);
+        next.minimum = min(next.minimum, next.cells[j]);
+        left = value;
+    }
+    return next;
+}
+
+bool LevenshteinAutomaton::occursInWord(char c) const {
+    return inWord[static_cast<unsigned char>(c)];
+}
+
+// The word is alphanumeric, so '\0' stands for any character outside it.
+LevenshteinAutomaton::State LevenshteinAutomaton::stepOther(const State& state) const {
+    return step(state, '\0');
+}
+
+bool LevenshteinAutomaton::alive(const State& state) const {
+    return state.minimum <= maxDistance;
+}
+
+bool LevenshteinAutomaton::accepts(const State& state) const {
+    return cell(state, word.size()) <= maxDistance;
+}
+
+unsigned LevenshteinAutomaton::distance(const State& state) const {
+    return cell(state, word.size());
+}
+
+unsigned LevenshteinAutomaton::distanceTo(string_view term) const {
+    State state = start();
+    for (char c : term) {
+        state = step(state, c);
+        if (!alive(state)) {
+            return maxDistance + 1;
+        }
+    }
+    return distance(state);
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Accepts the terms within a given edit distance (insertions, deletions and
+// substitutions) of a word. A state is one row of the edit-distance table:
+// cell j holds the distance between the characters read so far and the first
+// j characters of the word, capped at the limit + 1. Once every cell is over
+// the limit no continuation can match, so a walk over a trie or a sorted term
+// list drops the branch right there, like WildcardPattern does for patterns.
+//
+// After k characters, cell j is at least |k - j|, so only the cells within
+// the limit of the diagonal are kept and computed; the others are known to be
+// over it.
+class LevenshteinAutomaton {
+public:
+    static constexpr size_t MaxLength = 63;
+    static constexpr unsigned MaxDistance = 2;
+
+    struct State {
+        uint8_t cells[MaxLength + 1];
+        uint8_t minimum;
+        // Characters read, which places the band of valid cells.
+        uint16_t depth;
+    };
+
+private:
+    std::string word;
+    unsigned maxDistance;
+    bool inWord[256] = {};
+
+    uint8_t cell(const State& state, size_t j) const;
+
+public:
+    LevenshteinAutomaton(const std::string& word, unsigned maxDistance);
+
+    // Splits a query word of the form "word~" or "word~N" into the word and
+    // the distance, 2 for a bare "~". False for words without the suffix.
+    static bool parse(const std::string& queryWord, std::string& word, unsigned& distance);
+
+    bool valid() const;
+    const std::string& text() const;
+    unsigned distanceLimit() const;
+
+    State start() const;
+    State step(const State& state, char c) const;
+    // Every character the word does not contain moves a state to the same
+    // next state, so a walk can step once for all of them.
+    bool occursInWord(char c) const;
+    State stepOther(const State& state) const;
+    bool alive(const State& state) const;
+    bool accepts(const State& state) const;
+    // The distance of an accepted term, or distanceLimit() + 1.
+    unsigned distance(const State& state) const;
+    unsigned distanceTo(std::string_view term) const;
+};
@@ -0,0 +1,339 @@
+#include "LoudsTrie.h"
+#include <algorithm>
+#include <cstring>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+using namespace std;
+
+static const char LoudsTrieMagic[8] = { 'S', 'E', 'L', 'O', 'U', 'D', 'S', '1' };
+
+static int countBits(uint64_t word) {
+#ifdef _MSC_VER
+    return static_cast<int>(__popcnt64(word));
+#else
+    return __builtin_popcountll(word);
+#endif
+}
+
+static int lowestSetBit(uint64_t word) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, word);
+    return static_cast<int>(index);
+#else
+    return __builtin_ctzll(word);
+#endif
+}
+
+// Position of the k-th set bit of word, which has more than k of them.
+static int selectInWord(uint64_t word, uint64_t k) {
+    for (; k > 0; --k) {
+        word &= word - 1;
+    }
+    return lowestSetBit(word);
+}
+
+static void appendBit(vector<uint64_t>& bits, uint64_t position, bool bit) {
+    if (position / 64 >= bits.size()) {
+        bits.push_back(0);
+    }
+    if (bit) {
+        bits[position / 64] |= uint64_t(1) << (position % 64);
+    }
+}
+
+static void padTo8(vector<uint8_t>& out) {
+    out.resize((out.size() + 7) & ~static_cast<size_t>(7), 0);
+}
+
+size_t RankedBits::sectionSize(uint64_t bitCount) {
+    size_t wordCount = (bitCount + 63) / 64;
+    size_t blockCount = (wordCount + BlockWords - 1) / BlockWords;
+    return sizeof(uint64_t) + wordCount * sizeof(uint64_t) + (((blockCount + 1) * sizeof(uint32_t) + 7) & ~static_cast<size_t>(7));
+}
+
+void RankedBits::write(const vector<uint64_t>& bits, uint64_t bitCount, vector<uint8_t>& out) {
+    size_t wordCount = (bitCount + 63) / 64;
+    size_t blockCount = (wordCount + BlockWords - 1) / BlockWords;
+    size_t start = out.size();
+    out.resize(start + sectionSize(bitCount), 0);
+    memcpy(out.data() + start, &bitCount, sizeof(bitCount));
+    memcpy(out.data() + start + sizeof(uint64_t), bits.data(), wordCount * sizeof(uint64_t));
+
+    uint8_t* ranks = out.data() + start + sizeof(uint64_t) + wordCount * sizeof(uint64_t);
+    uint32_t rank = 0;
+    for (size_t block = 0; block <= blockCount; ++block) {
+        memcpy(ranks + block * sizeof(uint32_t), &rank, sizeof(rank));
+        for (size_t w = block * BlockWords; w < min(wordCount, (block + 1) * BlockWords); ++w) {
+            rank += countBits(bits[w]);
+        }
+    }
+}
+
+bool RankedBits::view(const uint8_t* section, size_t size) {
+    if (size < sizeof(uint64_t)) {
+        return false;
+    }
+    uint64_t count;
+    memcpy(&count, section, sizeof(count));
+    if (count / 8 > size || sectionSize(count) > size) {
+        return false;
+    }
+
+    size_t wordCount = (count + 63) / 64;
+    size_t blockCount = (wordCount + BlockWords - 1) / BlockWords;
+    words = reinterpret_cast<const uint64_t*>(section + sizeof(uint64_t));
+    blockRanks = reinterpret_cast<const uint32_t*>(section + sizeof(uint64_t) + wordCount * sizeof(uint64_t));
+    bitCount = count;
+
+    // select trusts the directory, so it is checked against the bits once.
+    if (count % 64 != 0 && (words[wordCount - 1] >> (count % 64)) != 0) {
+        return false;
+    }
+    uint64_t rank = 0;
+    for (size_t block = 0; block <= blockCount; ++block) {
+        if (blockRanks[block] != rank) {
+            return false;
+        }
+        for (size_t w = block * BlockWords; w < min(wordCount, (block + 1) * BlockWords); ++w) {
+            rank += countBits(words[w]);
+        }
+    }
+    return true;
+}
+
+uint64_t RankedBits::size() const {
+    return bitCount;
+}
+
+uint64_t RankedBits::ones() const {
+    return blockRanks[((bitCount + 63) / 64 + BlockWords - 1) / BlockWords];
+}
+
+bool RankedBits::get(uint64_t position) const {
+    return (words[position / 64] >> (position % 64)) & 1;
+}
+
+uint64_t RankedBits::rank1(uint64_t position) const {
+    uint64_t rank = blockRanks[position / BlockBits];
+    for (size_t w = (position / BlockBits) * BlockWords; w < position / 64; ++w) {
+        rank += countBits(words[w]);
+    }
+    if (position % 64 != 0) {
+        rank += countBits(words[position / 64] & ((uint64_t(1) << (position % 64)) - 1));
+    }
+    return rank;
+}
+
+uint64_t RankedBits::select1(uint64_t k) const {
+    size_t blockCount = ((bitCount + 63) / 64 + BlockWords - 1) / BlockWords;
+    // The last block whose ones before it are at most k.
+    size_t block = upper_bound(blockRanks, blockRanks + blockCount + 1, static_cast<uint32_t>(k)) - blockRanks - 1;
+    uint64_t remaining = k - blockRanks[block];
+    for (size_t w = block * BlockWords; ; ++w) {
+        uint64_t count = countBits(words[w]);
+        if (remaining < count) {
+            return w * 64 + selectInWord(words[w], remaining);
+        }
+        remaining -= count;
+    }
+}
+
+uint64_t RankedBits::zerosBefore(size_t block) const {
+    return block * BlockBits - blockRanks[block];
+}
+
+uint64_t RankedBits::select0(uint64_t k) const {
+    size_t blockCount = ((bitCount + 63) / 64 + BlockWords - 1) / BlockWords;
+    size_t low = 0;
+    size_t high = blockCount;
+    while (high - low > 1) {
+        size_t middle = (low + high) / 2;
+        if (zerosBefore(middle) <= k) {
+            low = middle;
+        }
+        else {
+            high = middle;
+        }
+    }
+    uint64_t remaining = k - zerosBefore(low);
+    for (size_t w = low * BlockWords; ; ++w) {
+        uint64_t count = countBits(~words[w]);
+        if (remaining < count) {
+            return w * 64 + selectInWord(~words[w], remaining);
+        }
+        remaining -= count;
+    }
+}
+
+void LoudsTrie::Builder::addNode(string_view label, size_t childCount, bool isTerm) {
+    for (size_t i = 0; i < childCount; ++i) {
+        appendBit(loudsBits, loudsCount++, true);
+    }
+    appendBit(loudsBits, loudsCount++, false);
+    appendBit(terminalBits, nodeCount, isTerm);
+    if (nodeCount > 0) {
+        for (size_t i = 0; i < label.size(); ++i) {
+            appendBit(labelEndBits, labels.size() + i, i + 1 == label.size());
+        }
+        labels.append(label.data(), label.size());
+    }
+    nodeCount++;
+    if (isTerm) {
+        termCount++;
+    }
+}
+
+vector<uint8_t> LoudsTrie::Builder::finish() const {
+    LoudsTrieHeader header = {};
+    memcpy(header.magic, LoudsTrieMagic, sizeof(header.magic));
+    header.nodeCount = nodeCount;
+    header.termCount = termCount;
+
+    vector<uint8_t> out(sizeof(LoudsTrieHeader), 0);
+    header.loudsOffset = out.size();
+    RankedBits::write(loudsBits, loudsCount, out);
+    header.terminalOffset = out.size();
+    RankedBits::write(terminalBits, nodeCount, out);
+    header.labelEndsOffset = out.size();
+    RankedBits::write(labelEndBits, labels.size(), out);
+    header.labelBytesOffset = out.size();
+    header.labelByteCount = labels.size();
+    out.insert(out.end(), labels.begin(), labels.end());
+    padTo8(out);
+    header.size = out.size();
+    memcpy(out.data(), &header, sizeof(header));
+    return out;
+}
+
+bool LoudsTrie::open(const uint8_t* data, size_t size) {
+    header = nullptr;
+    if (size < sizeof(LoudsTrieHeader) || reinterpret_cast<uintptr_t>(data) % 8 != 0) {
+        return false;
+    }
+    const LoudsTrieHeader* candidate = reinterpret_cast<const LoudsTrieHeader*>(data);
+    if (memcmp(candidate->magic, LoudsTrieMagic, sizeof(LoudsTrieMagic)) != 0 || candidate->size > size
+        || candidate->nodeCount == 0) {
+        return false;
+    }
+    size = candidate->size;
+    uint64_t offsets[] = { candidate->loudsOffset, candidate->terminalOffset, candidate->labelEndsOffset, candidate->labelBytesOffset };
+    for (uint64_t offset : offsets) {
+        if (offset < sizeof(LoudsTrieHeader) || offset > size || offset % 8 != 0) {
+            return false;
+        }
+    }
+    if (!louds.view(data + candidate->loudsOffset, size - candidate->loudsOffset)
+        || !terminal.view(data + candidate->terminalOffset, size - candidate->terminalOffset)
+        || !labelEnds.view(data + candidate->labelEndsOffset, size - candidate->labelEndsOffset)
+        || candidate->labelByteCount > size - candidate->labelBytesOffset) {
+        return false;
+    }
+
+    uint64_t nodes = candidate->nodeCount;
+    if (louds.size() != 2 * nodes - 1 || louds.ones() != nodes - 1 || terminal.size() != nodes
+        || terminal.ones() != candidate->termCount || labelEnds.size() != candidate->labelByteCount
+        || labelEnds.ones() != nodes - 1) {
+        return false;
+    }
+    labelBytes = reinterpret_cast<const char*>(data + candidate->labelBytesOffset);
+    header = candidate;
+    return true;
+}
+
+LoudsTrie::Scanner::Scanner(const LoudsTrie& trie) : trie(trie) {
+}
+
+bool LoudsTrie::Scanner::next(size_t& childCount, string_view& label, bool& isTerm) {
+    if (node == trie.nodeCount()) {
+        return false;
+    }
+    childCount = 0;
+    while (trie.louds.get(loudsPosition++)) {
+        childCount++;
+    }
+    label = string_view();
+    if (node > 0) {
+        uint64_t begin = labelPosition;
+        while (!trie.labelEnds.get(labelPosition++)) {
+        }
+        label = string_view(trie.labelBytes + begin, labelPosition - begin);
+    }
+    isTerm = trie.terminal.get(node);
+    node++;
+    return true;
+}
+
+size_t LoudsTrie::nodeCount() const {
+    return header->nodeCount;
+}
+
+size_t LoudsTrie::termCount() const {
+    return header->termCount;
+}
+
+// Node i's ones start after the i-th zero, and every one before them stands
+// for a node numbered after the root and before node i's first child.
+size_t LoudsTrie::firstChild(size_t node) const {
+    size_t start = (node == 0) ? 0 : louds.select0(node - 1) + 1;
+    return start - node + 1;
+}
+
+size_t LoudsTrie::childCount(size_t node) const {
+    size_t start = (node == 0) ? 0 : louds.select0(node - 1) + 1;
+    return louds.select0(node) - start;
+}
+
+string_view LoudsTrie::label(size_t node) const {
+    if (node == 0) {
+        return string_view();
+    }
+    size_t begin = (node == 1) ? 0 : labelEnds.select1(node - 2) + 1;
+    size_t end = labelEnds.select1(node - 1) + 1;
+    return string_view(labelBytes + begin, end - begin);
+}
+
+bool LoudsTrie::isTerm(size_t node) const {
+    return terminal.get(node);
+}
+
+size_t LoudsTrie::termIndex(size_t node) const {
+    return terminal.rank1(node);
+}
+
+// Children are in label order, and no two labels of siblings start with the
+// same byte, so each level is a binary search on first bytes.
+size_t LoudsTrie::find(string_view term) const {
+    size_t node = 0;
+    size_t matched = 0;
+    while (matched < term.size()) {
+        size_t start = (node == 0) ? 0 : louds.select0(node - 1) + 1;
+        size_t first = start - node + 1;
+        size_t last = first + (louds.select0(node) - start);
+        unsigned char key = static_cast<unsigned char>(term[matched]);
+        size_t low = first;
+        size_t high = last;
+        while (low < high) {
+            size_t middle = (low + high) / 2;
+            if (static_cast<unsigned char>(label(middle)[0]) < key) {
+                low = middle + 1;
+            }
+            else {
+                high = middle;
+            }
+        }
+        if (low == last) {
+            return NotFound;
+        }
+        string_view edge = label(low);
+        if (term.compare(matched, edge.size(), edge) != 0) {
+            return NotFound;
+        }
+        matched += edge.size();
+        node = low;
+    }
+    return isTerm(node) ? termIndex(node) : NotFound;
+}
@@ -0,0 +1,124 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Read-only view of a bit array followed by its rank directory: the number of
+// ones before every block of 512 bits, plus the total. rank1 is one lookup and
+// a few popcounts; select binary-searches the directory and then scans one
+// block.
+class RankedBits {
+private:
+    static constexpr size_t BlockWords = 8;
+    static constexpr size_t BlockBits = BlockWords * 64;
+
+    const uint64_t* words = nullptr;
+    const uint32_t* blockRanks = nullptr;
+    uint64_t bitCount = 0;
+
+    uint64_t zerosBefore(size_t block) const;
+
+public:
+    // Bytes taken by a section of bitCount bits: the count, the words and the
+    // directory, rounded up to 8 bytes.
+    static size_t sectionSize(uint64_t bitCount);
+    static void write(const std::vector<uint64_t>& bits, uint64_t bitCount, std::vector<uint8_t>& out);
+    // Points the view at a section written by write(). Returns false if the
+    // section does not fit in size bytes or its directory does not match
+    // its bits.
+    bool view(const uint8_t* section, size_t size);
+
+    uint64_t size() const;
+    uint64_t ones() const;
+    bool get(uint64_t position) const;
+    // Ones in [0, position).
+    uint64_t rank1(uint64_t position) const;
+    // Position of the k-th one (or zero), counting from 0; k must be less
+    // than the number of ones (or zeros).
+    uint64_t select1(uint64_t k) const;
+    uint64_t select0(uint64_t k) const;
+};
+
+// Fixed-size header of a LoudsTrie; the sections follow it, each aligned to
+// 8 bytes and addressed by its offset from the start of the trie.
+struct LoudsTrieHeader {
+    char magic[8];
+    uint64_t nodeCount;
+    uint64_t termCount;
+    uint64_t loudsOffset;       // childCount ones and then a zero per node
+    uint64_t terminalOffset;    // one bit per node, set where a term ends
+    uint64_t labelEndsOffset;   // one bit per label byte, set on the last byte of a label
+    uint64_t labelBytesOffset;  // labels of nodes 1 to nodeCount - 1, concatenated
+    uint64_t labelByteCount;
+    uint64_t size;
+};
+
+// Radix tree in LOUDS form (level-order unary degree sequence). Nodes are
+// numbered breadth first, children in the order of their labels, and the
+// tree's shape is one bit string holding, node by node, a one per child and
+// a closing zero: about two bits per node. The children of a node are found
+// by rank and select over that string, labels through a second bit string
+// marking where each label ends, and terms are numbered by ranking a third
+// one. The trie is one flat buffer with no pointers, so it can be written to
+// a file as it is and queried wherever its bytes are, in a buffer read from a
+// file or in a mapped one, without building any nodes.
+class LoudsTrie {
+private:
+    const LoudsTrieHeader* header = nullptr;
+    RankedBits louds;
+    RankedBits terminal;
+    RankedBits labelEnds;
+    const char* labelBytes = nullptr;
+
+public:
+    static constexpr size_t NotFound = SIZE_MAX;
+
+    // Takes the nodes of a radix tree in level order, root first, and lays
+    // them out as a trie buffer. Every node but the root needs a label.
+    class Builder {
+    private:
+        std::vector<uint64_t> loudsBits;
+        std::vector<uint64_t> terminalBits;
+        std::vector<uint64_t> labelEndBits;
+        uint64_t loudsCount = 0;
+        uint64_t nodeCount = 0;
+        uint64_t termCount = 0;
+        std::string labels;
+
+    public:
+        void addNode(std::string_view label, size_t childCount, bool isTerm);
+        std::vector<uint8_t> finish() const;
+    };
+
+    // Reads the nodes one after another in level order with plain scans of
+    // the bit strings, for rebuilding a tree from the trie in one pass. The
+    // children of the n-th node read are the next childCount nodes not yet
+    // claimed by an earlier one.
+    class Scanner {
+    private:
+        const LoudsTrie& trie;
+        size_t node = 0;
+        uint64_t loudsPosition = 0;
+        uint64_t labelPosition = 0;
+
+    public:
+        explicit Scanner(const LoudsTrie& trie);
+        bool next(size_t& childCount, std::string_view& label, bool& isTerm);
+    };
+
+    // data must stay valid, and unchanged, for as long as the trie is used.
+    bool open(const uint8_t* data, size_t size);
+
+    size_t nodeCount() const;
+    size_t termCount() const;
+    size_t firstChild(size_t node) const;
+    size_t childCount(size_t node) const;
+    std::string_view label(size_t node) const;
+    bool isTerm(size_t node) const;
+    // Number of the term ending at node, counting terms in level order.
+    size_t termIndex(size_t node) const;
+    // Number of term, or NotFound.
+    size_t find(std::string_view term) const;
+};
@@ -1,9 +1,14 @@
 #include "SearchEngine.h"
+#include "Benchmark.h"
+#include "ResultFormatter.h"
+#include "Metrics.h"
 #include <iostream>
 #include <string>
 #include <vector>
 #include <experimental/filesystem>
 #include <fstream>
+#include <sstream>
+#include <chrono>
 
 namespace fs = std::experimental::filesystem;
 using namespace std;
@@ -16,12 +21,53 @@ void printMenu() {
     cout << "4. Add a new file to the index\n";
     cout << "5. Dump the search engine to a file\n";
     cout << "6. Load the search engine from a file\n";
-    cout << "7. Compare HashMap and Trie performance\n";
+    cout << "7. Benchmark HashMap and Trie on a generated corpus\n";
+    cout << "8. Write a memory-mapped index file\n";
+    cout << "9. Serve queries from a memory-mapped index file\n";
+    cout << "10. Show trie memory report\n";
+    cout << "11. Set the number of results per query\n";
+    cout << "12. Show query cache statistics\n";
+    cout << "13. Open a segmented index (new files are added as segments)\n";
+    cout << "14. Show segments of the segmented index\n";
+    cout << "15. Run a file of queries in parallel\n";
+    cout << "16. Show indexing and query metrics\n";
+    cout << "17. Set the fuzzy matching distance (0 = exact words)\n";
+    cout << "18. Remove a file from the index\n";
+    cout << "19. Re-index a file that changed\n";
+    cout << "20. Purge deleted documents from memory now\n";
+    cout << "21. Index a directory tree (with include/exclude globs)\n";
     cout << "0. Exit\n";
     cout << "===================================\n";
     cout << "Enter your choice: ";
 }
 
+// Shows the results a page at a time, as many per page as the result limit
+// (all of them when it is 0), asking before each further page.
+void showResults(const SearchEngine& searchEngine, const string& query) {
+    ResultCursor cursor = searchEngine.searchQuery(query, SearchEngine::useHashMap);
+    size_t pageSize = searchEngine.getResultLimit();
+    vector<ResultDocument> page = cursor.page(0, pageSize);
+    ResultFormatter::write(cout, page);
+
+    size_t shown = page.size();
+    while (pageSize != 0 && page.size() == pageSize) {
+        string answer;
+        cout << "Show more results? (y/n): ";
+        getline(cin, answer);
+        if (answer != "y" && answer != "Y") {
+            break;
+        }
+        page = cursor.page(shown, pageSize);
+        if (page.empty()) {
+            cout << "No more results.\n";
+            break;
+        }
+        ResultFormatter::write(cout, page);
+        shown += page.size();
+    }
+    cout.flush();
+}
+
 void clearScreen() {
     system("cls");
 }
@@ -33,6 +79,10 @@ int main() {
 
     const string folderPath = "C:/Users/chaud/source/repos/Search Engine/review_text/review_text";
     const string dumpFilePath = "search_engine.dat";
+    const string mappedIndexPath = "search_engine.idx";
+    const string segmentDirectory = "search_engine_segments";
+    const string batchResultsPath = "batch_results.tsv";
+    const string metricsPath = "metrics.json";
 
     if (!fs::exists(folderPath) || !fs::is_directory(folderPath)) {
         cerr << "Error: Folder path does not exist or is not a directory. Exiting program." << endl;
@@ -60,22 +110,24 @@ int main() {
                 cerr << "Invalid number of files. Please enter a positive number." << endl;
                 break;
             }
-            searchEngine.indexDocuments(folderPath, SearchEngine::useHashMap, numFiles);
-            cout << "Indexed " << numFiles << " files successfully from folder: " << folderPath << endl;
+            int numWorkers;
+            cout << "Enter the number of indexing threads (0 = one per core): ";
+            cin >> numWorkers;
+            searchEngine.indexDocuments(folderPath, SearchEngine::useHashMap, numFiles, numWorkers);
             break;
         }
         case 2: {
-            cout << "Enter your search query: ";
+            cout << "Enter your search query (use * and ? for wildcards, e.g. goo*, and ~ for typos, e.g. recieve~): ";
             cin.ignore();
             getline(cin, query);
-            searchEngine.searchQuery(query, SearchEngine::useHashMap);
+            showResults(searchEngine, query);
             break;
         }
         case 3: {
-            cout << "Enter your search query (e.g., word1 +word2 -word3): ";
+            cout << "Enter your search query (e.g., (word1 OR word2) word3 -word4, NOT, AND and \"phrases\"): ";
             cin.ignore();
             getline(cin, query);
-            searchEngine.searchQuery(query, SearchEngine::useHashMap);
+            showResults(searchEngine, query);
             break;
         }
         case 4: {
@@ -87,8 +139,9 @@ int main() {
                 cerr << "Error: File does not exist. Please provide a valid file path." << endl;
                 break;
             }
-            searchEngine.addFileToIndex(newFilePath, SearchEngine::useHashMap);
-            cout << "File indexed successfully: " << newFilePath << endl;
+            if (searchEngine.addFileToIndex(newFilePath, SearchEngine::useHashMap)) {
+                cout << "File indexed successfully: " << newFilePath << endl;
+            }
             break;
         }
         case 5: {
@@ -110,17 +163,165 @@ int main() {
             break;
         }
         case 7: {
-            vector<string> testQueries;
-            string testQuery;
-            cout << "Enter test queries (enter 'done' to stop):\n";
+            BenchmarkOptions options;
+            options.documentCount = 1000;
+            options.queriesPerKind = 200;
+            ofstream report("benchmark.json");
+            Benchmark benchmark(options);
+            if (report.is_open() && benchmark.run(report)) {
+                benchmark.displaySummary();
+                cout << "Full report written to benchmark.json" << endl;
+            }
+            else {
+                cerr << "Error: Benchmark failed." << endl;
+            }
+            break;
+        }
+        case 8: {
+            if (searchEngine.dumpMappedIndex(mappedIndexPath)) {
+                cout << "Mapped index written to: " << mappedIndexPath << endl;
+            }
+            else {
+                cerr << "Error: Could not write the mapped index." << endl;
+            }
+            break;
+        }
+        case 9: {
+            if (!searchEngine.openMappedIndex(mappedIndexPath)) {
+                cerr << "Error: Could not open the mapped index." << endl;
+            }
+            break;
+        }
+        case 10: {
+            searchEngine.displayMemoryReport();
+            break;
+        }
+        case 11: {
+            size_t resultLimit;
+            cout << "Enter the number of results to show (0 = all): ";
+            cin >> resultLimit;
+            searchEngine.setResultLimit(resultLimit);
+            break;
+        }
+        case 12: {
+            searchEngine.displayQueryCacheStats();
+            break;
+        }
+        case 13: {
+            if (!searchEngine.openSegmentedIndex(segmentDirectory)) {
+                cerr << "Error: Could not open the segmented index." << endl;
+            }
+            break;
+        }
+        case 14: {
+            searchEngine.displaySegments();
+            break;
+        }
+        case 15: {
+            string queryFilePath;
+            cout << "Enter the path of a file with one query per line: ";
+            cin.ignore();
+            getline(cin, queryFilePath);
+            ifstream queryFile(queryFilePath);
+            if (!queryFile.is_open()) {
+                cerr << "Error: Could not open the query file." << endl;
+                break;
+            }
+            vector<string> queries;
+            string line;
+            while (getline(queryFile, line)) {
+                if (!line.empty()) {
+                    queries.push_back(line);
+                }
+            }
+
+            auto start = chrono::steady_clock::now();
+            vector<BatchResult> results = searchEngine.searchBatch(queries, SearchEngine::useHashMap);
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+            // One line per result: query number, rank, score and document.
+            ofstream resultFile(batchResultsPath);
+            for (size_t i = 0; i < results.size(); ++i) {
+                if (!results[i].error.empty()) {
+                    cerr << "Query " << i + 1 << " is invalid: " << results[i].error << "\n";
+                }
+                for (size_t rank = 0; rank < results[i].documents.size(); ++rank) {
+                    const ResultDocument& document = results[i].documents[rank];
+                    resultFile << i + 1 << '\t' << rank + 1 << '\t' << document.score << '\t' << document.path << '\n';
+                }
+            }
+            cout << "Ran " << queries.size() << " queries in " << seconds * 1000.0 << " ms ("
+                << (seconds > 0 ? queries.size() / seconds : 0.0) << " queries/s). Results written to "
+                << batchResultsPath << endl;
+            break;
+        }
+        case 16: {
+            Metrics::writeJson(cout);
+            if (Metrics::writeJson(metricsPath)) {
+                cout << "Metrics written to " << metricsPath << endl;
+            }
+            break;
+        }
+        case 17: {
+            unsigned distance;
+            cout << "Enter the number of typos to allow per word (0, 1 or 2): ";
+            cin >> distance;
+            searchEngine.setFuzzyDistance(distance);
+            break;
+        }
+        case 18: {
+            string filePath;
+            cout << "Enter the path of the file to remove: ";
+            cin.ignore();
+            getline(cin, filePath);
+            searchEngine.removeDocument(filePath);
+            break;
+        }
+        case 19: {
+            string filePath;
+            cout << "Enter the path of the file to re-index: ";
             cin.ignore();
-            while (true) {
-                cout << "> ";
-                getline(cin, testQuery);
-                if (testQuery == "done") break;
-                testQueries.push_back(testQuery);
+            getline(cin, filePath);
+            searchEngine.updateDocument(filePath, SearchEngine::useHashMap);
+            break;
+        }
+        case 20: {
+            if (searchEngine.purgeDeletedDocuments()) {
+                cout << "Deleted documents purged from the in-memory index." << endl;
+            }
+            else {
+                cout << "Nothing to purge." << endl;
+            }
+            break;
+        }
+        case 21: {
+            string root;
+            string patterns;
+            DirectoryCrawler crawler;
+            cout << "Enter the directory to index: ";
+            cin.ignore();
+            getline(cin, root);
+            if (!fs::is_directory(root)) {
+                cerr << "Error: Not a directory. Please provide a valid directory path." << endl;
+                break;
+            }
+            cout << "Enter the files to include, separated by spaces (e.g. *.txt, empty = all files): ";
+            getline(cin, patterns);
+            istringstream includes(patterns);
+            for (string pattern; includes >> pattern; ) {
+                crawler.includePatterns.push_back(pattern);
+            }
+            cout << "Enter the files and directories to exclude, separated by spaces (empty = none): ";
+            getline(cin, patterns);
+            istringstream excludes(patterns);
+            for (string pattern; excludes >> pattern; ) {
+                crawler.excludePatterns.push_back(pattern);
             }
-            searchEngine.comparePerformance(testQueries);
+            int numWorkers;
+            cout << "Enter the number of indexing threads (0 = one per core): ";
+            cin >> numWorkers;
+            size_t found = searchEngine.indexDirectory(root, crawler, SearchEngine::useHashMap, numWorkers);
+            cout << "Found " << found << " files under: " << root << endl;
             break;
         }
         case 0: {
@@ -0,0 +1,671 @@
+#include "MappedIndex.h"
+#include "Metrics.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+static const char MappedIndexMagic[8] = { 'S', 'E', 'I', 'D', 'X', 'M', 'A', 'P' };
+
+static uint64_t alignOffset(uint64_t offset) {
+    return (offset + 7) & ~static_cast<uint64_t>(7);
+}
+
+// Appends a section to the file image and returns its offset.
+template <typename T>
+static uint64_t appendSection(vector<char>& image, const T* data, size_t count) {
+    uint64_t offset = alignOffset(image.size());
+    image.resize(offset + count * sizeof(T));
+    if (count > 0) {
+        memcpy(image.data() + offset, data, count * sizeof(T));
+    }
+    return offset;
+}
+
+// Arrays of an index file before they are laid out, filled by write() and
+// merge().
+struct MappedIndexSections {
+    vector<uint64_t> termOffsets = { 0 };
+    string termBytes;
+    vector<uint64_t> termPostings = { 0 };
+    vector<uint32_t> postingDocIds;
+    vector<uint32_t> postingFrequencies;
+    vector<uint64_t> positionOffsets = { 0 };
+    vector<uint8_t> positionBytes;
+    vector<uint32_t> maxFrequencies;
+    vector<uint64_t> pathOffsets = { 0 };
+    string pathBytes;
+    vector<uint32_t> documentLengths;
+    uint64_t totalDocumentLength = 0;
+    uint32_t minDocumentLength = 0;
+
+    void addTerm(const string& term) {
+        termBytes += term;
+        termOffsets.push_back(termBytes.size());
+    }
+
+    void addPath(const string& path) {
+        pathBytes += path;
+        pathOffsets.push_back(pathBytes.size());
+    }
+};
+
+// Moves sourcePath over targetPath in one step.
+static bool replaceFile(const string& sourcePath, const string& targetPath) {
+#ifdef _WIN32
+    return MoveFileExA(sourcePath.c_str(), targetPath.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    return rename(sourcePath.c_str(), targetPath.c_str()) == 0;
+#endif
+}
+
+static bool writeSections(const string& filePath, uint32_t version, const MappedIndexSections& sections) {
+    MappedIndexHeader fileHeader = {};
+    memcpy(fileHeader.magic, MappedIndexMagic, sizeof(fileHeader.magic));
+    fileHeader.version = version;
+    fileHeader.termCount = sections.maxFrequencies.size();
+    fileHeader.postingCount = sections.postingDocIds.size();
+    fileHeader.documentCount = sections.documentLengths.size();
+    fileHeader.totalDocumentLength = sections.totalDocumentLength;
+    fileHeader.minDocumentLength = sections.minDocumentLength;
+    vector<uint32_t> deletedDocIds;
+    for (size_t docId = 0; docId < sections.documentLengths.size(); ++docId) {
+        if (sections.pathOffsets[docId + 1] == sections.pathOffsets[docId]) {
+            deletedDocIds.push_back(static_cast<uint32_t>(docId));
+        }
+    }
+    fileHeader.deletedDocumentCount = static_cast<uint32_t>(deletedDocIds.size());
+
+    vector<char> image(sizeof(MappedIndexHeader));
+    fileHeader.termOffsetsOffset = appendSection(image, sections.termOffsets.data(), sections.termOffsets.size());
+    fileHeader.termBytesOffset = appendSection(image, sections.termBytes.data(), sections.termBytes.size());
+    fileHeader.termPostingsOffset = appendSection(image, sections.termPostings.data(), sections.termPostings.size());
+    fileHeader.docIdsOffset = appendSection(image, sections.postingDocIds.data(), sections.postingDocIds.size());
+    fileHeader.frequenciesOffset = appendSection(image, sections.postingFrequencies.data(), sections.postingFrequencies.size());
+    fileHeader.positionOffsetsOffset = appendSection(image, sections.positionOffsets.data(), sections.positionOffsets.size());
+    fileHeader.positionBytesOffset = appendSection(image, sections.positionBytes.data(), sections.positionBytes.size());
+    fileHeader.pathOffsetsOffset = appendSection(image, sections.pathOffsets.data(), sections.pathOffsets.size());
+    fileHeader.pathBytesOffset = appendSection(image, sections.pathBytes.data(), sections.pathBytes.size());
+    fileHeader.maxFrequenciesOffset = appendSection(image, sections.maxFrequencies.data(), sections.maxFrequencies.size());
+    fileHeader.documentLengthsOffset = appendSection(image, sections.documentLengths.data(), sections.documentLengths.size());
+    fileHeader.deletedDocIdsOffset = appendSection(image, deletedDocIds.data(), deletedDocIds.size());
+    image.resize(alignOffset(image.size()));
+    fileHeader.fileSize = image.size();
+    memcpy(image.data(), &fileHeader, sizeof(fileHeader));
+
+    // The file may be mapped by an index that is still being served, so it is
+    // replaced, never truncated: readers of the old file keep seeing it.
+    string tempPath = filePath + ".tmp";
+    ofstream outFile(tempPath, ios::binary | ios::trunc);
+    if (!outFile.is_open()) {
+        cerr << "Error: Could not open mapped index file for writing: " << tempPath << endl;
+        return false;
+    }
+    outFile.write(image.data(), image.size());
+    outFile.close();
+    if (!outFile) {
+        cerr << "Error: Failed to write mapped index file: " << tempPath << endl;
+        remove(tempPath.c_str());
+        return false;
+    }
+    if (!replaceFile(tempPath, filePath)) {
+        cerr << "Error: Could not move " << tempPath << " to " << filePath << endl;
+        remove(tempPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool MappedIndex::write(const string& filePath, const DocumentTable& documents,
+    vector<pair<string, const PostingList*>>& terms) {
+    sort(terms.begin(), terms.end(), [](const pair<string, const PostingList*>& a, const pair<string, const PostingList*>& b) {
+        return a.first < b.first;
+        });
+
+    MappedIndexSections sections;
+    bool anyDeleted = documents.deletedDocumentCount() > 0;
+    for (const auto& term : terms) {
+        uint32_t maxFrequency = 0;
+        for (const WordInDocument* wid : *term.second) {
+            if (anyDeleted && documents.isDeleted(wid->getDocId())) {
+                continue;
+            }
+            maxFrequency = max(maxFrequency, static_cast<uint32_t>(wid->getFrequency()));
+            sections.postingDocIds.push_back(wid->getDocId());
+            sections.postingFrequencies.push_back(static_cast<uint32_t>(wid->getFrequency()));
+            sections.positionBytes.insert(sections.positionBytes.end(), wid->encodedPositions, wid->encodedPositions + wid->encodedSize);
+            sections.positionOffsets.push_back(sections.positionBytes.size());
+        }
+        if (sections.postingDocIds.size() == sections.termPostings.back()) {
+            continue;  // every document of the term was deleted
+        }
+        sections.maxFrequencies.push_back(maxFrequency);
+        sections.addTerm(term.first);
+        sections.termPostings.push_back(sections.postingDocIds.size());
+    }
+
+    for (uint32_t docId = 0; docId < documents.size(); ++docId) {
+        sections.addPath(documents.getPath(docId));
+    }
+    sections.documentLengths.assign(documents.lengthData(), documents.lengthData() + documents.size());
+    sections.totalDocumentLength = documents.totalLength();
+    sections.minDocumentLength = documents.minLength();
+
+    return writeSections(filePath, Version, sections);
+}
+
+// The inputs cover consecutive runs of documents, so the merged postings of a
+// term are the inputs' postings concatenated in input order, each shifted by
+// the number of documents before its input. Terms are merged from the sorted
+// dictionaries without looking anything up.
+bool MappedIndex::merge(const string& filePath, const vector<const MappedIndex*>& inputs, const DocIdBitmap& deleted) {
+    MappedIndexSections sections;
+    vector<uint32_t> docBases;
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        const MappedIndex* input = inputs[i];
+        docBases.push_back(static_cast<uint32_t>(sections.documentLengths.size()));
+        for (uint32_t docId = 0; docId < input->documentCount(); ++docId) {
+            sections.addPath(deleted.contains(docBases[i] + docId) ? string() : input->getPath(docId));
+        }
+        sections.documentLengths.insert(sections.documentLengths.end(), input->documentLengths,
+            input->documentLengths + input->documentCount());
+        sections.totalDocumentLength += input->totalLength();
+        if (i == 0 || input->minLength() < sections.minDocumentLength) {
+            sections.minDocumentLength = input->minLength();
+        }
+    }
+
+    vector<size_t> cursors(inputs.size(), 0);
+    while (true) {
+        string term;
+        bool found = false;
+        for (size_t i = 0; i < inputs.size(); ++i) {
+            if (cursors[i] < inputs[i]->termCount()) {
+                string candidate = inputs[i]->getTerm(cursors[i]);
+                if (!found || candidate < term) {
+                    term = move(candidate);
+                    found = true;
+                }
+            }
+        }
+        if (!found) {
+            break;
+        }
+
+        uint32_t maxFrequency = 0;
+        for (size_t i = 0; i < inputs.size(); ++i) {
+            if (cursors[i] >= inputs[i]->termCount() || inputs[i]->compareTerm(cursors[i], term, SIZE_MAX) != 0) {
+                continue;
+            }
+            PostingView view;
+            if (!inputs[i]->termPostingView(cursors[i]++, view)) {
+                cerr << "Error: The postings of \"" << term << "\" in a mapped index to merge are corrupt." << endl;
+                return false;
+            }
+            for (size_t j = 0; j < view.size; ++j) {
+                if (!deleted.empty() && deleted.contains(docBases[i] + view.docIds[j])) {
+                    continue;
+                }
+                maxFrequency = max(maxFrequency, view.frequencies[j]);
+                sections.postingDocIds.push_back(docBases[i] + view.docIds[j]);
+                sections.postingFrequencies.push_back(view.frequencies[j]);
+                const uint8_t* first = view.positionBytes + view.positionOffsets[j];
+                const uint8_t* last = view.positionBytes + view.positionOffsets[j + 1];
+                sections.positionBytes.insert(sections.positionBytes.end(), first, last);
+                sections.positionOffsets.push_back(sections.positionBytes.size());
+            }
+        }
+        if (sections.postingDocIds.size() == sections.termPostings.back()) {
+            continue;
+        }
+        sections.addTerm(term);
+        sections.maxFrequencies.push_back(maxFrequency);
+        sections.termPostings.push_back(sections.postingDocIds.size());
+    }
+
+    return writeSections(filePath, Version, sections);
+}
+
+MappedIndex::~MappedIndex() {
+    close();
+}
+
+bool MappedIndex::mapFile(const string& filePath) {
+#ifdef _WIN32
+    HANDLE file = CreateFileA(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+        CloseHandle(file);
+        return false;
+    }
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping == nullptr) {
+        CloseHandle(file);
+        return false;
+    }
+    void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (view == nullptr) {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+    fileHandle = file;
+    mappingHandle = mapping;
+    base = static_cast<const uint8_t*>(view);
+    mappedSize = static_cast<size_t>(fileSize.QuadPart);
+#else
+    int fd = ::open(filePath.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0) {
+        ::close(fd);
+        return false;
+    }
+    void* view = mmap(nullptr, static_cast<size_t>(fileStat.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    if (view == MAP_FAILED) {
+        ::close(fd);
+        return false;
+    }
+    fileDescriptor = fd;
+    base = static_cast<const uint8_t*>(view);
+    mappedSize = static_cast<size_t>(fileStat.st_size);
+#endif
+    return true;
+}
+
+// Checks the header and that every section holds the entries its count calls
+// for and ends before the next one starts. Nothing inside the sections is
+// read, so opening takes the same time whatever the size of the index; the
+// offsets and document ids of a term are checked when the term is looked up.
+bool MappedIndex::validate() {
+    if (mappedSize < sizeof(MappedIndexHeader)) {
+        return false;
+    }
+    if (memcmp(header->magic, MappedIndexMagic, sizeof(MappedIndexMagic)) != 0 || header->version != Version) {
+        return false;
+    }
+    if (header->fileSize != mappedSize) {
+        return false;
+    }
+    // Every entry takes at least four bytes, which also keeps the section
+    // sizes below from overflowing.
+    uint64_t terms = header->termCount;
+    uint64_t postings = header->postingCount;
+    uint64_t documents = header->documentCount;
+    if (terms > mappedSize / 4 || postings > mappedSize / 4 || documents > mappedSize / 4
+        || header->deletedDocumentCount > documents) {
+        return false;
+    }
+
+    // In file order, with the bytes each section needs at least.
+    const pair<uint64_t, uint64_t> sections[] = {
+        { header->termOffsetsOffset, (terms + 1) * sizeof(uint64_t) },
+        { header->termBytesOffset, 0 },
+        { header->termPostingsOffset, (terms + 1) * sizeof(uint64_t) },
+        { header->docIdsOffset, postings * sizeof(uint32_t) },
+        { header->frequenciesOffset, postings * sizeof(uint32_t) },
+        { header->positionOffsetsOffset, (postings + 1) * sizeof(uint64_t) },
+        { header->positionBytesOffset, 0 },
+        { header->pathOffsetsOffset, (documents + 1) * sizeof(uint64_t) },
+        { header->pathBytesOffset, 0 },
+        { header->maxFrequenciesOffset, terms * sizeof(uint32_t) },
+        { header->documentLengthsOffset, documents * sizeof(uint32_t) },
+        { header->deletedDocIdsOffset, header->deletedDocumentCount * sizeof(uint32_t) }
+    };
+    const size_t sectionCount = sizeof(sections) / sizeof(sections[0]);
+    uint64_t sectionEnds[sectionCount];
+    for (size_t i = 0; i < sectionCount; ++i) {
+        uint64_t offset = sections[i].first;
+        uint64_t end = (i + 1 < sectionCount) ? sections[i + 1].first : mappedSize;
+        if (offset < sizeof(MappedIndexHeader) || offset % 8 != 0 || offset > end || end > mappedSize
+            || sections[i].second > end - offset) {
+            return false;
+        }
+        sectionEnds[i] = end;
+    }
+    termBytesSize = sectionEnds[1] - header->termBytesOffset;
+    positionBytesSize = sectionEnds[6] - header->positionBytesOffset;
+    pathBytesSize = sectionEnds[8] - header->pathBytesOffset;
+    return true;
+}
+
+bool MappedIndex::open(const string& filePath) {
+    close();
+
+    if (!mapFile(filePath)) {
+        cerr << "Error: Could not map index file: " << filePath << endl;
+        return false;
+    }
+
+    header = reinterpret_cast<const MappedIndexHeader*>(base);
+    if (!validate()) {
+        cerr << "Error: " << filePath << " is not a valid mapped index (version " << Version << ")." << endl;
+        close();
+        return false;
+    }
+
+    termOffsets = reinterpret_cast<const uint64_t*>(base + header->termOffsetsOffset);
+    termBytes = reinterpret_cast<const char*>(base + header->termBytesOffset);
+    termPostings = reinterpret_cast<const uint64_t*>(base + header->termPostingsOffset);
+    docIds = reinterpret_cast<const uint32_t*>(base + header->docIdsOffset);
+    frequencies = reinterpret_cast<const uint32_t*>(base + header->frequenciesOffset);
+    positionOffsets = reinterpret_cast<const uint64_t*>(base + header->positionOffsetsOffset);
+    positionBytes = base + header->positionBytesOffset;
+    pathOffsets = reinterpret_cast<const uint64_t*>(base + header->pathOffsetsOffset);
+    pathBytes = reinterpret_cast<const char*>(base + header->pathBytesOffset);
+    maxFrequencies = reinterpret_cast<const uint32_t*>(base + header->maxFrequenciesOffset);
+    documentLengths = reinterpret_cast<const uint32_t*>(base + header->documentLengthsOffset);
+
+    // Read here, in time proportional to the number of deleted documents, so
+    // queries take the bitmap without any locking. validate() only checks the
+    // list's extent, so ids out of order or out of range are skipped.
+    const uint32_t* deletedDocIds = reinterpret_cast<const uint32_t*>(base + header->deletedDocIdsOffset);
+    vector<uint32_t> ids;
+    ids.reserve(header->deletedDocumentCount);
+    for (uint32_t i = 0; i < header->deletedDocumentCount; ++i) {
+        uint32_t docId = deletedDocIds[i];
+        if (docId < header->documentCount && (ids.empty() || docId > ids.back())) {
+            ids.push_back(docId);
+        }
+    }
+    deleted = DocIdBitmap::fromSorted({ ids.data(), ids.size() });
+    termChecks.reset(new atomic<uint8_t>[header->termCount]());
+    return true;
+}
+
+void MappedIndex::close() {
+    if (base == nullptr) {
+        return;
+    }
+#ifdef _WIN32
+    UnmapViewOfFile(base);
+    CloseHandle(static_cast<HANDLE>(mappingHandle));
+    CloseHandle(static_cast<HANDLE>(fileHandle));
+    fileHandle = nullptr;
+    mappingHandle = nullptr;
+#else
+    munmap(const_cast<uint8_t*>(base), mappedSize);
+    ::close(fileDescriptor);
+    fileDescriptor = -1;
+#endif
+    base = nullptr;
+    mappedSize = 0;
+    header = nullptr;
+    bitmaps.clear();
+    deleted = DocIdBitmap();
+    termChecks.reset();
+}
+
+TermBitmapCache& MappedIndex::bitmapCache() const {
+    return bitmaps;
+}
+
+bool MappedIndex::isOpen() const {
+    return base != nullptr;
+}
+
+// Compares the first length bytes of a dictionary term with word, treating a
+// term shorter than length as a prefix of it.
+int MappedIndex::compareTerm(size_t termIndex, const string& word, size_t length) const {
+    uint64_t begin, end;
+    termRange(termIndex, begin, end);
+    const char* term = termBytes + begin;
+    size_t termLength = min<size_t>(end - begin, length);
+    int order = memcmp(term, word.data(), min(termLength, word.size()));
+    if (order == 0) {
+        order = (termLength < word.size()) ? -1 : (termLength > word.size() ? 1 : 0);
+    }
+    return order;
+}
+
+// Index of the first dictionary term that is not less than word.
+size_t MappedIndex::lowerBound(const string& word) const {
+    size_t low = 0;
+    size_t high = header->termCount;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (compareTerm(middle, word, SIZE_MAX) < 0) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+// A term or path whose offsets leave its section reads as empty.
+void MappedIndex::termRange(size_t termIndex, uint64_t& begin, uint64_t& end) const {
+    begin = termOffsets[termIndex];
+    end = termOffsets[termIndex + 1];
+    if (begin > end || end > termBytesSize) {
+        begin = end = 0;
+    }
+}
+
+void MappedIndex::pathRange(uint32_t docId, uint64_t& begin, uint64_t& end) const {
+    begin = pathOffsets[docId];
+    end = pathOffsets[docId + 1];
+    if (begin > end || end > pathBytesSize) {
+        begin = end = 0;
+    }
+}
+
+// The per-posting part of termPostingView's checks, run once per term.
+bool MappedIndex::postingsValid(uint64_t first, uint64_t last, uint32_t maxFrequency) const {
+    if (positionOffsets[last] > positionBytesSize) {
+        return false;
+    }
+    for (uint64_t i = first; i < last; ++i) {
+        if (docIds[i] >= header->documentCount || frequencies[i] > maxFrequency
+            || positionOffsets[i] > positionOffsets[i + 1]
+            || frequencies[i] > positionOffsets[i + 1] - positionOffsets[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Checks everything a reader of the view relies on: the postings lie inside
+// the posting arrays, refer to documents of the file, and address position
+// bytes inside their section, at least one byte for every position the
+// frequency counts, so no frequency can size more positions than there are
+// bytes. Returns false, with view empty, if the file is corrupt there. Only
+// the first lookup of a term reads all of its postings to check them.
+bool MappedIndex::termPostingView(size_t termIndex, PostingView& view) const {
+    view = PostingView();
+    uint64_t first = termPostings[termIndex];
+    uint64_t last = termPostings[termIndex + 1];
+    if (first > last || last > header->postingCount) {
+        return false;
+    }
+    uint32_t maxFrequency = maxFrequencies[termIndex];
+    // Concurrent lookups of an unchecked term may both check it; they store
+    // the same result.
+    uint8_t check = termChecks[termIndex].load(memory_order_acquire);
+    if (check == TermUnchecked) {
+        check = postingsValid(first, last, maxFrequency) ? TermValid : TermCorrupt;
+        termChecks[termIndex].store(check, memory_order_release);
+    }
+    if (check == TermCorrupt) {
+        return false;
+    }
+
+    view.docIds = docIds + first;
+    view.size = last - first;
+    view.maxFrequency = maxFrequency;
+    view.frequencies = frequencies + first;
+    view.positionOffsets = positionOffsets + first;
+    view.positionBytes = positionBytes;
+    return true;
+}
+
+// Binary search over the sorted term dictionary, comparing bytes in place.
+PostingView MappedIndex::lookup(const string& word) const {
+    if (!isOpen()) {
+        return PostingView();
+    }
+
+    size_t termIndex = lowerBound(word);
+    if (termIndex < header->termCount && compareTerm(termIndex, word, SIZE_MAX) == 0) {
+        Metrics::add(Counter::LookupHits);
+        PostingView view;
+        termPostingView(termIndex, view);
+        return view;
+    }
+    Metrics::add(Counter::LookupMisses);
+    return PostingView();
+}
+
+// Terms sharing the pattern's literal prefix form one contiguous range of the
+// sorted dictionary. Only that range is tested against the pattern, and the
+// maxTerms most frequent matches (0 means all) are kept.
+vector<pair<string, PostingView>> MappedIndex::matchTerms(const WildcardPattern& pattern, size_t maxTerms) const {
+    vector<pair<string, PostingView>> terms;
+    if (!isOpen() || !pattern.valid()) {
+        return terms;
+    }
+
+    string prefix = pattern.literalPrefix();
+    for (size_t termIndex = lowerBound(prefix); termIndex < header->termCount; ++termIndex) {
+        if (compareTerm(termIndex, prefix, prefix.size()) != 0) {
+            break;
+        }
+        string term = getTerm(termIndex);
+        if (pattern.matches(term)) {
+            PostingView view;
+            if (termPostingView(termIndex, view)) {
+                terms.emplace_back(term, view);
+            }
+        }
+    }
+
+    auto moreFrequent = [](const pair<string, PostingView>& a, const pair<string, PostingView>& b) {
+        if (a.second.size != b.second.size) {
+            return a.second.size > b.second.size;
+        }
+        return a.first < b.first;
+    };
+    if (maxTerms != 0 && terms.size() > maxTerms) {
+        partial_sort(terms.begin(), terms.begin() + maxTerms, terms.end(), moreFrequent);
+        terms.resize(maxTerms);
+    }
+    else {
+        sort(terms.begin(), terms.end(), moreFrequent);
+    }
+    return terms;
+}
+
+// Walks the sorted dictionary as if it were a trie: the automaton states of
+// the previous term are kept for the prefix the next term shares with it, and
+// when a prefix is out of reach every term starting with it is skipped with
+// one binary search, so only terms close to the word are read.
+vector<pair<string, PostingView>> MappedIndex::matchFuzzy(const LevenshteinAutomaton& automaton) const {
+    vector<pair<string, PostingView>> terms;
+    if (!isOpen() || !automaton.valid()) {
+        return terms;
+    }
+
+    // states[k] is the state after the first k characters of previous.
+    vector<LevenshteinAutomaton::State> states(1, automaton.start());
+    string previous;
+    size_t termIndex = 0;
+    while (termIndex < header->termCount) {
+        string term = getTerm(termIndex);
+        size_t length = 0;
+        while (length < previous.size() && length < term.size() && previous[length] == term[length]) {
+            length++;
+        }
+        states.resize(length + 1);
+        while (length < term.size() && automaton.alive(states.back())) {
+            states.push_back(automaton.step(states.back(), term[length++]));
+        }
+        previous = term.substr(0, length);
+
+        if (!automaton.alive(states.back())) {
+            string next = previous;
+            while (!next.empty() && static_cast<unsigned char>(next.back()) == 0xFF) {
+                next.pop_back();
+            }
+            if (next.empty()) {
+                break;
+            }
+            next.back()++;
+            termIndex = lowerBound(next);
+            continue;
+        }
+        if (automaton.accepts(states.back())) {
+            PostingView view;
+            if (termPostingView(termIndex, view)) {
+                terms.emplace_back(term, view);
+            }
+        }
+        termIndex++;
+    }
+    return terms;
+}
+
+size_t MappedIndex::termCount() const {
+    return isOpen() ? header->termCount : 0;
+}
+
+string MappedIndex::getTerm(size_t termIndex) const {
+    uint64_t begin, end;
+    termRange(termIndex, begin, end);
+    return string(termBytes + begin, end - begin);
+}
+
+size_t MappedIndex::documentCount() const {
+    return isOpen() ? header->documentCount : 0;
+}
+
+// Empty for a deleted document, as in DocumentTable.
+string MappedIndex::getPath(uint32_t docId) const {
+    if (isDeleted(docId)) {
+        return string();
+    }
+    uint64_t begin, end;
+    pathRange(docId, begin, end);
+    return string(pathBytes + begin, end - begin);
+}
+
+// The bitmap read from the deleted section is the only record of deletions;
+// the empty paths the writer stores for them are not consulted.
+bool MappedIndex::isDeleted(uint32_t docId) const {
+    return deleted.contains(docId);
+}
+
+const DocIdBitmap& MappedIndex::deletedDocuments() const {
+    return deleted;
+}
+
+const uint32_t* MappedIndex::lengthData() const {
+    return documentLengths;
+}
+
+uint64_t MappedIndex::totalLength() const {
+    return isOpen() ? header->totalDocumentLength : 0;
+}
+
+uint32_t MappedIndex::minLength() const {
+    return isOpen() ? header->minDocumentLength : 0;
+}
@@ -0,0 +1,126 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <utility>
+#include <memory>
+#include <atomic>
+#include "DocumentTable.h"
+#include "PostingList.h"
+#include "PostingView.h"
+#include "WildcardPattern.h"
+#include "LevenshteinAutomaton.h"
+#include "DocIdBitmap.h"
+
+// Fixed-size header at the start of a mapped index file. Every section is an
+// array aligned to 8 bytes and addressed by its byte offset from the start of
+// the file.
+struct MappedIndexHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t deletedDocumentCount;   // documents with an empty path, see DocumentTable
+    uint64_t termCount;
+    uint64_t postingCount;
+    uint64_t documentCount;
+    uint64_t termOffsetsOffset;      // uint64_t[termCount + 1] into termBytes
+    uint64_t termBytesOffset;        // sorted terms, concatenated
+    uint64_t termPostingsOffset;     // uint64_t[termCount + 1] into the posting arrays
+    uint64_t docIdsOffset;           // uint32_t[postingCount]
+    uint64_t frequenciesOffset;      // uint32_t[postingCount]
+    uint64_t positionOffsetsOffset;  // uint64_t[postingCount + 1] into positionBytes
+    uint64_t positionBytesOffset;    // encoded positions, see PositionCodec
+    uint64_t pathOffsetsOffset;      // uint64_t[documentCount + 1] into pathBytes
+    uint64_t pathBytesOffset;
+    uint64_t maxFrequenciesOffset;   // uint32_t[termCount], largest frequency per term
+    uint64_t documentLengthsOffset;  // uint32_t[documentCount]
+    uint64_t deletedDocIdsOffset;    // uint32_t[deletedDocumentCount], sorted
+    uint64_t totalDocumentLength;
+    uint32_t minDocumentLength;
+    uint32_t reserved2;
+    uint64_t fileSize;
+};
+
+// Immutable, versioned index file that is memory-mapped and queried in place.
+// Opening it maps the file, checks its header and section extents, and reads
+// only the list of deleted documents, into a bitmap. Processes serving the
+// same file share its pages through the page cache.
+class MappedIndex {
+private:
+    const uint8_t* base = nullptr;
+    size_t mappedSize = 0;
+#ifdef _WIN32
+    void* fileHandle = nullptr;
+    void* mappingHandle = nullptr;
+#else
+    int fileDescriptor = -1;
+#endif
+
+    const MappedIndexHeader* header = nullptr;
+    const uint64_t* termOffsets = nullptr;
+    const char* termBytes = nullptr;
+    const uint64_t* termPostings = nullptr;
+    const uint32_t* docIds = nullptr;
+    const uint32_t* frequencies = nullptr;
+    const uint64_t* positionOffsets = nullptr;
+    const uint8_t* positionBytes = nullptr;
+    const uint64_t* pathOffsets = nullptr;
+    const char* pathBytes = nullptr;
+    const uint32_t* maxFrequencies = nullptr;
+    const uint32_t* documentLengths = nullptr;
+    uint64_t termBytesSize = 0;
+    uint64_t positionBytesSize = 0;
+    uint64_t pathBytesSize = 0;
+    mutable TermBitmapCache bitmaps;
+    DocIdBitmap deleted;
+    // Whether each term's postings have been checked against the document
+    // count and the position bytes yet, and with what result. A term is
+    // checked the first time it is looked up rather than when the file is
+    // opened, which would read every posting.
+    enum TermCheck : uint8_t { TermUnchecked, TermValid, TermCorrupt };
+    std::unique_ptr<std::atomic<uint8_t>[]> termChecks;
+
+    bool mapFile(const std::string& filePath);
+    bool validate();
+    void termRange(size_t termIndex, uint64_t& begin, uint64_t& end) const;
+    void pathRange(uint32_t docId, uint64_t& begin, uint64_t& end) const;
+    int compareTerm(size_t termIndex, const std::string& word, size_t length) const;
+    size_t lowerBound(const std::string& word) const;
+    bool postingsValid(uint64_t first, uint64_t last, uint32_t maxFrequency) const;
+    bool termPostingView(size_t termIndex, PostingView& view) const;
+
+public:
+    static constexpr uint32_t Version = 3;
+
+    MappedIndex() = default;
+    MappedIndex(const MappedIndex&) = delete;
+    MappedIndex& operator=(const MappedIndex&) = delete;
+    ~MappedIndex();
+
+    // Postings of documents the table marks deleted are left out.
+    static bool write(const std::string& filePath, const DocumentTable& documents,
+        std::vector<std::pair<std::string, const PostingList*>>& terms);
+    // Writes one index holding the documents of every input, in input order.
+    // Documents in deleted, by their ids in the merged index, are written as
+    // deleted ones, and their postings are dropped.
+    static bool merge(const std::string& filePath, const std::vector<const MappedIndex*>& inputs,
+        const DocIdBitmap& deleted = DocIdBitmap());
+
+    bool open(const std::string& filePath);
+    void close();
+    bool isOpen() const;
+
+    PostingView lookup(const std::string& word) const;
+    std::vector<std::pair<std::string, PostingView>> matchTerms(const WildcardPattern& pattern, size_t maxTerms) const;
+    std::vector<std::pair<std::string, PostingView>> matchFuzzy(const LevenshteinAutomaton& automaton) const;
+    TermBitmapCache& bitmapCache() const;
+    size_t termCount() const;
+    std::string getTerm(size_t termIndex) const;
+    size_t documentCount() const;
+    std::string getPath(uint32_t docId) const;
+    bool isDeleted(uint32_t docId) const;
+    const DocIdBitmap& deletedDocuments() const;
+    const uint32_t* lengthData() const;
+    uint64_t totalLength() const;
+    uint32_t minLength() const;
+};
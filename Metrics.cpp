@@ -0,0 +1,222 @@
+#include "Metrics.h"
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+using namespace std;
+
+// Index of the highest set bit of a non-zero value.
+static int highestSetBit(uint64_t value) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanReverse64(&index, value);
+    return static_cast<int>(index);
+#else
+    return 63 - __builtin_clzll(value);
+#endif
+}
+
+size_t LatencyHistogram::bucketOf(uint64_t nanoseconds) {
+    const uint64_t subBuckets = uint64_t(1) << SubBucketBits;
+    if (nanoseconds < subBuckets) {
+        return static_cast<size_t>(nanoseconds);
+    }
+    nanoseconds = min(nanoseconds, (uint64_t(1) << MaxValueBits) - 1);
+    int magnitude = highestSetBit(nanoseconds);
+    int shift = magnitude - SubBucketBits;
+    return (static_cast<size_t>(shift) << SubBucketBits) + static_cast<size_t>(nanoseconds >> shift);
+}
+
+uint64_t LatencyHistogram::bucketUpperBound(size_t bucket) {
+    const size_t subBuckets = size_t(1) << SubBucketBits;
+    if (bucket < subBuckets) {
+        return bucket;
+    }
+    int shift = static_cast<int>(bucket >> SubBucketBits) - 1;
+    uint64_t top = bucket - (static_cast<size_t>(shift) << SubBucketBits);
+    return ((top + 1) << shift) - 1;
+}
+
+uint64_t LatencyHistogram::quantile(double q) const {
+    if (count == 0) {
+        return 0;
+    }
+    uint64_t rank = max<uint64_t>(1, static_cast<uint64_t>(q * count + 0.5));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BucketCount; ++i) {
+        seen += buckets[i];
+        if (seen >= rank) {
+            return min(bucketUpperBound(i), maxNanoseconds);
+        }
+    }
+    return maxNanoseconds;
+}
+
+const char* Metrics::name(Counter counter) {
+    switch (counter) {
+    case Counter::DocumentsIndexed: return "documentsIndexed";
+    case Counter::TokensProcessed: return "tokensProcessed";
+    case Counter::BytesRead: return "bytesRead";
+    case Counter::PostingsCreated: return "postingsCreated";
+    case Counter::LookupHits: return "lookupHits";
+    case Counter::LookupMisses: return "lookupMisses";
+    case Counter::Intersections: return "intersections";
+    case Counter::IntersectionInput: return "intersectionInputDocuments";
+    case Counter::IntersectionOutput: return "intersectionOutputDocuments";
+    case Counter::QueriesRun: return "queriesRun";
+    case Counter::ResultsReturned: return "resultsReturned";
+    default: return "unknown";
+    }
+}
+
+const char* Metrics::name(Phase phase) {
+    switch (phase) {
+    case Phase::Tokenize: return "tokenize";
+    case Phase::Insert: return "insert";
+    case Phase::Merge: return "merge";
+    case Phase::Lookup: return "lookup";
+    case Phase::Sort: return "sort";
+    case Phase::Search: return "search";
+    case Phase::Save: return "save";
+    case Phase::Load: return "load";
+    case Phase::Read: return "read";
+    default: return "unknown";
+    }
+}
+
+#ifndef SEARCH_ENGINE_NO_METRICS
+thread_local Metrics::ThreadBlock* Metrics::threadBlock = nullptr;
+
+mutex& Metrics::registryMutex() {
+    static mutex registryMutex;
+    return registryMutex;
+}
+
+// Blocks stay where they are until the process exits, since a deque does
+// not move its elements when it grows, so a reader can add up a block while
+// its owner exits and another thread takes it over.
+deque<Metrics::ThreadBlock>& Metrics::registry() {
+    static deque<ThreadBlock> blocks;
+    return blocks;
+}
+
+// Runs once per thread, on its first probe. The thread takes over a block
+// that an exited thread gave back, or adds a new one, and gives it back when
+// it exits itself.
+Metrics::ThreadBlock& Metrics::claimBlock() {
+    struct Claim {
+        ThreadBlock* block = nullptr;
+
+        ~Claim() {
+            if (block != nullptr) {
+                threadBlock = nullptr;
+                block->claimed.store(false);
+            }
+        }
+    };
+    thread_local Claim claim;
+
+    lock_guard<mutex> lock(registryMutex());
+    for (ThreadBlock& block : registry()) {
+        if (!block.claimed.load()) {
+            claim.block = &block;
+            break;
+        }
+    }
+    if (claim.block == nullptr) {
+        claim.block = &registry().emplace_back();
+    }
+    claim.block->claimed.store(true);
+    threadBlock = claim.block;
+    return *claim.block;
+}
+#endif
+
+// Counts from threads that are recording while the snapshot is taken may be
+// off by the probes that are in flight.
+MetricsSnapshot Metrics::snapshot() {
+    MetricsSnapshot totals;
+#ifndef SEARCH_ENGINE_NO_METRICS
+    lock_guard<mutex> lock(registryMutex());
+    for (const ThreadBlock& block : registry()) {
+        for (size_t c = 0; c < size_t(Counter::Count); ++c) {
+            totals.counters[c] += block.counters[c].load(memory_order_relaxed);
+        }
+        for (size_t p = 0; p < size_t(Phase::Count); ++p) {
+            LatencyHistogram& histogram = totals.phases[p];
+            for (size_t i = 0; i < LatencyHistogram::BucketCount; ++i) {
+                histogram.buckets[i] += block.buckets[p][i].load(memory_order_relaxed);
+            }
+            histogram.count += block.counts[p].load(memory_order_relaxed);
+            histogram.totalNanoseconds += block.totals[p].load(memory_order_relaxed);
+            histogram.maxNanoseconds = max(histogram.maxNanoseconds, block.maxima[p].load(memory_order_relaxed));
+        }
+    }
+#endif
+    return totals;
+}
+
+// Meant for quiet moments, such as between benchmark runs: a probe that runs
+// at the same time may write back the value it read before the reset.
+void Metrics::reset() {
+#ifndef SEARCH_ENGINE_NO_METRICS
+    lock_guard<mutex> lock(registryMutex());
+    for (ThreadBlock& block : registry()) {
+        for (size_t c = 0; c < size_t(Counter::Count); ++c) {
+            block.counters[c].store(0, memory_order_relaxed);
+        }
+        for (size_t p = 0; p < size_t(Phase::Count); ++p) {
+            for (size_t i = 0; i < LatencyHistogram::BucketCount; ++i) {
+                block.buckets[p][i].store(0, memory_order_relaxed);
+            }
+            block.counts[p].store(0, memory_order_relaxed);
+            block.totals[p].store(0, memory_order_relaxed);
+            block.maxima[p].store(0, memory_order_relaxed);
+        }
+    }
+#endif
+}
+
+void Metrics::writeJson(ostream& out) {
+    MetricsSnapshot totals = snapshot();
+#ifndef SEARCH_ENGINE_NO_METRICS
+    out << "{\n  \"enabled\": true,\n";
+#else
+    out << "{\n  \"enabled\": false,\n";
+#endif
+    out << "  \"counters\": {\n";
+    for (size_t c = 0; c < size_t(Counter::Count); ++c) {
+        out << "    \"" << name(Counter(c)) << "\": " << totals.counters[c]
+            << (c + 1 < size_t(Counter::Count) ? ",\n" : "\n");
+    }
+    out << "  },\n";
+    out << "  \"phases\": {\n";
+    for (size_t p = 0; p < size_t(Phase::Count); ++p) {
+        const LatencyHistogram& histogram = totals.phases[p];
+        double mean = histogram.count > 0 ? histogram.totalNanoseconds / 1000.0 / histogram.count : 0.0;
+        out << "    \"" << name(Phase(p)) << "\": {\"count\": " << histogram.count
+            << ", \"totalMillis\": " << histogram.totalNanoseconds / 1e6
+            << ", \"meanMicros\": " << mean
+            << ", \"p50Micros\": " << histogram.quantile(0.5) / 1000.0
+            << ", \"p90Micros\": " << histogram.quantile(0.9) / 1000.0
+            << ", \"p99Micros\": " << histogram.quantile(0.99) / 1000.0
+            << ", \"maxMicros\": " << histogram.maxNanoseconds / 1000.0 << "}"
+            << (p + 1 < size_t(Phase::Count) ? ",\n" : "\n");
+    }
+    out << "  }\n}\n";
+}
+
+bool Metrics::writeJson(const string& filePath) {
+    ofstream out(filePath);
+    if (!out.is_open()) {
+        cerr << "Error: Could not open " << filePath << " for writing.\n";
+        return false;
+    }
+    writeJson(out);
+    return true;
+}
@@ -0,0 +1,156 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Defining SEARCH_ENGINE_NO_METRICS turns every probe below into an empty
+// inline function, so instrumented code compiles to what it was without it.
+
+// Event counts kept by the registry.
+enum class Counter {
+    DocumentsIndexed,
+    TokensProcessed,
+    BytesRead,
+    PostingsCreated,
+    LookupHits,
+    LookupMisses,
+    Intersections,
+    IntersectionInput,
+    IntersectionOutput,
+    QueriesRun,
+    ResultsReturned,
+    Count
+};
+
+// Phases whose durations are recorded in a latency histogram each.
+enum class Phase {
+    Tokenize,
+    Insert,
+    Merge,
+    Lookup,
+    Sort,
+    Search,
+    Save,
+    Load,
+    Read,
+    Count
+};
+
+// Log-linear histogram of durations in nanoseconds, in the style of HDR
+// histograms: values below 16 get a bucket each, and every power of two above
+// that is split into 16 buckets, so a recorded value is known to within 1/16
+// of itself whatever its magnitude. Durations of up to 2^48 ns (about three
+// days) fit.
+class LatencyHistogram {
+public:
+    static constexpr int SubBucketBits = 4;
+    static constexpr int MaxValueBits = 48;
+    static constexpr size_t BucketCount = ((MaxValueBits - SubBucketBits) << SubBucketBits) + (size_t(1) << SubBucketBits);
+
+    static size_t bucketOf(uint64_t nanoseconds);
+    static uint64_t bucketUpperBound(size_t bucket);
+
+    std::vector<uint64_t> buckets = std::vector<uint64_t>(BucketCount);
+    uint64_t count = 0;
+    uint64_t totalNanoseconds = 0;
+    uint64_t maxNanoseconds = 0;
+
+    // Upper bound of the bucket holding the given quantile, in nanoseconds,
+    // never more than the largest value recorded.
+    uint64_t quantile(double q) const;
+};
+
+// Totals over every thread, as returned by Metrics::snapshot().
+struct MetricsSnapshot {
+    uint64_t counters[size_t(Counter::Count)] = {};
+    LatencyHistogram phases[size_t(Phase::Count)];
+};
+
+// Process-wide registry of counters and phase timings. Every thread that
+// records anything gets its own block of counters and histograms, written
+// only by that thread with relaxed loads and stores, so probes on hot paths
+// neither lock nor bounce a shared cache line between cores. Readers add the
+// blocks up. A block is handed to the next new thread when its owner exits,
+// and keeps its totals, so threads that come and go do not grow the registry.
+class Metrics {
+public:
+    static const char* name(Counter counter);
+    static const char* name(Phase phase);
+
+    static void add(Counter counter, uint64_t amount = 1);
+    static void record(Phase phase, uint64_t nanoseconds);
+
+    static MetricsSnapshot snapshot();
+    static void reset();
+    static void writeJson(std::ostream& out);
+    static bool writeJson(const std::string& filePath);
+
+#ifndef SEARCH_ENGINE_NO_METRICS
+private:
+    struct alignas(64) ThreadBlock {
+        std::atomic<uint64_t> counters[size_t(Counter::Count)] = {};
+        std::atomic<uint64_t> buckets[size_t(Phase::Count)][LatencyHistogram::BucketCount] = {};
+        std::atomic<uint64_t> counts[size_t(Phase::Count)] = {};
+        std::atomic<uint64_t> totals[size_t(Phase::Count)] = {};
+        std::atomic<uint64_t> maxima[size_t(Phase::Count)] = {};
+        std::atomic<bool> claimed{ false };
+    };
+
+    static thread_local ThreadBlock* threadBlock;
+
+    static std::mutex& registryMutex();
+    static std::deque<ThreadBlock>& registry();
+    static ThreadBlock& claimBlock();
+    static void bump(std::atomic<uint64_t>& value, uint64_t amount) {
+        value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+#endif
+};
+
+// Records the time from its construction to its destruction under a phase.
+class ScopedTimer {
+#ifndef SEARCH_ENGINE_NO_METRICS
+private:
+    Phase phase;
+    std::chrono::steady_clock::time_point start;
+
+public:
+    explicit ScopedTimer(Phase phase) : phase(phase), start(std::chrono::steady_clock::now()) {}
+    ~ScopedTimer() {
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+        Metrics::record(phase, static_cast<uint64_t>(elapsed.count()));
+    }
+#else
+public:
+    explicit ScopedTimer(Phase) {}
+#endif
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+};
+
+#ifndef SEARCH_ENGINE_NO_METRICS
+inline void Metrics::add(Counter counter, uint64_t amount) {
+    ThreadBlock& block = threadBlock != nullptr ? *threadBlock : claimBlock();
+    bump(block.counters[size_t(counter)], amount);
+}
+
+inline void Metrics::record(Phase phase, uint64_t nanoseconds) {
+    ThreadBlock& block = threadBlock != nullptr ? *threadBlock : claimBlock();
+    size_t p = size_t(phase);
+    bump(block.buckets[p][LatencyHistogram::bucketOf(nanoseconds)], 1);
+    bump(block.counts[p], 1);
+    bump(block.totals[p], nanoseconds);
+    if (nanoseconds > block.maxima[p].load(std::memory_order_relaxed)) {
+        block.maxima[p].store(nanoseconds, std::memory_order_relaxed);
+    }
+}
+#else
+inline void Metrics::add(Counter, uint64_t) {}
+inline void Metrics::record(Phase, uint64_t) {}
+#endif
@@ -0,0 +1,65 @@
+#include "PartialIndex.h"
+#include "Metrics.h"
+
+using namespace std;
+
+bool PartialIndex::addDocument(const string& filePath) {
+    ScopedTimer timer(Phase::Tokenize);
+    if (!tokenizer.open(filePath)) {
+        failedFiles.push_back(filePath);
+        return false;
+    }
+    addTokens(filePath);
+    return true;
+}
+
+void PartialIndex::addDocument(const string& filePath, vector<char>& contents) {
+    ScopedTimer timer(Phase::Tokenize);
+    tokenizer.open(contents);
+    addTokens(filePath);
+}
+
+void PartialIndex::addFailedDocument(const string& filePath) {
+    failedFiles.push_back(filePath);
+}
+
+// Adds the file open in the tokenizer as the next document. Tokens are views
+// into the tokenizer's buffer; a new term's text is only copied once, when
+// the term is first seen.
+void PartialIndex::addTokens(const string& filePath) {
+    uint32_t localDocId = static_cast<uint32_t>(indexedFiles.size());
+    string_view word;
+    int position = 0;
+    while (tokenizer.next(word)) {
+        auto slot = termSlots.find(word);
+        if (slot == termSlots.end()) {
+            terms.push_back({ string(word), {} });
+            slot = termSlots.emplace(terms.back().word, terms.size() - 1).first;
+        }
+
+        vector<Posting>& postings = terms[slot->second].postings;
+        if (postings.empty() || postings.back().localDocId != localDocId) {
+            postings.push_back({ localDocId, {} });
+        }
+        postings.back().positions.push_back(position++);
+        tokenCount++;
+    }
+    bytesRead += tokenizer.getBytesRead();
+    Metrics::add(Counter::DocumentsIndexed);
+    Metrics::add(Counter::TokensProcessed, static_cast<uint64_t>(position));
+    Metrics::add(Counter::BytesRead, tokenizer.getBytesRead());
+    tokenizer.close();
+
+    indexedFiles.push_back(filePath);
+    documentLengths.push_back(static_cast<uint32_t>(position));
+}
+
+void PartialIndex::clear() {
+    terms.clear();
+    termSlots.clear();
+    indexedFiles.clear();
+    documentLengths.clear();
+    failedFiles.clear();
+    tokenCount = 0;
+    bytesRead = 0;
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include "Tokenizer.h"
+
+// Postings built by one indexing worker over a contiguous run of files.
+// Terms are kept in first-occurrence order so that merging partial indexes
+// in file order inserts exactly what a serial build would have inserted.
+// Postings refer to documents by their position in indexedFiles; global
+// document ids are only assigned when the partial index is merged.
+class PartialIndex {
+public:
+    struct Posting {
+        uint32_t localDocId;
+        std::vector<int> positions;
+    };
+
+    struct TermPostings {
+        std::string word;
+        std::vector<Posting> postings;
+    };
+
+    // A deque so that the words stay in place while termSlots refers to them.
+    std::deque<TermPostings> terms;
+    std::vector<std::string> indexedFiles;
+    std::vector<uint32_t> documentLengths;
+    std::vector<std::string> failedFiles;
+    size_t tokenCount = 0;
+    size_t bytesRead = 0;
+
+    bool addDocument(const std::string& filePath);
+    // Indexes filePath from contents, the whole file already read; contents
+    // is left empty.
+    void addDocument(const std::string& filePath, std::vector<char>& contents);
+    // Records filePath as a file that could not be read.
+    void addFailedDocument(const std::string& filePath);
+    void clear();
+
+private:
+    void addTokens(const std::string& filePath);
+
+    std::unordered_map<std::string_view, size_t> termSlots;
+    Tokenizer tokenizer;
+};
@@ -0,0 +1,50 @@
+#include "PhraseMatcher.h"
+
+using namespace std;
+
+// positions[i] holds the sorted positions of the i-th phrase word. Every
+// occurrence of the rarest word proposes a phrase start; the other lists are
+// checked for start + i with cursors that only move forward, so one document
+// costs a single merge pass over its position lists. Matching start positions
+// are appended to starts in increasing order.
+void PhraseMatcher::findPhrase(const vector<const vector<int>*>& positions, vector<int>& starts) {
+    if (positions.empty()) {
+        return;
+    }
+
+    size_t rarest = 0;
+    for (size_t i = 1; i < positions.size(); ++i) {
+        if (positions[i]->size() < positions[rarest]->size()) {
+            rarest = i;
+        }
+    }
+
+    vector<size_t> cursors(positions.size(), 0);
+    for (int anchor : *positions[rarest]) {
+        int start = anchor - static_cast<int>(rarest);
+        if (start < 0) {
+            continue;
+        }
+
+        bool matched = true;
+        for (size_t i = 0; i < positions.size() && matched; ++i) {
+            if (i == rarest) {
+                continue;
+            }
+            const vector<int>& list = *positions[i];
+            int target = start + static_cast<int>(i);
+            size_t& cursor = cursors[i];
+            while (cursor < list.size() && list[cursor] < target) {
+                cursor++;
+            }
+            if (cursor == list.size()) {
+                return;
+            }
+            matched = (list[cursor] == target);
+        }
+
+        if (matched) {
+            starts.push_back(start);
+        }
+    }
+}
@@ -0,0 +1,9 @@
+#pragma once
+#include <vector>
+
+// Finds the places in one document where the words of a phrase occur at
+// consecutive positions.
+class PhraseMatcher {
+public:
+    static void findPhrase(const std::vector<const std::vector<int>*>& positions, std::vector<int>& starts);
+};
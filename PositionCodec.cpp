@@ -0,0 +1,123 @@
+#include "PositionCodec.h"
+#include <cstring>
+
+using namespace std;
+
+static const uint64_t ContinuationBits = 0x8080808080808080ULL;
+
+size_t PositionCodec::varintSize(uint32_t value) {
+    size_t size = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        size++;
+    }
+    return size;
+}
+
+// Writes the varint at out, which must have room for varintSize(value) bytes,
+// and returns the position just past it.
+uint8_t* PositionCodec::encodeVarint(uint32_t value, uint8_t* out) {
+    while (value >= 0x80) {
+        *out++ = static_cast<uint8_t>(value | 0x80);
+        value >>= 7;
+    }
+    *out++ = static_cast<uint8_t>(value);
+    return out;
+}
+
+bool PositionCodec::decodeVarint(const uint8_t*& data, const uint8_t* end, uint32_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 35 && data < end; shift += 7) {
+        uint8_t byte = *data++;
+        // The fifth byte holds bits 28 to 31, so anything above 0x0F would
+        // be shifted out of the value.
+        if (shift == 28 && byte > 0x0F) {
+            return false;
+        }
+        value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t PositionCodec::encodedSize(const vector<int>& positions) {
+    size_t size = 0;
+    int previous = 0;
+    for (int position : positions) {
+        size += varintSize(static_cast<uint32_t>(position - previous));
+        previous = position;
+    }
+    return size;
+}
+
+uint8_t* PositionCodec::encode(const vector<int>& positions, uint8_t* out) {
+    int previous = 0;
+    for (int position : positions) {
+        out = encodeVarint(static_cast<uint32_t>(position - previous), out);
+        previous = position;
+    }
+    return out;
+}
+
+// Most gaps fit in one byte, so eight bytes are loaded at once and, when none
+// of them has a continuation bit, turned into eight positions without
+// branching per byte. Runs containing longer gaps fall back to decodeVarint.
+// The eight-byte load is only taken while at least eight more positions
+// remain and eight more bytes are left before end. Positions add up in
+// unsigned arithmetic, so corrupt gaps wrap instead of overflowing.
+uint32_t PositionCodec::decode(const uint8_t* data, const uint8_t* end, uint32_t count, int* out) {
+    uint32_t value = 0;
+    uint32_t i = 0;
+
+    while (i + 8 <= count && end - data >= 8) {
+        uint64_t group;
+        memcpy(&group, data, sizeof(group));
+        if ((group & ContinuationBits) == 0) {
+            for (int j = 0; j < 8; ++j) {
+                value += data[j];
+                out[i + j] = static_cast<int>(value);
+            }
+            data += 8;
+            i += 8;
+        }
+        else {
+            uint32_t gap;
+            if (!decodeVarint(data, end, gap)) {
+                return i;
+            }
+            value += gap;
+            out[i++] = static_cast<int>(value);
+        }
+    }
+
+    while (i < count) {
+        uint32_t gap;
+        if (!decodeVarint(data, end, gap)) {
+            return i;
+        }
+        value += gap;
+        out[i++] = static_cast<int>(value);
+    }
+    return i;
+}
+
+bool PositionCodec::decode(const uint8_t* data, const uint8_t* end, uint32_t count, vector<int>& out) {
+    out.resize(count);
+    if (count > 0) {
+        out.resize(decode(data, end, count, out.data()));
+    }
+    return out.size() == count;
+}
+
+bool PositionCodec::validate(const uint8_t* data, size_t byteCount, uint32_t count) {
+    const uint8_t* end = data + byteCount;
+    uint32_t gap;
+    for (uint32_t i = 0; i < count; ++i) {
+        if (!decodeVarint(data, end, gap)) {
+            return false;
+        }
+    }
+    return data == end;
+}
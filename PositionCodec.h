@@ -0,0 +1,28 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// Delta + varint coding for the sorted position lists of a posting. Each
+// position is stored as the gap to the previous one in 7-bit groups, low
+// group first, with the high bit marking that another group follows.
+class PositionCodec {
+public:
+    static size_t varintSize(uint32_t value);
+    static uint8_t* encodeVarint(uint32_t value, uint8_t* out);
+    // Reads a varint from data, which must end before end, and moves data
+    // past it. Returns false if the varint runs past end, is longer than a
+    // 32-bit value needs, or its fifth byte sets bits above bit 31.
+    static bool decodeVarint(const uint8_t*& data, const uint8_t* end, uint32_t& value);
+
+    static size_t encodedSize(const std::vector<int>& positions);
+    static uint8_t* encode(const std::vector<int>& positions, uint8_t* out);
+    // Decodes up to count positions from [data, end) and returns how many it
+    // decoded, fewer than count if the bytes run out or a varint is
+    // malformed. The vector version shrinks out to the positions decoded and
+    // returns whether all count were.
+    static uint32_t decode(const uint8_t* data, const uint8_t* end, uint32_t count, int* out);
+    static bool decode(const uint8_t* data, const uint8_t* end, uint32_t count, std::vector<int>& out);
+    // True if [data, data + byteCount) holds exactly count well-formed varints.
+    static bool validate(const uint8_t* data, size_t byteCount, uint32_t count);
+};
@@ -0,0 +1,172 @@
+#include "PostingIntersection.h"
+#include "Metrics.h"
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SEARCH_ENGINE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+using namespace std;
+
+// Lists whose lengths differ by more than this factor are intersected by
+// galloping through the longer one instead of merging both.
+static const size_t GallopingRatio = 32;
+
+static int lowestSetBit(unsigned int mask) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return static_cast<int>(index);
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+// Returns the first index in [begin, size) whose value is >= target. Probes
+// at exponentially growing distances, then binary searches the last step.
+size_t PostingIntersection::gallop(const uint32_t* data, size_t begin, size_t size, uint32_t target) {
+    if (begin >= size || data[begin] >= target) {
+        return begin;
+    }
+
+    size_t step = 1;
+    size_t low = begin;
+    size_t high = begin + step;
+    while (high < size && data[high] < target) {
+        low = high;
+        step <<= 1;
+        high = begin + step;
+    }
+    if (high > size) {
+        high = size;
+    }
+    return lower_bound(data + low + 1, data + high, target) - data;
+}
+
+void PostingIntersection::intersectGalloping(DocIdSpan small, DocIdSpan large, vector<uint32_t>& out) {
+    size_t cursor = 0;
+    for (size_t i = 0; i < small.size && cursor < large.size; ++i) {
+        cursor = gallop(large.data, cursor, large.size, small.data[i]);
+        if (cursor < large.size && large.data[cursor] == small.data[i]) {
+            out.push_back(small.data[i]);
+            ++cursor;
+        }
+    }
+}
+
+// Compares blocks of four ids from each list against each other in one step:
+// the block of b is rotated through all four lanes, and every lane of a that
+// saw an equal value is emitted. The block with the smaller maximum is then
+// advanced. The tail is merged one id at a time.
+void PostingIntersection::intersectBlocks(DocIdSpan a, DocIdSpan b, vector<uint32_t>& out) {
+    size_t i = 0;
+    size_t j = 0;
+
+#ifdef SEARCH_ENGINE_SSE2
+    while (i + 4 <= a.size && j + 4 <= b.size) {
+        __m128i blockA = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a.data + i));
+        __m128i blockB = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b.data + j));
+
+        __m128i equal = _mm_cmpeq_epi32(blockA, blockB);
+        equal = _mm_or_si128(equal, _mm_cmpeq_epi32(blockA, _mm_shuffle_epi32(blockB, _MM_SHUFFLE(0, 3, 2, 1))));
+        equal = _mm_or_si128(equal, _mm_cmpeq_epi32(blockA, _mm_shuffle_epi32(blockB, _MM_SHUFFLE(1, 0, 3, 2))));
+        equal = _mm_or_si128(equal, _mm_cmpeq_epi32(blockA, _mm_shuffle_epi32(blockB, _MM_SHUFFLE(2, 1, 0, 3))));
+
+        unsigned int mask = static_cast<unsigned int>(_mm_movemask_ps(_mm_castsi128_ps(equal)));
+        while (mask != 0) {
+            out.push_back(a.data[i + lowestSetBit(mask)]);
+            mask &= mask - 1;
+        }
+
+        uint32_t maxA = a.data[i + 3];
+        uint32_t maxB = b.data[j + 3];
+        if (maxA <= maxB) {
+            i += 4;
+        }
+        if (maxB <= maxA) {
+            j += 4;
+        }
+    }
+#endif
+
+    while (i < a.size && j < b.size) {
+        if (a.data[i] < b.data[j]) {
+            ++i;
+        }
+        else if (b.data[j] < a.data[i]) {
+            ++j;
+        }
+        else {
+            out.push_back(a.data[i]);
+            ++i;
+            ++j;
+        }
+    }
+}
+
+void PostingIntersection::intersectTwo(DocIdSpan a, DocIdSpan b, vector<uint32_t>& out) {
+    if (a.size > b.size) {
+        swap(a, b);
+    }
+    if (a.size == 0) {
+        return;
+    }
+    if (b.size / a.size >= GallopingRatio) {
+        intersectGalloping(a, b, out);
+    }
+    else {
+        intersectBlocks(a, b, out);
+    }
+}
+
+vector<uint32_t> PostingIntersection::intersect(vector<DocIdSpan> lists) {
+    vector<uint32_t> result;
+    if (lists.empty()) {
+        return result;
+    }
+
+    sort(lists.begin(), lists.end(), [](const DocIdSpan& a, const DocIdSpan& b) {
+        return a.size < b.size;
+        });
+
+    if (lists.size() == 1) {
+        result.assign(lists[0].data, lists[0].data + lists[0].size);
+        return result;
+    }
+
+    size_t inputSize = 0;
+    for (const DocIdSpan& list : lists) {
+        inputSize += list.size;
+    }
+    intersectTwo(lists[0], lists[1], result);
+
+    vector<uint32_t> next;
+    for (size_t i = 2; i < lists.size() && !result.empty(); ++i) {
+        next.clear();
+        intersectTwo({ result.data(), result.size() }, lists[i], next);
+        result.swap(next);
+    }
+    Metrics::add(Counter::Intersections);
+    Metrics::add(Counter::IntersectionInput, inputSize);
+    Metrics::add(Counter::IntersectionOutput, result.size());
+    return result;
+}
+
+vector<uint32_t> PostingIntersection::difference(DocIdSpan include, DocIdSpan exclude) {
+    vector<uint32_t> result;
+    result.reserve(include.size);
+
+    size_t cursor = 0;
+    for (size_t i = 0; i < include.size; ++i) {
+        cursor = gallop(exclude.data, cursor, exclude.size, include.data[i]);
+        if (cursor >= exclude.size || exclude.data[cursor] != include.data[i]) {
+            result.push_back(include.data[i]);
+        }
+    }
+    return result;
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// A sorted run of document ids, usually the docIds array of a PostingList.
+struct DocIdSpan {
+    const uint32_t* data;
+    size_t size;
+};
+
+// Set operations over sorted document id lists. Multi-way intersections start
+// from the shortest list, so their cost follows the smallest list rather than
+// the sum of all of them.
+class PostingIntersection {
+public:
+    static std::vector<uint32_t> intersect(std::vector<DocIdSpan> lists);
+    static std::vector<uint32_t> difference(DocIdSpan include, DocIdSpan exclude);
+
+    static void intersectTwo(DocIdSpan a, DocIdSpan b, std::vector<uint32_t>& out);
+    static void intersectGalloping(DocIdSpan small, DocIdSpan large, std::vector<uint32_t>& out);
+    static void intersectBlocks(DocIdSpan a, DocIdSpan b, std::vector<uint32_t>& out);
+
+    static size_t gallop(const uint32_t* data, size_t begin, size_t size, uint32_t target);
+};
@@ -0,0 +1,50 @@
+#include "PostingList.h"
+#include <algorithm>
+
+using namespace std;
+
+size_t PostingList::size() const {
+    return docIds.size();
+}
+
+bool PostingList::empty() const {
+    return docIds.empty();
+}
+
+// Documents are indexed in increasing id order, so the common case is an
+// append. Anything else is inserted at its sorted position.
+void PostingList::add(WordInDocument* wid) {
+    updateMaxFrequency(wid);
+    uint32_t docId = wid->getDocId();
+    if (docIds.empty() || docIds.back() < docId) {
+        docIds.push_back(docId);
+        entries.push_back(wid);
+        return;
+    }
+
+    size_t index = lower_bound(docIds.begin(), docIds.end(), docId) - docIds.begin();
+    docIds.insert(index, docId);
+    entries.insert(index, wid);
+}
+
+// Keeps the largest term frequency in the list, which bounds the score any of
+// its documents can get for this term.
+void PostingList::updateMaxFrequency(const WordInDocument* wid) {
+    if (static_cast<uint32_t>(wid->getFrequency()) > maxFrequency) {
+        maxFrequency = static_cast<uint32_t>(wid->getFrequency());
+    }
+}
+
+void PostingList::clear() {
+    docIds.clear();
+    entries.clear();
+    maxFrequency = 0;
+}
+
+WordInDocument* const* PostingList::begin() const {
+    return entries.begin();
+}
+
+WordInDocument* const* PostingList::end() const {
+    return entries.end();
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "WordInDocument.h"
+#include "SharedVector.h"
+
+// Postings of one term, kept sorted by document id. docIds mirrors the ids of
+// entries so that intersections can run over a contiguous array. A copy
+// shares both arrays with the original, and postings appended to it land
+// after the original's, so copying an index does not copy its postings.
+class PostingList {
+public:
+    SharedVector<uint32_t> docIds;
+    SharedVector<WordInDocument*> entries;
+    uint32_t maxFrequency = 0;
+
+    size_t size() const;
+    bool empty() const;
+    void add(WordInDocument* wid);
+    void updateMaxFrequency(const WordInDocument* wid);
+    void clear();
+
+    WordInDocument* const* begin() const;
+    WordInDocument* const* end() const;
+};
@@ -0,0 +1,49 @@
+#include "PostingView.h"
+#include "PositionCodec.h"
+#include <algorithm>
+
+using namespace std;
+
+PostingView PostingView::fromList(const PostingList* list) {
+    PostingView view;
+    if (list != nullptr) {
+        view.docIds = list->docIds.data();
+        view.size = list->size();
+        view.maxFrequency = list->maxFrequency;
+        view.list = list;
+    }
+    return view;
+}
+
+bool PostingView::empty() const {
+    return size == 0;
+}
+
+DocIdSpan PostingView::span() const {
+    return { docIds, size };
+}
+
+// Returns the index of docId, or size when the term does not occur in it.
+size_t PostingView::find(uint32_t docId) const {
+    const uint32_t* it = lower_bound(docIds, docIds + size, docId);
+    if (it == docIds + size || *it != docId) {
+        return size;
+    }
+    return it - docIds;
+}
+
+uint32_t PostingView::frequency(size_t index) const {
+    if (list != nullptr) {
+        return static_cast<uint32_t>(list->entries[index]->getFrequency());
+    }
+    return frequencies[index];
+}
+
+void PostingView::decodePositions(size_t index, vector<int>& out) const {
+    if (list != nullptr) {
+        list->entries[index]->decodePositions(out);
+        return;
+    }
+    PositionCodec::decode(positionBytes + positionOffsets[index], positionBytes + positionOffsets[index + 1],
+        frequencies[index], out);
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include "PostingList.h"
+#include "PostingIntersection.h"
+
+// Read-only view of one term's postings, sorted by document id. It is backed
+// either by an in-memory PostingList or by the arrays of a mapped index file,
+// so query code can run over both without copying postings.
+class PostingView {
+public:
+    const uint32_t* docIds = nullptr;
+    size_t size = 0;
+    uint32_t maxFrequency = 0;
+
+    // In-memory source.
+    const PostingList* list = nullptr;
+
+    // Mapped source: per-posting frequencies and byte offsets of the encoded
+    // positions inside positionBytes.
+    const uint32_t* frequencies = nullptr;
+    const uint64_t* positionOffsets = nullptr;
+    const uint8_t* positionBytes = nullptr;
+
+    static PostingView fromList(const PostingList* list);
+
+    bool empty() const;
+    DocIdSpan span() const;
+    size_t find(uint32_t docId) const;
+    uint32_t frequency(size_t index) const;
+    void decodePositions(size_t index, std::vector<int>& out) const;
+};
@@ -0,0 +1,88 @@
+#include "QueryCache.h"
+#include <algorithm>
+#include <iostream>
+
+using namespace std;
+
+QueryCache::QueryCache(size_t capacity) : capacity(capacity) {
+}
+
+QueryCache::Results QueryCache::lookup(const string& query, uint64_t version) {
+    lock_guard<mutex> lock(cacheMutex);
+    auto slot = slots.find(query);
+    if (slot == slots.end()) {
+        misses++;
+        return nullptr;
+    }
+    if (slot->second->version != version) {
+        entries.erase(slot->second);
+        slots.erase(slot);
+        invalidations++;
+        misses++;
+        return nullptr;
+    }
+    entries.splice(entries.begin(), entries, slot->second);
+    hits++;
+    return entries.front().results;
+}
+
+void QueryCache::insert(const string& query, uint64_t version, Results results) {
+    lock_guard<mutex> lock(cacheMutex);
+    if (capacity == 0 || version < currentVersion) {
+        return;
+    }
+    auto slot = slots.find(query);
+    if (slot != slots.end()) {
+        slot->second->version = version;
+        slot->second->results = move(results);
+        entries.splice(entries.begin(), entries, slot->second);
+        return;
+    }
+    entries.push_front({ query, version, move(results) });
+    slots[query] = entries.begin();
+    evictOverflow();
+}
+
+void QueryCache::evictOverflow() {
+    while (entries.size() > capacity) {
+        slots.erase(entries.back().query);
+        entries.pop_back();
+        evictions++;
+    }
+}
+
+void QueryCache::clear() {
+    lock_guard<mutex> lock(cacheMutex);
+    entries.clear();
+    slots.clear();
+}
+
+// Drops every entry, counting them as stale. Called when a new index version
+// is published, since the entries' results hold on to the old one.
+void QueryCache::invalidate(uint64_t version) {
+    lock_guard<mutex> lock(cacheMutex);
+    currentVersion = max(currentVersion, version);
+    invalidations += entries.size();
+    entries.clear();
+    slots.clear();
+}
+
+void QueryCache::setCapacity(size_t capacity) {
+    lock_guard<mutex> lock(cacheMutex);
+    this->capacity = capacity;
+    evictOverflow();
+}
+
+size_t QueryCache::size() const {
+    lock_guard<mutex> lock(cacheMutex);
+    return entries.size();
+}
+
+void QueryCache::displayStats() const {
+    lock_guard<mutex> lock(cacheMutex);
+    uint64_t lookups = hits + misses;
+    cout << "Query cache: " << entries.size() << "/" << capacity << " entries, "
+        << hits << " hits, " << misses << " misses ("
+        << (lookups > 0 ? 100.0 * hits / lookups : 0.0) << "% hit rate), "
+        << evictions << " evictions, " << invalidations << " stale entries dropped\n";
+}
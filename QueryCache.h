@@ -0,0 +1,58 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct SearchResult;
+
+// Bounded LRU cache from a normalized query to its ranked results, shared by
+// every thread that searches; every call locks the cache for its duration.
+// Entries are stamped with the index version they were computed against, and
+// an entry whose version no longer matches is dropped on lookup. invalidate()
+// drops every entry at once, in time linear in the number of entries, so that
+// results of old versions do not keep their snapshots alive, and from then on
+// refuses results of versions older than the one it was given, which queries
+// that started before the new version was published would otherwise insert.
+class QueryCache {
+public:
+    typedef std::shared_ptr<const std::vector<SearchResult>> Results;
+
+private:
+    struct Entry {
+        std::string query;
+        uint64_t version;
+        Results results;
+    };
+
+    size_t capacity;
+    std::list<Entry> entries;  // most recently used first
+    std::unordered_map<std::string, std::list<Entry>::iterator> slots;
+    mutable std::mutex cacheMutex;
+    uint64_t currentVersion = 0;
+
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    uint64_t invalidations = 0;
+
+    void evictOverflow();
+
+public:
+    static constexpr size_t DefaultCapacity = 256;
+
+    explicit QueryCache(size_t capacity = DefaultCapacity);
+
+    Results lookup(const std::string& query, uint64_t version);
+    void insert(const std::string& query, uint64_t version, Results results);
+    void clear();
+    void invalidate(uint64_t version);
+    void setCapacity(size_t capacity);
+
+    size_t size() const;
+    void displayStats() const;
+};
@@ -0,0 +1,291 @@
+#include "QueryParser.h"
+#include <cctype>
+#include <utility>
+
+using namespace std;
+
+// Terms are matched case-insensitively, so their case is not part of the
+// canonical form.
+static string lowercase(const string& word) {
+    string result;
+    for (char c : word) {
+        result += static_cast<char>(tolower(static_cast<unsigned char>(c)));
+    }
+    return result;
+}
+
+bool QueryNode::isTermList(Type listType) const {
+    if (type != listType) {
+        return false;
+    }
+    for (const QueryNode& child : children) {
+        if (child.type != Term) {
+            return false;
+        }
+    }
+    return true;
+}
+
+string QueryNode::toString() const {
+    switch (type) {
+    case Term:
+        return lowercase(text);
+    case Phrase: {
+        string phrase = "\"";
+        for (size_t i = 0; i < words.size(); ++i) {
+            phrase += (i > 0 ? " " : "") + lowercase(words[i]);
+        }
+        return phrase + "\"";
+    }
+    case Not:
+        return "NOT " + children[0].toString();
+    default: {
+        string result = "(";
+        for (size_t i = 0; i < children.size(); ++i) {
+            if (i > 0) {
+                result += type == And ? " AND " : " OR ";
+            }
+            result += children[i].toString();
+        }
+        return result + ")";
+    }
+    }
+}
+
+bool QueryParser::tokenize(const string& query) {
+    size_t i = 0;
+    while (i < query.size()) {
+        char c = query[i];
+        if (isspace(static_cast<unsigned char>(c))) {
+            i++;
+        }
+        else if (c == '(' || c == ')') {
+            tokens.push_back({ c == '(' ? LeftParen : RightParen, string(1, c) });
+            i++;
+        }
+        else if (c == '+' || c == '-') {
+            tokens.push_back({ c == '+' ? Plus : NotOperator, string(1, c) });
+            i++;
+        }
+        else if (c == '"') {
+            size_t close = query.find('"', i + 1);
+            if (close == string::npos) {
+                error = "missing closing quote";
+                return false;
+            }
+            tokens.push_back({ Quoted, query.substr(i + 1, close - i - 1) });
+            i = close + 1;
+        }
+        else {
+            size_t start = i;
+            while (i < query.size() && !isspace(static_cast<unsigned char>(query[i]))
+                && query[i] != '(' && query[i] != ')' && query[i] != '"') {
+                i++;
+            }
+            string word = query.substr(start, i - start);
+            if (word == "AND") {
+                tokens.push_back({ AndOperator, word });
+            }
+            else if (word == "OR") {
+                tokens.push_back({ OrOperator, word });
+            }
+            else if (word == "NOT") {
+                tokens.push_back({ NotOperator, word });
+            }
+            else {
+                tokens.push_back({ Word, word });
+            }
+        }
+    }
+    tokens.push_back({ End, "" });
+    return true;
+}
+
+const QueryParser::Token& QueryParser::peek() const {
+    return tokens[cursor];
+}
+
+bool QueryParser::startsOperand() const {
+    TokenType type = peek().type;
+    return type == Word || type == Quoted || type == NotOperator || type == Plus || type == LeftParen;
+}
+
+bool QueryParser::parseOr(QueryNode& node) {
+    QueryNode first;
+    if (!parseAnd(first)) {
+        return false;
+    }
+    if (peek().type != OrOperator) {
+        node = move(first);
+        return true;
+    }
+
+    node.type = QueryNode::Or;
+    node.children.push_back(move(first));
+    while (peek().type == OrOperator) {
+        cursor++;
+        QueryNode next;
+        if (!parseAnd(next)) {
+            return false;
+        }
+        node.children.push_back(move(next));
+    }
+    return true;
+}
+
+bool QueryParser::parseAnd(QueryNode& node) {
+    QueryNode first;
+    if (!parseUnary(first)) {
+        return false;
+    }
+    if (peek().type != AndOperator && !startsOperand()) {
+        node = move(first);
+        return true;
+    }
+
+    node.type = QueryNode::And;
+    node.children.push_back(move(first));
+    while (peek().type == AndOperator || startsOperand()) {
+        if (peek().type == AndOperator) {
+            cursor++;
+        }
+        QueryNode next;
+        if (!parseUnary(next)) {
+            return false;
+        }
+        node.children.push_back(move(next));
+    }
+    return true;
+}
+
+bool QueryParser::parseUnary(QueryNode& node) {
+    if (peek().type == NotOperator) {
+        cursor++;
+        node.type = QueryNode::Not;
+        node.children.resize(1);
+        return parseUnary(node.children[0]);
+    }
+    if (peek().type == Plus) {
+        cursor++;
+        return parseUnary(node);
+    }
+    return parsePrimary(node);
+}
+
+bool QueryParser::parsePrimary(QueryNode& node) {
+    const Token& token = peek();
+    switch (token.type) {
+    case Word:
+        node.type = QueryNode::Term;
+        node.text = token.text;
+        cursor++;
+        return true;
+    case Quoted: {
+        node.type = QueryNode::Phrase;
+        size_t i = 0;
+        const string& phrase = token.text;
+        while (i < phrase.size()) {
+            while (i < phrase.size() && isspace(static_cast<unsigned char>(phrase[i]))) {
+                i++;
+            }
+            size_t start = i;
+            while (i < phrase.size() && !isspace(static_cast<unsigned char>(phrase[i]))) {
+                i++;
+            }
+            if (i > start) {
+                node.words.push_back(phrase.substr(start, i - start));
+            }
+        }
+        cursor++;
+        return true;
+    }
+    case LeftParen:
+        cursor++;
+        if (!parseOr(node)) {
+            return false;
+        }
+        if (peek().type != RightParen) {
+            error = "missing closing parenthesis";
+            return false;
+        }
+        cursor++;
+        return true;
+    case End:
+        error = "query ends where a word was expected";
+        return false;
+    default:
+        error = "unexpected '" + token.text + "'";
+        return false;
+    }
+}
+
+bool QueryParser::parse(const string& query, QueryNode& root, string& error) {
+    QueryParser parser;
+    if (!parser.tokenize(query)) {
+        error = parser.error;
+        return false;
+    }
+    if (parser.peek().type == End) {
+        error = "empty query";
+        return false;
+    }
+    if (!parser.parseOr(root)) {
+        error = parser.error;
+        return false;
+    }
+    if (parser.peek().type != End) {
+        error = "unexpected '" + parser.peek().text + "'";
+        return false;
+    }
+    simplify(root);
+    return true;
+}
+
+// Rewrites a tree into the shape the planner expects: nested ANDs and ORs are
+// flattened into one n-ary node, double negations cancel, and a negated OR
+// inside an AND is split into one exclusion per operand (a AND NOT (b OR c)
+// becomes a AND NOT b AND NOT c), so every exclusion can be applied directly
+// to the running intersection.
+void QueryParser::simplify(QueryNode& node) {
+    for (QueryNode& child : node.children) {
+        simplify(child);
+    }
+
+    if (node.type == QueryNode::Not) {
+        if (node.children[0].type == QueryNode::Not) {
+            QueryNode inner = move(node.children[0].children[0]);
+            node = move(inner);
+        }
+        return;
+    }
+    if (node.type != QueryNode::And && node.type != QueryNode::Or) {
+        return;
+    }
+
+    vector<QueryNode> children;
+    for (QueryNode& child : node.children) {
+        if (child.type == node.type) {
+            for (QueryNode& grandchild : child.children) {
+                children.push_back(move(grandchild));
+            }
+        }
+        else if (node.type == QueryNode::And && child.type == QueryNode::Not && child.children[0].type == QueryNode::Or) {
+            for (QueryNode& operand : child.children[0].children) {
+                QueryNode exclusion;
+                exclusion.type = QueryNode::Not;
+                exclusion.children.push_back(move(operand));
+                simplify(exclusion);
+                children.push_back(move(exclusion));
+            }
+        }
+        else {
+            children.push_back(move(child));
+        }
+    }
+    node.children = move(children);
+
+    if (node.children.size() == 1) {
+        QueryNode only = move(node.children[0]);
+        node = move(only);
+    }
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <string>
+#include <vector>
+
+// Operator tree of a boolean query. Term leaves hold a word as typed (it may
+// contain wildcards); Phrase leaves hold the words between a pair of quotes.
+struct QueryNode {
+    enum Type { Term, Phrase, And, Or, Not };
+
+    Type type = Term;
+    std::string text;
+    std::vector<std::string> words;
+    std::vector<QueryNode> children;
+
+    bool isTermList(Type listType) const;
+    // Canonical text of the tree: terms lowercased, phrases in quotes,
+    // operators in upper case and every AND and OR parenthesized. The query
+    // cache keys on it, so two trees must only share a text if they match the
+    // same documents; in particular a phrase never prints like its words
+    // ANDed together.
+    std::string toString() const;
+};
+
+// Parses queries of the form
+//
+//     query   := orExpr
+//     orExpr  := andExpr ("OR" andExpr)*
+//     andExpr := unary (["AND"] unary)*
+//     unary   := ("NOT" | "-") unary | "+" unary | primary
+//     primary := "(" orExpr ")" | "\"" words "\"" | word
+//
+// so juxtaposed words are ANDed, NOT binds tighter than AND, and AND tighter
+// than OR. The keywords are only recognized in upper case so that "and", "or"
+// and "not" can still be searched for. "a - b", "a -b" and "a NOT b" all
+// exclude b; "+" marks a required word, which every word already is.
+class QueryParser {
+private:
+    enum TokenType { Word, Quoted, AndOperator, OrOperator, NotOperator, Plus, LeftParen, RightParen, End };
+
+    struct Token {
+        TokenType type;
+        std::string text;
+    };
+
+    std::vector<Token> tokens;
+    size_t cursor = 0;
+    std::string error;
+
+    bool tokenize(const std::string& query);
+    const Token& peek() const;
+    bool startsOperand() const;
+    bool parseOr(QueryNode& node);
+    bool parseAnd(QueryNode& node);
+    bool parseUnary(QueryNode& node);
+    bool parsePrimary(QueryNode& node);
+
+public:
+    static bool parse(const std::string& query, QueryNode& root, std::string& error);
+    static void simplify(QueryNode& node);
+};
@@ -0,0 +1,48 @@
+#include "ResultFormatter.h"
+#include <cstdio>
+
+using namespace std;
+
+// Scores are printed with %g, which is what an ostream with default flags
+// prints for a double.
+void ResultFormatter::appendDocument(string& out, const ResultDocument& document) {
+    char score[32];
+    snprintf(score, sizeof(score), "%g", document.score);
+    out += "Document: ";
+    out += document.path;
+    out += ", Score: ";
+    out += score;
+    out += '\n';
+
+    for (const MatchedTerm& match : document.matches) {
+        out += "  ";
+        out += match.term;
+        out += " - Frequency: ";
+        out += to_string(match.positions.size());
+        out += ", Positions: [";
+        for (size_t i = 0; i < match.positions.size(); ++i) {
+            if (i != 0) {
+                out += ", ";
+            }
+            out += to_string(match.positions[i]);
+        }
+        out += "]\n";
+    }
+}
+
+string ResultFormatter::format(const vector<ResultDocument>& documents) {
+    if (documents.empty()) {
+        return "No results found.\n";
+    }
+
+    string out;
+    for (const ResultDocument& document : documents) {
+        appendDocument(out, document);
+    }
+    return out;
+}
+
+void ResultFormatter::write(ostream& out, const vector<ResultDocument>& documents) {
+    string text = format(documents);
+    out.write(text.data(), text.size());
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include <ostream>
+#include <string>
+#include <vector>
+#include "SearchEngine.h"
+
+// Turns a page of results into the text shown for it. The page is written
+// into one buffer and handed to the stream in a single write, instead of a
+// flushed line per document and term.
+class ResultFormatter {
+private:
+    static void appendDocument(std::string& out, const ResultDocument& document);
+
+public:
+    static std::string format(const std::vector<ResultDocument>& documents);
+    static void write(std::ostream& out, const std::vector<ResultDocument>& documents);
+};
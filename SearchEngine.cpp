@@ -1,13 +1,24 @@
 #include "SearchEngine.h"
+#include "Metrics.h"
+#include "FilePrefetcher.h"
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <chrono>
 #include <unordered_set>
+#include <algorithm>
+#include <iterator>
+#include <unordered_map>
+#include <thread>
+#include <atomic>
+#include <cmath>
 bool SearchEngine::useHashMap = true;
 
 using namespace std;
 
+// Share of the score a fuzzy expansion keeps per edit from the query word.
+static const double FuzzyEditWeight = 0.5;
+
 string SearchEngine::normalize(const string& word) {
     string result;
     for (char c : word) {
@@ -18,213 +29,1715 @@ string SearchEngine::normalize(const string& word) {
     return result;
 }
 
-vector<string> SearchEngine::splitQuery(const string& query) const {
-    vector<string> words;
-    string currentWord;
-    for (char c : query) {
-        if (isspace(c)) {
-            if (!currentWord.empty()) {
-                words.push_back(currentWord);
-                currentWord.clear();
-            }
+SearchEngine::SearchEngine() {
+    shared_ptr<IndexSnapshot> initial = make_shared<IndexSnapshot>();
+    initial->hashMap = make_shared<HashMapSearch>();
+    initial->trie = make_shared<TrieSearch>();
+    initial->documents = make_shared<DocumentTable>();
+    published.publish(initial);
+    purger = thread(&SearchEngine::purgeLoop, this);
+}
+
+SearchEngine::~SearchEngine() {
+    {
+        lock_guard<mutex> lock(purgeMutex);
+        purgerStopping = true;
+    }
+    purgeSignal.notify_one();
+    purger.join();
+}
+
+PostingView QuerySource::lookup(const string& normalizedWord) const {
+    PostingView view;
+    if (lookups != nullptr && lookups->findView(normalizedWord, view)) {
+        return view;
+    }
+    if (mapped != nullptr) {
+        view = mapped->lookup(normalizedWord);
+    }
+    else {
+        view = PostingView::fromList(hashMap != nullptr ? hashMap->findPostings(normalizedWord) : trie->findPostings(normalizedWord));
+    }
+    if (lookups != nullptr) {
+        lookups->storeView(normalizedWord, view);
+    }
+    return view;
+}
+
+TermLookupCache::Shard& TermLookupCache::shardOf(const string& word) {
+    return shards[hash<string>()(word) % ShardCount];
+}
+
+bool TermLookupCache::findView(const string& normalizedWord, PostingView& view) {
+    Shard& shard = shardOf(normalizedWord);
+    lock_guard<mutex> lock(shard.mutex);
+    auto found = shard.views.find(normalizedWord);
+    if (found == shard.views.end()) {
+        return false;
+    }
+    view = found->second;
+    return true;
+}
+
+void TermLookupCache::storeView(const string& normalizedWord, const PostingView& view) {
+    Shard& shard = shardOf(normalizedWord);
+    lock_guard<mutex> lock(shard.mutex);
+    shard.views.emplace(normalizedWord, view);
+}
+
+bool TermLookupCache::findExpansion(const string& word, ExpandedTerm& term) {
+    Shard& shard = shardOf(word);
+    lock_guard<mutex> lock(shard.mutex);
+    auto found = shard.expansions.find(word);
+    if (found == shard.expansions.end()) {
+        return false;
+    }
+    term = found->second;
+    return true;
+}
+
+void TermLookupCache::storeExpansion(const string& word, const ExpandedTerm& term) {
+    Shard& shard = shardOf(word);
+    lock_guard<mutex> lock(shard.mutex);
+    shard.expansions.emplace(word, term);
+}
+
+vector<pair<string, PostingView>> QuerySource::matchTerms(const WildcardPattern& pattern, size_t maxTerms) const {
+    if (mapped != nullptr) {
+        return mapped->matchTerms(pattern, maxTerms);
+    }
+    vector<pair<string, PostingView>> terms;
+    auto matches = hashMap != nullptr ? hashMap->matchTerms(pattern, maxTerms) : trie->matchTerms(pattern, maxTerms);
+    for (const auto& match : matches) {
+        terms.emplace_back(match.first, PostingView::fromList(match.second));
+    }
+    return terms;
+}
+
+vector<pair<string, PostingView>> QuerySource::matchFuzzy(const LevenshteinAutomaton& automaton) const {
+    if (mapped != nullptr) {
+        return mapped->matchFuzzy(automaton);
+    }
+    vector<pair<string, PostingView>> terms;
+    auto matches = hashMap != nullptr ? hashMap->matchFuzzy(automaton) : trie->matchFuzzy(automaton);
+    for (const auto& match : matches) {
+        terms.emplace_back(match.first, PostingView::fromList(match.second));
+    }
+    return terms;
+}
+
+// Bitmaps are cached by the index holding the postings, so they live exactly
+// as long as the postings they were built from.
+shared_ptr<const DocIdBitmap> QuerySource::bitmap(const string& term, const PostingView& view) const {
+    TermBitmapCache& cache = mapped != nullptr ? mapped->bitmapCache()
+        : hashMap != nullptr ? hashMap->bitmapCache() : trie->bitmapCache();
+    return cache.get(term, view.span());
+}
+
+// With a segmented index open, queries run over its segments, oldest first,
+// and then the in-memory segment. Otherwise they are served from the mapped
+// index while one is open, and from the selected in-memory backend if not.
+void SearchEngine::querySources(bool useHashMap, const QueryView& view, vector<QuerySource>& sources) const {
+    const IndexSnapshot& index = *view.index;
+    CorpusStatistics statistics;
+    uint64_t totalLength = 0;
+    if (!index.segmented) {
+        QuerySource source;
+        if (index.mapped != nullptr) {
+            source.mapped = index.mapped.get();
+            statistics.documentCount = index.mapped->documentCount();
+            statistics.minLength = index.mapped->minLength();
+            statistics.lengths = index.mapped->lengthData();
+            statistics.deleted = &index.mapped->deletedDocuments();
+            totalLength = index.mapped->totalLength();
         }
         else {
-            currentWord += c;
+            if (useHashMap) {
+                source.hashMap = index.hashMap.get();
+            }
+            else {
+                source.trie = index.trie.get();
+            }
+            statistics.documentCount = index.documents->size();
+            statistics.minLength = index.documents->minLength();
+            statistics.lengths = index.documents->lengthData();
+            statistics.deleted = &index.documents->deletedDocuments();
+            totalLength = index.documents->totalLength();
+        }
+        if (statistics.deleted->empty()) {
+            statistics.deleted = nullptr;
+        }
+        if (statistics.documentCount > 0) {
+            statistics.averageLength = static_cast<double>(totalLength) / statistics.documentCount;
         }
+        source.documentCount = statistics.documentCount;
+        source.statistics = statistics;
+        sources.push_back(source);
+        return;
+    }
+
+    // Each segment's lengths are indexed by its own ids; the other statistics
+    // are summed over the whole snapshot. Deleted documents are looked up by
+    // global id, through each source's docBase.
+    const SegmentedIndex::Snapshot& snapshot = *view.segments;
+    statistics.minLength = UINT32_MAX;
+    if (snapshot.deleted != nullptr && !snapshot.deleted->empty()) {
+        statistics.deleted = snapshot.deleted.get();
     }
-    if (!currentWord.empty()) {
-        words.push_back(currentWord);
+    for (const shared_ptr<const SegmentedIndex::Segment>& segment : snapshot.segments) {
+        QuerySource source;
+        source.mapped = &segment->index;
+        source.docBase = segment->docBase;
+        source.documentCount = segment->index.documentCount();
+        source.statistics.lengths = segment->index.lengthData();
+        statistics.minLength = min(statistics.minLength, segment->index.minLength());
+        totalLength += segment->index.totalLength();
+        sources.push_back(source);
+    }
+    if (snapshot.memory != nullptr && snapshot.memory->documents.size() > 0) {
+        QuerySource source;
+        source.hashMap = &snapshot.memory->index;
+        source.docBase = snapshot.memory->docBase;
+        source.documentCount = snapshot.memory->documents.size();
+        source.statistics.lengths = snapshot.memory->documents.lengthData();
+        statistics.minLength = min(statistics.minLength, snapshot.memory->documents.minLength());
+        totalLength += snapshot.memory->documents.totalLength();
+        sources.push_back(source);
+    }
+    for (const QuerySource& source : sources) {
+        statistics.documentCount += source.documentCount;
+    }
+    if (statistics.documentCount > 0) {
+        statistics.averageLength = static_cast<double>(totalLength) / statistics.documentCount;
+    }
+    for (QuerySource& source : sources) {
+        const uint32_t* lengths = source.statistics.lengths;
+        source.statistics = statistics;
+        source.statistics.lengths = lengths;
+        source.statistics.docBase = source.docBase;
+        source.siblings = &sources;
     }
-    return words;
 }
 
-void SearchEngine::displayResults(const vector<WordInDocument*>& results) const {
-    if (results.empty()) {
-        cout << "No results found.\n";
-        return;
+PostingView SearchEngine::lookupTerm(const string& word, const QuerySource& source) const {
+    ScopedTimer timer(Phase::Lookup);
+    return source.lookup(normalize(word));
+}
+
+// The number of documents containing term in the whole collection: its list
+// length, summed over every segment when the source is one of several.
+size_t SearchEngine::documentFrequency(const string& term, const PostingView& view, const QuerySource& source) const {
+    if (source.siblings == nullptr) {
+        return view.size;
+    }
+    size_t frequency = 0;
+    for (const QuerySource& sibling : *source.siblings) {
+        frequency += sibling.lookup(term).size;
     }
-    for (const auto& result : results) {
-        result->display();
+    return frequency;
+}
+
+// Paths come from the snapshot the results were computed on, or from one with
+// the same version, which holds the same documents.
+string SearchEngine::documentPath(uint32_t docId, const QueryView& view) const {
+    if (!view.index->segmented) {
+        return view.index->mapped != nullptr ? view.index->mapped->getPath(docId) : view.index->documents->getPath(docId);
     }
+
+    const SegmentedIndex::Snapshot& snapshot = *view.segments;
+    if (snapshot.memory != nullptr && docId >= snapshot.memory->docBase) {
+        return snapshot.memory->documents.getPath(docId - snapshot.memory->docBase);
+    }
+    auto segment = upper_bound(snapshot.segments.begin(), snapshot.segments.end(), docId,
+        [](uint32_t id, const shared_ptr<const SegmentedIndex::Segment>& candidate) {
+            return id < candidate->docBase;
+        });
+    --segment;
+    return (*segment)->index.getPath(docId - (*segment)->docBase);
 }
 
-void SearchEngine::indexDocuments(const string& folderPath, bool useHashMap, int numFiles) {
-    int filesIndexed = 0;
-    for (int i = 1; filesIndexed < numFiles; ++i) {
-        ostringstream fileName;
-        fileName << folderPath << "/review_" << i << ".txt";
-        if (fs::exists(fileName.str())) {
-            indexDocument(fileName.str(), useHashMap);
-            filesIndexed++;
+vector<RankedTerm> SearchEngine::rankTerms(const Bm25Ranker& ranker, const vector<ExpandedTerm>& terms, const QuerySource& source) const {
+    vector<RankedTerm> rankedTerms;
+    for (const ExpandedTerm& term : terms) {
+        for (size_t i = 0; i < term.views.size(); ++i) {
+            RankedTerm ranked = ranker.prepare(term.views[i], documentFrequency(term.terms[i], term.views[i], source));
+            if (!term.weights.empty()) {
+                ranked.idf *= term.weights[i];
+                ranked.upperBound *= term.weights[i];
+            }
+            rankedTerms.push_back(ranked);
         }
-        else {
-            cout << "File not found: " << fileName.str() << "\n";
+    }
+    return rankedTerms;
+}
+
+// Positions are only looked up for the documents that made the top k, after
+// ranking, so a query over long lists never touches most of their positions.
+vector<SearchResult> SearchEngine::collectResults(const vector<ScoredDocument>& ranked, const vector<ExpandedTerm>& terms, const QuerySource& source) const {
+    vector<SearchResult> results;
+    results.reserve(ranked.size());
+    for (const ScoredDocument& document : ranked) {
+        SearchResult result = { document.docId + source.docBase, document.score, {} };
+        for (const ExpandedTerm& term : terms) {
+            for (size_t i = 0; i < term.views.size(); ++i) {
+                size_t index = term.views[i].find(document.docId);
+                if (index < term.views[i].size) {
+                    result.matches.push_back({ term.terms[i], term.views[i], index, {} });
+                }
+            }
         }
+        results.push_back(move(result));
     }
-    cout << "Indexed " << filesIndexed << " files successfully.\n";
+    return results;
 }
 
-void SearchEngine::indexDocument(const string& filePath, bool useHashMap) {
-    ifstream file(filePath);
-    if (!file.is_open()) {
-        cerr << "Error opening file: " << filePath << "\n";
+uint32_t SearchHit::docId() const {
+    return postings.docIds[index];
+}
+
+uint32_t SearchHit::frequency() const {
+    return phrasePositions.empty() ? postings.frequency(index) : static_cast<uint32_t>(phrasePositions.size());
+}
+
+bool ExpandedTerm::empty() const {
+    return views.empty();
+}
+
+// A term with one view spans its postings directly, so only the ids of terms
+// with several are merged.
+void ExpandedTerm::unionDocIds() {
+    if (views.size() < 2) {
         return;
     }
+    for (const PostingView& view : views) {
+        docIds.insert(docIds.end(), view.docIds, view.docIds + view.size);
+    }
+    sort(docIds.begin(), docIds.end());
+    docIds.erase(unique(docIds.begin(), docIds.end()), docIds.end());
+}
 
-    static unordered_set<string> indexedFiles;
-    if (indexedFiles.find(filePath) != indexedFiles.end()) {
-        cout << "File already indexed: " << filePath << "\n";
-        return;
+DocIdSpan ExpandedTerm::span() const {
+    if (views.size() == 1) {
+        return views[0].span();
+    }
+    return { docIds.data(), docIds.size() };
+}
+
+// Wildcard words ("foo*", "b?d") are expanded to their wildcardTopK most
+// frequent matching terms, so a short prefix never pulls in the postings of
+// the whole vocabulary. The trie backend finds those terms without walking
+// subtrees that cannot match or cannot beat the terms already found.
+//
+// Fuzzy words ("recieve~", "recieve~1"), and every plain word while a fuzzy
+// distance is set, are expanded to the wildcardTopK terms closest to them.
+// Each edit halves a term's share of the score, so exact matches rank first.
+ExpandedTerm SearchEngine::expandTerm(const string& word, const QuerySource& source) const {
+    ExpandedTerm term;
+    string fuzzyWord = word;
+    unsigned distance = fuzzyDistance;
+    bool fuzzy = !WildcardPattern::isWildcard(word) && (LevenshteinAutomaton::parse(word, fuzzyWord, distance) || distance > 0);
+    if (fuzzy) {
+        return expandFuzzy(fuzzyWord, distance, source);
+    }
+    if (!WildcardPattern::isWildcard(word)) {
+        PostingView view = lookupTerm(word, source);
+        if (!view.empty()) {
+            term.terms.push_back(normalize(word));
+            term.views.push_back(view);
+        }
+        return term;
+    }
+
+    if (source.lookups != nullptr && source.lookups->findExpansion(word, term)) {
+        return term;
+    }
+
+    WildcardPattern pattern(word);
+    if (source.siblings == nullptr) {
+        for (const auto& match : source.matchTerms(pattern, wildcardTopK)) {
+            term.terms.push_back(match.first);
+            term.views.push_back(match.second);
+        }
+    }
+    else {
+        for (const string& expansion : collectionExpansions(pattern, *source.siblings)) {
+            PostingView view = source.lookup(expansion);
+            if (!view.empty()) {
+                term.terms.push_back(expansion);
+                term.views.push_back(view);
+            }
+        }
+    }
+
+    term.unionDocIds();
+    if (source.lookups != nullptr) {
+        source.lookups->storeExpansion(word, term);
+    }
+    return term;
+}
+
+ExpandedTerm SearchEngine::expandFuzzy(const string& word, unsigned distance, const QuerySource& source) const {
+    LevenshteinAutomaton automaton(word, distance);
+    string key = automaton.text() + "~" + to_string(automaton.distanceLimit());
+    ExpandedTerm term;
+    if (source.lookups != nullptr && source.lookups->findExpansion(key, term)) {
+        return term;
+    }
+
+    vector<QuerySource> single;
+    const vector<QuerySource>* sources = source.siblings;
+    if (sources == nullptr) {
+        single.push_back(source);
+        sources = &single;
+    }
+    for (const auto& expansion : fuzzyExpansions(automaton, *sources)) {
+        PostingView view = source.lookup(expansion.first);
+        if (!view.empty()) {
+            term.terms.push_back(expansion.first);
+            term.views.push_back(view);
+            term.weights.push_back(pow(FuzzyEditWeight, expansion.second));
+        }
+    }
+
+    term.unionDocIds();
+    if (source.lookups != nullptr) {
+        source.lookups->storeExpansion(key, term);
+    }
+    return term;
+}
+
+// The wildcardTopK terms within the automaton's distance across all sources,
+// closest first and, at the same distance, most frequent first, each with
+// its distance. Segments expand a fuzzy word to the same terms, like
+// wildcard words.
+vector<pair<string, unsigned>> SearchEngine::fuzzyExpansions(const LevenshteinAutomaton& automaton, const vector<QuerySource>& sources) const {
+    unordered_map<string, size_t> frequencies;
+    for (const QuerySource& source : sources) {
+        for (const auto& match : source.matchFuzzy(automaton)) {
+            frequencies[match.first] += match.second.size;
+        }
+    }
+
+    struct Candidate {
+        string term;
+        unsigned distance;
+        size_t frequency;
+    };
+    vector<Candidate> candidates;
+    for (auto& entry : frequencies) {
+        candidates.push_back({ entry.first, automaton.distanceTo(entry.first), entry.second });
+    }
+    auto closer = [](const Candidate& a, const Candidate& b) {
+        if (a.distance != b.distance) {
+            return a.distance < b.distance;
+        }
+        if (a.frequency != b.frequency) {
+            return a.frequency > b.frequency;
+        }
+        return a.term < b.term;
+    };
+    if (wildcardTopK != 0 && candidates.size() > wildcardTopK) {
+        partial_sort(candidates.begin(), candidates.begin() + wildcardTopK, candidates.end(), closer);
+        candidates.resize(wildcardTopK);
+    }
+    else {
+        sort(candidates.begin(), candidates.end(), closer);
+    }
+
+    vector<pair<string, unsigned>> expansions;
+    for (Candidate& candidate : candidates) {
+        expansions.emplace_back(move(candidate.term), candidate.distance);
+    }
+    return expansions;
+}
+
+// The wildcardTopK terms matching pattern that are most frequent across all
+// sources. Every segment expands a wildcard word to these same terms, so the
+// word means the same thing in each of them.
+vector<string> SearchEngine::collectionExpansions(const WildcardPattern& pattern, const vector<QuerySource>& sources) const {
+    unordered_map<string, size_t> frequencies;
+    for (const QuerySource& source : sources) {
+        for (const auto& match : source.matchTerms(pattern, 0)) {
+            frequencies[match.first] += match.second.size;
+        }
+    }
+
+    vector<pair<string, size_t>> terms(frequencies.begin(), frequencies.end());
+    auto moreFrequent = [](const pair<string, size_t>& a, const pair<string, size_t>& b) {
+        if (a.second != b.second) {
+            return a.second > b.second;
+        }
+        return a.first < b.first;
+    };
+    if (wildcardTopK != 0 && terms.size() > wildcardTopK) {
+        partial_sort(terms.begin(), terms.begin() + wildcardTopK, terms.end(), moreFrequent);
+        terms.resize(wildcardTopK);
+    }
+    else {
+        sort(terms.begin(), terms.end(), moreFrequent);
+    }
+
+    vector<string> expansions;
+    for (auto& term : terms) {
+        expansions.push_back(move(term.first));
+    }
+    return expansions;
+}
+
+// The limit best documents (0 means all) containing every word, ranked by BM25 with
+// one hit per word (or per matching expansion of a wildcard word). A single
+// word is a disjunction over its expansions and is ranked with MaxScore, so
+// low-scoring expansions are only probed for documents that can still make
+// the cut; several words are intersected first and the candidates ranked.
+// When even the rarest word occurs in a large share of the documents, the
+// intersection runs over the words' bitmaps rather than their lists.
+vector<SearchResult> SearchEngine::matchAll(const vector<string>& words, size_t limit, const QuerySource& source) const {
+    vector<ExpandedTerm> terms;
+    for (const string& word : words) {
+        terms.push_back(expandTerm(word, source));
+        if (terms.back().empty()) {
+            return {};
+        }
+    }
+
+    Bm25Ranker ranker(source.statistics);
+    vector<RankedTerm> rankedTerms = rankTerms(ranker, terms, source);
+    if (terms.size() == 1) {
+        return collectResults(ranker.topKDisjunctive(rankedTerms, limit), terms, source);
     }
-    indexedFiles.insert(filePath);
 
-    string word;
-    int position = 0;
-    while (file >> word) {
+    vector<DocIdSpan> spans;
+    size_t smallest = source.documentCount;
+    for (const ExpandedTerm& term : terms) {
+        spans.push_back(term.span());
+        smallest = min(smallest, term.span().size);
+    }
+    vector<uint32_t> matches;
+    if (DocIdBitmap::prefersBitmap(smallest, source.documentCount)) {
+        shared_ptr<const DocIdBitmap> intersection = termBitmap(terms[0], source);
+        for (size_t i = 1; i < terms.size() && !intersection->empty(); ++i) {
+            intersection = make_shared<const DocIdBitmap>(DocIdBitmap::intersect(*intersection, *termBitmap(terms[i], source)));
+        }
+        matches = intersection->toVector();
+    }
+    else {
+        matches = PostingIntersection::intersect(spans);
+    }
+    return collectResults(ranker.topKCandidates(matches, rankedTerms, limit), terms, source);
+}
+
+// The limit best documents containing any of the words. Every
+// expansion of every word is one list of the disjunction, ranked with
+// MaxScore.
+vector<SearchResult> SearchEngine::matchAny(const vector<string>& words, size_t limit, const QuerySource& source) const {
+    vector<ExpandedTerm> terms;
+    for (const string& word : words) {
+        ExpandedTerm term = expandTerm(word, source);
+        if (!term.empty()) {
+            terms.push_back(move(term));
+        }
+    }
+
+    Bm25Ranker ranker(source.statistics);
+    return collectResults(ranker.topKDisjunctive(rankTerms(ranker, terms, source), limit), terms, source);
+}
+
+// Documents where the words occur at consecutive positions. Candidates come
+// from intersecting the words' postings; for each one the position lists are
+// decoded into reused buffers and checked with PhraseMatcher.
+void SearchEngine::findPhrase(const vector<string>& words, const QuerySource& source, PhraseMatches& matches) const {
+    vector<DocIdSpan> spans;
+    for (const string& word : words) {
         string normalizedWord = normalize(word);
-        if (!normalizedWord.empty()) {
-            if (useHashMap) {
-                hashMapSearch.insertWord(normalizedWord, filePath, position++);
+        if (normalizedWord.empty()) {
+            continue;  // the indexer skips such tokens without using up a position
+        }
+        PostingView view = lookupTerm(word, source);
+        if (view.empty()) {
+            matches.views.clear();
+            return;
+        }
+        matches.label += (matches.words.empty() ? "" : " ") + normalizedWord;
+        matches.words.push_back(normalizedWord);
+        matches.views.push_back(view);
+        spans.push_back(view.span());
+    }
+    matches.label = "\"" + matches.label + "\"";
+    if (matches.views.empty()) {
+        return;
+    }
+
+    const vector<PostingView>& views = matches.views;
+    vector<uint32_t> candidates = PostingIntersection::intersect(spans);
+    vector<size_t> cursors(views.size(), 0);
+    vector<vector<int>> positions(views.size());
+    vector<const vector<int>*> positionLists;
+    for (const vector<int>& list : positions) {
+        positionLists.push_back(&list);
+    }
+
+    vector<int> starts;
+    for (uint32_t docId : candidates) {
+        for (size_t i = 0; i < views.size(); ++i) {
+            cursors[i] = PostingIntersection::gallop(views[i].docIds, cursors[i], views[i].size, docId);
+            views[i].decodePositions(cursors[i], positions[i]);
+        }
+
+        starts.clear();
+        PhraseMatcher::findPhrase(positionLists, starts);
+        if (!starts.empty()) {
+            matches.docIds.push_back(docId);
+            matches.frequencies.push_back(static_cast<uint32_t>(starts.size()));
+            matches.firstWordIndexes.push_back(cursors[0]);
+            matches.starts.push_back(starts);
+        }
+    }
+}
+
+// The phrase is ranked as a single term whose frequency is its number of
+// occurrences and whose document frequency is the number of documents it
+// occurs in across all sources.
+vector<SearchResult> SearchEngine::rankPhrase(PhraseMatches& matches, size_t documentFrequency, size_t limit, const QuerySource& source) const {
+    Bm25Ranker ranker(source.statistics);
+    vector<SearchResult> results;
+    for (const ScoredDocument& document : ranker.topKFrequencies(matches.docIds, matches.frequencies, documentFrequency, limit)) {
+        size_t match = lower_bound(matches.docIds.begin(), matches.docIds.end(), document.docId) - matches.docIds.begin();
+        SearchHit hit = { matches.label, matches.views[0], matches.firstWordIndexes[match], move(matches.starts[match]) };
+        results.push_back({ document.docId + source.docBase, document.score, { hit } });
+    }
+    return results;
+}
+
+// Resolves the leaves of a query tree and estimates how many documents each
+// node can match. Operands of an AND are ordered cheapest first, and an AND
+// with an operand that matches nothing is cut off before anything else is
+// evaluated; operands of an OR that match nothing are dropped. Exclusions are
+// ordered largest first since they are applied to the running intersection,
+// which is smallest once every positive operand has been applied.
+PlannedQuery SearchEngine::planQuery(const QueryNode& node, const QuerySource& source) const {
+    PlannedQuery plan;
+    plan.type = node.type;
+    size_t totalDocuments = source.documentCount;
+
+    switch (node.type) {
+    case QueryNode::Term:
+        plan.term = expandTerm(node.text, source);
+        plan.cost = plan.term.empty() ? 0 : plan.term.span().size;
+        break;
+    case QueryNode::Phrase: {
+        PhraseMatches matches;
+        findPhrase(node.words, source, matches);
+        plan.term.terms = matches.words;
+        plan.term.views = matches.views;
+        plan.phraseDocIds = move(matches.docIds);
+        plan.cost = plan.phraseDocIds.size();
+        break;
+    }
+    case QueryNode::Not:
+        plan.children.push_back(planQuery(node.children[0], source));
+        plan.cost = totalDocuments - min(totalDocuments, plan.children[0].cost);
+        break;
+    case QueryNode::And: {
+        vector<PlannedQuery> included;
+        vector<PlannedQuery> excluded;
+        plan.cost = totalDocuments;
+        for (const QueryNode& child : node.children) {
+            PlannedQuery childPlan = planQuery(child, source);
+            if (childPlan.type == QueryNode::Not) {
+                excluded.push_back(move(childPlan));
+                continue;
             }
-            else {
-                trieSearch.insertWord(normalizedWord, filePath, position++);
+            plan.cost = min(plan.cost, childPlan.cost);
+            included.push_back(move(childPlan));
+            if (plan.cost == 0) {
+                return plan;
+            }
+        }
+        sort(included.begin(), included.end(), [](const PlannedQuery& a, const PlannedQuery& b) {
+            return a.cost < b.cost;
+            });
+        sort(excluded.begin(), excluded.end(), [](const PlannedQuery& a, const PlannedQuery& b) {
+            return a.children[0].cost > b.children[0].cost;
+            });
+        for (PlannedQuery& child : included) {
+            plan.children.push_back(move(child));
+        }
+        for (PlannedQuery& child : excluded) {
+            if (child.children[0].cost > 0) {
+                plan.children.push_back(move(child));
+            }
+        }
+        break;
+    }
+    case QueryNode::Or:
+        for (const QueryNode& child : node.children) {
+            PlannedQuery childPlan = planQuery(child, source);
+            if (childPlan.cost > 0) {
+                plan.cost += childPlan.cost;
+                plan.children.push_back(move(childPlan));
             }
         }
+        plan.cost = min(plan.cost, totalDocuments);
+        break;
     }
+    return plan;
+}
 
-    file.close();
-    cout << "File indexed successfully: " << filePath << "\n";
+// Document ids are dense within a source, so every document is simply
+// 0 .. count - 1.
+static vector<uint32_t> allDocumentIds(size_t count) {
+    vector<uint32_t> docIds(count);
+    for (size_t i = 0; i < count; ++i) {
+        docIds[i] = static_cast<uint32_t>(i);
+    }
+    return docIds;
 }
 
-void SearchEngine::searchQuery(const string& query, bool useHashMap) const {
-    vector<string> words = splitQuery(query);  
-    vector<WordInDocument*> results;
+// Sorted ids of the documents a planned node matches. An AND intersects its
+// positive operands (posting lists are used in place), then subtracts each
+// exclusion from the result; NOT on its own is taken against every document.
+// A node that can match a large share of the documents is evaluated on
+// bitmaps instead, and only its result is turned back into a list.
+vector<uint32_t> SearchEngine::evaluatePlan(const PlannedQuery& plan, const QuerySource& source) const {
+    vector<uint32_t> result;
+    if (plan.cost == 0) {
+        return result;
+    }
+    if (plan.type != QueryNode::Term && plan.type != QueryNode::Phrase && DocIdBitmap::prefersBitmap(plan.cost, source.documentCount)) {
+        return evaluateBitmap(plan, source)->toVector();
+    }
 
-    if (query.front() == '"' && query.back() == '"') {
-        string phrase = query.substr(1, query.size() - 2);  // Remove quotes
-        vector<string> phraseWords = splitQuery(phrase);
-        results = useHashMap ? hashMapSearch.searchMultipleWords(phraseWords) : trieSearch.searchMultipleWords(phraseWords);
+    switch (plan.type) {
+    case QueryNode::Term: {
+        DocIdSpan span = plan.term.span();
+        result.assign(span.data, span.data + span.size);
+        break;
+    }
+    case QueryNode::Phrase:
+        result = plan.phraseDocIds;
+        break;
+    case QueryNode::Not: {
+        vector<uint32_t> allDocuments = allDocumentIds(source.documentCount);
+        vector<uint32_t> excluded = evaluatePlan(plan.children[0], source);
+        result = PostingIntersection::difference({ allDocuments.data(), allDocuments.size() }, { excluded.data(), excluded.size() });
+        break;
     }
+    case QueryNode::And: {
+        vector<vector<uint32_t>> evaluated;
+        evaluated.reserve(plan.children.size());
+        vector<DocIdSpan> spans;
+        size_t firstExclusion = 0;
+        for (; firstExclusion < plan.children.size() && plan.children[firstExclusion].type != QueryNode::Not; ++firstExclusion) {
+            const PlannedQuery& child = plan.children[firstExclusion];
+            if (child.type == QueryNode::Term) {
+                spans.push_back(child.term.span());
+            }
+            else {
+                evaluated.push_back(evaluatePlan(child, source));
+                spans.push_back({ evaluated.back().data(), evaluated.back().size() });
+            }
+        }
 
-    else if (query.find("+") != string::npos) {
-        vector<string> includedWords, excludedWords;
-        bool isPlusQuery = true;
-        for (const auto& word : words) {
-            if (word == "+") {
-                isPlusQuery = false;
-                continue;
+        if (spans.empty()) {
+            result = allDocumentIds(source.documentCount);
+        }
+        else {
+            result = PostingIntersection::intersect(spans);
+        }
+
+        for (size_t i = firstExclusion; i < plan.children.size() && !result.empty(); ++i) {
+            const PlannedQuery& excluded = plan.children[i].children[0];
+            if (excluded.type == QueryNode::Term) {
+                result = PostingIntersection::difference({ result.data(), result.size() }, excluded.term.span());
+            }
+            else {
+                vector<uint32_t> excludedDocIds = evaluatePlan(excluded, source);
+                result = PostingIntersection::difference({ result.data(), result.size() }, { excludedDocIds.data(), excludedDocIds.size() });
+            }
+        }
+        break;
+    }
+    case QueryNode::Or:
+        for (const PlannedQuery& child : plan.children) {
+            vector<uint32_t> childDocIds = evaluatePlan(child, source);
+            result.insert(result.end(), childDocIds.begin(), childDocIds.end());
+        }
+        sort(result.begin(), result.end());
+        result.erase(unique(result.begin(), result.end()), result.end());
+        break;
+    }
+    return result;
+}
+
+// The documents of a term as a bitmap. The bitmap of a single frequent term
+// is cached with its index, so repeated queries for common words do not
+// build it again; anything else is built for the query.
+shared_ptr<const DocIdBitmap> SearchEngine::termBitmap(const ExpandedTerm& term, const QuerySource& source) const {
+    if (term.views.size() == 1 && DocIdBitmap::prefersBitmap(term.views[0].size, source.documentCount)) {
+        return source.bitmap(term.terms[0], term.views[0]);
+    }
+    return make_shared<const DocIdBitmap>(DocIdBitmap::fromSorted(term.span()));
+}
+
+// evaluatePlan on bitmaps: operands are combined a container at a time, and
+// dense containers a machine word at a time. The planned order still
+// applies, so an AND starts from its cheapest operand and stops as soon as
+// nothing is left. Nodes that match few documents are evaluated as lists
+// and converted.
+shared_ptr<const DocIdBitmap> SearchEngine::evaluateBitmap(const PlannedQuery& plan, const QuerySource& source) const {
+    if (plan.type == QueryNode::Term) {
+        return termBitmap(plan.term, source);
+    }
+    if (plan.type == QueryNode::Phrase || plan.cost == 0 || !DocIdBitmap::prefersBitmap(plan.cost, source.documentCount)) {
+        vector<uint32_t> docIds = evaluatePlan(plan, source);
+        return make_shared<const DocIdBitmap>(DocIdBitmap::fromSorted({ docIds.data(), docIds.size() }));
+    }
+
+    shared_ptr<const DocIdBitmap> result;
+    switch (plan.type) {
+    case QueryNode::Not:
+        result = make_shared<const DocIdBitmap>(DocIdBitmap::difference(
+            DocIdBitmap::range(static_cast<uint32_t>(source.documentCount)), *evaluateBitmap(plan.children[0], source)));
+        break;
+    case QueryNode::And:
+        for (const PlannedQuery& child : plan.children) {
+            if (child.type == QueryNode::Not) {
+                if (result == nullptr) {
+                    result = make_shared<const DocIdBitmap>(DocIdBitmap::range(static_cast<uint32_t>(source.documentCount)));
+                }
+                result = make_shared<const DocIdBitmap>(DocIdBitmap::difference(*result, *evaluateBitmap(child.children[0], source)));
             }
-            if (isPlusQuery) {
-                includedWords.push_back(word);
+            else if (result == nullptr) {
+                result = evaluateBitmap(child, source);
             }
             else {
-                excludedWords.push_back(word);
+                result = make_shared<const DocIdBitmap>(DocIdBitmap::intersect(*result, *evaluateBitmap(child, source)));
+            }
+            if (result->empty()) {
+                break;
             }
         }
-        if (excludedWords.empty()) {
-            results = useHashMap ? hashMapSearch.searchMultipleWords(includedWords) : trieSearch.searchMultipleWords(includedWords);
+        if (result == nullptr) {
+            result = make_shared<const DocIdBitmap>(DocIdBitmap::range(static_cast<uint32_t>(source.documentCount)));
+        }
+        break;
+    default:
+        result = make_shared<const DocIdBitmap>();
+        for (const PlannedQuery& child : plan.children) {
+            result = make_shared<const DocIdBitmap>(DocIdBitmap::unite(*result, *evaluateBitmap(child, source)));
+        }
+        break;
+    }
+    return result;
+}
+
+// Terms that are not under a NOT add to the score of the documents they occur
+// in; excluded terms only filter.
+void SearchEngine::collectScoringTerms(const PlannedQuery& plan, vector<ExpandedTerm>& terms) const {
+    if (plan.type == QueryNode::Not) {
+        return;
+    }
+    if (!plan.term.empty()) {
+        terms.push_back(plan.term);
+    }
+    for (const PlannedQuery& child : plan.children) {
+        collectScoringTerms(child, terms);
+    }
+}
+
+// Any other combination of operators: the plan is evaluated to a candidate
+// set, which is ranked by the BM25 score of the query's positive terms.
+vector<SearchResult> SearchEngine::matchBoolean(const QueryNode& root, size_t limit, const QuerySource& source) const {
+    PlannedQuery plan = planQuery(root, source);
+    vector<uint32_t> candidates = evaluatePlan(plan, source);
+    if (candidates.empty()) {
+        return {};
+    }
+
+    vector<ExpandedTerm> terms;
+    collectScoringTerms(plan, terms);
+    Bm25Ranker ranker(source.statistics);
+    return collectResults(ranker.topKCandidates(candidates, rankTerms(ranker, terms, source), limit), terms, source);
+}
+
+void SearchEngine::setWildcardTopK(size_t topK) {
+    wildcardTopK = topK;
+}
+
+// Edit distance every plain query word is matched with; 0 matches words
+// exactly, as before. Distances over LevenshteinAutomaton::MaxDistance are
+// capped.
+void SearchEngine::setFuzzyDistance(unsigned distance) {
+    fuzzyDistance = min(distance, LevenshteinAutomaton::MaxDistance);
+}
+
+// Number of documents a query displays; 0 shows every match.
+void SearchEngine::setResultLimit(size_t limit) {
+    resultLimit = limit;
+}
+
+size_t SearchEngine::getResultLimit() const {
+    return resultLimit;
+}
+
+// Per-worker counters reported after a parallel indexing run.
+struct IndexingWorkerStats {
+    size_t files = 0;
+    size_t tokens = 0;
+    size_t bytes = 0;
+    double seconds = 0.0;
+    double readWaitSeconds = 0.0;
+};
+
+// Weight of a file when cutting files into chunks: its size plus a fixed cost
+// for opening it, so that a run of tiny files is not one chunk.
+static const uint64_t FileOpenCost = 4096;
+
+// The first numFiles review files directly in folderPath, in numeric order.
+void SearchEngine::indexDocuments(const string& folderPath, bool useHashMap, int numFiles, int numWorkers) {
+    if (numFiles <= 0) {
+        return;
+    }
+    DirectoryCrawler crawler;
+    crawler.includePatterns = { "review_*.txt" };
+    crawler.recursive = false;
+    crawler.maxFiles = static_cast<size_t>(numFiles);
+    size_t found = indexDirectory(folderPath, crawler, useHashMap, numWorkers);
+    if (found < crawler.maxFiles) {
+        cout << "Only " << found << " of " << numFiles << " files found in: " << folderPath << "\n";
+    }
+}
+
+size_t SearchEngine::indexDirectory(const string& root, const DirectoryCrawler& crawler, bool useHashMap, int numWorkers) {
+    lock_guard<mutex> lock(writerMutex);
+    closeMappedIndex();
+    auto wallStart = chrono::steady_clock::now();
+
+    vector<CrawledFile> crawled = crawler.crawl(root);
+    vector<CrawledFile> pendingFiles;
+    for (CrawledFile& file : crawled) {
+        if (documents.contains(file.path)) {
+            cout << "File already indexed: " << file.path << "\n";
         }
         else {
-            results = useHashMap ? hashMapSearch.searchExclusion(includedWords[0], excludedWords[0]) : trieSearch.searchExclusion(includedWords[0], excludedWords[0]);
+            pendingFiles.push_back(move(file));
         }
     }
+    if (pendingFiles.empty()) {
+        cout << "No new files to index in: " << root << "\n";
+        return crawled.size();
+    }
+
+    if (numWorkers <= 0) {
+        numWorkers = max(1, static_cast<int>(thread::hardware_concurrency()));
+    }
+    numWorkers = max(1, min(numWorkers, static_cast<int>(pendingFiles.size())));
 
-    else if (query.find("-") != string::npos) {
-        if (words.size() >= 3 && words[1] == "-") {
-            string word1 = words[0];
-            string word2 = words[2];
-            results = useHashMap ? hashMapSearch.searchExclusion(word1, word2) : trieSearch.searchExclusion(word1, word2);
+    // Files are cut into about four chunks per worker of roughly equal weight,
+    // so that a worker that draws light chunks can pick up more work. Each
+    // chunk is a contiguous run of files with its own partial index, chunks
+    // are handed out and merged in file order, and the prefetcher reads the
+    // files in that same order ahead of the workers.
+    uint64_t totalWeight = 0;
+    for (const CrawledFile& file : pendingFiles) {
+        totalWeight += file.size + FileOpenCost;
+    }
+    uint64_t chunkWeight = max<uint64_t>(1, totalWeight / (static_cast<uint64_t>(numWorkers) * 4));
+    vector<size_t> chunkStarts;
+    uint64_t weight = 0;
+    for (size_t i = 0; i < pendingFiles.size(); ++i) {
+        if (i == 0 || weight >= chunkWeight) {
+            chunkStarts.push_back(i);
+            weight = 0;
         }
+        weight += pendingFiles[i].size + FileOpenCost;
     }
+    chunkStarts.push_back(pendingFiles.size());
+    size_t numChunks = chunkStarts.size() - 1;
+
+    vector<PartialIndex> partials(numChunks);
+    vector<IndexingWorkerStats> workerStats(numWorkers);
+    atomic<size_t> nextChunk(0);
+    FilePrefetcher prefetcher(pendingFiles);
 
-    else if (words.size() == 1) {
-        results = useHashMap ? hashMapSearch.searchWord(words[0]) : trieSearch.searchWord(words[0]);
+    auto worker = [&](int workerId) {
+        IndexingWorkerStats& stats = workerStats[workerId];
+        auto start = chrono::steady_clock::now();
+        vector<char> contents;
+        for (size_t chunk = nextChunk++; chunk < numChunks; chunk = nextChunk++) {
+            PartialIndex& partial = partials[chunk];
+            for (size_t i = chunkStarts[chunk]; i < chunkStarts[chunk + 1]; ++i) {
+                auto waitStart = chrono::steady_clock::now();
+                bool ok = prefetcher.take(i, contents);
+                stats.readWaitSeconds += chrono::duration<double>(chrono::steady_clock::now() - waitStart).count();
+                if (ok) {
+                    partial.addDocument(pendingFiles[i].path, contents);
+                }
+                else {
+                    partial.addFailedDocument(pendingFiles[i].path);
+                }
+            }
+            stats.files += partial.indexedFiles.size();
+            stats.tokens += partial.tokenCount;
+            stats.bytes += partial.bytesRead;
+        }
+        stats.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    };
+
+    vector<thread> threads;
+    for (int i = 1; i < numWorkers; ++i) {
+        threads.emplace_back(worker, i);
+    }
+    worker(0);
+    for (thread& t : threads) {
+        t.join();
     }
+    auto tokenizeEnd = chrono::steady_clock::now();
+
+    mergePartialIndexes(partials, useHashMap);
+    auto wallEnd = chrono::steady_clock::now();
 
+    double wallSeconds = chrono::duration<double>(wallEnd - wallStart).count();
+    double mergeSeconds = chrono::duration<double>(wallEnd - tokenizeEnd).count();
+    size_t totalTokens = 0;
+    size_t totalBytes = 0;
+    for (const IndexingWorkerStats& stats : workerStats) {
+        totalTokens += stats.tokens;
+        totalBytes += stats.bytes;
+    }
+
+    // Only files that made it into the index count as indexed; the ones
+    // already in it and the ones that could not be read are reported apart.
+    size_t addedFiles = 0;
+    size_t failedFiles = 0;
+    for (const PartialIndex& partial : partials) {
+        addedFiles += partial.indexedFiles.size();
+        failedFiles += partial.failedFiles.size();
+    }
+    cout << "Indexed " << addedFiles << " files successfully.";
+    if (addedFiles < crawled.size()) {
+        cout << " Skipped " << crawled.size() - pendingFiles.size() << " already indexed and " << failedFiles << " unreadable.";
+    }
+    cout << "\n";
+    cout << "Indexing used " << numWorkers << " worker(s): " << wallSeconds * 1000.0 << " ms wall clock ("
+        << mergeSeconds * 1000.0 << " ms merging), " << totalTokens << " tokens, "
+        << (wallSeconds > 0 ? totalTokens / wallSeconds : 0.0) << " tokens/s, "
+        << (wallSeconds > 0 ? totalBytes / wallSeconds / (1024.0 * 1024.0) : 0.0) << " MB/s\n";
+    for (int i = 0; i < numWorkers; ++i) {
+        const IndexingWorkerStats& stats = workerStats[i];
+        cout << "  Worker " << i << ": " << stats.files << " files, " << stats.tokens << " tokens in "
+            << stats.seconds * 1000.0 << " ms ("
+            << (stats.seconds > 0 ? stats.tokens / stats.seconds : 0.0) << " tokens/s, "
+            << stats.readWaitSeconds * 1000.0 << " ms waiting for reads)\n";
+    }
+    return crawled.size();
+}
+
+bool SearchEngine::indexDocument(const string& filePath, bool useHashMap) {
+    lock_guard<mutex> lock(writerMutex);
+    closeMappedIndex();
+    if (documents.contains(filePath)) {
+        cout << "File already indexed: " << filePath << "\n";
+        return false;
+    }
+
+    vector<PartialIndex> partials(1);
+    bool indexed = partials[0].addDocument(filePath);
+    mergePartialIndexes(partials, useHashMap);
+    return indexed;
+}
+
+// Inserts every posting of the partial indexes into a copy of the selected
+// backend, which is published together with the new documents once all of
+// them are in; queries keep using the previous snapshot until then. The copy
+// shares all it does not change with that snapshot, so a batch costs what it
+// adds rather than the size of the index. With a segmented index open, the
+// postings go into its in-memory segment instead.
+// Partial indexes only ever contain files that are not in the index yet, so
+// postings are appended rather than looked up. When no file could be read,
+// nothing is published, so cached results stay valid. Called with
+// writerMutex held.
+void SearchEngine::mergePartialIndexes(const vector<PartialIndex>& partials, bool useHashMap) {
+    ScopedTimer mergeTimer(Phase::Merge);
+    size_t addedFiles = 0;
+    for (const PartialIndex& partial : partials) {
+        for (const string& failedFile : partial.failedFiles) {
+            cerr << "Error opening file: " << failedFile << "\n";
+        }
+        addedFiles += partial.indexedFiles.size();
+    }
+    if (addedFiles == 0) {
+        return;
+    }
+
+    shared_ptr<IndexSnapshot> next;
+    shared_ptr<HashMapSearch> hashMap;
+    shared_ptr<TrieSearch> trie;
+    if (!segmentedIndex.isOpen()) {
+        next = nextSnapshot();
+        if (useHashMap) {
+            hashMap = make_shared<HashMapSearch>(*next->hashMap);
+            next->hashMap = hashMap;
+        }
+        else {
+            trie = make_shared<TrieSearch>(*next->trie);
+            next->trie = trie;
+        }
+    }
+
+    for (const PartialIndex& partial : partials) {
+        vector<uint32_t> docIds;
+        docIds.reserve(partial.indexedFiles.size());
+        for (size_t i = 0; i < partial.indexedFiles.size(); ++i) {
+            uint32_t docId = documents.addDocument(partial.indexedFiles[i]);
+            documents.setLength(docId, partial.documentLengths[i]);
+            docIds.push_back(docId);
+        }
+
+        if (segmentedIndex.isOpen()) {
+            segmentedIndex.addDocuments(partial, docIds);
+        }
+        else {
+            ScopedTimer insertTimer(Phase::Insert);
+            for (const PartialIndex::TermPostings& term : partial.terms) {
+                for (const PartialIndex::Posting& posting : term.postings) {
+                    uint32_t docId = docIds[posting.localDocId];
+                    if (useHashMap) {
+                        hashMap->addPostings(term.word, docId, posting.positions);
+                    }
+                    else {
+                        trie->addPostings(term.word, docId, posting.positions);
+                    }
+                }
+            }
+        }
+
+        for (const string& filePath : partial.indexedFiles) {
+            cout << "File indexed successfully: " << filePath << "\n";
+        }
+    }
+
+    if (next != nullptr) {
+        next->documents = make_shared<DocumentTable>(documents);
+        publish(next);
+        requestPurge();
+    }
+}
+
+// A copy of the current snapshot for the writer to change. Called with
+// writerMutex held, so nothing else publishes until the copy is.
+shared_ptr<IndexSnapshot> SearchEngine::nextSnapshot() const {
+    return make_shared<IndexSnapshot>(*published.acquire());
+}
+
+// Results cached for earlier versions are dropped right away rather than when
+// they are next looked up, so that they do not keep old snapshots alive.
+void SearchEngine::publish(shared_ptr<IndexSnapshot> next) {
+    next->version = ++indexVersion;
+    published.publish(next);
+    queryCache.invalidate(next->version);
+}
+
+// Evaluates a query against every source without consulting the cache, and
+// keeps the limit best results (0 keeps all). Each source ranks its own documents with
+// collection-wide statistics, so merging the sources' best results gives the
+// ranking a single index holding every document would. How many documents a
+// phrase occurs in is only known once every source has been searched, so
+// phrases are matched everywhere before any source ranks them.
+vector<SearchResult> SearchEngine::runQuery(const QueryNode& root, size_t limit, const vector<QuerySource>& sources) const {
+    ScopedTimer timer(Phase::Search);
+    vector<SearchResult> results;
+    if (root.type == QueryNode::Phrase) {
+        vector<PhraseMatches> matches(sources.size());
+        size_t documentFrequency = 0;
+        for (size_t i = 0; i < sources.size(); ++i) {
+            findPhrase(root.words, sources[i], matches[i]);
+            documentFrequency += matches[i].docIds.size();
+        }
+        for (size_t i = 0; i < sources.size(); ++i) {
+            vector<SearchResult> ranked = rankPhrase(matches[i], documentFrequency, limit, sources[i]);
+            move(ranked.begin(), ranked.end(), back_inserter(results));
+        }
+    }
     else {
-        results = useHashMap ? hashMapSearch.searchMultipleWords(words) : trieSearch.searchMultipleWords(words);
+        for (const QuerySource& source : sources) {
+            vector<SearchResult> ranked = runSourceQuery(root, limit, source);
+            move(ranked.begin(), ranked.end(), back_inserter(results));
+        }
+    }
+
+    if (sources.size() > 1) {
+        ScopedTimer sortTimer(Phase::Sort);
+        sort(results.begin(), results.end(), [](const SearchResult& a, const SearchResult& b) {
+            if (a.score != b.score) {
+                return a.score > b.score;
+            }
+            return a.docId < b.docId;
+            });
+        if (limit != 0 && results.size() > limit) {
+            results.resize(limit);
+        }
     }
+    return results;
+}
+
+// A single word, and plain ANDs or ORs of words, go to the specialized paths;
+// everything else is planned and evaluated as a tree.
+vector<SearchResult> SearchEngine::runSourceQuery(const QueryNode& root, size_t limit, const QuerySource& source) const {
+    if (root.type == QueryNode::Term) {
+        return matchAll({ root.text }, limit, source);
+    }
+    if (root.isTermList(QueryNode::And) || root.isTermList(QueryNode::Or)) {
+        vector<string> words;
+        for (const QueryNode& child : root.children) {
+            words.push_back(child.text);
+        }
+        return root.type == QueryNode::And ? matchAll(words, limit, source) : matchAny(words, limit, source);
+    }
+    return matchBoolean(root, limit, source);
+}
 
+// The cache key is the parsed query in canonical form, together with every
+// setting that changes its results. Spacing, redundant parentheses and letter
+// case do not matter, but whether words are a phrase does: ' "a b"' and
+// '"a b"' parse to the same phrase and share a key, while "a b" without
+// quotes is an AND and gets a different one.
+string SearchEngine::cacheKey(const QueryNode& root, bool useHashMap, size_t limit, const QueryView& view) const {
+    ostringstream key;
+    char served = view.index->segmented ? 's' : (view.index->mapped != nullptr ? 'm' : '-');
+    key << (useHashMap ? 'h' : 't') << served << limit << ':' << wildcardTopK.load() << ':' << fuzzyDistance.load() << '|'
+        << root.toString();
+    return key.str();
+}
 
-    sort(results.begin(), results.end(), [](WordInDocument* a, WordInDocument* b) {
+// The version the results of a view are cached under. Segment snapshots
+// carry their own, since documents reach them without a new IndexSnapshot.
+uint64_t QueryView::version() const {
+    return segments != nullptr ? segments->version : index->version;
+}
 
-        if (a->getFrequency() != b->getFrequency()) {
-            return a->getFrequency() > b->getFrequency();  
+QueryView SearchEngine::currentView() const {
+    QueryView view;
+    view.index = published.acquire();
+    if (view.index->segmented) {
+        view.segments = segmentedIndex.snapshot();
+    }
+    return view;
+}
+
+// Results together with the view their PostingViews point into.
+struct ViewResults {
+    QueryView view;
+    vector<SearchResult> results;
+};
+
+// Ranked results of a query, without printing them. The results hold on to
+// the snapshots they were computed on, so they stay valid however the index
+// changes afterwards; the cache only hands them out while their version is
+// current.
+QueryCache::Results SearchEngine::search(const string& query, bool useHashMap) const {
+    QueryNode root;
+    string error;
+    if (!QueryParser::parse(query, root, error)) {
+        if (error != "empty query") {
+            cerr << "Invalid query: " << error << "\n";
         }
-        return a->getDocName() < b->getDocName();  
-        });
+        return make_shared<const vector<SearchResult>>();
+    }
+    Metrics::add(Counter::QueriesRun);
+    QueryCache::Results results = evaluate(root, useHashMap, resultLimit, currentView());
+    Metrics::add(Counter::ResultsReturned, results->size());
+    return results;
+}
 
-    displayResults(results);  
+// The limit best results of a parsed query over view, from the cache if they
+// are there.
+QueryCache::Results SearchEngine::evaluate(const QueryNode& root, bool useHashMap, size_t limit, const QueryView& view) const {
+    string key = cacheKey(root, useHashMap, limit, view);
+    QueryCache::Results results = queryCache.lookup(key, view.version());
+    if (!results) {
+        shared_ptr<ViewResults> computed = make_shared<ViewResults>();
+        computed->view = view;
+        vector<QuerySource> sources;
+        querySources(useHashMap, view, sources);
+        computed->results = runQuery(root, limit, sources);
+        results = QueryCache::Results(computed, &computed->results);
+        queryCache.insert(key, view.version(), results);
+    }
+    return results;
 }
 
+// Looks up the path of a ranked document, and the positions of its matched
+// terms if asked for.
+ResultDocument SearchEngine::materialize(const SearchResult& result, bool withPositions, const QueryView& view) const {
+    ResultDocument document{ result.docId, documentPath(result.docId, view), result.score, {} };
+    if (withPositions) {
+        for (const SearchHit& hit : result.matches) {
+            MatchedTerm match{ hit.term, hit.phrasePositions };
+            if (match.positions.empty()) {
+                hit.postings.decodePositions(hit.index, match.positions);
+            }
+            document.matches.push_back(move(match));
+        }
+    }
+    return document;
+}
 
-void SearchEngine::comparePerformance(const vector<string>& queries) {
-    auto start = chrono::high_resolution_clock::now();
-    for (const auto& query : queries) {
-        hashMapSearch.searchWord(query);
+// Nothing is ranked yet; the cursor ranks when its first page is read.
+ResultCursor SearchEngine::searchQuery(const string& query, bool useHashMap) const {
+    ResultCursor cursor;
+    cursor.engine = this;
+    cursor.useHashMap = useHashMap;
+    string error;
+    if (!QueryParser::parse(query, cursor.root, error)) {
+        if (error != "empty query") {
+            cerr << "Invalid query: " << error << "\n";
+        }
+        return cursor;
     }
-    auto end = chrono::high_resolution_clock::now();
-    auto hashMapDuration = chrono::duration_cast<chrono::milliseconds>(end - start).count();
+    Metrics::add(Counter::QueriesRun);
+    cursor.valid = true;
+    cursor.view = currentView();
+    return cursor;
+}
 
-    start = chrono::high_resolution_clock::now();
-    for (const auto& query : queries) {
-        trieSearch.searchWord(query);
+// Runs every query against one snapshot, taken when the batch starts, on a
+// work-stealing pool shared by all batches. The queries share term lookups
+// instead of going through the query cache, which would serialize them on
+// its lock; a batch is also expected to repeat words far more often than
+// whole queries.
+vector<BatchResult> SearchEngine::searchBatch(const vector<string>& queries, bool useHashMap, bool withPositions) const {
+    call_once(batchPoolStarted, [this] {
+        batchPool = make_unique<WorkStealingPool>();
+    });
+
+    QueryView view = currentView();
+    vector<QuerySource> sources;
+    querySources(useHashMap, view, sources);
+    vector<unique_ptr<TermLookupCache>> lookups;
+    for (QuerySource& source : sources) {
+        lookups.push_back(make_unique<TermLookupCache>());
+        source.lookups = lookups.back().get();
     }
-    end = chrono::high_resolution_clock::now();
-    auto trieDuration = chrono::duration_cast<chrono::milliseconds>(end - start).count();
 
-    cout << "HashMap Search Time: " << hashMapDuration << " ms\n";
-    cout << "Trie Search Time: " << trieDuration << " ms\n";
+    size_t limit = resultLimit;
+    vector<BatchResult> results(queries.size());
+    batchPool->parallelFor(queries.size(), [&](size_t i) {
+        QueryNode root;
+        if (!QueryParser::parse(queries[i], root, results[i].error)) {
+            return;
+        }
+        for (const SearchResult& ranked : runQuery(root, limit, sources)) {
+            results[i].documents.push_back(materialize(ranked, withPositions, view));
+        }
+        Metrics::add(Counter::QueriesRun);
+        Metrics::add(Counter::ResultsReturned, results[i].documents.size());
+    });
+    return results;
 }
 
-void SearchEngine::clear(bool useHashMap) {
-    if (useHashMap) {
-        hashMapSearch.clear();
+// Ranks deep enough for the page, doubling the depth each time it has to go
+// further, so paging through n results ranks O(n) documents in total. A
+// ranking that came back short of its depth holds every match already.
+vector<ResultDocument> ResultCursor::page(size_t offset, size_t count) {
+    vector<ResultDocument> documents;
+    if (!valid) {
+        return documents;
     }
-    else {
-        trieSearch.clear();
+
+    size_t needed = count == 0 ? 0 : offset + count;
+    bool complete = ranked != nullptr && (depth == 0 || ranked->size() < depth);
+    if (ranked == nullptr || (!complete && (needed == 0 || needed > depth))) {
+        depth = needed == 0 ? 0 : max(needed, depth * 2);
+        ranked = engine->evaluate(root, useHashMap, depth, view);
+    }
+
+    size_t end = count == 0 ? ranked->size() : min(ranked->size(), offset + count);
+    for (size_t i = offset; i < end; ++i) {
+        documents.push_back(engine->materialize((*ranked)[i], true, view));
     }
+    Metrics::add(Counter::ResultsReturned, documents.size());
+    return documents;
 }
 
+void SearchEngine::setQueryCacheCapacity(size_t capacity) {
+    queryCache.setCapacity(capacity);
+}
+
+void SearchEngine::displayQueryCacheStats() const {
+    queryCache.displayStats();
+}
+
+void SearchEngine::displayMemoryReport() const {
+    published.acquire()->trie->memoryReport();
+}
+
+// Both backends are cleared whichever one is selected: their postings refer
+// to ids in the document table, which is cleared with them.
+void SearchEngine::clear(bool) {
+    lock_guard<mutex> lock(writerMutex);
+    closeMappedIndex();
+    detachSegmentedIndex();
+    documents.clear();
+    purgedDeletions = 0;
+
+    shared_ptr<IndexSnapshot> next = nextSnapshot();
+    next->hashMap = make_shared<HashMapSearch>();
+    next->trie = make_shared<TrieSearch>();
+    next->documents = make_shared<DocumentTable>();
+    publish(next);
+}
+
+// With a segmented index open there is nothing to rewrite: only the
+// in-memory segment is written out, as a new segment.
 bool SearchEngine::dumpSearchEngine(const string& dumpFilePath) {
+    lock_guard<mutex> lock(writerMutex);
+    ScopedTimer timer(Phase::Save);
+    if (segmentedIndex.isOpen()) {
+        if (!segmentedIndex.flush()) {
+            return false;
+        }
+        cout << "In-memory segment flushed; the segmented index is up to date on disk.\n";
+        return true;
+    }
+    if (rejectWhileMapped("dumped")) {
+        return false;
+    }
+
     ofstream dumpFile(dumpFilePath, ios::binary);
     if (!dumpFile.is_open()) {
         cerr << "Error opening dump file for writing: " << dumpFilePath << "\n";
         return false;
     }
+    shared_ptr<const IndexSnapshot> snapshot = published.acquire();
+    if (!snapshot->documents->save(dumpFile)) {
+        return false;
+    }
     if (useHashMap) {
-        hashMapSearch.save(dumpFile);
+        snapshot->hashMap->save(dumpFile);
     }
     else {
-        trieSearch.save(dumpFile);
+        snapshot->trie->save(dumpFile);
     }
     dumpFile.close();
     cout << "Search engine index dumped successfully to " << dumpFilePath << "\n";
     return true;
 }
 
+// The dump is read into a new backend, so queries keep running against the
+// previous index until it is complete. The other backend is emptied, since
+// its postings refer to the document table the dump replaces.
 bool SearchEngine::loadSearchEngine(const string& dumpFilePath) {
+    lock_guard<mutex> lock(writerMutex);
+    ScopedTimer timer(Phase::Load);
     ifstream dumpFile(dumpFilePath, ios::binary);
     if (!dumpFile.is_open()) {
         cerr << "Error opening dump file for reading: " << dumpFilePath << "\n";
         return false;
     }
 
-    if (useHashMap) {
-        hashMapSearch.clear();
-        hashMapSearch.load(dumpFile);
+    // The whole dump is read before anything is closed, so a dump that
+    // fails to load leaves the index as it was.
+    DocumentTable loaded;
+    if (!loaded.load(dumpFile)) {
+        cerr << "Error reading document table from: " << dumpFilePath << "\n";
+        return false;
     }
-    else {
-        trieSearch.clear();
-        trieSearch.load(dumpFile);
+    shared_ptr<HashMapSearch> hashMap = make_shared<HashMapSearch>();
+    shared_ptr<TrieSearch> trie = make_shared<TrieSearch>();
+    bool indexLoaded = useHashMap ? hashMap->load(dumpFile, loaded.size()) : trie->load(dumpFile, loaded.size());
+    if (!indexLoaded) {
+        cerr << "Error reading index from: " << dumpFilePath << "\n";
+        return false;
     }
 
+    closeMappedIndex();
+    detachSegmentedIndex();
+    shared_ptr<IndexSnapshot> next = nextSnapshot();
+    next->hashMap = hashMap;
+    next->trie = trie;
+    documents = move(loaded);
+    purgedDeletions = 0;
+    next->documents = make_shared<DocumentTable>(documents);
+    publish(next);
+    requestPurge();
+
     dumpFile.close();
     cout << "Search engine index loaded successfully from " << dumpFilePath << "\n";
     return true;
 }
 
 
-void SearchEngine::addFileToIndex(const string& newFilePath, bool useHashMap) {
-    indexDocument(newFilePath, useHashMap);
+bool SearchEngine::addFileToIndex(const string& newFilePath, bool useHashMap) {
+    return indexDocument(newFilePath, useHashMap);
+}
+
+// Marks the document of filePath deleted, in the segmented index too while
+// one is open. Called with writerMutex held.
+bool SearchEngine::removeIndexedFile(const string& filePath) {
+    uint32_t docId = documents.findDocument(filePath);
+    if (docId == DocumentTable::InvalidId) {
+        return false;
+    }
+    documents.removeDocument(docId);
+    if (segmentedIndex.isOpen()) {
+        segmentedIndex.removeDocument(docId);
+    }
+    return true;
+}
+
+// Queries stop returning the file's document with the next snapshot. Its id
+// is not reused, and indexing the file again gives it a new one.
+bool SearchEngine::removeDocument(const string& filePath) {
+    lock_guard<mutex> lock(writerMutex);
+    if (rejectWhileMapped("changed")) {
+        return false;
+    }
+    if (!documents.contains(filePath)) {
+        cout << "File not indexed: " << filePath << "\n";
+        return false;
+    }
+    closeMappedIndex();
+    removeIndexedFile(filePath);
+    if (!segmentedIndex.isOpen()) {
+        shared_ptr<IndexSnapshot> next = nextSnapshot();
+        next->documents = make_shared<DocumentTable>(documents);
+        publish(next);
+        requestPurge();
+    }
+    cout << "File removed from the index: " << filePath << "\n";
+    return true;
+}
+
+// Re-indexes a file that changed since it was indexed: the old document is
+// deleted and the file indexed again under a new id. Outside a segmented
+// index both happen in one snapshot, so no query sees both versions or
+// neither. The file is read first, and a file that cannot be read keeps its
+// old version.
+bool SearchEngine::updateDocument(const string& filePath, bool useHashMap) {
+    lock_guard<mutex> lock(writerMutex);
+    if (rejectWhileMapped("changed")) {
+        return false;
+    }
+    vector<PartialIndex> partials(1);
+    partials[0].addDocument(filePath);
+    if (partials[0].indexedFiles.empty()) {
+        cerr << "Error opening file: " << filePath << "; the indexed version is kept.\n";
+        return false;
+    }
+
+    closeMappedIndex();
+    removeIndexedFile(filePath);
+    mergePartialIndexes(partials, useHashMap);
+    return true;
+}
+
+// Wakes the purge thread once enough deleted documents still have postings
+// in the in-memory backends. Called with writerMutex held.
+void SearchEngine::requestPurge() {
+    size_t deletedCount = documents.deletedDocumentCount();
+    if (segmentedIndex.isOpen() || deletedCount <= purgedDeletions
+        || (deletedCount - purgedDeletions) * PurgeRatio < documents.size()) {
+        return;
+    }
+    {
+        lock_guard<mutex> lock(purgeMutex);
+        purgeRequested = true;
+    }
+    purgeSignal.notify_one();
+}
+
+void SearchEngine::purgeLoop() {
+    unique_lock<mutex> lock(purgeMutex);
+    while (true) {
+        purgeSignal.wait(lock, [this] { return purgeRequested || purgerStopping; });
+        if (purgerStopping) {
+            return;
+        }
+        purgeRequested = false;
+        lock.unlock();
+        purgeDeletedDocuments();
+        lock.lock();
+    }
+}
+
+// A copy of index without the postings of deleted documents, and without
+// terms that only occurred in them. The copy gets an arena of its own, so the
+// purged positions are freed once no snapshot uses the old index.
+template <typename Index>
+static shared_ptr<Index> withoutDeletedDocuments(const Index& index, const DocumentTable& documents) {
+    shared_ptr<Index> purged = make_shared<Index>();
+    vector<pair<string, const PostingList*>> terms;
+    index.collectTerms(terms);
+    for (const pair<string, const PostingList*>& term : terms) {
+        for (const WordInDocument* posting : *term.second) {
+            if (!documents.deletedDocuments().contains(posting->getDocId())) {
+                purged->addPostings(term.first, posting->getDocId(), posting->getPositions());
+            }
+        }
+    }
+    return purged;
+}
+
+// Rewrites both in-memory backends without the postings of deleted documents.
+// The rewrite reads a published snapshot and runs without writerMutex, so
+// indexing and queries go on meanwhile. If a writer replaced either backend
+// in the meantime, the rewrite is dropped; the writer's own change requests
+// the next one. Returns whether a purged index was published.
+bool SearchEngine::purgeDeletedDocuments() {
+    shared_ptr<const IndexSnapshot> base;
+    {
+        lock_guard<mutex> lock(writerMutex);
+        if (segmentedIndex.isOpen() || documents.deletedDocumentCount() <= purgedDeletions) {
+            return false;
+        }
+        base = published.acquire();
+    }
+
+    ScopedTimer timer(Phase::Merge);
+    shared_ptr<HashMapSearch> hashMap = withoutDeletedDocuments(*base->hashMap, *base->documents);
+    shared_ptr<TrieSearch> trie = withoutDeletedDocuments(*base->trie, *base->documents);
+
+    lock_guard<mutex> lock(writerMutex);
+    shared_ptr<IndexSnapshot> next = nextSnapshot();
+    if (next->segmented || next->hashMap != base->hashMap || next->trie != base->trie) {
+        return false;
+    }
+    next->hashMap = hashMap;
+    next->trie = trie;
+    publish(next);
+    purgedDeletions = base->documents->deletedDocumentCount();
+    return true;
+}
+
+bool SearchEngine::dumpMappedIndex(const string& indexFilePath) {
+    lock_guard<mutex> lock(writerMutex);
+    ScopedTimer timer(Phase::Save);
+    if (segmentedIndex.isOpen()) {
+        cerr << "Error: A segmented index is open; its segments are mapped index files already.\n";
+        return false;
+    }
+
+    // While a mapped index is served, it is what gets written: the in-memory
+    // backends do not hold its documents.
+    shared_ptr<const IndexSnapshot> snapshot = published.acquire();
+    if (snapshot->mapped != nullptr) {
+        if (!MappedIndex::merge(indexFilePath, { snapshot->mapped.get() })) {
+            return false;
+        }
+        cout << "Mapped index with " << snapshot->mapped->termCount() << " terms written to " << indexFilePath << "\n";
+        return true;
+    }
+
+    vector<pair<string, const PostingList*>> terms;
+    if (useHashMap) {
+        snapshot->hashMap->collectTerms(terms);
+    }
+    else {
+        snapshot->trie->collectTerms(terms);
+    }
+
+    if (!MappedIndex::write(indexFilePath, *snapshot->documents, terms)) {
+        return false;
+    }
+    cout << "Mapped index with " << terms.size() << " terms written to " << indexFilePath << "\n";
+    return true;
+}
+
+// Queries running against the previously served index finish on it; it is
+// unmapped when the last of their results is gone.
+bool SearchEngine::openMappedIndex(const string& indexFilePath) {
+    lock_guard<mutex> lock(writerMutex);
+    ScopedTimer timer(Phase::Load);
+    detachSegmentedIndex();
+    auto start = chrono::steady_clock::now();
+    shared_ptr<MappedIndex> mapped = make_shared<MappedIndex>();
+    if (!mapped->open(indexFilePath)) {
+        return false;
+    }
+    auto end = chrono::steady_clock::now();
+
+    shared_ptr<IndexSnapshot> next = nextSnapshot();
+    next->mapped = mapped;
+    publish(next);
+    cout << "Mapped index opened in " << chrono::duration<double, milli>(end - start).count() << " ms: "
+        << mapped->termCount() << " terms, " << mapped->documentCount() << " documents. "
+        << "Queries are now served from " << indexFilePath << "\n";
+    return true;
+}
+
+// Any change to the in-memory index makes a previously opened mapped index
+// stale, so queries go back to the in-memory backend. Called with writerMutex
+// held.
+void SearchEngine::closeMappedIndex() {
+    if (published.acquire()->mapped != nullptr) {
+        shared_ptr<IndexSnapshot> next = nextSnapshot();
+        next->mapped.reset();
+        publish(next);
+        cout << "Mapped index closed; queries are served from memory again.\n";
+    }
+}
+
+// The document table of a mapped index stays in its file, so the writer has
+// nothing to remove documents from or dump. Called with writerMutex held.
+bool SearchEngine::rejectWhileMapped(const char* action) const {
+    if (published.acquire()->mapped == nullptr) {
+        return false;
+    }
+    cerr << "Error: Queries are served from a mapped index, which cannot be " << action
+        << ". Load a dump or index files to serve queries from memory again.\n";
+    return true;
+}
+
+// From here on, indexed files go into the segmented index in directory and
+// queries run over its segments. Whatever the in-memory backends held is
+// dropped; documents already in the directory are searchable right away.
+bool SearchEngine::openSegmentedIndex(const string& directory, size_t flushThreshold) {
+    lock_guard<mutex> lock(writerMutex);
+    closeMappedIndex();
+    detachSegmentedIndex();
+
+    shared_ptr<IndexSnapshot> next = nextSnapshot();
+    next->hashMap = make_shared<HashMapSearch>();
+    next->trie = make_shared<TrieSearch>();
+    next->documents = make_shared<DocumentTable>();
+
+    auto start = chrono::steady_clock::now();
+    segmentedIndex.setFlushThreshold(flushThreshold);
+    if (!segmentedIndex.open(directory, documents)) {
+        documents.clear();
+        publish(next);
+        return false;
+    }
+    auto end = chrono::steady_clock::now();
+
+    next->segmented = true;
+    publish(next);
+    cout << "Segmented index opened in " << chrono::duration<double, milli>(end - start).count() << " ms: "
+        << documents.size() << " documents. New files are added to " << directory << "\n";
+    return true;
+}
+
+// Writes out the in-memory segment and detaches from the directory; the
+// segments stay on disk for the next open.
+void SearchEngine::closeSegmentedIndex() {
+    lock_guard<mutex> lock(writerMutex);
+    detachSegmentedIndex();
+}
+
+// Called with writerMutex held.
+void SearchEngine::detachSegmentedIndex() {
+    if (segmentedIndex.isOpen()) {
+        segmentedIndex.close();
+        documents.clear();
+        purgedDeletions = 0;
+        shared_ptr<IndexSnapshot> next = nextSnapshot();
+        next->segmented = false;
+        publish(next);
+        cout << "Segmented index closed; its segments stay on disk.\n";
+    }
+}
+
+void SearchEngine::displaySegments() const {
+    segmentedIndex.displayStatus();
 }
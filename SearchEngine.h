@@ -3,33 +3,331 @@
 #include <vector>
 #include "HashMapSearch.h"
 #include "TrieSearch.h"
+#include "PartialIndex.h"
+#include "DirectoryCrawler.h"
+#include "MappedIndex.h"
+#include "PostingView.h"
+#include "PhraseMatcher.h"
+#include "Bm25Ranker.h"
+#include "QueryCache.h"
+#include "DocIdBitmap.h"
+#include "QueryParser.h"
+#include "SegmentedIndex.h"
+#include "VersionPublisher.h"
+#include "WorkStealingPool.h"
 #define _SILENCE_EXPERIMENTAL_FILESYSTEM_DEPRECATION_WARNING
 #include <experimental/filesystem>
 #include <unordered_set>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 
 namespace fs = std::experimental::filesystem;
 
+// One matching posting: the term's postings and the index of the document
+// within them. For a phrase match, postings are those of the first phrase word
+// and phrasePositions holds where the phrase starts in the document. docId()
+// is the id within the postings' source; SearchResult::docId is the one in
+// the document table.
+struct SearchHit {
+    std::string term;
+    PostingView postings;
+    size_t index;
+    std::vector<int> phrasePositions;
+
+    uint32_t docId() const;
+    uint32_t frequency() const;
+};
+
+// A ranked document with the postings of every query term it matched.
+struct SearchResult {
+    uint32_t docId;
+    double score;
+    std::vector<SearchHit> matches;
+};
+
+// One document of a query's results, in plain values that stay valid
+// without the index. matches holds every matched term with its positions in
+// the document, and is only filled in when the caller asks for positions.
+struct MatchedTerm {
+    std::string term;
+    std::vector<int> positions;
+};
+
+struct ResultDocument {
+    uint32_t docId;
+    std::string path;
+    double score;
+    std::vector<MatchedTerm> matches;
+};
+
+// Results of one query of a batch, best first. error is set, and documents
+// empty, when the query could not be parsed.
+struct BatchResult {
+    std::vector<ResultDocument> documents;
+    std::string error;
+};
+
+// Postings a query word resolves to: a single list for a plain word, the
+// lists of the most frequent matching terms for a wildcard word, or those of
+// the closest terms for a fuzzy word. docIds holds the union of the
+// expansions' documents when there is more than one. weights scales each
+// expansion's share of the score, and is empty when they all count fully.
+struct ExpandedTerm {
+    std::vector<std::string> terms;
+    std::vector<PostingView> views;
+    std::vector<uint32_t> docIds;
+    std::vector<double> weights;
+
+    bool empty() const;
+    // Sets docIds to the documents of every view.
+    void unionDocIds();
+    DocIdSpan span() const;
+};
+
+// Documents where a phrase occurs: its words' postings, and for each matching
+// document the phrase frequency, the index of the document in the first
+// word's postings, and where the phrase starts.
+struct PhraseMatches {
+    std::string label;
+    std::vector<std::string> words;
+    std::vector<PostingView> views;
+    std::vector<uint32_t> docIds;
+    std::vector<uint32_t> frequencies;
+    std::vector<size_t> firstWordIndexes;
+    std::vector<std::vector<int>> starts;
+};
+
+// Term lookups shared by the queries of one batch against one source. Every
+// query of a batch runs against the same snapshot, so a word resolves to the
+// same postings, and a wildcard word to the same expansions, in all of them;
+// only the first query that needs one pays for it. Entries are spread over
+// shards so that threads looking up different words rarely wait for each
+// other. Two threads may resolve the same word at once; they get the same
+// answer, and the first one stored is kept.
+class TermLookupCache {
+private:
+    static constexpr size_t ShardCount = 16;
+
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<std::string, PostingView> views;
+        std::unordered_map<std::string, ExpandedTerm> expansions;
+    };
+
+    Shard shards[ShardCount];
+
+    Shard& shardOf(const std::string& word);
+
+public:
+    bool findView(const std::string& normalizedWord, PostingView& view);
+    void storeView(const std::string& normalizedWord, const PostingView& view);
+    bool findExpansion(const std::string& word, ExpandedTerm& term);
+    void storeExpansion(const std::string& word, const ExpandedTerm& term);
+};
+
+// What a query is evaluated against: the selected in-memory backend, the
+// mapped index, or one segment of a segmented index. Document ids within a
+// source run from 0 to documentCount - 1, and docBase turns them into ids of
+// the document table. statistics describe the whole collection, with lengths
+// indexed by the source's ids. For a segment, siblings lists every segment of
+// the same snapshot, so that term frequencies can be taken over all of them.
+// lookups is set for the queries of a batch.
+struct QuerySource {
+    const HashMapSearch* hashMap = nullptr;
+    const TrieSearch* trie = nullptr;
+    const MappedIndex* mapped = nullptr;
+    uint32_t docBase = 0;
+    size_t documentCount = 0;
+    CorpusStatistics statistics;
+    const std::vector<QuerySource>* siblings = nullptr;
+    TermLookupCache* lookups = nullptr;
+
+    PostingView lookup(const std::string& normalizedWord) const;
+    std::vector<std::pair<std::string, PostingView>> matchTerms(const WildcardPattern& pattern, size_t maxTerms) const;
+    std::vector<std::pair<std::string, PostingView>> matchFuzzy(const LevenshteinAutomaton& automaton) const;
+    std::shared_ptr<const DocIdBitmap> bitmap(const std::string& term, const PostingView& view) const;
+};
+
+// Everything queries read as of one index version. A published snapshot is
+// never changed: the writer builds the next version beside it, copying only
+// the backend it adds to, and publishes it in one step. A query runs against
+// the snapshot it started with and its results keep that snapshot alive, so
+// queries never wait for indexing and never see half of a change. While a
+// segmented index is open, its segments are published by the SegmentedIndex
+// itself, because merges replace them without any write to the engine.
+struct IndexSnapshot {
+    uint64_t version = 0;
+    std::shared_ptr<const HashMapSearch> hashMap;
+    std::shared_ptr<const TrieSearch> trie;
+    std::shared_ptr<const DocumentTable> documents;
+    std::shared_ptr<const MappedIndex> mapped;
+    bool segmented = false;
+};
+
+// The snapshots a query runs against; segments is only set while a segmented
+// index is open.
+struct QueryView {
+    std::shared_ptr<const IndexSnapshot> index;
+    std::shared_ptr<const SegmentedIndex::Snapshot> segments;
+
+    uint64_t version() const;
+};
+
+// A boolean query node with its postings resolved. cost is the number of
+// documents the node can match at most, which orders the evaluation.
+struct PlannedQuery {
+    QueryNode::Type type;
+    ExpandedTerm term;
+    std::vector<uint32_t> phraseDocIds;
+    size_t cost = 0;
+    std::vector<PlannedQuery> children;
+};
+
+class SearchEngine;
+
+// The results of one query, read a page at a time. The query is parsed up
+// front but only ranked when a page is read, and then only as deep as that
+// page goes; paths and positions are looked up for the documents of the page
+// alone. A cursor keeps the snapshot it was opened on, so its pages stay
+// consistent while the index changes, and must not outlive its engine.
+class ResultCursor {
+private:
+    friend class SearchEngine;
+
+    const SearchEngine* engine = nullptr;
+    QueryNode root;
+    bool valid = false;
+    bool useHashMap = true;
+    QueryView view;
+    QueryCache::Results ranked;
+    // How many results ranked was asked for; 0 asked for all of them.
+    size_t depth = 0;
+
+public:
+    // Documents [offset, offset + count) of the ranking, fewer at its end;
+    // a count of 0 reads everything from offset on. Empty for a query that
+    // did not parse.
+    std::vector<ResultDocument> page(size_t offset, size_t count);
+};
+
+// Any number of threads may search while one thread at a time indexes,
+// loads, clears or opens an index; writers are serialized by writerMutex.
+// Readers take a snapshot without locking and never wait for a writer; the
+// only locks they take are the query cache's and the term bitmap caches',
+// each held for one lookup or insert.
+//
+// Removing a document only marks it deleted in the document table, and
+// queries skip it from the next snapshot on. Its postings stay in the
+// in-memory backends until a purge thread rewrites them, once one document
+// in PurgeRatio is deleted and not purged yet; a segmented index purges its
+// own segments when it flushes and merges them.
 class SearchEngine {
 private:
-    HashMapSearch hashMapSearch;
-    TrieSearch trieSearch;
+    friend class ResultCursor;
+
+    static constexpr size_t PurgeRatio = 4;
 
-    std::vector<std::string> splitQuery(const std::string& query) const;
-    void displayResults(const std::vector<WordInDocument*>& results) const;
+    // Writer state, only touched with writerMutex held. documents assigns the
+    // ids; snapshots get a copy of it. purgedDeletions counts the deleted
+    // documents whose postings the in-memory backends no longer hold.
+    std::mutex writerMutex;
+    DocumentTable documents;
+    SegmentedIndex segmentedIndex;
+    uint64_t indexVersion = 0;
+    size_t purgedDeletions = 0;
+
+    std::thread purger;
+    std::mutex purgeMutex;
+    std::condition_variable purgeSignal;
+    bool purgeRequested = false;
+    bool purgerStopping = false;
+
+    VersionPublisher<IndexSnapshot> published;
+    std::atomic<size_t> wildcardTopK{ 20 };
+    std::atomic<unsigned> fuzzyDistance{ 0 };
+    std::atomic<size_t> resultLimit{ 10 };
+    mutable QueryCache queryCache;
+    mutable std::unique_ptr<WorkStealingPool> batchPool;
+    mutable std::once_flag batchPoolStarted;
+
+    void mergePartialIndexes(const std::vector<PartialIndex>& partials, bool useHashMap);
+    std::shared_ptr<IndexSnapshot> nextSnapshot() const;
+    void publish(std::shared_ptr<IndexSnapshot> next);
+    void closeMappedIndex();
+    bool rejectWhileMapped(const char* action) const;
+    void detachSegmentedIndex();
+    bool removeIndexedFile(const std::string& filePath);
+    void requestPurge();
+    void purgeLoop();
+    QueryView currentView() const;
+    QueryCache::Results evaluate(const QueryNode& root, bool useHashMap, size_t limit, const QueryView& view) const;
+    ResultDocument materialize(const SearchResult& result, bool withPositions, const QueryView& view) const;
+    std::string cacheKey(const QueryNode& root, bool useHashMap, size_t limit, const QueryView& view) const;
+    void querySources(bool useHashMap, const QueryView& view, std::vector<QuerySource>& sources) const;
+    std::vector<SearchResult> runQuery(const QueryNode& root, size_t limit, const std::vector<QuerySource>& sources) const;
+    std::vector<SearchResult> runSourceQuery(const QueryNode& root, size_t limit, const QuerySource& source) const;
+
+    PostingView lookupTerm(const std::string& word, const QuerySource& source) const;
+    ExpandedTerm expandTerm(const std::string& word, const QuerySource& source) const;
+    ExpandedTerm expandFuzzy(const std::string& word, unsigned distance, const QuerySource& source) const;
+    std::vector<std::string> collectionExpansions(const WildcardPattern& pattern, const std::vector<QuerySource>& sources) const;
+    std::vector<std::pair<std::string, unsigned>> fuzzyExpansions(const LevenshteinAutomaton& automaton, const std::vector<QuerySource>& sources) const;
+    size_t documentFrequency(const std::string& term, const PostingView& view, const QuerySource& source) const;
+    std::string documentPath(uint32_t docId, const QueryView& view) const;
+    std::vector<RankedTerm> rankTerms(const Bm25Ranker& ranker, const std::vector<ExpandedTerm>& terms, const QuerySource& source) const;
+    std::vector<SearchResult> collectResults(const std::vector<ScoredDocument>& ranked, const std::vector<ExpandedTerm>& terms, const QuerySource& source) const;
+    std::vector<SearchResult> matchAll(const std::vector<std::string>& words, size_t limit, const QuerySource& source) const;
+    std::vector<SearchResult> matchAny(const std::vector<std::string>& words, size_t limit, const QuerySource& source) const;
+    std::vector<SearchResult> rankPhrase(PhraseMatches& matches, size_t documentFrequency, size_t limit, const QuerySource& source) const;
+    std::vector<SearchResult> matchBoolean(const QueryNode& root, size_t limit, const QuerySource& source) const;
+    void findPhrase(const std::vector<std::string>& words, const QuerySource& source, PhraseMatches& matches) const;
+    PlannedQuery planQuery(const QueryNode& node, const QuerySource& source) const;
+    std::vector<uint32_t> evaluatePlan(const PlannedQuery& plan, const QuerySource& source) const;
+    std::shared_ptr<const DocIdBitmap> evaluateBitmap(const PlannedQuery& plan, const QuerySource& source) const;
+    std::shared_ptr<const DocIdBitmap> termBitmap(const ExpandedTerm& term, const QuerySource& source) const;
+    void collectScoringTerms(const PlannedQuery& plan, std::vector<ExpandedTerm>& terms) const;
 
 public:
+    SearchEngine();
+    ~SearchEngine();
+
     static bool useHashMap;
     static std::string normalize(const std::string& word);
-    void indexDocuments(const std::string& folderPath, bool useHashMap, int numFiles);
-    void indexDocument(const std::string& filePath, bool useHashMap);
-    void searchQuery(const std::string& query, bool useHashMap) const;
-    void comparePerformance(const std::vector<std::string>& queries);
+    void indexDocuments(const std::string& folderPath, bool useHashMap, int numFiles, int numWorkers = 0);
+    // Indexes the files the crawler finds under root that are not indexed
+    // yet, reading them ahead of the indexing threads. Returns the number of
+    // files found, including those already indexed or unreadable; the number
+    // actually added is reported on cout.
+    size_t indexDirectory(const std::string& root, const DirectoryCrawler& crawler, bool useHashMap, int numWorkers = 0);
+    // Returns false if the file is already indexed or cannot be read.
+    bool indexDocument(const std::string& filePath, bool useHashMap);
+    QueryCache::Results search(const std::string& query, bool useHashMap) const;
+    ResultCursor searchQuery(const std::string& query, bool useHashMap) const;
+    std::vector<BatchResult> searchBatch(const std::vector<std::string>& queries, bool useHashMap, bool withPositions = false) const;
+    void setWildcardTopK(size_t topK);
+    void setFuzzyDistance(unsigned distance);
+    void setResultLimit(size_t limit);
+    size_t getResultLimit() const;
+    void setQueryCacheCapacity(size_t capacity);
+    void displayQueryCacheStats() const;
     void clear(bool useHashMap);
     void save(const std::string& filePath, bool useHashMap);
     void load(const std::string& filePath, bool useHashMap);
     void displayIndex(bool useHashMap) const;
-    static std::unordered_set<std::string> indexedFiles;
+    void displayMemoryReport() const;
     bool dumpSearchEngine(const std::string& dumpFilePath);
-    void addFileToIndex(const std::string& newFilePath, bool useHashMap);
+    bool addFileToIndex(const std::string& newFilePath, bool useHashMap);
+    bool removeDocument(const std::string& filePath);
+    bool updateDocument(const std::string& filePath, bool useHashMap);
+    bool purgeDeletedDocuments();
     bool loadSearchEngine(const std::string& dumpFilePath);
+    bool dumpMappedIndex(const std::string& indexFilePath);
+    bool openMappedIndex(const std::string& indexFilePath);
+    bool openSegmentedIndex(const std::string& directory, size_t flushThreshold = SegmentedIndex::DefaultFlushThreshold);
+    void closeSegmentedIndex();
+    void displaySegments() const;
 };
@@ -0,0 +1,568 @@
+#include "SegmentedIndex.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#define _SILENCE_EXPERIMENTAL_FILESYSTEM_DEPRECATION_WARNING
+#include <experimental/filesystem>
+
+namespace fs = std::experimental::filesystem;
+using namespace std;
+
+static const char ManifestHeader[] = "search-engine segments 1";
+static const char DeletionsHeader[] = "search-engine deletions 1";
+static const char SegmentPrefix[] = "segment_";
+static const char SegmentExtension[] = ".idx";
+
+SegmentedIndex::Segment::~Segment() {
+    index.close();
+    if (obsolete) {
+        error_code error;
+        fs::remove(filePath, error);
+    }
+}
+
+SegmentedIndex::~SegmentedIndex() {
+    close();
+}
+
+string SegmentedIndex::segmentPath(uint64_t generation) const {
+    char name[32];
+    snprintf(name, sizeof(name), "%s%06llu%s", SegmentPrefix, static_cast<unsigned long long>(generation), SegmentExtension);
+    return (fs::path(directory) / name).string();
+}
+
+// Reads the generation back from a name segmentPath made. Returns false for
+// any other name.
+static bool parseGeneration(const string& fileName, uint64_t& generation) {
+    const size_t prefixLength = sizeof(SegmentPrefix) - 1;
+    const size_t extensionLength = sizeof(SegmentExtension) - 1;
+    if (fileName.size() <= prefixLength + extensionLength || fileName.compare(0, prefixLength, SegmentPrefix) != 0
+        || fileName.compare(fileName.size() - extensionLength, extensionLength, SegmentExtension) != 0) {
+        return false;
+    }
+    const char* digits = fileName.c_str() + prefixLength;
+    const char* digitsEnd = fileName.c_str() + fileName.size() - extensionLength;
+    for (const char* c = digits; c != digitsEnd; ++c) {
+        if (*c < '0' || *c > '9') {
+            return false;
+        }
+    }
+    errno = 0;
+    char* end;
+    unsigned long long value = strtoull(digits, &end, 10);
+    if (errno == ERANGE || end != digitsEnd || value == UINT64_MAX) {
+        return false;
+    }
+    generation = value;
+    return true;
+}
+
+string SegmentedIndex::manifestPath() const {
+    return (fs::path(directory) / "segments.txt").string();
+}
+
+string SegmentedIndex::deletionsPath() const {
+    return (fs::path(directory) / "deletions.txt").string();
+}
+
+// Segment files are listed oldest first, which is also document id order.
+// The list is written to a temporary file that then replaces the manifest, so
+// a reader never sees a half-written one. Called with segmentMutex held.
+bool SegmentedIndex::writeManifest() const {
+    string temporaryPath = manifestPath() + ".tmp";
+    {
+        ofstream manifest(temporaryPath, ios::trunc);
+        if (!manifest.is_open()) {
+            cerr << "Error: Could not write segment manifest: " << temporaryPath << endl;
+            return false;
+        }
+        manifest << ManifestHeader << "\n";
+        for (const shared_ptr<Segment>& segment : segments) {
+            manifest << fs::path(segment->filePath).filename().string() << "\n";
+        }
+        if (!manifest) {
+            cerr << "Error: Could not write segment manifest: " << temporaryPath << endl;
+            return false;
+        }
+    }
+
+    error_code error;
+    fs::rename(temporaryPath, manifestPath(), error);
+    if (error) {
+        cerr << "Error: Could not replace segment manifest: " << error.message() << endl;
+        return false;
+    }
+    return true;
+}
+
+// Lists the deleted documents whose postings are still in a segment file,
+// one id per line; deletions that a flush or merge has written into a
+// segment are dropped. Documents of the in-memory segment are not listed,
+// since they are lost anyway if the process ends before a flush. Replaced
+// like the manifest. Called with segmentMutex held.
+bool SegmentedIndex::writeDeletions() const {
+    string temporaryPath = deletionsPath() + ".tmp";
+    {
+        ofstream file(temporaryPath, ios::trunc);
+        if (!file.is_open()) {
+            cerr << "Error: Could not write deletions: " << temporaryPath << endl;
+            return false;
+        }
+        file << DeletionsHeader << "\n";
+        for (uint32_t docId : deleted->toVector()) {
+            if (docId >= memory->docBase) {
+                break;
+            }
+            const Segment& segment = *segments[segmentOf(docId)];
+            if (!segment.index.isDeleted(docId - segment.docBase)) {
+                file << docId << "\n";
+            }
+        }
+        if (!file) {
+            cerr << "Error: Could not write deletions: " << temporaryPath << endl;
+            return false;
+        }
+    }
+
+    error_code error;
+    fs::rename(temporaryPath, deletionsPath(), error);
+    if (error) {
+        cerr << "Error: Could not replace deletions: " << error.message() << endl;
+        return false;
+    }
+    return true;
+}
+
+// Index of the segment holding a document that is not in the in-memory
+// segment. Called with segmentMutex held.
+size_t SegmentedIndex::segmentOf(uint32_t docId) const {
+    auto segment = upper_bound(segments.begin(), segments.end(), docId,
+        [](uint32_t id, const shared_ptr<Segment>& candidate) {
+            return id < candidate->docBase;
+        });
+    return static_cast<size_t>(segment - segments.begin()) - 1;
+}
+
+// Called with segmentMutex held.
+size_t SegmentedIndex::countPendingDeletions(const Segment& segment) const {
+    size_t pending = 0;
+    uint32_t count = static_cast<uint32_t>(segment.index.documentCount());
+    for (uint32_t docId : deleted->slice(segment.docBase, count).toVector()) {
+        if (!segment.index.isDeleted(docId)) {
+            pending++;
+        }
+    }
+    return pending;
+}
+
+shared_ptr<SegmentedIndex::Segment> SegmentedIndex::openSegment(const string& filePath, uint32_t docBase) const {
+    shared_ptr<Segment> segment = make_shared<Segment>();
+    segment->filePath = filePath;
+    segment->docBase = docBase;
+    if (!segment->index.open(filePath)) {
+        return nullptr;
+    }
+    return segment;
+}
+
+// Opens (or creates) the segment directory and fills documents with the
+// paths and lengths of every document in it, in id order.
+bool SegmentedIndex::open(const string& directoryPath, DocumentTable& documents) {
+    close();
+
+    error_code error;
+    fs::create_directories(directoryPath, error);
+    if (error) {
+        cerr << "Error: Could not create segment directory: " << directoryPath << endl;
+        return false;
+    }
+    directory = directoryPath;
+
+    vector<string> fileNames;
+    ifstream manifest(manifestPath());
+    if (manifest.is_open()) {
+        string line;
+        if (!getline(manifest, line) || line != ManifestHeader) {
+            cerr << "Error: " << manifestPath() << " is not a segment manifest." << endl;
+            return false;
+        }
+        while (getline(manifest, line)) {
+            if (!line.empty()) {
+                fileNames.push_back(line);
+            }
+        }
+    }
+
+    documents.clear();
+    vector<shared_ptr<Segment>> loaded;
+    uint32_t docBase = 0;
+    nextGeneration = 1;
+    for (const string& fileName : fileNames) {
+        uint64_t generation;
+        if (!parseGeneration(fileName, generation)) {
+            cerr << "Error: " << manifestPath() << " lists \"" << fileName << "\", which is not a segment file name." << endl;
+            documents.clear();
+            return false;
+        }
+        shared_ptr<Segment> segment = openSegment((fs::path(directory) / fileName).string(), docBase);
+        if (!segment) {
+            documents.clear();
+            return false;
+        }
+        const MappedIndex& index = segment->index;
+        for (uint32_t docId = 0; docId < index.documentCount(); ++docId) {
+            uint32_t globalId = documents.addDocument(index.getPath(docId));
+            documents.setLength(globalId, index.lengthData()[docId]);
+        }
+        docBase += static_cast<uint32_t>(index.documentCount());
+        nextGeneration = max<uint64_t>(nextGeneration, generation + 1);
+        loaded.push_back(segment);
+    }
+
+    vector<uint32_t> deletedIds;
+    ifstream deletions(deletionsPath());
+    if (deletions.is_open()) {
+        string line;
+        if (!getline(deletions, line) || line != DeletionsHeader) {
+            cerr << "Error: " << deletionsPath() << " is not a deletions file." << endl;
+            documents.clear();
+            return false;
+        }
+        uint32_t docId;
+        while (deletions >> docId) {
+            deletedIds.push_back(docId);
+        }
+    }
+    for (uint32_t docId : deletedIds) {
+        if (docId < documents.size()) {
+            documents.removeDocument(docId);
+        }
+    }
+
+    for (const auto& entry : fs::directory_iterator(directory)) {
+        string fileName = entry.path().filename().string();
+        bool isSegment = fileName.compare(0, sizeof(SegmentPrefix) - 1, SegmentPrefix) == 0;
+        if (isSegment && find(fileNames.begin(), fileNames.end(), fileName) == fileNames.end()) {
+            fs::remove(entry.path(), error);
+        }
+    }
+
+    shared_ptr<MemorySegment> empty = make_shared<MemorySegment>();
+    empty->docBase = docBase;
+
+    lock_guard<mutex> lock(segmentMutex);
+    segments = move(loaded);
+    memory = empty;
+    deleted = make_shared<const DocIdBitmap>(documents.deletedDocuments());
+    for (const shared_ptr<Segment>& segment : segments) {
+        segment->pendingDeletions = countPendingDeletions(*segment);
+    }
+    contentVersion++;
+    publishSnapshot();
+    stopping = false;
+    merging = false;
+    mergeFailed = false;
+    opened = true;
+    merger = thread(&SegmentedIndex::mergeLoop, this);
+    return true;
+}
+
+// Writes out what is still in memory and stops the merge thread. A merge that
+// is running is finished first.
+void SegmentedIndex::close() {
+    if (!opened) {
+        return;
+    }
+    flush();
+
+    {
+        lock_guard<mutex> lock(segmentMutex);
+        stopping = true;
+    }
+    mergeSignal.notify_all();
+    merger.join();
+
+    lock_guard<mutex> lock(segmentMutex);
+    segments.clear();
+    memory.reset();
+    deleted = make_shared<const DocIdBitmap>();
+    contentVersion++;
+    publishSnapshot();
+    opened = false;
+}
+
+bool SegmentedIndex::isOpen() const {
+    return opened;
+}
+
+// docIds are the ids the document table gave the partial index's files. They
+// continue where the in-memory segment's documents end. The in-memory segment
+// is copied first, since queries may be reading the published one; its size
+// is bounded by the flush threshold, and the copy shares its postings.
+void SegmentedIndex::addDocuments(const PartialIndex& partial, const vector<uint32_t>& docIds) {
+    shared_ptr<MemorySegment> next = make_shared<MemorySegment>(*memory);
+    MemorySegment& segment = *next;
+    for (size_t i = 0; i < partial.indexedFiles.size(); ++i) {
+        uint32_t localId = segment.documents.addDocument(partial.indexedFiles[i]);
+        segment.documents.setLength(localId, partial.documentLengths[i]);
+    }
+
+    for (const PartialIndex::TermPostings& term : partial.terms) {
+        for (const PartialIndex::Posting& posting : term.postings) {
+            segment.index.addPostings(term.word, docIds[posting.localDocId] - segment.docBase, posting.positions);
+        }
+    }
+
+    {
+        lock_guard<mutex> lock(segmentMutex);
+        memory = next;
+        contentVersion++;
+        publishSnapshot();
+    }
+
+    if (segment.documents.size() >= flushThreshold) {
+        flush();
+    }
+}
+
+// Marks a document deleted. One in the in-memory segment is removed from a
+// copy of it as well, so that the flush leaves its postings out; one in a
+// segment file is recorded in the deletions file before this returns. Runs on
+// the writer's thread only.
+bool SegmentedIndex::removeDocument(uint32_t docId) {
+    if (!opened || deleted->contains(docId) || docId >= memory->docBase + memory->documents.size()) {
+        return false;
+    }
+
+    shared_ptr<MemorySegment> nextMemory;
+    if (docId >= memory->docBase) {
+        nextMemory = make_shared<MemorySegment>(*memory);
+        nextMemory->documents.removeDocument(docId - memory->docBase);
+    }
+    shared_ptr<DocIdBitmap> nextDeleted = make_shared<DocIdBitmap>(*deleted);
+    nextDeleted->add(docId);
+
+    lock_guard<mutex> lock(segmentMutex);
+    deleted = nextDeleted;
+    bool written = true;
+    if (nextMemory != nullptr) {
+        memory = nextMemory;
+    }
+    else {
+        segments[segmentOf(docId)]->pendingDeletions++;
+        written = writeDeletions();
+        mergeSignal.notify_one();
+    }
+    contentVersion++;
+    publishSnapshot();
+    return written;
+}
+
+// Writes the in-memory segment to a new segment file and starts an empty one
+// after it. The file is complete before the manifest lists it, so a crash in
+// between only leaves an unlisted file behind. Snapshots taken earlier keep
+// the old in-memory segment alive. Like addDocuments, it runs on the writer's
+// thread only.
+bool SegmentedIndex::flush() {
+    if (!opened || memory->documents.size() == 0) {
+        return true;
+    }
+
+    uint64_t generation;
+    {
+        lock_guard<mutex> lock(segmentMutex);
+        generation = nextGeneration++;
+    }
+
+    string filePath = segmentPath(generation);
+    vector<pair<string, const PostingList*>> terms;
+    memory->index.collectTerms(terms);
+    if (!MappedIndex::write(filePath, memory->documents, terms)) {
+        return false;
+    }
+    shared_ptr<Segment> segment = openSegment(filePath, memory->docBase);
+    if (!segment) {
+        return false;
+    }
+
+    shared_ptr<MemorySegment> next = make_shared<MemorySegment>();
+    next->docBase = memory->docBase + static_cast<uint32_t>(memory->documents.size());
+
+    lock_guard<mutex> lock(segmentMutex);
+    segments.push_back(segment);
+    memory = next;
+    publishSnapshot();
+    mergeFailed = false;
+    bool written = writeManifest();
+    mergeSignal.notify_one();
+    return written;
+}
+
+// Called with segmentMutex held after every change to segments or memory.
+void SegmentedIndex::publishSnapshot() {
+    shared_ptr<Snapshot> next = make_shared<Snapshot>();
+    next->segments.assign(segments.begin(), segments.end());
+    next->memory = memory;
+    next->deleted = deleted;
+    next->version = contentVersion;
+    published.publish(next);
+}
+
+shared_ptr<const SegmentedIndex::Snapshot> SegmentedIndex::snapshot() const {
+    return published.acquire();
+}
+
+// Segments are tiered by document count: tier 0 holds what one flush
+// produces, and each tier above holds mergeFactor times more.
+size_t SegmentedIndex::tierOf(const Segment& segment) const {
+    size_t tier = 0;
+    size_t limit = flushThreshold * mergeFactor;
+    while (segment.index.documentCount() >= limit) {
+        tier++;
+        limit *= mergeFactor;
+    }
+    return tier;
+}
+
+// Looks for mergeFactor adjacent segments of the same tier, preferring the
+// lowest tier since those merges are the cheapest. Only adjacent segments are
+// merged so that every segment keeps covering one range of document ids.
+// Failing that, a segment with many deleted documents is rewritten alone.
+// Called with segmentMutex held.
+bool SegmentedIndex::findMerge(size_t& first, size_t& count) const {
+    count = mergeFactor;
+    bool found = false;
+    size_t bestTier = 0;
+    size_t runStart = 0;
+    for (size_t i = 1; i <= segments.size(); ++i) {
+        size_t tier = tierOf(*segments[runStart]);
+        if (i < segments.size() && tierOf(*segments[i]) == tier) {
+            continue;
+        }
+        if (i - runStart >= mergeFactor && (!found || tier < bestTier)) {
+            found = true;
+            bestTier = tier;
+            first = runStart;
+        }
+        runStart = i;
+    }
+    if (found) {
+        return true;
+    }
+
+    for (size_t i = 0; i < segments.size(); ++i) {
+        const Segment& segment = *segments[i];
+        if (segment.pendingDeletions > 0 && segment.pendingDeletions * PurgeRatio >= segment.index.documentCount()) {
+            first = i;
+            count = 1;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Merges run one at a time. The inputs are immutable, so the merged file is
+// written without holding the lock; only flushes append segments meanwhile,
+// and they append after the inputs, so the inputs are still in place when the
+// merged segment replaces them.
+void SegmentedIndex::mergeLoop() {
+    unique_lock<mutex> lock(segmentMutex);
+    while (!stopping) {
+        size_t first = 0;
+        size_t count = 0;
+        if (!findMerge(first, count)) {
+            mergeDone.notify_all();
+            mergeSignal.wait(lock);
+            continue;
+        }
+
+        vector<shared_ptr<Segment>> inputs(segments.begin() + first, segments.begin() + first + count);
+        string filePath = segmentPath(nextGeneration++);
+        uint32_t mergedCount = 0;
+        for (const shared_ptr<Segment>& input : inputs) {
+            mergedCount += static_cast<uint32_t>(input->index.documentCount());
+        }
+        DocIdBitmap mergedDeletions = deleted->slice(inputs[0]->docBase, mergedCount);
+        merging = true;
+        lock.unlock();
+
+        vector<const MappedIndex*> indexes;
+        for (const shared_ptr<Segment>& input : inputs) {
+            indexes.push_back(&input->index);
+        }
+        shared_ptr<Segment> merged;
+        if (MappedIndex::merge(filePath, indexes, mergedDeletions)) {
+            merged = openSegment(filePath, inputs[0]->docBase);
+        }
+
+        lock.lock();
+        merging = false;
+        if (!merged) {
+            cerr << "Error: Merging segments into " << filePath << " failed; retrying after the next flush." << endl;
+            mergeFailed = true;
+            mergeDone.notify_all();
+            mergeSignal.wait(lock);
+            continue;
+        }
+
+        segments.erase(segments.begin() + first, segments.begin() + first + count);
+        segments.insert(segments.begin() + first, merged);
+        merged->pendingDeletions = countPendingDeletions(*merged);
+        publishSnapshot();
+        writeManifest();
+        writeDeletions();
+        for (const shared_ptr<Segment>& input : inputs) {
+            input->obsolete = true;
+        }
+        mergeCount++;
+    }
+    mergeDone.notify_all();
+}
+
+// Blocks until the merge thread has nothing left to merge, or a merge failed.
+void SegmentedIndex::waitForMerges() {
+    unique_lock<mutex> lock(segmentMutex);
+    if (!opened) {
+        return;
+    }
+    mergeSignal.notify_one();
+    mergeDone.wait(lock, [this] {
+        size_t first;
+        size_t count;
+        return stopping || (!merging && (mergeFailed || !findMerge(first, count)));
+    });
+}
+
+void SegmentedIndex::setFlushThreshold(size_t documents) {
+    lock_guard<mutex> lock(segmentMutex);
+    flushThreshold = max<size_t>(1, documents);
+    mergeSignal.notify_one();
+}
+
+void SegmentedIndex::setMergeFactor(size_t segmentCount) {
+    lock_guard<mutex> lock(segmentMutex);
+    mergeFactor = max<size_t>(2, segmentCount);
+    mergeSignal.notify_one();
+}
+
+void SegmentedIndex::displayStatus() const {
+    if (!opened) {
+        cout << "No segmented index is open.\n";
+        return;
+    }
+
+    lock_guard<mutex> lock(segmentMutex);
+    cout << "Segmented index in " << directory << ": " << segments.size() << " segment(s), "
+        << memory->documents.size() << " document(s) in memory (flushed at " << flushThreshold << "), "
+        << mergeCount << " merge(s) done" << (merging ? ", merging now" : "") << ", "
+        << deleted->cardinality() << " document(s) deleted\n";
+    for (const shared_ptr<Segment>& segment : segments) {
+        size_t count = segment->index.documentCount();
+        cout << "  " << fs::path(segment->filePath).filename().string() << ": documents " << segment->docBase
+            << " - " << segment->docBase + count - 1 << " (" << count << " documents, " << segment->index.termCount()
+            << " terms, tier " << tierOf(*segment) << ", " << segment->pendingDeletions << " deleted not purged)\n";
+    }
+}
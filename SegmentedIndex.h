@@ -0,0 +1,131 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "DocumentTable.h"
+#include "HashMapSearch.h"
+#include "MappedIndex.h"
+#include "PartialIndex.h"
+#include "VersionPublisher.h"
+
+// Log-structured index kept in a directory. New documents go into an
+// in-memory segment; once it holds flushThreshold documents it is written out
+// as an immutable mapped index file (a segment) and a fresh one is started.
+// A background thread merges runs of adjacent segments of similar size, so
+// the number of segments stays logarithmic in the number of documents and no
+// write ever rewrites the whole index.
+//
+// Every segment covers a consecutive range of document ids starting at its
+// docBase, and postings inside it use ids relative to that base. The list of
+// live segments is kept in a manifest file that is replaced atomically after
+// every flush and merge; files not listed there are leftovers and are removed
+// when the directory is opened.
+//
+// Queries read published snapshots without locking them and never wait for
+// the writer. Segments are immutable, and a published in-memory segment is never changed either: new
+// documents go into a copy of it, which the next snapshot publishes.
+//
+// Removed documents are marked in a bitmap of deleted ids that queries skip.
+// Their postings are purged when the in-memory segment is flushed and when a
+// merge rewrites their segment; a segment that has collected many deleted
+// documents is rewritten on its own. Deletions not purged yet are kept in a
+// deletions file next to the manifest, replaced the same way.
+class SegmentedIndex {
+public:
+    struct Segment {
+        std::string filePath;
+        uint32_t docBase = 0;
+        MappedIndex index;
+        // Set once the segment has been merged away; the file is deleted
+        // when the last snapshot using it lets go.
+        std::atomic<bool> obsolete{ false };
+        // Deleted documents whose postings are still in the file. Guarded by
+        // segmentMutex.
+        size_t pendingDeletions = 0;
+
+        ~Segment();
+    };
+
+    struct MemorySegment {
+        uint32_t docBase = 0;
+        DocumentTable documents;
+        HashMapSearch index;
+    };
+
+    // The segments a query runs against. Holding a snapshot keeps its
+    // segments mapped even if a merge replaces them in the meantime. version
+    // changes whenever documents are added or the index is opened or closed,
+    // but not when segments are flushed or merged: snapshots with the same
+    // version hold the same documents.
+    struct Snapshot {
+        std::vector<std::shared_ptr<const Segment>> segments;
+        std::shared_ptr<const MemorySegment> memory;
+        // Every deleted document, by document table id.
+        std::shared_ptr<const DocIdBitmap> deleted;
+        uint64_t version = 0;
+    };
+
+    static constexpr size_t DefaultFlushThreshold = 1000;
+    static constexpr size_t DefaultMergeFactor = 4;
+    // A segment is rewritten without its deleted documents once this share
+    // of them (one in PurgeRatio) has been deleted.
+    static constexpr size_t PurgeRatio = 4;
+
+    SegmentedIndex() = default;
+    SegmentedIndex(const SegmentedIndex&) = delete;
+    SegmentedIndex& operator=(const SegmentedIndex&) = delete;
+    ~SegmentedIndex();
+
+    bool open(const std::string& directory, DocumentTable& documents);
+    void close();
+    bool isOpen() const;
+
+    void addDocuments(const PartialIndex& partial, const std::vector<uint32_t>& docIds);
+    bool removeDocument(uint32_t docId);
+    bool flush();
+    std::shared_ptr<const Snapshot> snapshot() const;
+    void waitForMerges();
+
+    void setFlushThreshold(size_t documents);
+    void setMergeFactor(size_t segmentCount);
+    void displayStatus() const;
+
+private:
+    std::string directory;
+    bool opened = false;
+    size_t flushThreshold = DefaultFlushThreshold;
+    size_t mergeFactor = DefaultMergeFactor;
+    uint64_t nextGeneration = 1;
+
+    mutable std::mutex segmentMutex;
+    std::condition_variable mergeSignal;
+    std::condition_variable mergeDone;
+    std::vector<std::shared_ptr<Segment>> segments;
+    std::shared_ptr<const MemorySegment> memory;
+    std::shared_ptr<const DocIdBitmap> deleted = std::make_shared<const DocIdBitmap>();
+    uint64_t contentVersion = 0;
+    VersionPublisher<Snapshot> published{ std::make_shared<const Snapshot>() };
+    std::thread merger;
+    bool stopping = false;
+    bool merging = false;
+    bool mergeFailed = false;
+    size_t mergeCount = 0;
+
+    std::string segmentPath(uint64_t generation) const;
+    std::string manifestPath() const;
+    std::string deletionsPath() const;
+    bool writeManifest() const;
+    bool writeDeletions() const;
+    size_t segmentOf(uint32_t docId) const;
+    size_t countPendingDeletions(const Segment& segment) const;
+    void publishSnapshot();
+    std::shared_ptr<Segment> openSegment(const std::string& filePath, uint32_t docBase) const;
+    size_t tierOf(const Segment& segment) const;
+    bool findMerge(size_t& first, size_t& count) const;
+    void mergeLoop();
+};
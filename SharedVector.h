@@ -0,0 +1,130 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <type_traits>
+
+// Array of plain values whose copies share one buffer, so a copy takes
+// constant time. Each copy sees the elements it had when it was made. The
+// buffer records how many elements any copy can see (shared) and how many
+// have been written (used); appending to the copy whose end is the buffer's
+// end writes into the spare capacity past every other copy, and so do
+// changes to elements no other copy can see. Anything else copies the buffer
+// first. The elements are contiguous, as in a std::vector.
+//
+// A copy can be read from any thread while another is changed, but copying
+// and changing have to happen on one thread at a time (the index writer).
+template <typename T>
+class SharedVector {
+    static_assert(std::is_trivially_copyable<T>::value, "elements are copied with memcpy");
+
+private:
+    struct Buffer {
+        std::unique_ptr<T[]> elements;
+        size_t capacity = 0;
+        size_t used = 0;
+        size_t shared = 0;
+    };
+
+    std::shared_ptr<Buffer> buffer;
+    size_t count = 0;
+
+    bool ownsFrom(size_t index) const {
+        return buffer != nullptr && buffer->used == count && index >= buffer->shared;
+    }
+
+    void share() const {
+        if (buffer != nullptr) {
+            buffer->shared = std::max(buffer->shared, count);
+        }
+    }
+
+    void reallocate(size_t capacity) {
+        std::shared_ptr<Buffer> next = std::make_shared<Buffer>();
+        next->elements.reset(new T[capacity]);
+        next->capacity = capacity;
+        next->used = count;
+        if (count != 0) {
+            std::memcpy(next->elements.get(), buffer->elements.get(), count * sizeof(T));
+        }
+        buffer = std::move(next);
+    }
+
+public:
+    SharedVector() = default;
+    SharedVector(const SharedVector& other) : buffer(other.buffer), count(other.count) {
+        share();
+    }
+    SharedVector(SharedVector&& other) noexcept : buffer(std::move(other.buffer)), count(other.count) {
+        other.count = 0;
+    }
+    SharedVector& operator=(const SharedVector& other) {
+        buffer = other.buffer;
+        count = other.count;
+        share();
+        return *this;
+    }
+    SharedVector& operator=(SharedVector&& other) noexcept {
+        buffer = std::move(other.buffer);
+        count = other.count;
+        other.count = 0;
+        return *this;
+    }
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    size_t capacity() const { return buffer != nullptr ? buffer->capacity : 0; }
+    const T* data() const { return buffer != nullptr ? buffer->elements.get() : nullptr; }
+    const T* begin() const { return data(); }
+    const T* end() const { return data() + count; }
+    const T& operator[](size_t index) const { return buffer->elements[index]; }
+    const T& back() const { return buffer->elements[count - 1]; }
+
+    void push_back(const T& value) {
+        if (!ownsFrom(count) || count == buffer->capacity) {
+            reallocate(std::max<size_t>(count * 2, 4));
+        }
+        buffer->elements[count++] = value;
+        buffer->used = count;
+    }
+
+    void append(const T* values, size_t valueCount) {
+        if (!ownsFrom(count) || buffer->capacity - count < valueCount) {
+            reallocate(std::max<size_t>(std::max(count * 2, count + valueCount), 4));
+        }
+        if (valueCount != 0) {
+            std::memcpy(buffer->elements.get() + count, values, valueCount * sizeof(T));
+        }
+        count += valueCount;
+        buffer->used = count;
+    }
+
+    void insert(size_t index, const T& value) {
+        if (!ownsFrom(index) || count == buffer->capacity) {
+            reallocate(std::max<size_t>(count * 2, 4));
+        }
+        T* elements = buffer->elements.get();
+        std::memmove(elements + index + 1, elements + index, (count - index) * sizeof(T));
+        elements[index] = value;
+        buffer->used = ++count;
+    }
+
+    void set(size_t index, const T& value) {
+        if (!ownsFrom(index)) {
+            reallocate(std::max<size_t>(count, 4));
+        }
+        buffer->elements[index] = value;
+    }
+
+    void reserve(size_t capacity) {
+        if (capacity > this->capacity()) {
+            reallocate(capacity);
+        }
+    }
+
+    void clear() {
+        buffer.reset();
+        count = 0;
+    }
+};
@@ -0,0 +1,245 @@
+#include "TermDictionary.h"
+#include <algorithm>
+#include <atomic>
+#include <functional>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SEARCH_ENGINE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+using namespace std;
+
+static int lowestSetBit(uint32_t mask) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return static_cast<int>(index);
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+// Bit i is set where the i-th of the 16 codes at group equals code.
+static uint32_t matchGroup(const uint8_t* group, uint8_t code) {
+#ifdef SEARCH_ENGINE_SSE2
+    __m128i codes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group));
+    __m128i equal = _mm_cmpeq_epi8(codes, _mm_set1_epi8(static_cast<char>(code)));
+    return static_cast<uint32_t>(_mm_movemask_epi8(equal));
+#else
+    uint32_t mask = 0;
+    for (uint32_t i = 0; i < 16; ++i) {
+        if (group[i] == code) {
+            mask |= 1u << i;
+        }
+    }
+    return mask;
+#endif
+}
+
+static atomic<uint64_t> nextOwner{ 1 };
+
+TermDictionary::TermDictionary() : owner(newOwner()) {
+}
+
+TermDictionary::TermDictionary(const TermDictionary& other)
+    : entryBlocks(other.entryBlocks), slotBlocks(other.slotBlocks), entryCount(other.entryCount),
+    capacity(other.capacity), owner(newOwner()) {
+    other.owner = newOwner();
+}
+
+TermDictionary& TermDictionary::operator=(const TermDictionary& other) {
+    if (this != &other) {
+        entryBlocks = other.entryBlocks;
+        slotBlocks = other.slotBlocks;
+        entryCount = other.entryCount;
+        capacity = other.capacity;
+        owner = newOwner();
+        other.owner = newOwner();
+    }
+    return *this;
+}
+
+uint64_t TermDictionary::newOwner() {
+    return nextOwner++;
+}
+
+// The library hash is finished with a multiply and shift so that both the low
+// 7 bits (the control code) and the bits above them (the group) are mixed,
+// whatever the library's hash looks like.
+uint64_t TermDictionary::hashTerm(string_view term) {
+    uint64_t hash = static_cast<uint64_t>(std::hash<string_view>()(term));
+    hash *= 0x9E3779B97F4A7C15ULL;
+    return hash ^ (hash >> 32);
+}
+
+const TermDictionary::Entry& TermDictionary::entryAt(size_t index) const {
+    return entryBlocks[index / EntriesPerBlock]->entries[index % EntriesPerBlock];
+}
+
+// Blocks hold a whole number of groups, so a group never spans two blocks.
+const uint8_t* TermDictionary::controlAt(size_t slot) const {
+    return slotBlocks[slot / SlotsPerBlock]->control.data() + slot % SlotsPerBlock;
+}
+
+TermDictionary::EntryBlock& TermDictionary::ownedEntryBlock(size_t block) {
+    shared_ptr<EntryBlock>& entries = entryBlocks[block];
+    if (entries->owner != owner) {
+        entries = make_shared<EntryBlock>(*entries);
+        entries->owner = owner;
+    }
+    return *entries;
+}
+
+TermDictionary::SlotBlock& TermDictionary::ownedSlotBlock(size_t slot) {
+    shared_ptr<SlotBlock>& slots = slotBlocks[slot / SlotsPerBlock];
+    if (slots->owner != owner) {
+        slots = make_shared<SlotBlock>(*slots);
+        slots->owner = owner;
+    }
+    return *slots;
+}
+
+// Groups are probed in triangular steps (1, 2, 3, ... groups on), which visit
+// every group of a power-of-two table. A group with an empty slot ends the
+// search, because an insert would have stopped there.
+size_t TermDictionary::findEntry(string_view term, uint64_t hash) const {
+    size_t groupMask = capacity / GroupSize - 1;
+    size_t group = (hash >> 7) & groupMask;
+    uint8_t code = static_cast<uint8_t>(hash & 0x7F);
+    for (size_t step = 1; ; ++step) {
+        const uint8_t* codes = controlAt(group * GroupSize);
+        for (uint32_t matches = matchGroup(codes, code); matches != 0; matches &= matches - 1) {
+            size_t slot = group * GroupSize + lowestSetBit(matches);
+            uint32_t index = slotBlocks[slot / SlotsPerBlock]->slots[slot % SlotsPerBlock];
+            if (entryAt(index).hash == hash && term == termAt(index)) {
+                return index;
+            }
+        }
+        if (matchGroup(codes, EmptySlot) != 0) {
+            return NotFound;
+        }
+        group = (group + step) & groupMask;
+    }
+}
+
+void TermDictionary::placeEntry(uint64_t hash, uint32_t entry) {
+    size_t groupMask = capacity / GroupSize - 1;
+    size_t group = (hash >> 7) & groupMask;
+    for (size_t step = 1; ; ++step) {
+        uint32_t empty = matchGroup(controlAt(group * GroupSize), EmptySlot);
+        if (empty != 0) {
+            size_t slot = group * GroupSize + lowestSetBit(empty);
+            SlotBlock& block = ownedSlotBlock(slot);
+            block.control[slot % SlotsPerBlock] = static_cast<uint8_t>(hash & 0x7F);
+            block.slots[slot % SlotsPerBlock] = entry;
+            return;
+        }
+        group = (group + step) & groupMask;
+    }
+}
+
+void TermDictionary::rehash(size_t newCapacity) {
+    capacity = newCapacity;
+    size_t blockSize = min(capacity, SlotsPerBlock);
+    slotBlocks.clear();
+    for (size_t i = 0; i < capacity / blockSize; ++i) {
+        shared_ptr<SlotBlock> block = make_shared<SlotBlock>();
+        block->owner = owner;
+        block->control.assign(blockSize, EmptySlot);
+        block->slots.assign(blockSize, 0);
+        slotBlocks.push_back(move(block));
+    }
+    for (size_t i = 0; i < entryCount; ++i) {
+        placeEntry(entryAt(i).hash, static_cast<uint32_t>(i));
+    }
+}
+
+PostingList& TermDictionary::insert(string_view term) {
+    uint64_t hash = hashTerm(term);
+    if (capacity != 0) {
+        size_t index = findEntry(term, hash);
+        if (index != NotFound) {
+            return ownedEntryBlock(index / EntriesPerBlock).entries[index % EntriesPerBlock].postings;
+        }
+    }
+
+    if ((entryCount + 1) * 8 > capacity * 7) {
+        rehash(capacity == 0 ? GroupSize : capacity * 2);
+    }
+    if (entryCount % EntriesPerBlock == 0) {
+        shared_ptr<EntryBlock> block = make_shared<EntryBlock>();
+        block->owner = owner;
+        block->entries.reserve(EntriesPerBlock);
+        entryBlocks.push_back(move(block));
+    }
+    EntryBlock& block = ownedEntryBlock(entryCount / EntriesPerBlock);
+    Entry entry;
+    entry.hash = hash;
+    entry.termOffset = static_cast<uint32_t>(block.termBytes.size());
+    entry.termLength = static_cast<uint32_t>(term.size());
+    block.termBytes.append(term.data(), term.size());
+    block.entries.push_back(move(entry));
+    placeEntry(hash, static_cast<uint32_t>(entryCount));
+    entryCount++;
+    return block.entries.back().postings;
+}
+
+const PostingList* TermDictionary::find(string_view term) const {
+    if (entryCount == 0) {
+        return nullptr;
+    }
+    size_t index = findEntry(term, hashTerm(term));
+    return (index != NotFound) ? &entryAt(index).postings : nullptr;
+}
+
+size_t TermDictionary::size() const {
+    return entryCount;
+}
+
+bool TermDictionary::empty() const {
+    return entryCount == 0;
+}
+
+string_view TermDictionary::termAt(size_t index) const {
+    const EntryBlock& block = *entryBlocks[index / EntriesPerBlock];
+    const Entry& entry = block.entries[index % EntriesPerBlock];
+    return string_view(block.termBytes.data() + entry.termOffset, entry.termLength);
+}
+
+const PostingList& TermDictionary::postingsAt(size_t index) const {
+    return entryAt(index).postings;
+}
+
+void TermDictionary::reserve(size_t count) {
+    size_t newCapacity = GroupSize;
+    while (newCapacity * 7 < count * 8) {
+        newCapacity *= 2;
+    }
+    if (newCapacity > capacity) {
+        rehash(newCapacity);
+    }
+    entryBlocks.reserve((count + EntriesPerBlock - 1) / EntriesPerBlock);
+}
+
+void TermDictionary::clear() {
+    entryBlocks.clear();
+    slotBlocks.clear();
+    entryCount = 0;
+    capacity = 0;
+}
+
+size_t TermDictionary::memoryBytes() const {
+    size_t bytes = entryBlocks.capacity() * sizeof(shared_ptr<EntryBlock>) + slotBlocks.capacity() * sizeof(shared_ptr<SlotBlock>);
+    for (const shared_ptr<EntryBlock>& block : entryBlocks) {
+        bytes += sizeof(EntryBlock) + block->entries.capacity() * sizeof(Entry) + block->termBytes.capacity();
+    }
+    for (const shared_ptr<SlotBlock>& block : slotBlocks) {
+        bytes += sizeof(SlotBlock) + block->control.capacity() + block->slots.capacity() * sizeof(uint32_t);
+    }
+    return bytes;
+}
@@ -0,0 +1,97 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "PostingList.h"
+
+// Term -> postings map of the hash backend, an open-addressing table in the
+// style of Swiss tables. Entries sit in insertion order, each with the full
+// hash of its term and the term's place in a buffer of term characters, so
+// terms need no allocation of their own. The table proper is an array of
+// one-byte control codes beside a parallel array of entry indexes: a full
+// slot's code is 7 bits of its term's hash, so a probe compares a group of 16
+// codes at once (in one instruction with SSE2) and only reads the entries
+// whose bits match. A lookup takes a string_view and never builds a key.
+//
+// Terms are never removed. The table doubles once it is seven eighths full,
+// placing entries again from their stored hashes without hashing any term.
+//
+// Copies share storage. Entries are kept in blocks of EntriesPerBlock, each
+// with the characters of its own terms, and the table in blocks of
+// SlotsPerBlock slots. A dictionary only changes the blocks it created and
+// copies any other block before changing it, so copying a dictionary costs a
+// pointer per block, and adding a posting to the copy copies the one block
+// of entries that holds the term. Copying and changing have to happen on one
+// thread at a time; copies can be read from any thread meanwhile.
+class TermDictionary {
+private:
+    static constexpr size_t GroupSize = 16;
+    static constexpr uint8_t EmptySlot = 0x80;
+    static constexpr size_t NotFound = SIZE_MAX;
+    static constexpr size_t EntriesPerBlock = 64;
+    static constexpr size_t SlotsPerBlock = 4096;
+
+    struct Entry {
+        uint64_t hash;
+        uint32_t termOffset;
+        uint32_t termLength;
+        PostingList postings;
+    };
+
+    // owner is the dictionary that created the block, the only one that may
+    // change it.
+    struct EntryBlock {
+        uint64_t owner;
+        std::vector<Entry> entries;
+        std::string termBytes;
+    };
+
+    struct SlotBlock {
+        uint64_t owner;
+        std::vector<uint8_t> control;
+        std::vector<uint32_t> slots;
+    };
+
+    std::vector<std::shared_ptr<EntryBlock>> entryBlocks;
+    std::vector<std::shared_ptr<SlotBlock>> slotBlocks;
+    size_t entryCount = 0;
+    size_t capacity = 0;
+    // Both dictionaries get a new one when one is copied from the other, so
+    // neither changes the blocks they then share.
+    mutable uint64_t owner;
+
+    static uint64_t newOwner();
+    static uint64_t hashTerm(std::string_view term);
+    const Entry& entryAt(size_t index) const;
+    const uint8_t* controlAt(size_t slot) const;
+    EntryBlock& ownedEntryBlock(size_t block);
+    SlotBlock& ownedSlotBlock(size_t slot);
+    size_t findEntry(std::string_view term, uint64_t hash) const;
+    void placeEntry(uint64_t hash, uint32_t entry);
+    void rehash(size_t capacity);
+
+public:
+    TermDictionary();
+    TermDictionary(const TermDictionary& other);
+    TermDictionary& operator=(const TermDictionary& other);
+
+    // The postings of term, added empty if term is new.
+    PostingList& insert(std::string_view term);
+    const PostingList* find(std::string_view term) const;
+
+    // Entries are numbered 0 to size() - 1 in the order their terms were added.
+    size_t size() const;
+    bool empty() const;
+    std::string_view termAt(size_t index) const;
+    const PostingList& postingsAt(size_t index) const;
+
+    void reserve(size_t count);
+    void clear();
+    // Bytes held by the table, the entries and the term characters, counting
+    // blocks shared with copies in full; the postings' own arrays are not
+    // counted.
+    size_t memoryBytes() const;
+};
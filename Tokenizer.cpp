@@ -0,0 +1,259 @@
+#include "Tokenizer.h"
+#include <cstring>
+
+#if defined(__AVX2__)
+#define SEARCH_ENGINE_AVX2 1
+#include <immintrin.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SEARCH_ENGINE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+using namespace std;
+
+static int lowestSetBit(uint64_t mask) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, mask);
+    return static_cast<int>(index);
+#else
+    return __builtin_ctzll(mask);
+#endif
+}
+
+// Classifies one byte the way operator>> and SearchEngine::normalize do in the
+// "C" locale, lowercasing it in place. Returns its separator and drop bits.
+static void classifyByte(unsigned char& c, uint64_t& separator, uint64_t& drop) {
+    bool space = c == ' ' || (c >= '\t' && c <= '\r');
+    bool upper = c >= 'A' && c <= 'Z';
+    bool alnum = upper || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9');
+    if (upper) {
+        c = static_cast<unsigned char>(c | 0x20);
+    }
+    separator = space ? 1 : 0;
+    drop = !space && !alnum ? 1 : 0;
+}
+
+#ifdef SEARCH_ENGINE_SSE2
+// Bytes in [lo, hi]: shifting lo down to -128 turns the unsigned range check
+// into a single signed comparison.
+static __m128i bytesInRange(__m128i v, char lo, char hi) {
+    __m128i shifted = _mm_add_epi8(v, _mm_set1_epi8(static_cast<char>(0x80 - lo)));
+    return _mm_cmplt_epi8(shifted, _mm_set1_epi8(static_cast<char>(-128 + (hi - lo + 1))));
+}
+
+static void classifyBlock16(unsigned char* p, uint64_t& separators, uint64_t& drops) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    __m128i upper = bytesInRange(v, 'A', 'Z');
+    __m128i alnum = _mm_or_si128(_mm_or_si128(upper, bytesInRange(v, 'a', 'z')), bytesInRange(v, '0', '9'));
+    __m128i space = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), bytesInRange(v, '\t', '\r'));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(p), _mm_or_si128(v, _mm_and_si128(upper, _mm_set1_epi8(0x20))));
+    separators = static_cast<uint32_t>(_mm_movemask_epi8(space));
+    drops = ~static_cast<uint32_t>(_mm_movemask_epi8(_mm_or_si128(alnum, space))) & 0xFFFFu;
+}
+#endif
+
+#ifdef SEARCH_ENGINE_AVX2
+static __m256i bytesInRange(__m256i v, char lo, char hi) {
+    __m256i shifted = _mm256_add_epi8(v, _mm256_set1_epi8(static_cast<char>(0x80 - lo)));
+    return _mm256_cmpgt_epi8(_mm256_set1_epi8(static_cast<char>(-128 + (hi - lo + 1))), shifted);
+}
+
+static void classifyBlock32(unsigned char* p, uint64_t& separators, uint64_t& drops) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    __m256i upper = bytesInRange(v, 'A', 'Z');
+    __m256i alnum = _mm256_or_si256(_mm256_or_si256(upper, bytesInRange(v, 'a', 'z')), bytesInRange(v, '0', '9'));
+    __m256i space = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), bytesInRange(v, '\t', '\r'));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), _mm256_or_si256(v, _mm256_and_si256(upper, _mm256_set1_epi8(0x20))));
+    separators = static_cast<uint32_t>(_mm256_movemask_epi8(space));
+    drops = ~static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_or_si256(alnum, space))) & 0xFFFFFFFFu;
+}
+#endif
+
+Tokenizer::Tokenizer(size_t bufferSize) : buffer(bufferSize > 0 ? bufferSize : DefaultBufferSize) {
+    file.rdbuf()->pubsetbuf(nullptr, 0);  // blocks are read straight into buffer
+}
+
+bool Tokenizer::open(const string& filePath) {
+    close();
+    file.open(filePath, ios::binary);
+    if (!file.is_open()) {
+        return false;
+    }
+    length = 0;
+    cursor = 0;
+    endOfFile = false;
+    bytesRead = 0;
+    return true;
+}
+
+// The whole file is one block, so next() never calls fill().
+void Tokenizer::open(vector<char>& contents) {
+    close();
+    fileBuffer.swap(buffer);
+    buffer.swap(contents);
+    length = buffer.size();
+    cursor = 0;
+    endOfFile = true;
+    bytesRead = length;
+    classify();
+}
+
+void Tokenizer::close() {
+    if (file.is_open()) {
+        file.close();
+    }
+    if (!fileBuffer.empty()) {
+        buffer = move(fileBuffer);
+        fileBuffer = vector<char>();
+    }
+    file.clear();
+    length = 0;
+    cursor = 0;
+    endOfFile = true;
+}
+
+size_t Tokenizer::getBytesRead() const {
+    return bytesRead;
+}
+
+// Moves the unfinished token that starts at carryStart to the front of the
+// buffer and reads the next block behind it. A token longer than the whole
+// buffer grows the buffer.
+void Tokenizer::fill(size_t carryStart) {
+    size_t carry = length - carryStart;
+    memmove(buffer.data(), buffer.data() + carryStart, carry);
+    if (carry == buffer.size()) {
+        buffer.resize(buffer.size() * 2);
+    }
+
+    file.read(buffer.data() + carry, static_cast<streamsize>(buffer.size() - carry));
+    size_t count = static_cast<size_t>(file.gcount());
+    bytesRead += count;
+    length = carry + count;
+    endOfFile = !file;
+    cursor = 0;
+    classify();
+}
+
+// Carried-over bytes are classified again; lowercasing is idempotent and they
+// have not been compacted yet, so the result is the same.
+void Tokenizer::classify() {
+    size_t words = (length + 63) / 64;
+    separatorBits.assign(words, 0);
+    dropBits.assign(words, 0);
+    unsigned char* data = reinterpret_cast<unsigned char*>(buffer.data());
+    size_t i = 0;
+
+#if defined(SEARCH_ENGINE_AVX2)
+    for (; i + 64 <= length; i += 64) {
+        uint64_t separatorsLow, dropsLow, separatorsHigh, dropsHigh;
+        classifyBlock32(data + i, separatorsLow, dropsLow);
+        classifyBlock32(data + i + 32, separatorsHigh, dropsHigh);
+        separatorBits[i / 64] = separatorsLow | (separatorsHigh << 32);
+        dropBits[i / 64] = dropsLow | (dropsHigh << 32);
+    }
+#elif defined(SEARCH_ENGINE_SSE2)
+    for (; i + 64 <= length; i += 64) {
+        uint64_t separators = 0;
+        uint64_t drops = 0;
+        for (int block = 0; block < 4; ++block) {
+            uint64_t blockSeparators, blockDrops;
+            classifyBlock16(data + i + block * 16, blockSeparators, blockDrops);
+            separators |= blockSeparators << (block * 16);
+            drops |= blockDrops << (block * 16);
+        }
+        separatorBits[i / 64] = separators;
+        dropBits[i / 64] = drops;
+    }
+#endif
+
+    for (; i < length; ++i) {
+        uint64_t separator, drop;
+        classifyByte(data[i], separator, drop);
+        separatorBits[i / 64] |= separator << (i % 64);
+        dropBits[i / 64] |= drop << (i % 64);
+    }
+
+    // Bits past the end count as separators, so every token scan stops there.
+    if (length % 64 != 0) {
+        separatorBits[length / 64] |= ~0ULL << (length % 64);
+    }
+}
+
+// First position at or after from whose separator bit equals separator, or
+// length if there is none.
+size_t Tokenizer::findSeparator(size_t from, bool separator) const {
+    if (from >= length) {
+        return length;
+    }
+    size_t word = from / 64;
+    uint64_t bits = separator ? separatorBits[word] : ~separatorBits[word];
+    bits &= ~0ULL << (from % 64);
+    while (bits == 0) {
+        if (++word == separatorBits.size()) {
+            return length;
+        }
+        bits = separator ? separatorBits[word] : ~separatorBits[word];
+    }
+    size_t position = word * 64 + lowestSetBit(bits);
+    return position < length ? position : length;
+}
+
+bool Tokenizer::hasDroppedBytes(size_t begin, size_t end) const {
+    for (size_t word = begin / 64; word * 64 < end; ++word) {
+        uint64_t bits = dropBits[word];
+        if (word == begin / 64) {
+            bits &= ~0ULL << (begin % 64);
+        }
+        if (end - word * 64 < 64) {
+            bits &= (1ULL << (end - word * 64)) - 1;
+        }
+        if (bits != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Tokenizer::next(string_view& token) {
+    while (true) {
+        size_t start = findSeparator(cursor, false);
+        if (start == length) {
+            if (endOfFile) {
+                return false;
+            }
+            fill(length);
+            continue;
+        }
+
+        size_t end = findSeparator(start, true);
+        if (end == length && !endOfFile) {
+            fill(start);  // the token may continue in the next block
+            continue;
+        }
+        cursor = end;
+
+        if (!hasDroppedBytes(start, end)) {
+            token = string_view(buffer.data() + start, end - start);
+            return true;
+        }
+
+        size_t out = start;
+        for (size_t i = start; i < end; ++i) {
+            if (!(dropBits[i / 64] & (1ULL << (i % 64)))) {
+                buffer[out++] = buffer[i];
+            }
+        }
+        if (out > start) {
+            token = string_view(buffer.data() + start, out - start);
+            return true;
+        }
+    }
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Streams the normalized tokens of a file without allocating per token. The
+// file is read in large blocks into a reused buffer; each block is classified
+// and lowercased in place with SIMD, producing one bit per byte for
+// whitespace and one for bytes that normalization drops. Tokens are then found
+// by scanning those bitmaps, and a token without dropped bytes is returned as
+// a view straight into the buffer. Only tokens with punctuation inside are
+// compacted, which is done in place as well.
+//
+// The tokens are exactly those of reading the file with operator>> and
+// passing each word through SearchEngine::normalize in the "C" locale:
+// whitespace is ' ' and '\t' through '\r', letters and digits are kept and
+// lowercased, everything else (including bytes >= 0x80) is dropped, and words
+// left empty are skipped.
+class Tokenizer {
+private:
+    std::ifstream file;
+    std::vector<char> buffer;
+    std::vector<char> fileBuffer;  // buffer's own storage while it holds a whole file
+    std::vector<uint64_t> separatorBits;
+    std::vector<uint64_t> dropBits;
+    size_t length = 0;
+    size_t cursor = 0;
+    bool endOfFile = true;
+    size_t bytesRead = 0;
+
+    void fill(size_t carryStart);
+    void classify();
+    size_t findSeparator(size_t from, bool separator) const;
+    bool hasDroppedBytes(size_t begin, size_t end) const;
+
+public:
+    static constexpr size_t DefaultBufferSize = 64 * 1024;
+
+    explicit Tokenizer(size_t bufferSize = DefaultBufferSize);
+
+    bool open(const std::string& filePath);
+    // Tokenizes contents, a whole file already in memory, in place instead of
+    // reading a file. contents is left empty.
+    void open(std::vector<char>& contents);
+    void close();
+    // The returned view stays valid until the next call.
+    bool next(std::string_view& token);
+    size_t getBytesRead() const;
+};
@@ -2,278 +2,579 @@
 #include <iostream>
 #include <cctype>
 #include "SearchEngine.h"
+#include "Metrics.h"
 #include <fstream>
-#include <unordered_set>
-#include <unordered_map>
+#include <algorithm>
+#include <queue>
+#include "LoudsTrie.h"
+#include <cstring>
+#include <atomic>
 using namespace std;
 
-TrieNode::TrieNode(char val) : value(val), isEndOfWord(false) {
-    for (int i = 0; i < 256; ++i) {
-        children[i] = nullptr;
-    }
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SEARCH_ENGINE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+static const char TrieDumpMagic[8] = { 'S', 'E', 'T', 'R', 'I', 'E', '0', '2' };
+
+TrieNode::TrieNode(const string& label, uint64_t owner) : label(label), isEndOfWord(false), maxDocumentFrequency(0), owner(owner) {
 }
 
-TrieNode::~TrieNode() {
-    for (int i = 0; i < 256; ++i) {
-        if (children[i] != nullptr) {
-            delete children[i];
+// Nodes near the root can have dozens of children, so their keys are compared
+// sixteen at a time. Smaller nodes are scanned directly.
+TrieNode* TrieNode::findChild(unsigned char key) const {
+    size_t count = childKeys.size();
+    const unsigned char* keys = childKeys.data();
+    size_t i = 0;
+
+#ifdef SEARCH_ENGINE_SSE2
+    __m128i needle = _mm_set1_epi8(static_cast<char>(key));
+    for (; i + 16 <= count; i += 16) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i));
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, needle));
+        if (mask != 0) {
+            for (int bit = 0; bit < 16; ++bit) {
+                if (mask & (1 << bit)) {
+                    return children[i + bit];
+                }
+            }
+        }
+    }
+#endif
+
+    for (; i < count; ++i) {
+        if (keys[i] == key) {
+            return children[i];
+        }
+        if (keys[i] > key) {
+            break;
         }
     }
+    return nullptr;
 }
 
-TrieSearch::TrieSearch() {
-    root = new TrieNode('\0');
+void TrieNode::addChild(TrieNode* child) {
+    unsigned char key = static_cast<unsigned char>(child->label[0]);
+    size_t index = lower_bound(childKeys.begin(), childKeys.end(), key) - childKeys.begin();
+    childKeys.insert(childKeys.begin() + index, key);
+    children.insert(children.begin() + index, child);
 }
 
-TrieSearch::~TrieSearch() {
-    clear();
-    delete root;
+// Swaps in a node for the existing child that starts with the same byte.
+void TrieNode::replaceChild(TrieNode* child) {
+    unsigned char key = static_cast<unsigned char>(child->label[0]);
+    size_t index = lower_bound(childKeys.begin(), childKeys.end(), key) - childKeys.begin();
+    children[index] = child;
 }
 
-int TrieSearch::charToIndex(char c) const {
-    return static_cast<unsigned char>(c);
+static atomic<uint64_t> nextOwner{ 1 };
+
+uint64_t TrieSearch::newOwner() {
+    return nextOwner++;
 }
 
-void TrieSearch::insertWord(const string& word, const string& docName, int position) {
-    TrieNode* current = root;
+TrieSearch::TrieSearch() : owner(newOwner()) {
+    root = newNode("");
+}
 
-    for (char c : word) {
-        int index = charToIndex(c);
-        if (current->children[index] == nullptr) {
-            current->children[index] = new TrieNode(c);
-        }
-        current = current->children[index];
+// Shares the nodes of other. Replaced nodes stay in the shared arena until
+// every copy using it is gone, so once they outnumber the live ones the copy
+// takes every node into a new arena instead, which costs as much as the
+// replacements that led to it.
+TrieSearch::TrieSearch(const TrieSearch& other)
+    : nodeArena(other.nodeArena), postingArena(other.postingArena), root(other.root), owner(newOwner()),
+    nodeCount(other.nodeCount), replacedNodes(other.replacedNodes) {
+    other.owner = newOwner();
+    if (replacedNodes > nodeCount) {
+        nodeArena = make_shared<Arena>();
+        root = copyHelper(other.root);
+        replacedNodes = 0;
     }
+}
 
-    current->isEndOfWord = true;
-
-    for (WordInDocument* doc : current->wordOccurrences) {
-        if (doc->getDocName() == docName) {
-            doc->addPosition(position);
-            return;
-        }
+TrieNode* TrieSearch::copyHelper(const TrieNode* node) {
+    TrieNode* copy = nodeArena->create<TrieNode>(*node);
+    copy->owner = owner;
+    for (TrieNode*& child : copy->children) {
+        child = copyHelper(child);
     }
+    return copy;
+}
 
-    vector<int> positions = { position };
-    current->wordOccurrences.push_back(new WordInDocument(docName, positions));
+TrieNode* TrieSearch::newNode(const string& label) {
+    nodeCount++;
+    return nodeArena->create<TrieNode>(label, owner);
 }
 
-std::vector<WordInDocument*> TrieSearch::searchWord(const std::string& word) const {
-    string normalizedWord = SearchEngine::normalize(word);
-    TrieNode* node = getNode(normalizedWord);
-
-    if (node != nullptr && node->isEndOfWord) {
-        std::vector<WordInDocument*> sortedDocs = node->wordOccurrences;
-        for (size_t i = 0; i < sortedDocs.size(); ++i) {
-            for (size_t j = i + 1; j < sortedDocs.size(); ++j) {
-                if (sortedDocs[i]->getPositions().size() < sortedDocs[j]->getPositions().size()) {
-                    WordInDocument* temp = sortedDocs[i];
-                    sortedDocs[i] = sortedDocs[j];
-                    sortedDocs[j] = temp;
-                }
-            }
-        }
-        return sortedDocs;
+TrieNode* TrieSearch::ownedRoot() {
+    if (root->owner != owner) {
+        root = nodeArena->create<TrieNode>(*root);
+        root->owner = owner;
+        replacedNodes++;
     }
-    return {};
+    return root;
 }
 
-TrieNode* TrieSearch::getNode(const string& word) const {
-    TrieNode* current = root;
+// child itself if this trie created it, otherwise a copy that takes its place
+// under parent, which must be this trie's already.
+TrieNode* TrieSearch::ownedChild(TrieNode* parent, TrieNode* child) {
+    if (child->owner == owner) {
+        return child;
+    }
+    TrieNode* copy = nodeArena->create<TrieNode>(*child);
+    copy->owner = owner;
+    parent->replaceChild(copy);
+    replacedNodes++;
+    return copy;
+}
 
-    for (char c : word) {
-        int index = charToIndex(c);
-        if (current->children[index] == nullptr) {
-            return nullptr;
+// Walks down the tree matching whole edge labels. When the word diverges from
+// an edge part-way, the edge is split at that point so the word ends on (or
+// continues from) a node. Every node on the path is this trie's own on return.
+TrieNode* TrieSearch::getOrCreateNode(const string& word, vector<TrieNode*>& path) {
+    TrieNode* current = ownedRoot();
+    size_t i = 0;
+    path.push_back(root);
+
+    while (i < word.size()) {
+        TrieNode* child = current->findChild(static_cast<unsigned char>(word[i]));
+        if (child == nullptr) {
+            child = newNode(word.substr(i));
+            current->addChild(child);
+            current = child;
+            path.push_back(current);
+            break;
         }
-        current = current->children[index];
+        child = ownedChild(current, child);
+
+        size_t common = 0;
+        while (common < child->label.size() && i + common < word.size() && child->label[common] == word[i + common]) {
+            common++;
+        }
+
+        if (common < child->label.size()) {
+            TrieNode* middle = newNode(child->label.substr(0, common));
+            middle->maxDocumentFrequency = child->maxDocumentFrequency;
+            child->label.erase(0, common);
+            middle->addChild(child);
+            current->replaceChild(middle);
+            child = middle;
+        }
+
+        current = child;
+        path.push_back(current);
+        i += common;
     }
 
+    current->isEndOfWord = true;
     return current;
 }
 
-void TrieSearch::display() const {
-    displayHelper(root, "");
-}
-
-void TrieSearch::displayHelper(TrieNode* node, string currentWord) const {
-    if (node->isEndOfWord) {
-        cout << "Word: " << currentWord << "\n";
-        for (auto& doc : node->wordOccurrences) {
-            cout << "  Document: " << doc->getDocName() << ", Positions: ";
-            for (int pos : doc->getPositions()) {
-                cout << pos << " ";
-            }
-            cout << "\n";
+void TrieSearch::updateFrequencyBounds(const vector<TrieNode*>& path, uint32_t documentFrequency) {
+    for (TrieNode* node : path) {
+        if (node->maxDocumentFrequency < documentFrequency) {
+            node->maxDocumentFrequency = documentFrequency;
         }
     }
+}
 
-    for (int i = 0; i < 256; ++i) {
-        if (node->children[i] != nullptr) {
-            displayHelper(node->children[i], currentWord + node->children[i]->value);
-        }
-    }
+// Appends the postings of a document that is not yet in the index, as produced
+// by a PartialIndex. No scan for an existing entry is needed.
+void TrieSearch::addPostings(const string& word, uint32_t docId, const vector<int>& positions) {
+    vector<TrieNode*> path;
+    TrieNode* node = getOrCreateNode(word, path);
+    node->wordOccurrences.add(postingArena->create<WordInDocument>(docId, positions, *postingArena));
+    Metrics::add(Counter::PostingsCreated);
+    updateFrequencyBounds(path, static_cast<uint32_t>(node->wordOccurrences.size()));
 }
 
-void TrieSearch::clear() {
-    clearHelper(root);
-    root = nullptr; 
+const PostingList* TrieSearch::findPostings(const std::string& word) const {
+    TrieNode* node = getNode(SearchEngine::normalize(word));
+    bool found = node != nullptr && node->isEndOfWord;
+    Metrics::add(found ? Counter::LookupHits : Counter::LookupMisses);
+    return found ? &node->wordOccurrences : nullptr;
 }
 
-void TrieSearch::clearHelper(TrieNode* node) {
-    if (node == nullptr) return;
+TrieNode* TrieSearch::getNode(const string& word) const {
+    TrieNode* current = root;
+    size_t i = 0;
 
-    for (int i = 0; i < 256; ++i) {
-        if (node->children[i] != nullptr) {
-            clearHelper(node->children[i]);  
-            delete node->children[i];        
-            node->children[i] = nullptr;    
+    while (i < word.size()) {
+        TrieNode* child = current->findChild(static_cast<unsigned char>(word[i]));
+        if (child == nullptr || word.compare(i, child->label.size(), child->label) != 0) {
+            return nullptr;
         }
+        current = child;
+        i += child->label.size();
     }
+
+    return current;
 }
 
+// Best-first walk over the subtrees that can still match the pattern. Subtrees
+// are queued by the largest document frequency below them and complete terms
+// by their own, so terms come out most frequent first and the walk stops after
+// maxTerms of them (0 means no limit) without touching the rest of the tree.
+vector<pair<string, const PostingList*>> TrieSearch::matchTerms(const WildcardPattern& pattern, size_t maxTerms) const {
+    struct Candidate {
+        uint32_t bound;
+        bool isTerm;
+        TrieNode* node;
+        uint64_t state;
+        string word;
+    };
+    auto lowerPriority = [](const Candidate& a, const Candidate& b) {
+        if (a.bound != b.bound) {
+            return a.bound < b.bound;
+        }
+        if (a.isTerm != b.isTerm) {
+            return !a.isTerm;
+        }
+        return a.word > b.word;
+    };
+    priority_queue<Candidate, vector<Candidate>, decltype(lowerPriority)> queue(lowerPriority);
 
-void TrieSearch::save(std::ofstream& outFile) const {
-    if (!outFile.is_open()) {
-        std::cerr << "Error: Output file stream is not open." << std::endl;
-        return;
+    vector<pair<string, const PostingList*>> terms;
+    if (!pattern.valid()) {
+        return terms;
     }
+    queue.push({ root->maxDocumentFrequency, false, root, pattern.start(), "" });
 
-    try {
-        saveHelper(outFile, root);
+    while (!queue.empty()) {
+        Candidate candidate = queue.top();
+        queue.pop();
 
-        if (!outFile) {
-            std::cerr << "Error: Failed to save Trie." << std::endl;
-            return;
+        if (candidate.isTerm) {
+            terms.emplace_back(candidate.word, &candidate.node->wordOccurrences);
+            if (maxTerms != 0 && terms.size() >= maxTerms) {
+                break;
+            }
+            continue;
         }
 
-        std::cout << "Trie successfully saved." << std::endl;
-    }
-    catch (const std::exception& ex) {
-        std::cerr << "Error during save: " << ex.what() << std::endl;
+        TrieNode* node = candidate.node;
+        if (node->isEndOfWord && !node->wordOccurrences.empty() && pattern.accepts(candidate.state)) {
+            queue.push({ static_cast<uint32_t>(node->wordOccurrences.size()), true, node, candidate.state, candidate.word });
+        }
+
+        for (TrieNode* child : node->children) {
+            uint64_t state = candidate.state;
+            for (size_t i = 0; i < child->label.size() && state != 0; ++i) {
+                state = pattern.step(state, child->label[i]);
+            }
+            if (state != 0) {
+                queue.push({ child->maxDocumentFrequency, false, child, state, candidate.word + child->label });
+            }
+        }
     }
+    return terms;
 }
 
-void TrieSearch::saveHelper(std::ofstream& outFile, TrieNode* node) const {
-    outFile.write(reinterpret_cast<const char*>(&node->value), sizeof(node->value));
-    if (!outFile) throw std::runtime_error("Failed to write node->value");
-
-    outFile.write(reinterpret_cast<const char*>(&node->isEndOfWord), sizeof(node->isEndOfWord));
-    if (!outFile) throw std::runtime_error("Failed to write node->isEndOfWord");
-
-    size_t occurrencesSize = node->wordOccurrences.size();
-    outFile.write(reinterpret_cast<const char*>(&occurrencesSize), sizeof(occurrencesSize));
-    if (!outFile) throw std::runtime_error("Failed to write occurrencesSize");
-
-    for (const WordInDocument* doc : node->wordOccurrences) {
-        doc->serialize(outFile);
-        if (!outFile) throw std::runtime_error("Failed to write WordInDocument");
+// Every term within the automaton's distance. The walk steps the automaton
+// through each edge label and leaves a subtree as soon as no continuation can
+// come within the distance, so it only visits the prefixes that are close to
+// the word rather than the whole vocabulary.
+vector<pair<string, const PostingList*>> TrieSearch::matchFuzzy(const LevenshteinAutomaton& automaton) const {
+    vector<pair<string, const PostingList*>> terms;
+    if (!automaton.valid()) {
+        return terms;
     }
+    string currentWord;
+    fuzzyHelper(root, automaton, automaton.start(), currentWord, terms);
+    return terms;
+}
 
-    for (int i = 0; i < 256; ++i) {
-        bool hasChild = (node->children[i] != nullptr);
-        outFile.write(reinterpret_cast<const char*>(&hasChild), sizeof(hasChild)); 
-        if (!outFile) throw std::runtime_error("Failed to write child flag");
+void TrieSearch::fuzzyHelper(const TrieNode* node, const LevenshteinAutomaton& automaton, const LevenshteinAutomaton::State& state,
+    string& currentWord, vector<pair<string, const PostingList*>>& terms) const {
+    if (node->isEndOfWord && !node->wordOccurrences.empty() && automaton.accepts(state)) {
+        terms.emplace_back(currentWord, &node->wordOccurrences);
+    }
 
-        if (hasChild) {
-            saveHelper(outFile, node->children[i]); 
+    // The first character of every edge is in the parent's childKeys, so
+    // children that are out of reach after it are never loaded. Characters
+    // that are not in the word all lead to one state, computed once.
+    LevenshteinAutomaton::State other = automaton.stepOther(state);
+    bool otherAlive = automaton.alive(other);
+    for (size_t c = 0; c < node->children.size(); ++c) {
+        char key = static_cast<char>(node->childKeys[c]);
+        bool inWord = automaton.occursInWord(key);
+        if (!inWord && !otherAlive) {
+            continue;
+        }
+        LevenshteinAutomaton::State next = inWord ? automaton.step(state, key) : other;
+        if (!automaton.alive(next)) {
+            continue;
+        }
+        const TrieNode* child = node->children[c];
+        for (size_t i = 1; i < child->label.size() && automaton.alive(next); ++i) {
+            next = automaton.step(next, child->label[i]);
+        }
+        if (automaton.alive(next)) {
+            currentWord += child->label;
+            fuzzyHelper(child, automaton, next, currentWord, terms);
+            currentWord.resize(currentWord.size() - child->label.size());
         }
     }
 }
 
+void TrieSearch::display(const DocumentTable& documents) const {
+    displayHelper(root, "", documents);
+}
 
-void TrieSearch::load(std::ifstream& inFile) {
-    if (!inFile.is_open()) {
-        std::cerr << "Error: Input file stream is not open." << std::endl;
-        return;
+void TrieSearch::displayHelper(TrieNode* node, string currentWord, const DocumentTable& documents) const {
+    if (node->isEndOfWord) {
+        cout << "Word: " << currentWord << "\n";
+        for (auto& doc : node->wordOccurrences) {
+            cout << "  Document: " << documents.getPath(doc->getDocId()) << ", Positions: ";
+            for (int pos : doc->getPositions()) {
+                cout << pos << " ";
+            }
+            cout << "\n";
+        }
     }
 
-    clear(); 
+    for (TrieNode* child : node->children) {
+        displayHelper(child, currentWord + child->label, documents);
+    }
+}
 
-    try {
-        loadHelper(inFile, root);  
-        std::cout << "Trie successfully loaded." << std::endl;
+// Children are kept sorted by their first byte, so terms come out sorted.
+void TrieSearch::collectTerms(vector<pair<string, const PostingList*>>& terms) const {
+    string currentWord;
+    collectHelper(root, currentWord, terms);
+}
+
+void TrieSearch::collectHelper(TrieNode* node, string& currentWord, vector<pair<string, const PostingList*>>& terms) const {
+    if (node->isEndOfWord) {
+        terms.emplace_back(currentWord, &node->wordOccurrences);
     }
-    catch (const std::exception& e) {
-        std::cerr << "Error while loading Trie: " << e.what() << std::endl;
+
+    for (TrieNode* child : node->children) {
+        size_t length = currentWord.size();
+        currentWord += child->label;
+        collectHelper(child, currentWord, terms);
+        currentWord.resize(length);
     }
 }
 
+TermBitmapCache& TrieSearch::bitmapCache() const {
+    return bitmaps;
+}
 
-void TrieSearch::loadHelper(std::ifstream& inFile, TrieNode* node) {
-    inFile.read(reinterpret_cast<char*>(&node->value), sizeof(node->value));
-    inFile.read(reinterpret_cast<char*>(&node->isEndOfWord), sizeof(node->isEndOfWord));
+// Postings need no destructor, so freeing their arena, once no copy of the
+// trie shares it, is a handful of block frees. Nodes are destroyed in one
+// pass over their arena's list, likewise once no copy shares it, instead of
+// a recursive walk of the tree.
+void TrieSearch::clear() {
+    postingArena = make_shared<Arena>();
+    bitmaps.clear();
+    nodeArena = make_shared<Arena>();
+    nodeCount = 0;
+    replacedNodes = 0;
+    root = newNode("");
+}
 
-    size_t occurrencesSize;
-    inFile.read(reinterpret_cast<char*>(&occurrencesSize), sizeof(occurrencesSize));
-    for (size_t i = 0; i < occurrencesSize; ++i) {
-        WordInDocument* doc = WordInDocument::deserialize(inFile);
-        node->wordOccurrences.push_back(doc);
+// Layout of the node this trie used before it was path-compressed: one node
+// per character with a pointer slot for every possible byte.
+struct LegacyTrieNode {
+    char value;
+    TrieNode* children[256];
+    bool isEndOfWord;
+    std::vector<WordInDocument*> wordOccurrences;
+};
+
+void TrieSearch::memoryHelper(TrieNode* node, size_t& nodeCount, size_t& labelChars, size_t& nodeBytes) const {
+    nodeCount++;
+    labelChars += node->label.size();
+    nodeBytes += sizeof(TrieNode) + node->childKeys.capacity() + node->children.capacity() * sizeof(TrieNode*);
+    if (node->label.capacity() > 15) {
+        nodeBytes += node->label.capacity() + 1;  // heap buffer beyond the small-string storage
     }
 
-    for (int i = 0; i < 256; ++i) {
-        bool hasChild;
-        inFile.read(reinterpret_cast<char*>(&hasChild), sizeof(hasChild));
-
-        if (hasChild) {
-            TrieNode* childNode = new TrieNode('\0'); 
-            node->children[i] = childNode;          
-            loadHelper(inFile, childNode);          
-        }
+    for (TrieNode* child : node->children) {
+        memoryHelper(child, nodeCount, labelChars, nodeBytes);
     }
 }
 
+// Compares the node memory of the radix tree with what the same terms would
+// take with one 256-pointer node per character. Postings are not included;
+// they are the same in both layouts.
+void TrieSearch::memoryReport() const {
+    size_t nodeCount = 0;
+    size_t labelChars = 0;
+    size_t nodeBytes = 0;
+    memoryHelper(root, nodeCount, labelChars, nodeBytes);
+
+    size_t legacyNodes = labelChars + 1;
+    size_t legacyBytes = legacyNodes * sizeof(LegacyTrieNode);
+
+    cout << "Trie memory report:\n";
+    cout << "  Radix tree:        " << nodeCount << " nodes, " << nodeBytes << " bytes ("
+        << (nodeCount ? nodeBytes / nodeCount : 0) << " bytes/node)\n";
+    cout << "  256-pointer nodes: " << legacyNodes << " nodes, " << legacyBytes << " bytes ("
+        << sizeof(LegacyTrieNode) << " bytes/node)\n";
+    if (nodeBytes > 0) {
+        cout << "  Reduction:         " << static_cast<double>(legacyBytes) / nodeBytes << "x\n";
+    }
+}
 
-std::vector<WordInDocument*> TrieSearch::searchExclusion(const std::string& word1, const std::string& word2) const {
-    auto docsWithWord1 = searchWord(word1);
-    auto docsWithWord2 = searchWord(word2);
 
-    std::unordered_set<std::string> excludeDocs;
-    for (const auto& doc : docsWithWord2) {
-        excludeDocs.insert(doc->getDocName());
+// The dump is a LoudsTrie of the nodes followed by the postings of every term,
+// in the trie's term order, each with a packed header. Both the writer and the loader go through the
+// nodes breadth first, in one flat loop, so neither recurses however deep the
+// tree gets.
+void TrieSearch::save(std::ofstream& outFile) const {
+    if (!outFile.is_open()) {
+        std::cerr << "Error: Output file stream is not open." << std::endl;
+        return;
     }
 
-    std::vector<WordInDocument*> result;
-    for (const auto& doc : docsWithWord1) {
-        if (excludeDocs.find(doc->getDocName()) == excludeDocs.end()) {
-            result.push_back(doc);
+    try {
+        std::vector<const TrieNode*> levelOrder{ root };
+        LoudsTrie::Builder builder;
+        for (size_t i = 0; i < levelOrder.size(); ++i) {
+            const TrieNode* node = levelOrder[i];
+            builder.addNode(node->label, node->children.size(), node->isEndOfWord);
+            levelOrder.insert(levelOrder.end(), node->children.begin(), node->children.end());
         }
-    }
+        std::vector<uint8_t> trie = builder.finish();
+
+        outFile.write(TrieDumpMagic, sizeof(TrieDumpMagic));
+        uint64_t trieSize = trie.size();
+        outFile.write(reinterpret_cast<const char*>(&trieSize), sizeof(trieSize));
+        outFile.write(reinterpret_cast<const char*>(trie.data()), trie.size());
+        if (!outFile) throw std::runtime_error("Failed to write the trie");
+
+        // The postings are preceded by their size in bytes, which is only
+        // known once they are written.
+        std::streampos sizePosition = outFile.tellp();
+        uint64_t postingsSize = 0;
+        outFile.write(reinterpret_cast<const char*>(&postingsSize), sizeof(postingsSize));
+        for (const TrieNode* node : levelOrder) {
+            if (!node->isEndOfWord) {
+                continue;
+            }
+            uint32_t occurrencesSize = static_cast<uint32_t>(node->wordOccurrences.size());
+            outFile.write(reinterpret_cast<const char*>(&occurrencesSize), sizeof(occurrencesSize));
+            uint32_t previousDocId = 0;
+            for (const WordInDocument* doc : node->wordOccurrences) {
+                doc->serializePacked(outFile, previousDocId);
+                previousDocId = doc->getDocId();
+            }
+            if (!outFile) throw std::runtime_error("Failed to write WordInDocument");
+        }
+        std::streampos endPosition = outFile.tellp();
+        postingsSize = static_cast<uint64_t>(endPosition - sizePosition) - sizeof(postingsSize);
+        outFile.seekp(sizePosition);
+        outFile.write(reinterpret_cast<const char*>(&postingsSize), sizeof(postingsSize));
+        outFile.seekp(endPosition);
+        if (!outFile) throw std::runtime_error("Failed to write the postings size");
 
-    return result;
+        std::cout << "Trie successfully saved." << std::endl;
+    }
+    catch (const std::exception& ex) {
+        std::cerr << "Error during save: " << ex.what() << std::endl;
+    }
 }
 
-std::vector<WordInDocument*> TrieSearch::searchMultipleWords(const std::vector<std::string>& includedWords) const {
-    std::unordered_map<std::string, int> docCount;
-
-    for (const auto& word : includedWords) {
-        auto results = searchWord(word);
-        for (const auto& wid : results) {
-            docCount[wid->getDocName()]++;
-        }
+bool TrieSearch::load(std::ifstream& inFile, size_t documentCount) {
+    if (!inFile.is_open()) {
+        std::cerr << "Error: Input file stream is not open." << std::endl;
+        return false;
     }
 
-    std::vector<WordInDocument*> result;
+    clear();
 
-    for (const auto& entry : docCount) {
-        const std::string& docName = entry.first;
-        int count = entry.second;
+    try {
+        char magic[sizeof(TrieDumpMagic)];
+        inFile.read(magic, sizeof(magic));
+        if (!inFile || memcmp(magic, TrieDumpMagic, sizeof(magic)) != 0) {
+            throw std::runtime_error("Not a trie dump of this version");
+        }
+        uint64_t trieSize;
+        inFile.read(reinterpret_cast<char*>(&trieSize), sizeof(trieSize));
+        std::streampos start = inFile.tellg();
+        inFile.seekg(0, std::ios::end);
+        if (!inFile || trieSize > static_cast<uint64_t>(inFile.tellg() - start)) {
+            throw std::runtime_error("Truncated trie");
+        }
+        inFile.seekg(start);
+        // uint64_t elements keep the buffer aligned for the trie's words.
+        std::vector<uint64_t> buffer((trieSize + 7) / 8);
+        inFile.read(reinterpret_cast<char*>(buffer.data()), trieSize);
+        LoudsTrie trie;
+        if (!inFile || !trie.open(reinterpret_cast<const uint8_t*>(buffer.data()), trieSize)) {
+            throw std::runtime_error("Invalid trie");
+        }
 
-        if (count == includedWords.size()) {
-            for (const auto& word : includedWords) {
-                auto results = searchWord(word);
-                for (const auto& wid : results) {
-                    if (wid->getDocName() == docName) {
-                        result.push_back(wid);
-                    }
-                }
+        // Level order numbers every child after its parent, so one pass
+        // creates the nodes and a pass backwards carries the frequency bounds
+        // up to the root.
+        std::vector<TrieNode*> nodes(trie.nodeCount(), nullptr);
+        std::vector<size_t> parents(trie.nodeCount(), 0);
+        nodes[0] = root;
+        size_t nextChild = 1;
+        size_t childCount;
+        std::string_view label;
+        bool isTerm;
+        LoudsTrie::Scanner scanner(trie);
+        for (size_t i = 0; scanner.next(childCount, label, isTerm); ++i) {
+            if (i > 0) {
+                if (nextChild <= i) throw std::runtime_error("Invalid trie");
+                nodes[i] = newNode(std::string(label));
+                nodes[parents[i]]->addChild(nodes[i]);
+            }
+            nodes[i]->isEndOfWord = isTerm;
+            if (childCount > nodes.size() - nextChild) throw std::runtime_error("Invalid trie");
+            for (size_t child = 0; child < childCount; ++child) {
+                parents[nextChild++] = i;
             }
         }
-    }
 
-    std::sort(result.begin(), result.end(), [](WordInDocument* a, WordInDocument* b) {
-        return a->getPositions().size() > b->getPositions().size();
-        });
+        uint64_t postingsSize;
+        inFile.read(reinterpret_cast<char*>(&postingsSize), sizeof(postingsSize));
+        start = inFile.tellg();
+        inFile.seekg(0, std::ios::end);
+        if (!inFile || postingsSize > static_cast<uint64_t>(inFile.tellg() - start)) {
+            throw std::runtime_error("Truncated postings");
+        }
+        inFile.seekg(start);
+        std::vector<uint8_t> postings(postingsSize);
+        inFile.read(reinterpret_cast<char*>(postings.data()), postingsSize);
+        if (!inFile) throw std::runtime_error("Failed to read the postings");
+
+        const uint8_t* data = postings.data();
+        const uint8_t* end = data + postings.size();
+        for (TrieNode* node : nodes) {
+            if (!node->isEndOfWord) {
+                continue;
+            }
+            uint32_t occurrencesSize;
+            if (static_cast<size_t>(end - data) < sizeof(occurrencesSize)) throw std::runtime_error("Failed to read the postings of a term");
+            memcpy(&occurrencesSize, data, sizeof(occurrencesSize));
+            data += sizeof(occurrencesSize);
+            uint32_t previousDocId = 0;
+            for (uint32_t i = 0; i < occurrencesSize; ++i) {
+                WordInDocument* doc = WordInDocument::deserializePacked(data, end, previousDocId, *postingArena);
+                if (doc == nullptr) throw std::runtime_error("Failed to read WordInDocument");
+                if (doc->getDocId() >= documentCount) throw std::runtime_error("A posting refers to a document that is not in the dump");
+                node->wordOccurrences.add(doc);
+                previousDocId = doc->getDocId();
+            }
+            node->maxDocumentFrequency = static_cast<uint32_t>(node->wordOccurrences.size());
+        }
+        for (size_t i = nodes.size() - 1; i > 0; --i) {
+            TrieNode* parent = nodes[parents[i]];
+            parent->maxDocumentFrequency = max(parent->maxDocumentFrequency, nodes[i]->maxDocumentFrequency);
+        }
 
-    return result;
+        std::cout << "Trie successfully loaded." << std::endl;
+        return true;
+    }
+    catch (const std::exception& e) {
+        clear();
+        std::cerr << "Error while loading Trie: " << e.what() << std::endl;
+        return false;
+    }
 }
@@ -2,42 +2,91 @@
 #include <vector>
 #include <string>
 #include "WordInDocument.h"
+#include "PostingList.h"
+#include "WildcardPattern.h"
+#include "LevenshteinAutomaton.h"
+#include "Arena.h"
+#include "DocIdBitmap.h"
 #include <fstream>
+#include <memory>
 
+// Node of a path-compressed radix tree. label holds the characters on the
+// edge from the parent, so chains of single-child nodes collapse into one.
+// Children are kept in a small array sorted by the first byte of their label.
+// Nodes are owned by an arena that copies of a TrieSearch share, not by their
+// parent.
 class TrieNode {
 public:
-    char value;
-    TrieNode* children[256];
+    std::string label;
+    std::vector<unsigned char> childKeys;
+    std::vector<TrieNode*> children;
     bool isEndOfWord;
-    std::vector<WordInDocument*> wordOccurrences;
+    PostingList wordOccurrences;
+    // Largest document frequency of any term in this subtree, used to visit
+    // the most frequent terms under a prefix first.
+    uint32_t maxDocumentFrequency;
+    // The trie that created the node, the only one that may change it.
+    uint64_t owner;
 
-    TrieNode(char val);
-    ~TrieNode();
+    TrieNode(const std::string& label, uint64_t owner);
+
+    TrieNode* findChild(unsigned char key) const;
+    void addChild(TrieNode* child);
+    void replaceChild(TrieNode* child);
 };
 
 class TrieSearch {
 private:
+    // Nodes and postings are kept in separate arenas so that a walk over the
+    // tree does not step over posting data. A copy of the trie shares both
+    // arenas and every node with the original. Adding a term copies the
+    // nodes on its path that the trie did not create itself, so a copy
+    // costs nothing up front and each addition a handful of nodes.
+    std::shared_ptr<Arena> nodeArena = std::make_shared<Arena>();
+    std::shared_ptr<Arena> postingArena = std::make_shared<Arena>();
     TrieNode* root;
+    // Both tries get a new one when one is copied from the other, so neither
+    // changes the nodes they then share.
+    mutable uint64_t owner;
+    // Nodes reachable from root, and nodes in the node arena that copies
+    // have replaced along this line of copies.
+    size_t nodeCount = 0;
+    size_t replacedNodes = 0;
+    mutable TermBitmapCache bitmaps;
 
-    int charToIndex(char c) const;
-    void displayHelper(TrieNode* node, std::string currentWord) const;
+    void displayHelper(TrieNode* node, std::string currentWord, const DocumentTable& documents) const;
+    static uint64_t newOwner();
+    TrieNode* newNode(const std::string& label);
+    TrieNode* ownedRoot();
+    TrieNode* ownedChild(TrieNode* parent, TrieNode* child);
     TrieNode* getNode(const std::string& word) const;
+    TrieNode* getOrCreateNode(const std::string& word, std::vector<TrieNode*>& path);
+    void updateFrequencyBounds(const std::vector<TrieNode*>& path, uint32_t documentFrequency);
 
-    void saveHelper(std::ofstream& outFile, TrieNode* node) const;
-    void loadHelper(std::ifstream& inFile, TrieNode* node);
+    void collectHelper(TrieNode* node, std::string& currentWord, std::vector<std::pair<std::string, const PostingList*>>& terms) const;
+    void fuzzyHelper(const TrieNode* node, const LevenshteinAutomaton& automaton, const LevenshteinAutomaton::State& state,
+        std::string& currentWord, std::vector<std::pair<std::string, const PostingList*>>& terms) const;
+    void memoryHelper(TrieNode* node, size_t& nodeCount, size_t& labelChars, size_t& nodeBytes) const;
+    TrieNode* copyHelper(const TrieNode* node);
 
 public:
     TrieSearch();
-    ~TrieSearch();
+    TrieSearch(const TrieSearch& other);
+    TrieSearch& operator=(const TrieSearch&) = delete;
 
-    void insertWord(const std::string& word, const std::string& docName, int position);
-    std::vector<WordInDocument*> searchWord(const std::string& word) const;
+    void addPostings(const std::string& word, uint32_t docId, const std::vector<int>& positions);
+    const PostingList* findPostings(const std::string& word) const;
+    std::vector<std::pair<std::string, const PostingList*>> matchTerms(const WildcardPattern& pattern, size_t maxTerms) const;
+    std::vector<std::pair<std::string, const PostingList*>> matchFuzzy(const LevenshteinAutomaton& automaton) const;
+    TermBitmapCache& bitmapCache() const;
+    void collectTerms(std::vector<std::pair<std::string, const PostingList*>>& terms) const;
     void clear();
-    void clearHelper(TrieNode* node);
-    void display() const;
+    void display(const DocumentTable& documents) const;
+    void memoryReport() const;
 
     void save(std::ofstream& outFile) const;
-    void load(std::ifstream& inFile);
-    std::vector<WordInDocument*> searchExclusion(const std::string& word1, const std::string& word2) const;
-    std::vector<WordInDocument*> searchMultipleWords(const std::vector<std::string>& includedWords) const;
+    // Returns false, leaving the index empty, if the dump cannot be read or
+    // a posting refers to a document at or past documentCount, the size of
+    // the document table loaded with it.
+    bool load(std::ifstream& inFile, size_t documentCount);
 };
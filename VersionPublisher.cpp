@@ -0,0 +1,78 @@
+#include "VersionPublisher.h"
+
+using namespace std;
+
+EpochDomain& EpochDomain::instance() {
+    static EpochDomain domain;
+    return domain;
+}
+
+// Takes a free slot, adding a block of slots when every one is taken, so a
+// reader never waits for another thread to give one back.
+EpochDomain::Slot* EpochDomain::claimSlot() {
+    for (SlotBlock* block = blocks.load(); block != nullptr; block = block->next) {
+        for (Slot& slot : block->slots) {
+            bool expected = false;
+            if (!slot.claimed.load() && slot.claimed.compare_exchange_strong(expected, true)) {
+                return &slot;
+            }
+        }
+    }
+
+    SlotBlock* block = new SlotBlock();
+    block->slots[0].claimed.store(true);
+    block->next = blocks.load();
+    while (!blocks.compare_exchange_weak(block->next, block)) {
+    }
+    return &block->slots[0];
+}
+
+// A thread claims a slot on its first read and gives it back when it exits.
+EpochDomain::Slot& EpochDomain::threadSlot() {
+    struct Claim {
+        Slot* slot = nullptr;
+
+        ~Claim() {
+            if (slot != nullptr) {
+                slot->claimed.store(false);
+            }
+        }
+    };
+    thread_local Claim claim;
+
+    if (claim.slot == nullptr) {
+        claim.slot = claimSlot();
+    }
+    return *claim.slot;
+}
+
+// The announcement is a sequentially consistent store, so either a writer
+// scanning the slots sees it, or the reader's load of the published pointer
+// comes after the writer's exchange and finds the new version.
+void EpochDomain::enter() {
+    threadSlot().epoch.store(currentEpoch.load());
+}
+
+void EpochDomain::exit() {
+    threadSlot().epoch.store(0);
+}
+
+// The epoch to record a pointer that was just unpublished with. Later readers
+// announce a later epoch.
+uint64_t EpochDomain::retire() {
+    return currentEpoch.fetch_add(1);
+}
+
+// UINT64_MAX when no reader is inside a read section.
+uint64_t EpochDomain::oldestAnnounced() const {
+    uint64_t oldest = UINT64_MAX;
+    for (const SlotBlock* block = blocks.load(); block != nullptr; block = block->next) {
+        for (const Slot& slot : block->slots) {
+            uint64_t epoch = slot.epoch.load();
+            if (epoch != 0 && epoch < oldest) {
+                oldest = epoch;
+            }
+        }
+    }
+    return oldest;
+}
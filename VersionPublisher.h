@@ -0,0 +1,113 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// Epoch-based reclamation behind VersionPublisher. A reader announces the
+// epoch it starts in before it loads a published pointer, and withdraws the
+// announcement once it is done with it. A pointer retired in epoch e is freed
+// once every announced epoch is later than e, since a reader that could still
+// see it must have announced e or an earlier epoch. Every thread gets its own
+// announcement slot the first time it reads; read sections do not nest.
+class EpochDomain {
+public:
+    static constexpr size_t SlotsPerBlock = 256;
+
+    static EpochDomain& instance();
+
+    void enter();
+    void exit();
+    uint64_t retire();
+    uint64_t oldestAnnounced() const;
+
+private:
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> epoch{ 0 };
+        std::atomic<bool> claimed{ false };
+    };
+
+    // Slots come in blocks that are added, never removed, so a slot stays
+    // valid for as long as the domain does.
+    struct SlotBlock {
+        Slot slots[SlotsPerBlock];
+        SlotBlock* next = nullptr;
+    };
+
+    std::atomic<uint64_t> currentEpoch{ 1 };
+    SlotBlock firstBlock;
+    std::atomic<SlotBlock*> blocks{ &firstBlock };
+
+    Slot& threadSlot();
+    Slot* claimSlot();
+};
+
+// Hands the current version of a value to any number of readers while one
+// writer at a time replaces it. A published value is never changed: the
+// writer builds the next version and publishes it, and readers that hold an
+// older one keep it, through its reference count, for as long as they need.
+// acquire() never waits, whatever the writer is doing.
+//
+// The epochs only guard the small record the published pointer points to, for
+// the moment between a reader loading the pointer and taking its reference.
+// Retired records are freed by later publishes.
+template <typename T>
+class VersionPublisher {
+private:
+    struct Version {
+        std::shared_ptr<const T> value;
+        uint64_t retiredIn = 0;
+    };
+
+    std::atomic<Version*> current;
+    std::mutex retireMutex;
+    std::vector<Version*> retired;
+
+    // Called with retireMutex held.
+    void reclaim() {
+        uint64_t oldest = EpochDomain::instance().oldestAnnounced();
+        size_t kept = 0;
+        for (Version* version : retired) {
+            if (version->retiredIn < oldest) {
+                delete version;
+            }
+            else {
+                retired[kept++] = version;
+            }
+        }
+        retired.resize(kept);
+    }
+
+public:
+    explicit VersionPublisher(std::shared_ptr<const T> initial = nullptr) : current(new Version{ std::move(initial) }) {}
+
+    // No reader may be inside acquire() any more.
+    ~VersionPublisher() {
+        delete current.load();
+        for (Version* version : retired) {
+            delete version;
+        }
+    }
+
+    VersionPublisher(const VersionPublisher&) = delete;
+    VersionPublisher& operator=(const VersionPublisher&) = delete;
+
+    std::shared_ptr<const T> acquire() const {
+        EpochDomain& domain = EpochDomain::instance();
+        domain.enter();
+        std::shared_ptr<const T> value = current.load()->value;
+        domain.exit();
+        return value;
+    }
+
+    void publish(std::shared_ptr<const T> value) {
+        Version* previous = current.exchange(new Version{ std::move(value) });
+        std::lock_guard<std::mutex> lock(retireMutex);
+        previous->retiredIn = EpochDomain::instance().retire();
+        retired.push_back(previous);
+        reclaim();
+    }
+};
@@ -0,0 +1,84 @@
+#include "WildcardPattern.h"
+#include <cctype>
+
+using namespace std;
+
+// Normalizes the word the same way SearchEngine::normalize does, but keeps the
+// wildcard characters. Runs of '*' are collapsed since they match the same.
+WildcardPattern::WildcardPattern(const string& word) {
+    for (char c : word) {
+        if (c == '*') {
+            if (pattern.empty() || pattern.back() != '*') {
+                pattern += c;
+            }
+        }
+        else if (c == '?') {
+            pattern += c;
+        }
+        else if (isalnum(c)) {
+            pattern += static_cast<char>(tolower(c));
+        }
+    }
+}
+
+bool WildcardPattern::isWildcard(const string& word) {
+    return word.find_first_of("*?") != string::npos;
+}
+
+bool WildcardPattern::valid() const {
+    return !pattern.empty() && pattern.size() <= MaxLength;
+}
+
+const string& WildcardPattern::text() const {
+    return pattern;
+}
+
+string WildcardPattern::literalPrefix() const {
+    return pattern.substr(0, pattern.find_first_of("*?"));
+}
+
+// A '*' can match the empty string, so a state that reaches it also reaches
+// the position after it.
+uint64_t WildcardPattern::closure(uint64_t state) const {
+    for (size_t i = 0; i < pattern.size(); ++i) {
+        if ((state & (1ULL << i)) && pattern[i] == '*') {
+            state |= 1ULL << (i + 1);
+        }
+    }
+    return state;
+}
+
+uint64_t WildcardPattern::start() const {
+    return closure(1);
+}
+
+uint64_t WildcardPattern::step(uint64_t state, char c) const {
+    uint64_t next = 0;
+    for (size_t i = 0; i < pattern.size(); ++i) {
+        if (!(state & (1ULL << i))) {
+            continue;
+        }
+        if (pattern[i] == '*') {
+            next |= 1ULL << i;
+        }
+        else if (pattern[i] == '?' || pattern[i] == c) {
+            next |= 1ULL << (i + 1);
+        }
+    }
+    return closure(next);
+}
+
+bool WildcardPattern::accepts(uint64_t state) const {
+    return (state & (1ULL << pattern.size())) != 0;
+}
+
+bool WildcardPattern::matches(string_view term) const {
+    uint64_t state = start();
+    for (char c : term) {
+        state = step(state, c);
+        if (state == 0) {
+            return false;
+        }
+    }
+    return accepts(state);
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// A query term with '*' (any run of characters) and '?' (any one character).
+// The pattern is run as a bitmask automaton: bit i of a state means the first
+// i pattern characters have been matched. Walking a trie edge by edge and
+// dropping a branch as soon as its state becomes 0 prunes every subtree that
+// cannot contain a match.
+class WildcardPattern {
+private:
+    std::string pattern;
+
+    uint64_t closure(uint64_t state) const;
+
+public:
+    static constexpr size_t MaxLength = 63;
+
+    explicit WildcardPattern(const std::string& word);
+
+    static bool isWildcard(const std::string& word);
+
+    bool valid() const;
+    const std::string& text() const;
+    std::string literalPrefix() const;
+
+    uint64_t start() const;
+    uint64_t step(uint64_t state, char c) const;
+    bool accepts(uint64_t state) const;
+    bool matches(std::string_view term) const;
+};
@@ -1,33 +1,50 @@
 #include "WordInDocument.h"
+#include "PositionCodec.h"
 #include <sstream>
 #include <iostream>
 #include <fstream>
+#include <cstring>
+#include <type_traits>
 
 using namespace std;
 
-WordInDocument::WordInDocument(const string& docName, const vector<int>& positions)
-    : docName(docName), positions(positions) {
+static_assert(std::is_trivially_destructible<WordInDocument>::value, "postings are released with their arena");
+
+WordInDocument::WordInDocument(uint32_t docId, const vector<int>& positions, Arena& arena)
+    : docId(docId), frequency(static_cast<uint32_t>(positions.size())),
+    lastPosition(positions.empty() ? 0 : positions.back()) {
+    encodedSize = static_cast<uint32_t>(PositionCodec::encodedSize(positions));
+    encodedPositions = arena.allocateArray<uint8_t>(encodedSize);
+    PositionCodec::encode(positions, encodedPositions);
 }
 
-void WordInDocument::addPosition(int position) {
-    positions.push_back(position);
+WordInDocument::WordInDocument(uint32_t docId, uint32_t frequency, int lastPosition, uint32_t encodedSize, uint8_t* encodedPositions)
+    : docId(docId), frequency(frequency), lastPosition(lastPosition), encodedSize(encodedSize),
+    encodedPositions(encodedPositions) {
 }
 
-string WordInDocument::getDocName() const {
-    return docName;
+uint32_t WordInDocument::getDocId() const {
+    return docId;
 }
 
 vector<int> WordInDocument::getPositions() const {
+    vector<int> positions;
+    decodePositions(positions);
     return positions;
 }
 
+void WordInDocument::decodePositions(vector<int>& out) const {
+    PositionCodec::decode(encodedPositions, encodedPositions + encodedSize, frequency, out);
+}
+
 int WordInDocument::getFrequency() const {
-    return positions.size();
+    return static_cast<int>(frequency);
 }
 
-string WordInDocument::toString() const {
+string WordInDocument::toString(const DocumentTable& documents) const {
+    vector<int> positions = getPositions();
     ostringstream oss;
-    oss << "Document: " << docName << ", Frequency: " << getFrequency() << ", Positions: [";
+    oss << "Document: " << documents.getPath(docId) << ", Frequency: " << getFrequency() << ", Positions: [";
     for (size_t i = 0; i < positions.size(); ++i) {
         oss << positions[i];
         if (i != positions.size() - 1) {
@@ -38,37 +55,65 @@ string WordInDocument::toString() const {
     return oss.str();
 }
 
-void WordInDocument::display() const {
-    cout << toString() << endl;
+void WordInDocument::display(const DocumentTable& documents) const {
+    cout << toString(documents) << endl;
 }
 
+// Layout: docId, frequency, lastPosition and the encoded length as a fixed
+// header, followed by the encoded positions in a single write.
 void WordInDocument::serialize(ofstream& outFile) const {
-    size_t docNameLength = docName.size();
-    outFile.write(reinterpret_cast<const char*>(&docNameLength), sizeof(docNameLength));
-    outFile.write(docName.c_str(), docNameLength);
-
-    size_t positionsSize = positions.size();
-    outFile.write(reinterpret_cast<const char*>(&positionsSize), sizeof(positionsSize));
-    for (int position : positions) {
-        outFile.write(reinterpret_cast<const char*>(&position), sizeof(position));
-    }
+    uint32_t header[4] = { docId, frequency, static_cast<uint32_t>(lastPosition),
+        encodedSize };
+    outFile.write(reinterpret_cast<const char*>(header), sizeof(header));
+    outFile.write(reinterpret_cast<const char*>(encodedPositions), encodedSize);
 }
 
-WordInDocument* WordInDocument::deserialize(ifstream& inFile) {
-    size_t docNameLength;
-    inFile.read(reinterpret_cast<char*>(&docNameLength), sizeof(docNameLength));
+// The position bytes are read straight into the arena. If the read fails, or
+// the bytes are not exactly frequency varints, nullptr is returned and they
+// are left there unused; a failed load clears the index anyway.
+WordInDocument* WordInDocument::deserialize(ifstream& inFile, uint64_t& remaining, Arena& arena) {
+    uint32_t header[4];
+    inFile.read(reinterpret_cast<char*>(header), sizeof(header));
+    if (!inFile || remaining < sizeof(header) + static_cast<uint64_t>(header[3])) {
+        return nullptr;
+    }
+    remaining -= sizeof(header) + static_cast<uint64_t>(header[3]);
 
-    string docName(docNameLength, '\0');
-    inFile.read(&docName[0], docNameLength);
+    uint8_t* encoded = arena.allocateArray<uint8_t>(header[3]);
+    inFile.read(reinterpret_cast<char*>(encoded), header[3]);
+    if (!inFile || !PositionCodec::validate(encoded, header[3], header[1])) {
+        return nullptr;
+    }
 
-    size_t positionsSize;
-    inFile.read(reinterpret_cast<char*>(&positionsSize), sizeof(positionsSize));
+    void* storage = arena.allocate(sizeof(WordInDocument), alignof(WordInDocument));
+    return new (storage) WordInDocument(header[0], header[1], static_cast<int>(header[2]), header[3], encoded);
+}
 
-    vector<int> positions(positionsSize);
-    for (size_t i = 0; i < positionsSize; ++i) {
-        inFile.read(reinterpret_cast<char*>(&positions[i]), sizeof(positions[i]));
+void WordInDocument::serializePacked(ofstream& outFile, uint32_t previousDocId) const {
+    uint8_t header[20];
+    uint8_t* end = PositionCodec::encodeVarint(docId - previousDocId, header);
+    end = PositionCodec::encodeVarint(frequency, end);
+    end = PositionCodec::encodeVarint(static_cast<uint32_t>(lastPosition), end);
+    end = PositionCodec::encodeVarint(encodedSize, end);
+    outFile.write(reinterpret_cast<const char*>(header), end - header);
+    outFile.write(reinterpret_cast<const char*>(encodedPositions), encodedSize);
+}
+
+WordInDocument* WordInDocument::deserializePacked(const uint8_t*& data, const uint8_t* end, uint32_t previousDocId, Arena& arena) {
+    uint32_t header[4];
+    for (uint32_t& field : header) {
+        if (!PositionCodec::decodeVarint(data, end, field)) {
+            return nullptr;
+        }
+    }
+    if (header[3] > static_cast<size_t>(end - data) || !PositionCodec::validate(data, header[3], header[1])) {
+        return nullptr;
     }
 
-    return new WordInDocument(docName, positions);
-}
+    uint8_t* encoded = arena.allocateArray<uint8_t>(header[3]);
+    memcpy(encoded, data, header[3]);
+    data += header[3];
 
+    void* storage = arena.allocate(sizeof(WordInDocument), alignof(WordInDocument));
+    return new (storage) WordInDocument(previousDocId + header[0], header[1], static_cast<int>(header[2]), header[3], encoded);
+}
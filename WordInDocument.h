@@ -1,28 +1,55 @@
 #pragma once
+#include <cstdint>
 #include <string>
 #include <vector>
 #include <fstream>
-
+#include "DocumentTable.h"
+#include "Arena.h"
+
+// Occurrences of one term in one document. Positions are kept delta + varint
+// encoded (see PositionCodec), both in memory and in the dump file, and are
+// only decoded when a caller asks for them.
+//
+// Postings and their position bytes live in the arena of the index that owns
+// them, so the class has no destructor of its own and a whole index of them
+// is freed by releasing the arena.
 class WordInDocument {
 public:
-    std::string docName;
-    std::vector<int> positions;
-
-    WordInDocument(const std::string& docName, const std::vector<int>& positions);
+    uint32_t docId;
+    uint32_t frequency;
+    int lastPosition;
+    uint32_t encodedSize;
+    uint8_t* encodedPositions;
 
-    void addPosition(int position);
+    WordInDocument(uint32_t docId, const std::vector<int>& positions, Arena& arena);
 
-    std::string getDocName() const;
+    uint32_t getDocId() const;
 
     std::vector<int> getPositions() const;
 
+    void decodePositions(std::vector<int>& out) const;
+
     int getFrequency() const;
 
-    std::string toString() const;
+    std::string toString(const DocumentTable& documents) const;
 
-    void display() const;
+    void display(const DocumentTable& documents) const;
 
     void serialize(std::ofstream& outFile) const;
 
-    static WordInDocument* deserialize(std::ifstream& inFile);
+    // remaining is the number of bytes left in the file; it is checked
+    // against the lengths read and reduced by the bytes consumed.
+    static WordInDocument* deserialize(std::ifstream& inFile, uint64_t& remaining, Arena& arena);
+
+    // Like serialize, with the header as varints and the document id as the
+    // gap to the previous posting of the same term.
+    void serializePacked(std::ofstream& outFile, uint32_t previousDocId) const;
+
+    // Reads from the bytes at data, up to end, and moves data past them.
+    // Returns nullptr if the posting runs past end or its position bytes are
+    // not exactly frequency varints.
+    static WordInDocument* deserializePacked(const uint8_t*& data, const uint8_t* end, uint32_t previousDocId, Arena& arena);
+
+private:
+    WordInDocument(uint32_t docId, uint32_t frequency, int lastPosition, uint32_t encodedSize, uint8_t* encodedPositions);
 };
@@ -0,0 +1,128 @@
+#include "WorkStealingPool.h"
+#include <algorithm>
+
+using namespace std;
+
+WorkStealingPool::WorkStealingPool(size_t threadCount) {
+    if (threadCount == 0) {
+        threadCount = max<size_t>(1, thread::hardware_concurrency());
+    }
+    for (size_t i = 0; i < threadCount; ++i) {
+        workers.push_back(make_unique<Worker>());
+    }
+    for (size_t i = 0; i < threadCount; ++i) {
+        threads.emplace_back(&WorkStealingPool::workerLoop, this, i);
+    }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+    {
+        lock_guard<mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (thread& t : threads) {
+        t.join();
+    }
+}
+
+size_t WorkStealingPool::threadCount() const {
+    return threads.size();
+}
+
+void WorkStealingPool::push(size_t worker, const Range& range) {
+    {
+        lock_guard<mutex> lock(workers[worker]->mutex);
+        workers[worker]->ranges.push_back(range);
+    }
+    {
+        lock_guard<mutex> lock(sleepMutex);
+        queued++;
+    }
+    wake.notify_one();
+}
+
+bool WorkStealingPool::popLocal(size_t worker, Range& range) {
+    lock_guard<mutex> lock(workers[worker]->mutex);
+    deque<Range>& ranges = workers[worker]->ranges;
+    if (ranges.empty()) {
+        return false;
+    }
+    range = ranges.back();
+    ranges.pop_back();
+    queued--;
+    return true;
+}
+
+// Victims are tried starting after the thief, so thieves spread out.
+bool WorkStealingPool::steal(size_t thief, Range& range) {
+    for (size_t offset = 1; offset < workers.size(); ++offset) {
+        Worker& victim = *workers[(thief + offset) % workers.size()];
+        lock_guard<mutex> lock(victim.mutex);
+        if (!victim.ranges.empty()) {
+            range = victim.ranges.front();
+            victim.ranges.pop_front();
+            queued--;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Halves are pushed until the range is down to the job's grain, so there is
+// always something to steal while the job is still large.
+void WorkStealingPool::execute(size_t worker, Range range) {
+    while (range.end - range.begin > range.job->grain) {
+        size_t middle = range.begin + (range.end - range.begin) / 2;
+        push(worker, { range.job, middle, range.end });
+        range.end = middle;
+    }
+
+    Job& job = *range.job;
+    for (size_t i = range.begin; i < range.end; ++i) {
+        (*job.task)(i);
+    }
+    size_t count = range.end - range.begin;
+    if (job.remaining.fetch_sub(count) == count) {
+        lock_guard<mutex> lock(job.mutex);
+        job.finished = true;
+        job.done.notify_all();
+    }
+}
+
+void WorkStealingPool::workerLoop(size_t worker) {
+    while (true) {
+        Range range;
+        if (popLocal(worker, range) || steal(worker, range)) {
+            execute(worker, range);
+            continue;
+        }
+
+        unique_lock<mutex> lock(sleepMutex);
+        wake.wait(lock, [this] { return stopping || queued > 0; });
+        if (stopping && queued == 0) {
+            return;
+        }
+    }
+}
+
+// The grain keeps a few dozen ranges per thread: enough to balance uneven
+// tasks, few enough that deque traffic stays small next to the tasks.
+void WorkStealingPool::parallelFor(size_t count, const function<void(size_t)>& task) {
+    if (count == 0) {
+        return;
+    }
+
+    Job job;
+    job.task = &task;
+    job.grain = max<size_t>(1, count / (workers.size() * 32));
+    job.remaining = count;
+
+    size_t slices = min(count, workers.size());
+    for (size_t i = 0; i < slices; ++i) {
+        push(i, { &job, count * i / slices, count * (i + 1) / slices });
+    }
+
+    unique_lock<mutex> lock(job.mutex);
+    job.done.wait(lock, [&job] { return job.finished; });
+}
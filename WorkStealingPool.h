@@ -0,0 +1,66 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads, each with its own deque of work. parallelFor
+// hands every worker a slice of the index range. A worker splits the range
+// it is running in halves, keeping one and pushing the other onto its deque,
+// takes its newest range first, and when its deque is empty steals the
+// oldest (and so largest) range of another worker. Uneven tasks even out
+// without all workers contending on one queue.
+class WorkStealingPool {
+private:
+    struct Job {
+        const std::function<void(size_t)>* task;
+        size_t grain;
+        std::atomic<size_t> remaining;
+        // Set under mutex by the thread that finishes the last index, after
+        // which no worker touches the job again.
+        bool finished = false;
+        std::mutex mutex;
+        std::condition_variable done;
+    };
+
+    struct Range {
+        Job* job;
+        size_t begin;
+        size_t end;
+    };
+
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Range> ranges;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> threads;
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    std::atomic<size_t> queued{ 0 };
+    bool stopping = false;
+
+    void push(size_t worker, const Range& range);
+    bool popLocal(size_t worker, Range& range);
+    bool steal(size_t thief, Range& range);
+    void execute(size_t worker, Range range);
+    void workerLoop(size_t worker);
+
+public:
+    // 0 starts one thread per core.
+    explicit WorkStealingPool(size_t threadCount = 0);
+    ~WorkStealingPool();
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    size_t threadCount() const;
+    // Calls task(i) for every i in [0, count) on the pool's threads and returns
+    // once all calls are done. Several threads may run jobs at the same time.
+    void parallelFor(size_t count, const std::function<void(size_t)>& task);
+};
@@ -0,0 +1,92 @@
+#include "../Benchmark.h"
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+void printUsage() {
+    cout << "Usage: benchmark [options]\n"
+        << "  --documents N       number of generated documents (default 2000)\n"
+        << "  --vocabulary N      number of distinct words (default 20000)\n"
+        << "  --zipf S            Zipf exponent of word frequencies (default 1.0)\n"
+        << "  --min-length N      shortest document in words (default 50)\n"
+        << "  --max-length N      longest document in words (default 400)\n"
+        << "  --queries N         timed queries per query kind (default 1000)\n"
+        << "  --workers N         indexing threads, 0 = one per core (default 0)\n"
+        << "  --seed N            corpus and query seed (default 42)\n"
+        << "  --corpus DIR        folder for the generated corpus (default benchmark_corpus)\n"
+        << "  --output FILE       write the JSON report to FILE instead of stdout\n";
+}
+
+int main(int argc, char* argv[]) {
+    BenchmarkOptions options;
+    string outputPath;
+
+    for (int i = 1; i < argc; ++i) {
+        string option = argv[i];
+        if (option == "--help") {
+            printUsage();
+            return 0;
+        }
+        if (i + 1 >= argc) {
+            cerr << "Missing value for " << option << "\n";
+            printUsage();
+            return 1;
+        }
+        string value = argv[++i];
+        if (option == "--documents") {
+            options.documentCount = strtoull(value.c_str(), nullptr, 10);
+        }
+        else if (option == "--vocabulary") {
+            options.vocabularySize = strtoull(value.c_str(), nullptr, 10);
+        }
+        else if (option == "--zipf") {
+            options.zipfExponent = strtod(value.c_str(), nullptr);
+        }
+        else if (option == "--min-length") {
+            options.minDocumentLength = strtoull(value.c_str(), nullptr, 10);
+        }
+        else if (option == "--max-length") {
+            options.maxDocumentLength = strtoull(value.c_str(), nullptr, 10);
+        }
+        else if (option == "--queries") {
+            options.queriesPerKind = strtoull(value.c_str(), nullptr, 10);
+        }
+        else if (option == "--workers") {
+            options.indexingWorkers = atoi(value.c_str());
+        }
+        else if (option == "--seed") {
+            options.seed = strtoull(value.c_str(), nullptr, 10);
+        }
+        else if (option == "--corpus") {
+            options.corpusFolder = value;
+        }
+        else if (option == "--output") {
+            outputPath = value;
+        }
+        else {
+            cerr << "Unknown option: " << option << "\n";
+            printUsage();
+            return 1;
+        }
+    }
+
+    Benchmark benchmark(options);
+    if (outputPath.empty()) {
+        return benchmark.run(cout) ? 0 : 1;
+    }
+
+    ofstream output(outputPath);
+    if (!output.is_open()) {
+        cerr << "Error opening benchmark output file: " << outputPath << "\n";
+        return 1;
+    }
+    if (!benchmark.run(output)) {
+        return 1;
+    }
+    benchmark.displaySummary();
+    cout << "Benchmark report written to " << outputPath << "\n";
+    return 0;
+}
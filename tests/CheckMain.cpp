@@ -0,0 +1,560 @@
+#include "../PostingIntersection.h"
+#include "../DocIdBitmap.h"
+#include "../PhraseMatcher.h"
+#include "../Bm25Ranker.h"
+#include "../QueryParser.h"
+#include "../HashMapSearch.h"
+#include "../TrieSearch.h"
+#include "../LoudsTrie.h"
+#include "../QueryCache.h"
+#include "../SearchEngine.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+// Small deterministic checks of the query code against straightforward
+// reference implementations. Every input comes from a fixed seed, so a
+// failure reproduces on every run.
+
+static int failures = 0;
+
+static void check(bool passed, const string& name) {
+    if (!passed) {
+        cout << "FAIL " << name << "\n";
+        failures++;
+    }
+}
+
+// Sorted, distinct ids drawn from [0, range).
+static vector<uint32_t> randomIds(mt19937& random, size_t count, uint32_t range) {
+    vector<uint32_t> ids;
+    uniform_int_distribution<uint32_t> draw(0, range - 1);
+    for (size_t i = 0; i < count; ++i) {
+        ids.push_back(draw(random));
+    }
+    sort(ids.begin(), ids.end());
+    ids.erase(unique(ids.begin(), ids.end()), ids.end());
+    return ids;
+}
+
+// Galloping, block-wise and multi-way intersections and the difference give
+// what the standard set algorithms give, for list sizes from empty to a
+// thousand times apart, which picks every intersection strategy.
+static void checkIntersections() {
+    mt19937 random(3);
+    const size_t sizes[] = { 0, 1, 7, 64, 500, 4000, 30000 };
+    for (size_t smallSize : sizes) {
+        for (size_t largeSize : sizes) {
+            vector<uint32_t> a = randomIds(random, smallSize, 60000);
+            vector<uint32_t> b = randomIds(random, largeSize, 60000);
+            DocIdSpan spanA = { a.data(), a.size() };
+            DocIdSpan spanB = { b.data(), b.size() };
+            string name = to_string(a.size()) + " x " + to_string(b.size());
+
+            vector<uint32_t> expected;
+            set_intersection(a.begin(), a.end(), b.begin(), b.end(), back_inserter(expected));
+
+            vector<uint32_t> galloping;
+            PostingIntersection::intersectGalloping(spanA, spanB, galloping);
+            check(galloping == expected, "galloping intersection " + name);
+
+            vector<uint32_t> blocks;
+            PostingIntersection::intersectBlocks(spanA, spanB, blocks);
+            check(blocks == expected, "block intersection " + name);
+
+            vector<uint32_t> two;
+            PostingIntersection::intersectTwo(spanA, spanB, two);
+            check(two == expected, "two-list intersection " + name);
+
+            vector<uint32_t> c = randomIds(random, largeSize / 2 + 1, 60000);
+            vector<uint32_t> expectedThree;
+            set_intersection(expected.begin(), expected.end(), c.begin(), c.end(), back_inserter(expectedThree));
+            check(PostingIntersection::intersect({ spanA, spanB, { c.data(), c.size() } }) == expectedThree,
+                "three-list intersection " + name);
+
+            vector<uint32_t> expectedDifference;
+            set_difference(a.begin(), a.end(), b.begin(), b.end(), back_inserter(expectedDifference));
+            check(PostingIntersection::difference(spanA, spanB) == expectedDifference, "difference " + name);
+
+            for (size_t begin = 0; begin <= b.size(); begin += 1 + b.size() / 5) {
+                for (uint32_t target : { 0u, 1u, 30000u, 59999u, 60000u }) {
+                    size_t expectedIndex = lower_bound(b.begin() + begin, b.end(), target) - b.begin();
+                    check(PostingIntersection::gallop(b.data(), begin, b.size(), target) == expectedIndex,
+                        "gallop " + name + " from " + to_string(begin) + " to " + to_string(target));
+                }
+            }
+        }
+    }
+}
+
+// Phrase starts found from per-word position lists are exactly the places
+// where the words follow each other in the token sequence, including phrases
+// that repeat a word. A vocabulary of four words makes matches common.
+static void checkPhrases() {
+    mt19937 random(8);
+    uniform_int_distribution<int> drawWord(0, 3);
+    for (int document = 0; document < 200; ++document) {
+        vector<int> tokens(document % 50);
+        for (int& token : tokens) {
+            token = drawWord(random);
+        }
+        vector<vector<int>> wordPositions(4);
+        for (size_t i = 0; i < tokens.size(); ++i) {
+            wordPositions[tokens[i]].push_back(static_cast<int>(i));
+        }
+
+        for (size_t length = 1; length <= 4; ++length) {
+            vector<int> phrase(length);
+            for (int& word : phrase) {
+                word = drawWord(random);
+            }
+            vector<const vector<int>*> positions;
+            for (int word : phrase) {
+                positions.push_back(&wordPositions[word]);
+            }
+
+            vector<int> expected;
+            for (size_t start = 0; start + length <= tokens.size(); ++start) {
+                if (equal(phrase.begin(), phrase.end(), tokens.begin() + start)) {
+                    expected.push_back(static_cast<int>(start));
+                }
+            }
+            vector<int> starts;
+            PhraseMatcher::findPhrase(positions, starts);
+            check(starts == expected, "phrase of " + to_string(length) + " words in document " + to_string(document));
+        }
+    }
+}
+
+// Scores are added up in a different order by MaxScore than by a plain loop,
+// so they are compared with a tolerance.
+static bool sameScore(double a, double b) {
+    return fabs(a - b) <= 1e-9 * max(1.0, fabs(b));
+}
+
+// results holds the scores expected gives each of its documents, and its
+// scores are the best ones in expected, best first.
+static bool sameRanking(const vector<ScoredDocument>& results, const vector<ScoredDocument>& expected, size_t k) {
+    size_t count = (k == 0) ? expected.size() : min(k, expected.size());
+    if (results.size() != count) {
+        return false;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        auto match = find_if(expected.begin(), expected.end(), [&](const ScoredDocument& document) {
+            return document.docId == results[i].docId;
+            });
+        if (!sameScore(results[i].score, expected[i].score) || match == expected.end()
+            || !sameScore(results[i].score, match->score)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// MaxScore over a disjunction, and top-k over conjunctive candidates, give
+// the best documents an exhaustive BM25 ranking gives, skipping deleted ones.
+static void checkTopK() {
+    mt19937 random(9);
+    const uint32_t documentCount = 400;
+    vector<uint32_t> lengths(documentCount);
+    uniform_int_distribution<uint32_t> drawLength(5, 300);
+    for (uint32_t& length : lengths) {
+        length = drawLength(random);
+    }
+    vector<uint32_t> deletedIds = randomIds(random, 30, documentCount);
+    DocIdBitmap deleted = DocIdBitmap::fromSorted({ deletedIds.data(), deletedIds.size() });
+
+    CorpusStatistics statistics;
+    statistics.documentCount = documentCount;
+    statistics.lengths = lengths.data();
+    statistics.minLength = *min_element(lengths.begin(), lengths.end());
+    double lengthSum = 0;
+    for (uint32_t length : lengths) {
+        lengthSum += length;
+    }
+    statistics.averageLength = lengthSum / documentCount;
+    statistics.deleted = &deleted;
+    Bm25Ranker ranker(statistics);
+
+    for (int query = 0; query < 100; ++query) {
+        size_t termCount = 1 + query % 5;
+        vector<vector<uint32_t>> docIds(termCount);
+        vector<vector<uint32_t>> frequencies(termCount);
+        vector<RankedTerm> terms;
+        for (size_t t = 0; t < termCount; ++t) {
+            // Lists from a handful of documents to most of the collection, so
+            // that term bounds differ widely.
+            docIds[t] = randomIds(random, 3 + random() % documentCount, documentCount);
+            uniform_int_distribution<uint32_t> drawFrequency(1, 1 + static_cast<uint32_t>(random() % 20));
+            for (size_t i = 0; i < docIds[t].size(); ++i) {
+                frequencies[t].push_back(drawFrequency(random));
+            }
+            PostingView view;
+            view.docIds = docIds[t].data();
+            view.size = docIds[t].size();
+            view.frequencies = frequencies[t].data();
+            view.maxFrequency = *max_element(frequencies[t].begin(), frequencies[t].end());
+            terms.push_back(ranker.prepare(view, view.size));
+        }
+
+        vector<ScoredDocument> any;
+        vector<ScoredDocument> all;
+        vector<uint32_t> candidates;
+        for (uint32_t docId = 0; docId < documentCount; ++docId) {
+            double score = 0.0;
+            size_t matched = 0;
+            for (size_t t = 0; t < termCount; ++t) {
+                auto it = lower_bound(docIds[t].begin(), docIds[t].end(), docId);
+                if (it != docIds[t].end() && *it == docId) {
+                    score += ranker.termScore(frequencies[t][it - docIds[t].begin()], lengths[docId], terms[t].idf);
+                    matched++;
+                }
+            }
+            if (matched == termCount) {
+                candidates.push_back(docId);
+            }
+            if (matched == 0 || deleted.contains(docId)) {
+                continue;
+            }
+            any.push_back({ docId, score });
+            if (matched == termCount) {
+                all.push_back({ docId, score });
+            }
+        }
+        auto better = [](const ScoredDocument& a, const ScoredDocument& b) {
+            return a.score > b.score;
+        };
+        sort(any.begin(), any.end(), better);
+        sort(all.begin(), all.end(), better);
+
+        for (size_t k : { 1, 5, 20, 0 }) {
+            string name = "query " + to_string(query) + " with k = " + to_string(k);
+            check(sameRanking(ranker.topKDisjunctive(terms, k), any, k), "MaxScore disjunction " + name);
+            check(sameRanking(ranker.topKCandidates(candidates, terms, k), all, k), "top-k conjunction " + name);
+        }
+    }
+}
+
+// Queries mixing NOT, parentheses and phrases parse to the expected tree,
+// compared through its canonical text, and malformed ones are rejected.
+static void checkParser() {
+    const pair<const char*, const char*> queries[] = {
+        { "apple banana", "(apple AND banana)" },
+        { "apple OR banana NOT cherry", "(apple OR (banana AND NOT cherry))" },
+        { "(apple OR banana) -cherry", "((apple OR banana) AND NOT cherry)" },
+        { "\"red apple\" OR pie", "(\"red apple\" OR pie)" },
+        { "NOT (\"big red\" OR apple) banana", "(NOT \"big red\" AND NOT apple AND banana)" },
+        { "a AND (b OR (c NOT \"d e\"))", "(a AND (b OR (c AND NOT \"d e\")))" },
+        { "((a OR b) (c OR \"d e f\")) OR -g", "(((a OR b) AND (c OR \"d e f\")) OR NOT g)" },
+        { "  ( ( Apple ) )  ", "apple" },
+        { "\"a b\" c", "(\"a b\" AND c)" },
+        { "a NOT NOT b", "(a AND b)" },
+        { "+apple +banana", "(apple AND banana)" },
+        { "and or not", "(and AND or AND not)" },
+    };
+    for (const auto& query : queries) {
+        QueryNode root;
+        string error;
+        bool parsed = QueryParser::parse(query.first, root, error);
+        check(parsed && root.toString() == query.second, string("parse of ") + query.first);
+    }
+
+    const char* malformed[] = { "apple OR", "(apple", "\"open", "apple)", "NOT", "()" };
+    for (const char* query : malformed) {
+        QueryNode root;
+        string error;
+        check(!QueryParser::parse(query, root, error) && !error.empty(), string("rejection of ") + query);
+    }
+}
+
+// A random AND / OR / NOT expression over the given term lists, evaluated
+// both on sorted lists, as matchBoolean does, and on bitmaps, as
+// evaluateBitmap does.
+static void evaluateRandomExpression(mt19937& random, const vector<vector<uint32_t>>& lists, uint32_t universe,
+    int depth, vector<uint32_t>& ids, DocIdBitmap& bitmap) {
+    int kind = (depth == 0) ? 0 : static_cast<int>(random() % 4);
+    if (kind == 0) {
+        ids = lists[random() % lists.size()];
+        bitmap = DocIdBitmap::fromSorted({ ids.data(), ids.size() });
+        return;
+    }
+
+    vector<uint32_t> leftIds, rightIds;
+    DocIdBitmap leftBitmap, rightBitmap;
+    evaluateRandomExpression(random, lists, universe, depth - 1, leftIds, leftBitmap);
+    if (kind == 3) {
+        vector<uint32_t> all(universe);
+        for (uint32_t docId = 0; docId < universe; ++docId) {
+            all[docId] = docId;
+        }
+        ids = PostingIntersection::difference({ all.data(), all.size() }, { leftIds.data(), leftIds.size() });
+        bitmap = DocIdBitmap::difference(DocIdBitmap::range(universe), leftBitmap);
+        return;
+    }
+    evaluateRandomExpression(random, lists, universe, depth - 1, rightIds, rightBitmap);
+    if (kind == 1) {
+        ids = PostingIntersection::intersect({ { leftIds.data(), leftIds.size() }, { rightIds.data(), rightIds.size() } });
+        bitmap = DocIdBitmap::intersect(leftBitmap, rightBitmap);
+    }
+    else {
+        ids.clear();
+        set_union(leftIds.begin(), leftIds.end(), rightIds.begin(), rightIds.end(), back_inserter(ids));
+        bitmap = DocIdBitmap::unite(leftBitmap, rightBitmap);
+    }
+}
+
+// Boolean expressions evaluated on document bitmaps match the same documents
+// as on posting lists. The universe spans several chunks and the lists range
+// from a few ids to most of it, so array and bitmap containers, and
+// conversions between them, all take part.
+static void checkBitmaps() {
+    mt19937 random(21);
+    const uint32_t universe = 200000;
+    const size_t sizes[] = { 0, 20, 3000, 5000, 40000, 150000 };
+    vector<vector<uint32_t>> lists;
+    for (size_t size : sizes) {
+        lists.push_back(randomIds(random, size, universe));
+    }
+
+    for (int expression = 0; expression < 200; ++expression) {
+        vector<uint32_t> ids;
+        DocIdBitmap bitmap;
+        evaluateRandomExpression(random, lists, universe, 1 + expression % 4, ids, bitmap);
+        string name = "bitmap expression " + to_string(expression);
+        check(bitmap.toVector() == ids, name);
+        check(bitmap.cardinality() == ids.size(), name + " cardinality");
+
+        uint32_t first = static_cast<uint32_t>(random() % universe);
+        uint32_t count = static_cast<uint32_t>(random() % (universe - first + 1));
+        vector<uint32_t> expectedSlice;
+        for (auto it = lower_bound(ids.begin(), ids.end(), first); it != ids.end() && *it < first + count; ++it) {
+            expectedSlice.push_back(*it - first);
+        }
+        check(bitmap.slice(first, count).toVector() == expectedSlice, name + " slice");
+    }
+}
+
+// A dump whose postings refer to a document past the document table loaded
+// with it is rejected, so ranking never reads past the table's lengths.
+static void checkDumpDocumentIds() {
+    const char* dumpPath = "check_dump.dat";
+    HashMapSearch hashMap;
+    hashMap.addPostings("apple", 0, { 0, 4 });
+    hashMap.addPostings("apple", 2, { 1 });
+    hashMap.addPostings("pear", 1, { 3 });
+    {
+        ofstream outFile(dumpPath, ios::binary);
+        hashMap.save(outFile);
+    }
+    {
+        ifstream inFile(dumpPath, ios::binary);
+        HashMapSearch loaded;
+        check(loaded.load(inFile, 3) && loaded.findPostings("apple") != nullptr, "hash dump with every document");
+    }
+    {
+        ifstream inFile(dumpPath, ios::binary);
+        HashMapSearch loaded;
+        check(!loaded.load(inFile, 2) && loaded.findPostings("pear") == nullptr, "hash dump with a document id past the table");
+    }
+
+    TrieSearch trie;
+    trie.addPostings("apple", 0, { 0, 4 });
+    trie.addPostings("apple", 2, { 1 });
+    trie.addPostings("pear", 1, { 3 });
+    {
+        ofstream outFile(dumpPath, ios::binary);
+        trie.save(outFile);
+    }
+    {
+        ifstream inFile(dumpPath, ios::binary);
+        TrieSearch loaded;
+        check(loaded.load(inFile, 3) && loaded.findPostings("apple") != nullptr, "trie dump with every document");
+    }
+    {
+        ifstream inFile(dumpPath, ios::binary);
+        TrieSearch loaded;
+        check(!loaded.load(inFile, 2) && loaded.findPostings("pear") == nullptr, "trie dump with a document id past the table");
+    }
+    remove(dumpPath);
+}
+
+// Node of the radix tree of a set of terms, for laying it out as a LoudsTrie.
+struct CheckTrieNode {
+    string path;
+    string label;
+    // Rest of every term under the node, sorted; an empty one ends here.
+    vector<string> suffixes;
+};
+
+// LoudsTrie lookups against a set of terms: every term is found under its
+// number in level order, and words that are not terms, including prefixes
+// and extensions of terms, are not. Walking the children from the root
+// gives back the set.
+static void checkLoudsTrie() {
+    mt19937 random(24);
+    uniform_int_distribution<int> length(1, 8);
+    uniform_int_distribution<int> letter('a', 'e');
+    auto randomWord = [&]() {
+        string word(length(random), ' ');
+        for (char& c : word) {
+            c = static_cast<char>(letter(random));
+        }
+        return word;
+    };
+    set<string> terms;
+    for (int i = 0; i < 2000; ++i) {
+        terms.insert(randomWord());
+    }
+
+    vector<CheckTrieNode> levelOrder(1);
+    levelOrder[0].suffixes.assign(terms.begin(), terms.end());
+    LoudsTrie::Builder builder;
+    map<string, size_t> termNumbers;
+    for (size_t i = 0; i < levelOrder.size(); ++i) {
+        // A copy, as adding the children may move the nodes.
+        CheckTrieNode node = levelOrder[i];
+        bool isTerm = !node.suffixes.empty() && node.suffixes[0].empty();
+        if (isTerm) {
+            termNumbers.emplace(node.path, termNumbers.size());
+        }
+        size_t childCount = 0;
+        for (size_t s = isTerm ? 1 : 0; s < node.suffixes.size();) {
+            size_t end = s;
+            size_t common = node.suffixes[s].size();
+            while (end < node.suffixes.size() && node.suffixes[end][0] == node.suffixes[s][0]) {
+                while (node.suffixes[end].compare(0, common, node.suffixes[s], 0, common) != 0) {
+                    common--;
+                }
+                end++;
+            }
+            CheckTrieNode child;
+            child.label = node.suffixes[s].substr(0, common);
+            child.path = node.path + child.label;
+            for (; s < end; ++s) {
+                child.suffixes.push_back(node.suffixes[s].substr(common));
+            }
+            levelOrder.push_back(move(child));
+            childCount++;
+        }
+        builder.addNode(node.label, childCount, isTerm);
+    }
+    vector<uint8_t> bytes = builder.finish();
+    LoudsTrie trie;
+    check(trie.open(bytes.data(), bytes.size()), "LOUDS trie opens");
+    check(trie.nodeCount() == levelOrder.size() && trie.termCount() == terms.size(), "LOUDS trie node and term counts");
+
+    for (const auto& term : termNumbers) {
+        check(trie.find(term.first) == term.second, "LOUDS trie finds " + term.first);
+        for (size_t prefix = 0; prefix < term.first.size(); ++prefix) {
+            string shorter = term.first.substr(0, prefix);
+            check((trie.find(shorter) != LoudsTrie::NotFound) == (terms.count(shorter) != 0), "LOUDS trie prefix " + shorter);
+        }
+        string longer = term.first + "f";
+        check(trie.find(longer) == LoudsTrie::NotFound, "LOUDS trie extension " + longer);
+    }
+    for (int i = 0; i < 2000; ++i) {
+        string word = randomWord() + randomWord();
+        check((trie.find(word) != LoudsTrie::NotFound) == (terms.count(word) != 0), "LOUDS trie lookup " + word);
+    }
+
+    set<string> walked;
+    vector<pair<size_t, string>> pending{ { 0, string() } };
+    while (!pending.empty()) {
+        pair<size_t, string> node = pending.back();
+        pending.pop_back();
+        if (trie.isTerm(node.first)) {
+            walked.insert(node.second);
+            check(trie.termIndex(node.first) == termNumbers[node.second], "LOUDS trie term index of " + node.second);
+        }
+        size_t first = trie.firstChild(node.first);
+        for (size_t child = first; child < first + trie.childCount(node.first); ++child) {
+            pending.emplace_back(child, node.second + string(trie.label(child)));
+        }
+    }
+    check(walked == terms, "LOUDS trie children spell out the terms");
+}
+
+// Results of a query that started before a version was published must not
+// stay in the cache once that version has invalidated it, or they keep the
+// old snapshot alive. Queries insert while a writer publishes the way
+// SearchEngine::publish does, bumping the version and then invalidating, and
+// go on after its last version, which is what queries racing it would have
+// inserted behind.
+static void checkQueryCacheVersions() {
+    const int queryThreads = 4;
+    const int queriesPerThread = 2000;
+    QueryCache cache(queryThreads * queriesPerThread);
+    cache.invalidate(2);
+    cache.insert("apple", 1, make_shared<const vector<SearchResult>>());
+    check(cache.size() == 0, "cache refuses results of an invalidated version");
+
+    atomic<uint64_t> version(2);
+    atomic<int> queriesDone(0);
+    vector<vector<pair<uint64_t, weak_ptr<const vector<SearchResult>>>>> inserted(queryThreads);
+    vector<thread> queries;
+    for (int t = 0; t < queryThreads; ++t) {
+        queries.emplace_back([&, t]() {
+            for (int i = 0; i < queriesPerThread; ++i) {
+                // Every query is distinct, so no later lookup drops a stale
+                // entry instead.
+                string query = to_string(t) + "/" + to_string(i);
+                uint64_t seen = version.load();
+                if (cache.lookup(query, seen) == nullptr) {
+                    // Stands in for evaluating the query.
+                    this_thread::yield();
+                    QueryCache::Results results = make_shared<const vector<SearchResult>>();
+                    cache.insert(query, seen, results);
+                    inserted[t].emplace_back(seen, results);
+                }
+                queriesDone++;
+            }
+        });
+    }
+    while (queriesDone.load() < queryThreads * queriesPerThread / 2) {
+        cache.invalidate(++version);
+        this_thread::yield();
+    }
+    for (thread& query : queries) {
+        query.join();
+    }
+
+    bool pinned = false;
+    for (const auto& results : inserted) {
+        for (const auto& entry : results) {
+            pinned = pinned || (entry.first < version.load() && !entry.second.expired());
+        }
+    }
+    check(!pinned, "cache keeps no results of versions older than the last published");
+}
+
+int main() {
+    checkIntersections();
+    checkPhrases();
+    checkTopK();
+    checkParser();
+    checkBitmaps();
+    checkDumpDocumentIds();
+    checkQueryCacheVersions();
+    checkLoudsTrie();
+
+    if (failures > 0) {
+        cout << failures << " check(s) failed.\n";
+        return 1;
+    }
+    cout << "All checks passed.\n";
+    return 0;
+}